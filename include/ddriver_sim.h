@@ -0,0 +1,37 @@
+#ifndef _DDRIVER_SIM_H_
+#define _DDRIVER_SIM_H_
+
+#include "ddriver.h"
+#include <stdint.h>
+
+/******************************************************************************
+* SECTION: 模拟ddriver（sim/ddriver_sim.c）
+*
+* 实现ddriver.h的全部接口，CMake中打开NEWFS_DDRIVER_SIM后代替libddriver.a链接。
+* 设备路径以"mem:"开头时放在进程内存中（同一进程内关闭后再打开内容仍在），
+* 否则是一个普通镜像文件，不够大时自动扩展。
+*
+* 环境变量:
+*   DDRIVER_SIM_MODEL    延迟模型 none | hdd | ssd，默认none
+*   DDRIVER_SIM_SEEK_NS  访问不连续时的固定寻道开销，覆盖模型默认值
+*   DDRIVER_SIM_DIST_NS  磁头每移动一个IO单位的额外开销（HDD的寻道距离）
+*   DDRIVER_SIM_BYTE_NS  每字节传输开销
+*   DDRIVER_SIM_DELAY    为1时按模型真的等待，否则只累计到busy_ns
+*   DDRIVER_SIM_SIZE     设备大小（字节），默认4MB
+*   DDRIVER_SIM_IO_SZ    IO单位（字节），默认512
+*******************************************************************************/
+struct ddriver_sim_stats
+{
+    uint64_t read_cnt;          // 读IO数
+    uint64_t write_cnt;         // 写IO数
+    uint64_t seek_cnt;          // ddriver_seek调用数
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+    uint64_t head_moves;        // 与上一次IO不连续、磁头真的移动的次数
+    uint64_t seek_dist;         // 磁头移动的总距离（IO单位）
+    uint64_t busy_ns;           // 按延迟模型累计的设备耗时
+};
+
+#define IOC_REQ_DEVICE_SIM_STATS   _IOR(IOC_MAGIC, 0x40, struct ddriver_sim_stats)  /* 模拟设备的详细计数 */
+
+#endif /* _DDRIVER_SIM_H_ */
@@ -10,9 +10,14 @@
 #include "fuse.h"
 #include <stddef.h>
 #include "ddriver.h"
+#include "newfs_ctl_user.h"
 #include "errno.h"
+#include <pthread.h>
+#include <limits.h>
 #include "types.h"
 #include "stdint.h"
+#include <time.h>
+#include <linux/falloc.h>
 
 #define NEWFS_MAGIC NEWFS_MAGIC_NUM                /* TODO: Define by yourself */
 #define NEWFS_DEFAULT_PERM    0777   /* 全权限打开 */
@@ -22,20 +27,138 @@
 *******************************************************************************/
 char* 			   		newfs_get_fname(const char* path);
 int 			   		newfs_calc_lvl(const char * path);
+void 			   		newfs_update_time(struct newfs_inode * inode, int flags);
+void 			   		newfs_update_atime(struct newfs_inode * inode);
 int 			   		newfs_driver_read(int offset, uint8_t *out_content, int size);
 int 			   		newfs_driver_write(int offset, uint8_t *in_content, int size);
+struct newfs_dentry* 	newfs_find_dentry(struct newfs_inode * inode, const char * name);
 int 			   		newfs_alloc_dentry(struct newfs_inode * inode, struct newfs_dentry * dentry);
+int 					newfs_detach_dentry(struct newfs_inode * inode, struct newfs_dentry * dentry);
+int 					newfs_move_dentry(struct newfs_dentry * dentry, struct newfs_inode * to, const char * fname,
+										  struct newfs_dentry * victim);
+int 					newfs_exchange_dentry(struct newfs_dentry * a, struct newfs_dentry * b);
 int 					newfs_drop_dentry(struct newfs_inode * inode, struct newfs_dentry * dentry);
+int 					newfs_alloc_blk(int goal);
 int 					newfs_alloc_data(struct newfs_inode* inode,int blk_no);
+int 					newfs_alloc_data_range(struct newfs_inode* inode, int blk_no, int blk_cnt);
+int 					newfs_count_free_data();
+void 					newfs_free_data(struct newfs_inode* inode, int blk_no);
+uint8_t* 				newfs_load_data(struct newfs_inode* inode, int blk_no);
+uint8_t* 				newfs_get_data(struct newfs_inode* inode, int blk_no);
+int 					newfs_clone_data(struct newfs_inode* src, int src_blk, 
+										 struct newfs_inode* dst, int dst_blk, int blk_cnt);
 struct newfs_inode*  	newfs_alloc_inode(struct newfs_dentry * dentry);
 int 					newfs_drop_inode(struct newfs_inode * inode);
-int 			   		newfs_sync_inode(struct newfs_inode * inode);
+void 					newfs_inode_to_d(struct newfs_inode * inode, struct newfs_inode_d * inode_d);
+int 					newfs_alloc_delalloc(struct newfs_inode * inode);
+void 					newfs_flush_data(struct newfs_inode * inode, struct newfs_wb * wb);
+void 					newfs_flush_data_done(struct newfs_inode * inode);
+void 			   		newfs_release_inode(struct newfs_inode * inode);
 struct newfs_inode*  	newfs_read_inode(struct newfs_dentry * dentry, int ino);
-struct newfs_dentry* 	newfs_get_dentry(struct newfs_inode * inode, int dir);
 struct newfs_dentry* 	newfs_lookup(const char * path, boolean * is_find, boolean* is_root);
+int 					newfs_write_super(uint32_t state);
 int 			   		newfs_mount(struct custom_options options);
 int 			   		newfs_umount();
 
+/******************************************************************************
+* SECTION: newfs_dir.c
+*******************************************************************************/
+uint32_t 				newfs_dx_hash(const char * name);
+int 					newfs_dx_find(struct newfs_inode * inode, const char * name, 
+									  struct newfs_dentry_d * dentry_d);
+int 					newfs_dx_insert(struct newfs_inode * inode, const char * name, uint32_t ino,
+										NEWFS_FILE_TYPE ftype);
+int 					newfs_dx_delete(struct newfs_inode * inode, const char * name);
+int 					newfs_dx_set(struct newfs_inode * inode, const char * name, uint32_t ino,
+									 NEWFS_FILE_TYPE ftype);
+int 					newfs_dx_iterate(struct newfs_inode * inode, uint32_t start, newfs_dx_fn fn, void * arg);
+void 					newfs_dx_free(struct newfs_inode * inode);
+void 					newfs_dx_sort(struct newfs_dentry_d * dentrys, int cnt);
+int 					newfs_dx_build_blks(int cnt);
+void 					newfs_dx_build(struct newfs_dentry_d * sorted, int cnt, int first_dno, int k, 
+									   uint8_t * out);
+
+/******************************************************************************
+* SECTION: newfs_mkfs.c
+*******************************************************************************/
+int 					newfs_mkfs(const char * device, struct newfs_mkfs_opts * opts, 
+								   struct newfs_super_d * out_sb);
+
+/******************************************************************************
+* SECTION: newfs_writeback.c
+*******************************************************************************/
+void 					newfs_wb_init(struct newfs_wb * wb);
+void 					newfs_wb_add(struct newfs_wb * wb, int blk, uint8_t * content);
+int 					newfs_wb_submit(struct newfs_wb * wb);
+
+/******************************************************************************
+* SECTION: newfs_bufpool.c
+*******************************************************************************/
+int 					newfs_bufpool_init();
+void 					newfs_bufpool_destroy();
+uint8_t* 				newfs_buf_get(int size);
+void 					newfs_buf_put(uint8_t * buf);
+
+/******************************************************************************
+* SECTION: newfs_cache.c
+*******************************************************************************/
+void 					newfs_cache_init(int limit_kb);
+void 					newfs_cache_destroy();
+long 					newfs_cache_bytes();
+void 					newfs_cache_add(struct newfs_inode * inode);
+void 					newfs_cache_touch(struct newfs_inode * inode);
+void 					newfs_cache_remove(struct newfs_inode * inode);
+int 					newfs_cache_shrink();
+void 					newfs_cache_link_dentry(struct newfs_inode * inode, struct newfs_dentry * dentry);
+void 					newfs_cache_unlink_dentry(struct newfs_dentry * dentry);
+struct newfs_dentry* 	newfs_cache_find_dentry(struct newfs_inode * inode, const char * name);
+uint8_t* 				newfs_cache_read_blk(int dno);
+uint8_t* 				newfs_cache_write_blk(int dno, boolean is_new);
+void 					newfs_cache_forget_blk(int dno);
+
+/******************************************************************************
+* SECTION: newfs_stats.c
+*******************************************************************************/
+uint64_t 				newfs_stats_now();
+void 					newfs_stats_record(int op, uint64_t start);
+int 					newfs_stats_end(int op, uint64_t start, int ret);
+void 					newfs_stats_dev_state(struct ddriver_state * state);
+uint64_t 				newfs_stats_phase_begin(struct ddriver_state * mark);
+boolean 				newfs_stats_phase_end(int op, uint64_t start, struct ddriver_state * mark,
+											  uint64_t user_bytes);
+void 					newfs_stats_op_mark();
+void 					newfs_stats_op_take();
+void 					newfs_stats_user_bytes(int op, uint64_t bytes);
+void 					newfs_stats_inc(uint64_t * counter);
+void 					newfs_stats_reset();
+int 					newfs_stats_render(char * buf, int size);
+
+/******************************************************************************
+* SECTION: newfs_trace.c
+*******************************************************************************/
+int 					newfs_trace_init(const char * path);
+void 					newfs_trace_destroy();
+void 					newfs_trace_args(const char * path, const char * path2, int64_t offset,
+										 uint64_t size, uint32_t mode);
+void 					newfs_trace_ino(uint32_t ino);
+void 					newfs_trace_record(int op, uint64_t start, int ret, uint32_t dev_io);
+
+/******************************************************************************
+* SECTION: newfs_journal.c
+*******************************************************************************/
+int 					newfs_journal_init(uint32_t seq);
+int 					newfs_journal_read(int offset, uint8_t * out_content, int size);
+void 					newfs_journal_dirty_meta(int offset);
+void 					newfs_journal_free_data(int dno);
+void 					newfs_journal_dirty_inode(struct newfs_inode * inode);
+void 					newfs_journal_dirty_blk(struct newfs_dblk * dblk);
+void 					newfs_journal_forget_blk(struct newfs_dblk * dblk);
+void 					newfs_journal_forget(struct newfs_inode * inode);
+int 					newfs_journal_commit();
+int 					newfs_journal_checkpoint();
+void 					newfs_op_begin(int type);
+int 					newfs_op_end(int ret, int type);
+
 /******************************************************************************
 * SECTION: newfs.c
 *******************************************************************************/
@@ -50,15 +173,27 @@ int   			   newfs_write(const char *, const char *, size_t, off_t,
 					                  struct fuse_file_info *);
 int   			   newfs_read(const char *, char *, size_t, off_t,
 					                 struct fuse_file_info *);
+int   			   newfs_write_buf(const char *, struct fuse_bufvec *, off_t,
+					                  struct fuse_file_info *);
+int   			   newfs_read_buf(const char *, struct fuse_bufvec **, size_t, off_t,
+					                 struct fuse_file_info *);
 int   			   newfs_access(const char *, int);
+int   			   newfs_fsync(const char *, int, struct fuse_file_info *);
 int   			   newfs_unlink(const char *);
 int   			   newfs_rmdir(const char *);
 int   			   newfs_rename(const char *, const char *);
+int   			   newfs_rename2(const char *, const char *, unsigned int);
 int   			   newfs_utimens(const char *, const struct timespec tv[2]);
 int   			   newfs_truncate(const char *, off_t);
+int   			   newfs_fallocate(const char *, int, off_t, off_t, 
+						               struct fuse_file_info *);
 			
+int   			   newfs_ioctl(const char *, int, void *, struct fuse_file_info *,
+						            unsigned int, void *);
 int   			   newfs_open(const char *, struct fuse_file_info *);
 int   			   newfs_opendir(const char *, struct fuse_file_info *);
 
+extern struct fuse_operations newfs_operations;		/* 加锁入口，FUSE和回放工具共用 */
+
 void 			   newfs_dump_map();
 #endif  /* _newfs_H_ */
\ No newline at end of file
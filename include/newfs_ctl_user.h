@@ -0,0 +1,42 @@
+#ifndef _NEWFS_CTL_H_ 
+#define _NEWFS_CTL_H_
+
+#include <stdint.h>
+#include <sys/ioctl.h>   
+/******************************************************************************
+* SECTION: IO ctl protocol definitions
+*******************************************************************************/
+#define NEWFS_IOC_MAGIC         'N'
+#define NEWFS_IOC_PATH_LEN      256
+
+/**
+ * 对目标文件fd发起，把源文件的一段以共享数据块的方式克隆到目标文件，
+ * 只修改元数据，第一次写共享块时才复制。偏移和长度要按逻辑块对齐，
+ * 长度到源文件尾时除外
+ */
+struct newfs_ioc_clone
+{
+    char     src_path[NEWFS_IOC_PATH_LEN];  /* 源文件，相对于挂载点的路径 */
+    uint64_t src_offset;
+    uint64_t src_length;                    /* 0表示一直到源文件尾 */
+    uint64_t dest_offset;
+};
+
+/* rename标志，取值与renameat2(2)的RENAME_*一致 */
+#define NEWFS_RENAME_NOREPLACE  (1 << 0)    /* 目标已存在时返回EEXIST */
+#define NEWFS_RENAME_EXCHANGE   (1 << 1)    /* 原子交换源和目标，两者都必须存在 */
+
+/**
+ * 对源文件fd发起，带标志的rename（FUSE 2.x的rename回调不传递标志）
+ */
+struct newfs_ioc_rename
+{
+    char     dest_path[NEWFS_IOC_PATH_LEN]; /* 目标，相对于挂载点的路径 */
+    uint32_t flags;                         /* NEWFS_RENAME_* */
+};
+
+#define NEWFS_IOC_CLONE         _IOW(NEWFS_IOC_MAGIC, 1, struct newfs_ioc_clone)   /* 克隆文件区间 */
+#define NEWFS_IOC_RENAME        _IOW(NEWFS_IOC_MAGIC, 2, struct newfs_ioc_rename)  /* 带标志的rename */
+#define NEWFS_IOC_CHECKPOINT    _IO(NEWFS_IOC_MAGIC, 3)     /* 提交日志并把已提交的元数据写回原位置 */
+
+#endif
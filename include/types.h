@@ -17,13 +17,52 @@ typedef enum newfs_file_type {
 #define SUPER_BLKS_NUM          1
 #define INODE_MAP_BLKS_NUM      1   
 #define DATA_MAP_BLKS_NUM       1   
+#define REFCNT_BLKS_NUM         4       /* 每个数据块1字节引用计数 */
+#define JOURNAL_BLKS_NUM        64      /* 元数据日志区，第0块为日志头 */
+#define JOURNAL_BLKS_MAX        4096    /* 日志区块数上限，挂载时按日志区大小分配检查点表 */
 #define MAX_INODE_BLKS_NUM      256
 #define MAX_INODE_NUM_PERBLK    16
-#define MAX_DATA_BLKS_NUM       3837
+#define MAX_DATA_BLKS_NUM       3769
+#define MAX_REFCNT              255
 #define MAX_DATA_PERFILE        6 
+#define NEWFS_GROUPS            8       /* 分配组数，inode和数据块位图各按组切成连续的几段 */
 
 
 #define NEWFS_MAGIC_NUM           0x20110520 
+#define NEWFS_JOURNAL_MAGIC       0x4A524E4C
+#define NEWFS_JOURNAL_MAX_BLKS    (JOURNAL_BLKS_NUM - 2)   /* 一个事务最多记录的块数（除去日志超级块和事务头） */
+#define NEWFS_JOURNAL_CREDITS     24        /* 一个操作最多弄脏的元数据块数 */
+#define NEWFS_JOURNAL_BATCH_US    200       /* 还有操作在执行时，提交前等它们加入同一事务 */
+#define NEWFS_JOURNAL_COMMIT_SECS 5         /* 只写数据的操作不等提交，最多攒这么久 */
+#define NEWFS_OP_READ             0         /* 只读操作 */
+#define NEWFS_OP_SYNC             1         /* 修改元数据，事务提交后才返回 */
+#define NEWFS_OP_ASYNC            2         /* 写数据，修改加入当前事务后即返回 */
+#define NEWFS_STATE_CLEAN         1         /* 正常卸载，日志为空 */
+#define NEWFS_STATE_DIRTY         2         /* 挂载后改过元数据，没有正常卸载时要重放日志 */
+#define NEWFS_WB_MAX_RUN          64        /* 合并后一次写入的最大块数 */
+#define NEWFS_CACHE_KB            2048      /* inode缓存默认的内存上限（KB），--cache_kb可改 */
+#define NEWFS_BUF_SIZE            (64 * 1024)   /* 驱动层缓冲区大小，覆盖一次合并写回的最大长度 */
+#define NEWFS_BUF_NR              32        /* 缓冲区个数，合起来正好一个2MB大页 */
+#define NEWFS_BUF_ALIGN           4096      /* 缓冲区按页对齐，可以直接用于O_DIRECT */
+#define NEWFS_STATS_DIR           "/.newfs"         /* 隐藏的统计目录，不出现在根目录的列表里 */
+#define NEWFS_STATS_FILE          "/.newfs/stats"   /* 读出各操作的延迟分布，写入任意内容清零 */
+#define NEWFS_STATS_SUB_BITS      2         /* 延迟直方图每个2的幂再细分成4个桶 */
+#define NEWFS_STATS_BUCKETS       (64 << NEWFS_STATS_SUB_BITS)
+#define NEWFS_TRACE_MAGIC         0x5254464E    /* "NFTR" */
+#define NEWFS_TRACE_VERSION       1
+#define NEWFS_TRACE_RINGS         16        /* 轨迹环形缓冲区个数，每个线程独占一个 */
+#define NEWFS_TRACE_RING_RECS     4096      /* 每个环的记录数，2的幂 */
+#define NEWFS_TRACE_PATH          100       /* 记录中路径的长度，更长的截断 */
+#define NEWFS_TRACE_DUMP_SIG      SIGUSR1   /* 收到时把轨迹另存一份到<轨迹文件>.dump */
+#define NEWFS_FEATURE_LAZY_ITABLE 0x1      /* 格式化时没有清零inode表，只有位图中已分配的inode有意义 */
+#define NEWFS_FEATURE_DX_TREE     0x2      /* 目录是多层的哈希B+树，block_pointer[0]指向树根；没有时是旧的单层索引 */
+#define NEWFS_FEATURE_ALL         (NEWFS_FEATURE_LAZY_ITABLE | NEWFS_FEATURE_DX_TREE)
+#define NEWFS_FEATURE_REQUIRED    (NEWFS_FEATURE_DX_TREE)     /* 格式化时总是设置，没有时拒绝挂载 */
+#define NEWFS_MKFS_CHUNK          (1024 * 1024) /* 格式化时一次顺序写的字节数 */
+#define NEWFS_DISK_SIZE_MAX       INT_MAX   /* 偏移都按int字节数记录，设备不能达到2GB */
+#define NEWFS_DX_MAGIC            0x4458    /* "DX"，目录树结点 */
+#define NEWFS_DX_MAX_LEVEL        4         /* 目录树最多的层数（含叶子），一个操作弄脏的目录块有上限 */
+#define NEWFS_DENTRY_HASH_MIN     1024      /* dentry哈希表的初始桶数 */
 #define NEWFS_SUPER_OFS           0 
 #define NEWFS_ROOT_INO            0
 
@@ -37,9 +76,18 @@ typedef enum newfs_file_type {
 #define NEWFS_ERROR_UNSUPPORTED   ENXIO
 #define NEWFS_ERROR_IO            EIO     /* Error Input/Output */
 #define NEWFS_ERROR_INVAL         EINVAL
+#define NEWFS_ERROR_NOTSUPP       EOPNOTSUPP
+#define NEWFS_ERROR_NOTEMPTY      ENOTEMPTY
+#define NEWFS_ERROR_FBIG          EFBIG
 
 #define NEWFS_ERROR_NONE        0
 
+/* 时间戳更新标志 */
+#define NEWFS_UPDATE_ATIME      0x1
+#define NEWFS_UPDATE_MTIME      0x2
+#define NEWFS_UPDATE_CTIME      0x4
+#define NEWFS_RELATIME_SECS     (24 * 60 * 60)   /* relatime: atime最多每天刷新一次 */
+
 /* Macro Function */
 #define NEWFS_IO_SIZE()                     (super.io_size)
 #define NEWFS_BLK_SIZE()                    (super.blks_size)
@@ -48,13 +96,26 @@ typedef enum newfs_file_type {
 #define NEWFS_ROUND_DOWN(value, round)      ((value) % (round) == 0 ? (value) : ((value) / (round)) * (round))
 #define NEWFS_ROUND_UP(value, round)        ((value) % (round) == 0 ? (value) : ((value) / (round) + 1) * (round))
 #define NEWFS_ASSIGN_FNAME(pnewfs_dentry, _fname) memcpy(pnewfs_dentry->name, _fname, strlen(_fname))
-#define MAX_DENTRY_PERBLK()                 (NEWFS_BLK_SIZE() / sizeof(struct newfs_dentry))
+//目录树：每个结点一个数据块，块头之后叶子放目录项，索引结点放索引项
+#define MAX_DENTRY_PERBLK()                 ((NEWFS_BLK_SIZE() - sizeof(struct newfs_dx_head)) / sizeof(struct newfs_dentry_d))
+#define MAX_DX_ENTRY_PERBLK()               ((NEWFS_BLK_SIZE() - sizeof(struct newfs_dx_head)) / sizeof(struct newfs_dx_entry))
 //计算偏移
 #define NEWFS_INO_OFS(ino)                  (super.ino_offset + ((ino) /  MAX_INODE_NUM_PERBLK) * NEWFS_BLK_SIZE() + ((ino) %  MAX_INODE_NUM_PERBLK) * sizeof(struct newfs_inode_d))
 #define NEWFS_DB_OFS(dno)                   (super.db_offset + NEWFS_BLKS_SIZE(dno))
 //判断节点类型
 #define NEWFS_IS_DIR(pinode)                (pinode->dentry->ftype == DIR)
 #define NEWFS_IS_REG(pinode)                (pinode->dentry->ftype == REG_FILE)
+//位图操作，第nr位对应第nr / 8字节的第nr % 8位
+#define NEWFS_BM_TEST(map, nr)              ((map)[(nr) / UINT8_BITS] & (0x1 << ((nr) % UINT8_BITS)))
+#define NEWFS_BM_SET(map, nr)               ((map)[(nr) / UINT8_BITS] |= (0x1 << ((nr) % UINT8_BITS)))
+#define NEWFS_BM_CLEAR(map, nr)             ((map)[(nr) / UINT8_BITS] &= (uint8_t)~(0x1 << ((nr) % UINT8_BITS)))
+//分配组：第ino个inode、第dno个数据块所在的组
+#define NEWFS_INO_GROUP(ino)                ((ino) / super.ino_per_group)
+#define NEWFS_DB_GROUP(dno)                 ((dno) / super.db_per_group)
+//预分配（未写入）块
+#define NEWFS_BLK_IS_UNWRITTEN(pinode, i)   ((pinode)->unwritten & (0x1 << (i)))
+//延迟分配（只有缓存，还没有数据块）块
+#define NEWFS_BLK_IS_DELALLOC(pinode, i)    ((pinode)->delalloc & (0x1 << (i)))
 
 /* macro debug */
 #define NEWFS_DBG(fmt, ...) do { printf("NEWFS_DBG: " fmt, ##__VA_ARGS__); } while(0) 
@@ -62,11 +123,214 @@ typedef enum newfs_file_type {
 /* in memory struction */
 struct custom_options {
 	const char*        device;
+	int                cache_kb;        // inode缓存的内存上限（KB），0为默认值
+	const char*        trace;           // 记录操作轨迹的文件，NULL为不记录
+};
+
+/* mkfs.newfs的参数，0为默认值 */
+struct newfs_mkfs_opts {
+    int      blks_size;         // 逻辑块大小，IO单位的2的幂倍，默认IO单位的2倍
+    int      ino_cnt;           // inode数，按每块的inode数向上取整，默认每个逻辑块一个
+    int      journal_blks;      // 日志区块数，不少于JOURNAL_BLKS_NUM
+    uint32_t features;          // NEWFS_FEATURE_*
+    boolean  is_force;          // 设备上已有newfs时也格式化
+    boolean  is_dry_run;        // 只算布局输出超级块，不写设备
+};
+
+/* 写回队列中的一个块，内容在提交前由调用者保持有效 */
+struct newfs_wb_req {
+    int      blk;               // 设备块号
+    int      seq;               // 加入顺序，同一块排在后面的覆盖前面的
+    uint8_t* content;
+};
+
+/* 写回调度：收集一批块写，按块号排序、相邻块合并后再交给驱动 */
+struct newfs_wb {
+    struct newfs_wb_req* reqs;
+    int                  nr;
+    int                  cap;
+};
+
+struct newfs_journal {
+    int                  offset;            // 日志区于磁盘中的偏移
+    int                  blks;              // 日志区于磁盘中的块数
+    uint32_t             running_tid;       // 正在收集修改的事务
+    uint32_t             commit_tid;        // 最后一个已提交的事务
+    time_t               commit_time;       // 最后一次提交的时间
+    boolean              committing;        // 有线程正在提交
+    int                  nr_active;         // 正在执行的修改操作数
+    int*                 meta_blks;         // 被弄脏的位图、引用计数块（设备块号）
+    int                  nr_meta;
+    int                  max_meta;
+    struct newfs_inode*  inodes;            // 被弄脏的inode，经inode->jnext串起
+    struct newfs_dblk*   dblks;             // 被弄脏的目录块，经dblk->jnext串起
+    int                  nr_dblks;
+    int*                 freed;             // 当前事务释放的数据块，提交后才归还位图，之前不能再分配
+    int                  nr_freed;
+    int                  max_freed;
+    uint32_t             seq;               // 下一个写入日志的事务的序号，日志超级块记下第一个
+    int                  head;              // 下一个事务头在日志区中的块号
+    int*                 ckpt_blks;         // 已提交未写回原位置的块（设备块号），最多blks个
+    uint8_t*             ckpt_imgs;         // 这些块最新的已提交内容
+    int                  nr_ckpt;
+    pthread_mutex_t      lock;              // 保护提交状态，事务内容由super.lock保护
+    pthread_cond_t       cond;
+};
+
+/* 驱动层缓冲池：一段预先映射的对齐内存切成NEWFS_BUF_NR个缓冲区，每个线程再缓存一个 */
+struct newfs_bufpool {
+    uint8_t*             base;              // 缓冲区所在的连续内存，NULL表示未初始化
+    boolean              is_huge;           // 是否映射到了大页
+    int                  free[NEWFS_BUF_NR];    // 空闲缓冲区的下标
+    int                  nr_free;
+    uint32_t             gen;               // 每次初始化加一，线程缓存里上一次挂载的缓冲区作废
+    pthread_key_t        key;               // 线程缓存，线程退出时归还
+    pthread_mutex_t      lock;
+};
+
+/* inode缓存：常驻的inode按最近使用串成LRU链表，超过上限时从表尾淘汰干净的inode */
+struct newfs_cache {
+    struct newfs_inode*  lru_head;          // 最近使用
+    struct newfs_inode*  lru_tail;          // 最久未使用
+    int                  nr_inodes;         // 常驻的inode数
+    int                  nr_blks;           // 已分配的数据块缓存数
+    int                  nr_dentrys;        // 挂在目录下的dentry数
+    struct newfs_dentry** dentry_htab;      // 按（父目录，文件名）散列的dentry，经dentry->hnext串起
+    int                  dentry_hsize;      // 桶数，2的幂，随nr_dentrys加倍
+    struct newfs_dblk**  dblk_htab;         // 按数据块号散列的目录块
+    int                  dblk_hsize;
+    struct newfs_dblk*   dblk_head;         // 目录块的LRU链表，最近使用
+    struct newfs_dblk*   dblk_tail;         // 最久未使用
+    int                  nr_dblks;          // 缓存的目录块数
+    long                 limit;             // 内存上限（字节）
+};
+
+/* 缓存的一个目录树结点块，当前事务改过的块提交时记入日志 */
+struct newfs_dblk {
+    int                  dno;               // 数据块号
+    boolean              jdirty;            // 已被当前事务记录，提交前不能淘汰
+    uint8_t*             content;
+    struct newfs_dblk*   hnext;             // 哈希链中的下一个
+    struct newfs_dblk*   lru_prev;
+    struct newfs_dblk*   lru_next;
+    struct newfs_dblk*   jnext;             // 当前事务中的下一个脏目录块
+};
+
+/* 统计的操作：FUSE回调和几个内部环节 */
+#define NEWFS_STAT_MKDIR          0
+#define NEWFS_STAT_GETATTR        1
+#define NEWFS_STAT_READDIR        2
+#define NEWFS_STAT_MKNOD          3
+#define NEWFS_STAT_WRITE          4
+#define NEWFS_STAT_READ           5
+#define NEWFS_STAT_WRITE_BUF      6
+#define NEWFS_STAT_READ_BUF       7
+#define NEWFS_STAT_UTIMENS        8
+#define NEWFS_STAT_TRUNCATE       9
+#define NEWFS_STAT_FALLOCATE      10
+#define NEWFS_STAT_IOCTL          11
+#define NEWFS_STAT_UNLINK         12
+#define NEWFS_STAT_RMDIR          13
+#define NEWFS_STAT_RENAME         14
+#define NEWFS_STAT_OPEN           15
+#define NEWFS_STAT_OPENDIR        16
+#define NEWFS_STAT_ACCESS         17
+#define NEWFS_STAT_FSYNC          18
+#define NEWFS_STAT_LOOKUP         19        /* 路径查找 */
+#define NEWFS_STAT_READ_INODE     20        /* 从盘上读inode */
+#define NEWFS_STAT_SYNC           21        /* 提交一个日志事务 */
+#define NEWFS_STAT_DRIVER_READ    22
+#define NEWFS_STAT_DRIVER_WRITE   23
+#define NEWFS_STAT_MOUNT          24
+#define NEWFS_STAT_LOOKUP_MISS    25        /* 要读盘的路径查找 */
+#define NEWFS_STAT_WRITEBACK      26        /* 提交写回队列 */
+#define NEWFS_STAT_NR             27
+
+/* 一种操作的延迟直方图，桶按纳秒数的对数划分，计数都用原子操作累加 */
+struct newfs_stat_hist {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+    uint64_t buckets[NEWFS_STATS_BUCKETS];
+};
+
+/* 一种操作引起的设备I/O，由操作前后IOC_REQ_DEVICE_STATE的差得到 */
+struct newfs_stat_io {
+    uint64_t reads;             // 读的IO单位数
+    uint64_t writes;            // 写的IO单位数
+    uint64_t seeks;
+    uint64_t user_bytes;        // 操作本身要读写的字节数，用来算I/O放大
+};
+
+/* 运行统计，挂载时清零，经NEWFS_STATS_FILE读出 */
+struct newfs_stats {
+    struct newfs_stat_hist ops[NEWFS_STAT_NR];
+    struct newfs_stat_io   io[NEWFS_STAT_NR];
+    struct newfs_stat_io   dev_base;        // 清零时设备的计数，算清零以来的总I/O
+    uint64_t inode_hit;         // 路径查找时inode已常驻
+    uint64_t inode_miss;        // 路径查找时要从盘上读inode
+    uint64_t blk_hit;           // 读数据时块已缓存
+    uint64_t blk_miss;          // 读数据时要从盘上读块
+};
+
+/* 一条操作轨迹，256字节；时间相对轨迹开始 */
+struct newfs_trace_rec {
+    uint64_t ts_ns;             // 开始时间
+    uint64_t lat_ns;            // 耗时，含等锁和等提交
+    int64_t  offset;            // 读写、截断、预分配的偏移，readdir的位置
+    uint64_t size;              // 读写、预分配的长度
+    uint32_t op;                // NEWFS_STAT_*
+    int32_t  ret;
+    uint32_t ino;               // 操作最后查找到的inode
+    uint32_t mode;              // mkdir、mknod的模式，access的类型，fallocate的模式，ioctl的命令
+    uint32_t dev_io;            // 持锁期间设备读写的IO单位数
+    uint32_t tid;               // 所在环的编号
+    char     path[NEWFS_TRACE_PATH];
+    char     path2[NEWFS_TRACE_PATH];   // rename的目标
+};
+
+/* 轨迹文件头，之后是NEWFS_TRACE_RINGS个环头，再之后是各环的记录 */
+struct newfs_trace_d {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t rec_size;
+    uint32_t nr_rings;
+    uint32_t ring_recs;
+    uint32_t dropped;           // 环不够分时丢掉的记录数
+    uint64_t start_ns;          // 开始记录时的CLOCK_MONOTONIC
+    uint8_t  pad[32];
+};
+
+/* 环头，head是写过的记录总数，只由所属线程推进 */
+struct newfs_trace_ring_d {
+    uint64_t head;
+    uint8_t  pad[56];           // 各环头独占一个缓存行
+};
+
+/* 操作轨迹：一段映射到文件的共享内存，崩溃后文件里仍有最后的记录 */
+struct newfs_trace {
+    uint8_t*             base;              // NULL表示没有开启
+    size_t               size;
+    uint32_t             next_ring;         // 下一个分给新线程的环
+    uint32_t             gen;               // 每次开启加一，线程记下的旧环作废
+    char                 dump_path[256];    // 信号处理函数里用，事先拼好
+};
+
+/* 分配组：同一组内的inode和数据块尽量放在一起，新目录分散到不同的组 */
+struct newfs_group {
+    int ino_start;              // 组内第一个inode号
+    int ino_cnt;                // 组内inode数
+    int ino_free;               // 组内空闲inode数
+    int db_start;               // 组内第一个数据块号
+    int db_cnt;                 // 组内数据块数
+    int db_free;                // 组内空闲数据块数（位图中）
+    int dirs;                   // 组内目录数
 };
 
 struct newfs_super {
     uint32_t magic;
     int      fd;
+    int      img_fd;        // 设备为普通镜像文件时的只读fd，用于splice零拷贝读，否则为-1
     /* TODO: Define yourself */
     int disk_size;          // 磁盘大小
     /* 逻辑块信息 */
@@ -86,15 +350,37 @@ struct newfs_super {
     int db_map_blks;       // 数据块位图于磁盘中的块数 1
     uint8_t* map_db;
 
-    int ino_offset;         // 索引节点于磁盘中的偏移 3
+    int refcnt_offset;      // 数据块引用计数于磁盘中的偏移 3
+    int refcnt_blks;        // 数据块引用计数于磁盘中的块数 4
+    uint8_t* refcnt;        // 每个数据块除第一个持有者外还被几个文件共享
+
+    uint32_t state;         // 盘上超级块记录的状态 NEWFS_STATE_*
+
+    struct newfs_journal journal;   // 元数据日志，偏移 7，块数 64
+
+    int ino_offset;         // 索引节点于磁盘中的偏移 71
     int ino_blks;           // 索引节点于磁盘中的块数 256
 
-    int db_offset;          // 数据块于磁盘中的偏移 259
-    int db_blks;            // 数据块于磁盘中的块数 3837
+    int db_offset;          // 数据块于磁盘中的偏移 327
+    int db_blks;            // 数据块于磁盘中的块数 3769
+    int db_free;            // 数据块位图中的空闲块数
+    int db_reserved;        // 延迟分配预留、还没有占用位图的块数
+
+    /* 分配组 */
+    struct newfs_group groups[NEWFS_GROUPS];
+    int ino_per_group;      // 每组inode数，最后一组可能少一些
+    int db_per_group;       // 每组数据块数，最后一组可能少一些
+    int group_rotor;        // 下一个顶层目录从哪一组开始找
+
+    struct newfs_cache cache;       // inode和dentry缓存
+    struct newfs_stats stats;       // 各操作的延迟分布和缓存命中率
+    struct newfs_trace trace;       // 操作轨迹
+    struct newfs_bufpool bufpool;   // 驱动层读写用的缓冲区
 
     /* 支持的限制 */
     int ino_max;            // 最大支持inode数
     int file_max;           // 支持文件最大大小
+    uint32_t features;      // NEWFS_FEATURE_*
 
     /* 根目录索引 */
     int root_ino;           // 根目录对应的inode
@@ -103,6 +389,7 @@ struct newfs_super {
     boolean            is_mounted;
     int sz_usage;
     struct newfs_dentry* root_dentry;     // 根目录
+    pthread_mutex_t    lock;              // 文件系统大锁，FUSE操作在锁内串行执行
 };
 
 struct newfs_inode {
@@ -115,12 +402,29 @@ struct newfs_inode {
 
     /* 数据块的索引 */
     int                block_pointer[MAX_DATA_PERFILE];   // 数据块指针（可固定分配）
-    uint8_t*           data[MAX_DATA_PERFILE];
+    uint8_t*           data[MAX_DATA_PERFILE];            // 数据块缓存，NULL表示未读入（或是空洞）
+    boolean            data_dirty[MAX_DATA_PERFILE];      // 缓存块是否比磁盘上的新
+    uint32_t           unwritten;                         // 预分配但未写入的块，第i位对应block_pointer[i]
+    uint32_t           delalloc;                          // 只预留了空间、提交时才分配数据块的脏缓存块
+
+    /* 时间戳 */
+    uint32_t           atime;              // 最后访问时间
+    uint32_t           mtime;              // 最后修改内容时间
+    uint32_t           ctime;              // 最后修改属性时间
+    boolean            cache_valid;        // 自上次open后内容未变，内核页缓存可保留
 
     /* 其他字段 */
     struct newfs_dentry* dentry;            // 指向该inode的dentry(父)
-    struct newfs_dentry* dentrys;           // 指向的目录项
+    struct newfs_dentry* dentrys;           // 缓存中的目录项（查找过的和常驻inode的），目录项全集在目录树里
     int                dir_cnt;             // 如果是目录类型文件，下面有几个目录项 
+
+    /* 日志 */
+    boolean            jdirty;              // 已被当前事务记录
+    struct newfs_inode* jnext;              // 当前事务中的下一个脏inode
+
+    /* 缓存 */
+    struct newfs_inode* lru_prev;           // LRU链表中更近使用的一个
+    struct newfs_inode* lru_next;           // LRU链表中更久未使用的一个
 };
 
 struct newfs_dentry {
@@ -136,6 +440,8 @@ struct newfs_dentry {
     struct newfs_inode* inode;
     struct newfs_dentry* parent;
     struct newfs_dentry* brother;
+    struct newfs_dentry* brother_prev;      // 兄弟链表是双向的，摘下时不用遍历
+    struct newfs_dentry* hnext;             // dentry哈希链中的下一个
 };
 
 static inline struct newfs_dentry* new_dentry(char * fname, NEWFS_FILE_TYPE ftype) {
@@ -164,11 +470,17 @@ struct newfs_super_d {
     int db_map_offset;     // 数据块位图于磁盘中的偏移 2
     int db_map_blks;       // 数据块位图于磁盘中的块数 1
 
-    int ino_offset;         // 索引节点于磁盘中的偏移 3
+    int refcnt_offset;      // 数据块引用计数于磁盘中的偏移 3
+    int refcnt_blks;        // 数据块引用计数于磁盘中的块数 4
+
+    int journal_offset;     // 元数据日志于磁盘中的偏移 7
+    int journal_blks;       // 元数据日志于磁盘中的块数 64
+
+    int ino_offset;         // 索引节点于磁盘中的偏移 71
     int ino_blks;           // 索引节点于磁盘中的块数 256
 
-    int db_offset;          // 数据块于磁盘中的偏移 259
-    int db_blks;            // 数据块于磁盘中的块数 3837
+    int db_offset;          // 数据块于磁盘中的偏移 327
+    int db_blks;            // 数据块于磁盘中的块数 3769
 
     /* 支持的限制 */
     int ino_max;            // 最大支持inode数
@@ -179,6 +491,17 @@ struct newfs_super_d {
 
     /* 其他信息 */
     int sz_usage;
+
+    /* 卸载状态 */
+    uint32_t state;         // NEWFS_STATE_*
+    uint32_t journal_seq;   // 正常卸载时下一个写入日志的事务序号
+
+    /* 分配组 */
+    int group_dirs[NEWFS_GROUPS];   // 各组的目录数，空闲数挂载时从位图统计
+
+    /* 格式化参数 */
+    int      blks_size;     // 逻辑块大小，0为IO单位的2倍（mkfs.newfs之前格式化的盘）
+    uint32_t features;      // NEWFS_FEATURE_*，有不认识的位时拒绝挂载
 };
 
 struct newfs_inode_d {
@@ -190,9 +513,15 @@ struct newfs_inode_d {
 
     /* 数据块的索引 */
     int                block_pointer[MAX_DATA_PERFILE];   // 数据块指针（可固定分配）
+    uint32_t           unwritten;                         // 预分配但未写入的块，读出为0
 
     /* 其他字段 */
     int                dir_cnt;            // 如果是目录类型文件，下面有几个目录项 
+
+    /* 时间戳 */
+    uint32_t           atime;              // 最后访问时间
+    uint32_t           mtime;              // 最后修改内容时间
+    uint32_t           ctime;              // 最后修改属性时间
 };
 
 struct newfs_dentry_d {
@@ -204,4 +533,35 @@ struct newfs_dentry_d {
     NEWFS_FILE_TYPE     ftype; 
 };
 
+/**
+ * 日志区第0块是日志超级块（nr_blks为0，tid为日志中第一个事务的序号），
+ * 之后依次是各事务：事务头一块，紧跟nr_blks个日志块，写入事务头即提交了事务
+ */
+struct newfs_journal_d {
+    uint32_t magic;
+    uint32_t tid;                               // 事务序号
+    int      nr_blks;                           // 日志块数
+    uint32_t checksum;                          // 日志块内容的校验和
+    int      blk_no[NEWFS_JOURNAL_MAX_BLKS];    // 第i个日志块的目的设备块号
+};
+
+/**
+ * 目录树结点（一个数据块）的块头。叶子（level为0）之后是按文件名哈希排序的目录项，
+ * 索引结点之后是按哈希排序的索引项，第i个子树中的哈希不小于entries[i].hash，
+ * 不大于entries[i+1].hash（同一哈希的目录项可能跨过子树边界）
+ */
+struct newfs_dx_head {
+    uint16_t magic;                       // NEWFS_DX_MAGIC
+    uint16_t level;                       // 离叶子的层数
+    int      cnt;                         // 目录项数或索引项数
+};
+
+struct newfs_dx_entry {
+    uint32_t hash;                        // 子树中文件名哈希的下界，第0项不参与查找
+    int      dno;                         // 子结点的数据块号
+};
+
+/* 按哈希顺序遍历目录树时对每个目录项的回调，返回非0时停止遍历 */
+typedef int (*newfs_dx_fn)(void* arg, struct newfs_dentry_d* dentry_d, uint32_t hash);
+
 #endif /* _TYPES_H_ */
\ No newline at end of file
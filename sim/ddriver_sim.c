@@ -0,0 +1,250 @@
+#include "ddriver_sim.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DDRIVER_SIM_MEM_PREFIX    "mem:"
+#define DDRIVER_SIM_MEM_FD        0x7fff0000      /* 内存设备返回的假fd */
+#define DDRIVER_SIM_DEFAULT_SIZE  (4 * 1024 * 1024)
+#define DDRIVER_SIM_DEFAULT_IO_SZ 512
+
+/* 延迟模型 */
+struct ddriver_sim_model {
+    const char* name;
+    uint64_t    seek_ns;        // 不连续访问的固定开销
+    uint64_t    dist_ns;        // 每移动一个IO单位的开销
+    uint64_t    byte_ns;        // 每字节的传输开销
+};
+
+static const struct ddriver_sim_model ddriver_sim_models[] = {
+    { "none", 0,       0,   0  },
+    { "hdd",  4000000, 500, 10 },   /* 平均寻道4ms，满行程再多约4ms，约100MB/s */
+    { "ssd",  20000,   0,   2  },   /* 随机访问20us，约500MB/s */
+};
+
+struct ddriver_sim {
+    int                      fd;            // 打开的fd，-1表示没有打开
+    int                      is_mem;
+    int                      size;
+    int                      io_sz;
+    off_t                    pos;           // 当前磁头位置
+    off_t                    last_end;      // 上一次IO结束的位置，下一次IO从这里开始就不用寻道
+    struct ddriver_sim_model model;
+    int                      is_delay;
+    struct ddriver_sim_stats stats;
+};
+
+static struct ddriver_sim sim = { .fd = -1 };
+static char*              sim_mem;          // 内存设备的内容，进程内一直保留
+static int                sim_mem_size;
+
+static uint64_t ddriver_sim_env(const char* name, uint64_t def) {
+    const char* val = getenv(name);
+    return val != NULL && *val != '\0' ? strtoull(val, NULL, 0) : def;
+}
+
+/**
+ * @brief 按环境变量配置设备参数和延迟模型
+ */
+static void ddriver_sim_configure() {
+    const char* model = getenv("DDRIVER_SIM_MODEL");
+
+    sim.model = ddriver_sim_models[0];
+    for (size_t i = 0; model != NULL && i < sizeof(ddriver_sim_models) / sizeof(ddriver_sim_models[0]); i++) {
+        if (strcmp(model, ddriver_sim_models[i].name) == 0) {
+            sim.model = ddriver_sim_models[i];
+        }
+    }
+    sim.model.seek_ns = ddriver_sim_env("DDRIVER_SIM_SEEK_NS", sim.model.seek_ns);
+    sim.model.dist_ns = ddriver_sim_env("DDRIVER_SIM_DIST_NS", sim.model.dist_ns);
+    sim.model.byte_ns = ddriver_sim_env("DDRIVER_SIM_BYTE_NS", sim.model.byte_ns);
+    sim.is_delay      = (int)ddriver_sim_env("DDRIVER_SIM_DELAY", 0);
+    sim.size          = (int)ddriver_sim_env("DDRIVER_SIM_SIZE", DDRIVER_SIM_DEFAULT_SIZE);
+    sim.io_sz         = (int)ddriver_sim_env("DDRIVER_SIM_IO_SZ", DDRIVER_SIM_DEFAULT_IO_SZ);
+}
+
+/**
+ * @brief 按延迟模型记一次IO的开销，需要时真的等待
+ */
+static void ddriver_sim_charge(size_t size) {
+    uint64_t ns = sim.model.byte_ns * size;
+    uint64_t dist;
+
+    if (sim.pos != sim.last_end) {
+        dist = (uint64_t)(sim.pos > sim.last_end ? sim.pos - sim.last_end : sim.last_end - sim.pos) / sim.io_sz;
+        ns  += sim.model.seek_ns + sim.model.dist_ns * dist;
+        sim.stats.head_moves++;
+        sim.stats.seek_dist += dist;
+    }
+    sim.stats.busy_ns += ns;
+    if (sim.is_delay && ns > 0) {
+        struct timespec ts = { (time_t)(ns / 1000000000ull), (long)(ns % 1000000000ull) };
+        while (nanosleep(&ts, &ts) != 0 && errno == EINTR);
+    }
+}
+
+/**
+ * @brief 检查一次IO：设备已打开、大小等于IO单位、不越界
+ */
+static int ddriver_sim_check(int fd, size_t size) {
+    if (fd < 0 || fd != sim.fd || size != (size_t)sim.io_sz ||
+        sim.pos < 0 || sim.pos + (off_t)size > sim.size) {
+        return -1;
+    }
+    return 0;
+}
+
+int ddriver_open(char *path) {
+    struct stat st;
+
+    if (sim.fd >= 0) {                          /* 同时只模拟一个设备 */
+        return -1;
+    }
+    ddriver_sim_configure();
+    memset(&sim.stats, 0, sizeof(sim.stats));
+    sim.pos      = 0;
+    sim.last_end = 0;
+    sim.is_mem   = strncmp(path, DDRIVER_SIM_MEM_PREFIX, strlen(DDRIVER_SIM_MEM_PREFIX)) == 0;
+
+    if (sim.is_mem) {
+        if (sim_mem == NULL || sim_mem_size != sim.size) {
+            free(sim_mem);
+            sim_mem      = (char*)calloc(1, sim.size);
+            sim_mem_size = sim.size;
+            if (sim_mem == NULL) {
+                return -1;
+            }
+        }
+        sim.fd = DDRIVER_SIM_MEM_FD;
+        return sim.fd;
+    }
+
+    sim.fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (sim.fd < 0) {
+        return -1;
+    }
+    if (fstat(sim.fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size < sim.size &&
+        ftruncate(sim.fd, sim.size) != 0) {
+        close(sim.fd);
+        sim.fd = -1;
+        return -1;
+    }
+    return sim.fd;
+}
+
+int ddriver_seek(int fd, off_t offset, int whence) {
+    off_t pos;
+
+    if (fd < 0 || fd != sim.fd) {
+        return -1;
+    }
+    switch (whence) {
+    case SEEK_SET: pos = offset;            break;
+    case SEEK_CUR: pos = sim.pos + offset;  break;
+    case SEEK_END: pos = sim.size + offset; break;
+    default:       return -1;
+    }
+    if (pos < 0 || pos > sim.size || pos % sim.io_sz != 0) {
+        return -1;
+    }
+    sim.pos = pos;
+    sim.stats.seek_cnt++;
+    return 0;
+}
+
+int ddriver_write(int fd, char *buf, size_t size) {
+    if (ddriver_sim_check(fd, size) != 0) {
+        return -1;
+    }
+    if (sim.is_mem) {
+        memcpy(sim_mem + sim.pos, buf, size);
+    }
+    else if (pwrite(sim.fd, buf, size, sim.pos) != (ssize_t)size) {
+        return -1;
+    }
+    ddriver_sim_charge(size);
+    sim.stats.write_cnt++;
+    sim.stats.write_bytes += size;
+    sim.pos     += size;
+    sim.last_end = sim.pos;
+    return 0;
+}
+
+int ddriver_read(int fd, char *buf, size_t size) {
+    if (ddriver_sim_check(fd, size) != 0) {
+        return -1;
+    }
+    if (sim.is_mem) {
+        memcpy(buf, sim_mem + sim.pos, size);
+    }
+    else if (pread(sim.fd, buf, size, sim.pos) != (ssize_t)size) {
+        return -1;
+    }
+    ddriver_sim_charge(size);
+    sim.stats.read_cnt++;
+    sim.stats.read_bytes += size;
+    sim.pos     += size;
+    sim.last_end = sim.pos;
+    return 0;
+}
+
+int ddriver_ioctl(int fd, unsigned long cmd, void *ret) {
+    struct ddriver_state* state;
+
+    if (fd < 0 || fd != sim.fd) {
+        return -1;
+    }
+    switch (cmd) {
+    case IOC_REQ_DEVICE_SIZE:
+        *(int*)ret = sim.size;
+        return 0;
+    case IOC_REQ_DEVICE_IO_SZ:
+        *(int*)ret = sim.io_sz;
+        return 0;
+    case IOC_REQ_DEVICE_STATE:
+        state = (struct ddriver_state*)ret;
+        state->read_cnt  = (int)sim.stats.read_cnt;
+        state->write_cnt = (int)sim.stats.write_cnt;
+        state->seek_cnt  = (int)sim.stats.seek_cnt;
+        return 0;
+    case IOC_REQ_DEVICE_SIM_STATS:
+        *(struct ddriver_sim_stats*)ret = sim.stats;
+        return 0;
+    case IOC_REQ_DEVICE_RESET:                  /* 擦除设备并清零计数 */
+        if (sim.is_mem) {
+            memset(sim_mem, 0, sim.size);
+        }
+        else {
+            char* zero = (char*)calloc(1, sim.io_sz);
+            for (off_t off = 0; off < sim.size; off += sim.io_sz) {
+                if (pwrite(sim.fd, zero, sim.io_sz, off) != sim.io_sz) {
+                    free(zero);
+                    return -1;
+                }
+            }
+            free(zero);
+        }
+        memset(&sim.stats, 0, sizeof(sim.stats));
+        sim.pos      = 0;
+        sim.last_end = 0;
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+int ddriver_close(int fd) {
+    if (fd < 0 || fd != sim.fd) {
+        return -1;
+    }
+    if (!sim.is_mem) {
+        close(sim.fd);
+    }
+    sim.fd = -1;
+    return 0;
+}
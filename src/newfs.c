@@ -5,50 +5,30 @@
 /******************************************************************************
 * SECTION: 宏定义
 *******************************************************************************/
-#define OPTION(t, p)        { t, offsetof(struct custom_options, p), 1 }
+#define NEWFS_STATS_TEXT_MAX	8192		/* 统计文本的最大长度 */
+#define NEWFS_STATS_NODE_NONE	0			/* 不在统计目录下 */
+#define NEWFS_STATS_NODE_DIR	1			/* NEWFS_STATS_DIR */
+#define NEWFS_STATS_NODE_FILE	2			/* NEWFS_STATS_FILE */
+#define NEWFS_STATS_NODE_OTHER	3			/* 统计目录下不存在的路径 */
 
 /******************************************************************************
 * SECTION: 全局变量
 *******************************************************************************/
-static const struct fuse_opt option_spec[] = {		/* 用于FUSE文件系统解析参数 */
-	OPTION("--device=%s", device),
-	FUSE_OPT_END
-};
-
-struct custom_options newfs_options;			 /* 全局选项 */
-struct newfs_super super; 
-/******************************************************************************
-* SECTION: FUSE操作定义
-*******************************************************************************/
-static struct fuse_operations operations = {
-	.init = newfs_init,						 	/* mount文件系统 */		
-	.destroy = newfs_destroy,				 	/* umount文件系统 */
-	.mkdir = newfs_mkdir,					 	/* 建目录，mkdir */
-	.getattr = newfs_getattr,				 	/* 获取文件属性，类似stat，必须完成 */
-	.readdir = newfs_readdir,				 	/* 填充dentrys */
-	.mknod = newfs_mknod,					 	/* 创建文件，touch相关 */
-	.write = newfs_write,						/* 写入文件 */
-	.read = newfs_read,							/* 读文件 */
-	.utimens = newfs_utimens,				 	/* 修改时间，忽略，避免touch报错 */
-	.truncate = newfs_truncate,					/* 改变文件大小 */
-	.unlink = newfs_unlink,						/* 删除文件 */
-	.rmdir	= newfs_rmdir,						/* 删除目录， rm -r */
-	.rename = newfs_rename,						/* 重命名，mv */
-
-	.open = newfs_open,							
-	.opendir = newfs_opendir,
-	.access = newfs_access
-};
+extern struct custom_options newfs_options;		/* 定义在newfs_main.c，回调在核心库中 */
+extern struct newfs_super super;
+static boolean newfs_stats_shadowed = FALSE;		/* 根目录下有真的NEWFS_STATS_DIR，不再拦截 */
 /******************************************************************************
 * SECTION: 必做函数实现
 *******************************************************************************/
 /**
  * @brief 挂载（mount）文件系统
  * 
- * @param conn_info 可忽略，一些建立连接相关的信息 
+ * @param conn_info 建立连接相关的信息，用于打开splice读写
  * @return void*
  */
 void* newfs_init(struct fuse_conn_info * conn_info) {
+	boolean is_find, is_root;
+
 	/* TODO: 在这里进行挂载 */
 	if (newfs_mount(newfs_options) != NEWFS_ERROR_NONE) {
         NEWFS_DBG("[%s] mount error\n", __func__);
@@ -56,6 +36,23 @@ void* newfs_init(struct fuse_conn_info * conn_info) {
 		return NULL;
 	} 
 
+	/* 统计文件出现之前的盘上可能已有同名的项，此时让它照常可访问、可删除，不提供统计文件 */
+	newfs_op_begin(NEWFS_OP_READ);
+	newfs_lookup(NEWFS_STATS_DIR, &is_find, &is_root);
+	newfs_op_end(NEWFS_ERROR_NONE, NEWFS_OP_READ);
+	newfs_stats_shadowed = is_find;
+	if (is_find) {
+		NEWFS_DBG("[%s] %s exists on disk, stats are unavailable until it is renamed\n", 
+				  __func__, NEWFS_STATS_DIR);
+	}
+
+	/* 内核支持时，读写数据走splice，省去用户态的中转拷贝 */
+	if (conn_info) {
+		conn_info->want |= conn_info->capable & (FUSE_CAP_SPLICE_READ | 
+												 FUSE_CAP_SPLICE_WRITE | 
+												 FUSE_CAP_SPLICE_MOVE);
+	}
+
 	/* 下面是一个控制设备的示例 */
 	// super.fd = ddriver_open(newfs_options.device);
 	
@@ -111,7 +108,16 @@ int newfs_mkdir(const char* path, mode_t mode) {
 	dentry = new_dentry(fname, DIR); 
 	dentry->parent = last_dentry;
 	inode  = newfs_alloc_inode(dentry);
-	newfs_alloc_dentry(last_dentry->inode, dentry);
+	if (inode == NULL) {
+		free(dentry);
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	if (newfs_alloc_dentry(last_dentry->inode, dentry) < 0) {
+		newfs_drop_inode(inode);
+		free(dentry);
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	newfs_update_time(last_dentry->inode, NEWFS_UPDATE_MTIME | NEWFS_UPDATE_CTIME);
 	
 	return NEWFS_ERROR_NONE;
 }
@@ -143,8 +149,9 @@ int newfs_getattr(const char* path, struct stat * newfs_stat) {
 	newfs_stat->st_nlink = 1;
 	newfs_stat->st_uid 	 = getuid();
 	newfs_stat->st_gid 	 = getgid();
-	newfs_stat->st_atime   = time(NULL);
-	newfs_stat->st_mtime   = time(NULL);
+	newfs_stat->st_atime   = dentry->inode->atime;
+	newfs_stat->st_mtime   = dentry->inode->mtime;
+	newfs_stat->st_ctime   = dentry->inode->ctime;
 	newfs_stat->st_blksize = NEWFS_IO_SIZE();
 
 	if (is_root) {
@@ -155,6 +162,33 @@ int newfs_getattr(const char* path, struct stat * newfs_stat) {
 	return NEWFS_ERROR_NONE;
 }
 
+/* readdir的位置：目录项的文件名哈希和它在同一哈希中的序号，0表示从头开始 */
+#define NEWFS_READDIR_POS(hash, seq)	(((((off_t)(hash)) << 16) | (seq)) + 1)
+
+struct newfs_readdir_ctx {
+	void*           buf;
+	fuse_fill_dir_t filler;
+	off_t           offset;			// 只输出位置在它之后的目录项
+	uint32_t        hash;			// 上一个目录项的哈希
+	int             seq;			// 上一个目录项在同一哈希中的序号，-1为还没有
+};
+
+/**
+ * @brief 按哈希顺序遍历目录树时对每个目录项调用，buf满时停止遍历
+ */
+static int newfs_readdir_fill(void* arg, struct newfs_dentry_d* dentry_d, uint32_t hash) {
+	struct newfs_readdir_ctx* ctx = (struct newfs_readdir_ctx*)arg;
+	off_t pos;
+
+	ctx->seq  = (ctx->seq >= 0 && hash == ctx->hash) ? ctx->seq + 1 : 0;
+	ctx->hash = hash;
+	pos = NEWFS_READDIR_POS(hash, ctx->seq);
+	if (pos <= ctx->offset) {
+		return 0;
+	}
+	return ctx->filler(ctx->buf, dentry_d->name, NULL, pos);
+}
+
 /**
  * @brief 遍历目录项，填充至buf，并交给FUSE输出
  * 
@@ -167,31 +201,38 @@ int newfs_getattr(const char* path, struct stat * newfs_stat) {
  * buf: name会被复制到buf中
  * name: dentry名字
  * stbuf: 文件状态，可忽略
- * off: 下一次offset从哪里开始，这里可以理解为第几个dentry
+ * off: 下一次offset从哪里开始，这里是目录项的位置NEWFS_READDIR_POS，
+ *      由哈希定位，目录在两次调用之间增删项也不会重复或漏掉其余的项
  * 
- * @param offset 第几个目录项？
+ * @param offset 上一次输出的最后一个目录项的位置，0为从头开始
  * @param fi 可忽略
  * @return int 0成功，否则返回对应错误号
  */
 int newfs_readdir(const char * path, void * buf, fuse_fill_dir_t filler, off_t offset,
 			    		 struct fuse_file_info * fi) {
-    /* TODO: 解析路径，获取目录的Inode，并读取目录项，利用filler填充到buf，可参考/fs/simplefs/sfs.c的sfs_readdir()函数实现 */
 	boolean	is_find, is_root;
-	int		cur_dir = offset;
-
+	struct newfs_readdir_ctx ctx;
 	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
-	struct newfs_dentry* sub_dentry;
-	struct newfs_inode* inode;
-	if (is_find) {
-		inode = dentry->inode;
-		sub_dentry = newfs_get_dentry(inode, cur_dir);
-		if (sub_dentry) {
-			filler(buf, sub_dentry->name, NULL, ++offset);
-		}
-		return NEWFS_ERROR_NONE;
+	int    ret;
+
+	if (!is_find) {
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	if (NEWFS_IS_REG(dentry->inode)) {
+		return -NEWFS_ERROR_NOTDIR;
+	}
+	ctx.buf    = buf;
+	ctx.filler = filler;
+	ctx.offset = offset;
+	ctx.hash   = 0;
+	ctx.seq    = -1;
+	ret = newfs_dx_iterate(dentry->inode, offset > 0 ? (uint32_t)((offset - 1) >> 16) : 0,
+						   newfs_readdir_fill, &ctx);
+	if (ret < 0) {
+		return ret;
 	}
-	return -NEWFS_ERROR_NOTFOUND;
-    return 0;
+	newfs_update_atime(dentry->inode);
+	return NEWFS_ERROR_NONE;
 }
 
 /**
@@ -228,25 +269,75 @@ int newfs_mknod(const char* path, mode_t mode, dev_t dev) {
 	}
 	dentry->parent = last_dentry;
 	inode = newfs_alloc_inode(dentry);
-	newfs_alloc_dentry(last_dentry->inode, dentry);
+	if (inode == NULL) {
+		free(dentry);
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	if (newfs_alloc_dentry(last_dentry->inode, dentry) < 0) {
+		newfs_drop_inode(inode);
+		free(dentry);
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	newfs_update_time(last_dentry->inode, NEWFS_UPDATE_MTIME | NEWFS_UPDATE_CTIME);
 
 	return NEWFS_ERROR_NONE;
 }
 
 /**
- * @brief 修改时间，为了不让touch报错 
+ * @brief 修改时间，tv[0]为atime，tv[1]为mtime，支持UTIME_NOW/UTIME_OMIT
  * 
  * @param path 相对于挂载点的路径
- * @param tv 实践
+ * @param tv 时间
  * @return int 0成功，否则返回对应错误号
  */
 int newfs_utimens(const char* path, const struct timespec tv[2]) {
-	(void)path;
-	return 0;
+	boolean	is_find, is_root;
+	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
+	struct newfs_inode*  inode;
+	uint32_t now = (uint32_t)time(NULL);
+
+	if (is_find == FALSE) {
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+
+	inode = dentry->inode;
+	if (tv == NULL) {
+		inode->atime = inode->mtime = now;
+	}
+	else {
+		if (tv[0].tv_nsec != UTIME_OMIT) {
+			inode->atime = tv[0].tv_nsec == UTIME_NOW ? now : (uint32_t)tv[0].tv_sec;
+		}
+		if (tv[1].tv_nsec != UTIME_OMIT) {
+			inode->mtime = tv[1].tv_nsec == UTIME_NOW ? now : (uint32_t)tv[1].tv_sec;
+		}
+	}
+	newfs_update_time(inode, NEWFS_UPDATE_CTIME);
+	return NEWFS_ERROR_NONE;
 }
 /******************************************************************************
 * SECTION: 选做函数实现
 *******************************************************************************/
+/**
+ * @brief 计算文件区间[offset, offset + size)落在文件第blk_no块内的部分
+ * 
+ * @param offset 区间起点
+ * @param size 区间长度
+ * @param blk_no 文件的第几块
+ * @param blk_ofs 返回块内偏移
+ * @param blk_sz 返回块内长度
+ */
+static void newfs_blk_range(off_t offset, size_t size, int blk_no, 
+							int* blk_ofs, int* blk_sz) {
+	off_t blk_begin = NEWFS_BLKS_SIZE((off_t)blk_no);
+	off_t blk_end   = blk_begin + NEWFS_BLK_SIZE();
+	off_t begin     = offset > blk_begin ? offset : blk_begin;
+	off_t end       = offset + (off_t)size < blk_end ? offset + (off_t)size : blk_end;
+
+	*blk_ofs = begin - blk_begin;
+	*blk_sz  = end - begin;
+}
+
 /**
  * @brief 写入文件
  * 
@@ -260,9 +351,34 @@ int newfs_utimens(const char* path, const struct timespec tv[2]) {
 int newfs_write(const char* path, const char* buf, size_t size, off_t offset,
 		        struct fuse_file_info* fi) {
 	/* 选做 */
+	struct fuse_bufvec bufv = FUSE_BUFVEC_INIT(size);
+
+	bufv.buf[0].mem = (void *)buf;
+	return newfs_write_buf(path, &bufv, offset, fi);
+}
+
+/**
+ * @brief 写入文件，FUSE给出的bufvec（可能是splice进来的管道）直接拷进缓存块，
+ * 不再经过中间缓冲区
+ * 
+ * @param path 相对于挂载点的路径
+ * @param buf 写入的内容
+ * @param offset 相对文件的偏移
+ * @param fi 可忽略
+ * @return int 写入大小
+ */
+int newfs_write_buf(const char* path, struct fuse_bufvec* buf, off_t offset,
+		            struct fuse_file_info* fi) {
 	boolean	is_find, is_root;
 	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
 	struct newfs_inode*  inode;
+	struct {
+		struct fuse_bufvec bufv;
+		struct fuse_buf    bufs[MAX_DATA_PERFILE];
+	} dst;
+	size_t  size = fuse_buf_size(buf);
+	ssize_t write_size;
+	int     blk_start, blk_end, blk_ofs, blk_sz;
 	
 	if (is_find == FALSE) {
 		return -NEWFS_ERROR_NOTFOUND;
@@ -274,40 +390,53 @@ int newfs_write(const char* path, const char* buf, size_t size, off_t offset,
 		return -NEWFS_ERROR_ISDIR;	
 	}
 
-	if (inode->size < offset) {
-		return -NEWFS_ERROR_SEEK;
+	/* 允许越过文件尾写，中间未写的块保持为空洞 */
+	if (offset + size > NEWFS_BLKS_SIZE(MAX_DATA_PERFILE)) {
+		if (offset >= NEWFS_BLKS_SIZE(MAX_DATA_PERFILE)) {
+			return -NEWFS_ERROR_NOSPACE;
+		}
+		size = NEWFS_BLKS_SIZE(MAX_DATA_PERFILE) - offset;
+	}
+	if (size == 0) {
+		return 0;
 	}
 
-	int blk_start = offset / NEWFS_BLK_SIZE();
-	int blk_end = (offset + size - 1) / NEWFS_BLK_SIZE();
-	int write_size,current_size,current_offset;
-	write_size = current_offset = current_size = 0;
-
-	for(int i = blk_start;i <= blk_end && i < MAX_DATA_PERFILE; i++) {
-		if(inode->block_pointer[i] == -1) newfs_alloc_data(inode, i);
+	blk_start = offset / NEWFS_BLK_SIZE();
+	blk_end   = (offset + size - 1) / NEWFS_BLK_SIZE();
 
-		if(blk_start == blk_end) {
-			current_offset = offset;
-			current_size = size;
-		} else if(i == blk_start) {
-			current_offset = offset;
-			current_size = NEWFS_BLK_SIZE() - current_offset;
-		} else if(i == blk_end) {
-			current_offset = 0;
-			current_size = size - write_size;
-		} else {
-			current_offset = 0;
-			current_size = NEWFS_BLK_SIZE();
+	/* 目的bufvec的每一段直接指向对应的缓存块 */
+	dst.bufv = FUSE_BUFVEC_INIT(0);
+	dst.bufv.count = 0;
+	for (int i = blk_start; i <= blk_end; i++) {
+		uint8_t* data = newfs_get_data(inode, i);		/* 分配或写时复制 */
+		if (data == NULL) {
+			break;
 		}
+		newfs_blk_range(offset, size, i, &blk_ofs, &blk_sz);
+		dst.bufv.buf[dst.bufv.count].size  = blk_sz;
+		dst.bufv.buf[dst.bufv.count].flags = 0;
+		dst.bufv.buf[dst.bufv.count].mem   = data + blk_ofs;
+		dst.bufv.buf[dst.bufv.count].fd    = -1;
+		dst.bufv.buf[dst.bufv.count].pos   = 0;
+		dst.bufv.count++;
+	}
+	if (dst.bufv.count == 0) {
+		return -NEWFS_ERROR_NOSPACE;
+	}
 
-		memcpy(inode->data[i] + current_offset,  buf + write_size, current_size);
-		write_size += current_size;
+	write_size = fuse_buf_copy(&dst.bufv, buf, FUSE_BUF_SPLICE_NONBLOCK);
+	if (write_size <= 0) {
+		return write_size;
 	}
 
+	for (int i = blk_start; i <= (offset + write_size - 1) / NEWFS_BLK_SIZE(); i++) {
+		inode->data_dirty[i] = TRUE;
+		inode->unwritten &= ~(0x1 << i);
+	}
+	inode->size = offset + write_size > inode->size ? offset + write_size : inode->size;
+	newfs_update_time(inode, NEWFS_UPDATE_MTIME | NEWFS_UPDATE_CTIME);
 	
-	inode->size = offset + size > inode->size ? offset + size : inode->size;
-	
-	return size;
+	return write_size;
 }
 
 /**
@@ -326,6 +455,7 @@ int newfs_read(const char* path, char* buf, size_t size, off_t offset,
 	boolean	is_find, is_root;
 	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
 	struct newfs_inode*  inode;
+	int read_size, blk_ofs, blk_sz;
 
 	if (is_find == FALSE) {
 		return -NEWFS_ERROR_NOTFOUND;
@@ -337,35 +467,123 @@ int newfs_read(const char* path, char* buf, size_t size, off_t offset,
 		return -NEWFS_ERROR_ISDIR;	
 	}
 
-	if (inode->size < offset) {
-		return -NEWFS_ERROR_SEEK;
+	if (inode->size <= offset) {
+		return 0;
+	}
+	if (offset + size > inode->size) {
+		size = inode->size - offset;
 	}
-	int blk_start = offset / NEWFS_BLK_SIZE();
-	int blk_end = (offset + size - 1) / NEWFS_BLK_SIZE();
-	int read_size,current_size,current_offset;
-	read_size = current_offset = current_size = 0;
-
-	for(int i = blk_start;i <= blk_end && i < MAX_DATA_PERFILE; i++) {
 
-		if(blk_start == blk_end) {
-			current_offset = offset;
-			current_size = size;
-		} else if(i == blk_start) {
-			current_offset = offset;
-			current_size = NEWFS_BLK_SIZE() - current_offset;
-		} else if(i == blk_end) {
-			current_offset = 0;
-			current_size = size - read_size;
-		} else {
-			current_offset = 0;
-			current_size = NEWFS_BLK_SIZE();
+	read_size = 0;
+	for (int i = offset / NEWFS_BLK_SIZE(); read_size < size; i++) {
+		uint8_t* data = newfs_load_data(inode, i);
+		newfs_blk_range(offset, size, i, &blk_ofs, &blk_sz);
+		if (data == NULL) {								/* 空洞 */
+			memset(buf + read_size, 0, blk_sz);
+		}
+		else {
+			memcpy(buf + read_size, data + blk_ofs, blk_sz);
 		}
+		read_size += blk_sz;
+	}
+	newfs_update_atime(inode);
+	
+	return read_size;			   
+}
+
+/**
+ * @brief 读取文件，不拷贝数据，只描述数据在哪里：
+ * 与磁盘一致的块以镜像文件fd区间交给FUSE，由内核splice出去，
+ * 物理相邻的块合并成一段；缓存比磁盘新（或没有镜像fd）的块才拷贝出来，
+ * 空洞不读盘，直接给出全0
+ * 
+ * @param path 相对于挂载点的路径
+ * @param bufp 返回的bufvec，由FUSE负责释放
+ * @param size 读取的字节数
+ * @param offset 相对文件的偏移
+ * @param fi 可忽略
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_read_buf(const char* path, struct fuse_bufvec **bufp, size_t size, off_t offset,
+		           struct fuse_file_info* fi) {
+	boolean	is_find, is_root;
+	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
+	struct newfs_inode*  inode;
+	struct fuse_bufvec*  bufv;
+	struct fuse_buf*     fbuf;
+	struct fuse_buf*     prev;
+	off_t pos;
+	int   blk_start, blk_end, blk_ofs, blk_sz;
 
-		memcpy(buf + read_size, inode->data[i] + current_offset, current_size);
-		read_size += current_size;
+	if (is_find == FALSE) {
+		return -NEWFS_ERROR_NOTFOUND;
 	}
+
+	inode = dentry->inode;
 	
-	return size;			   
+	if (NEWFS_IS_DIR(inode)) {
+		return -NEWFS_ERROR_ISDIR;	
+	}
+
+	if (inode->size < offset) {
+		size = 0;
+	}
+	else if (offset + size > inode->size) {
+		size = inode->size - offset;
+	}
+
+	blk_start = offset / NEWFS_BLK_SIZE();
+	blk_end   = size == 0 ? blk_start - 1 : (offset + size - 1) / NEWFS_BLK_SIZE();
+
+	bufv = (struct fuse_bufvec *)malloc(sizeof(struct fuse_bufvec) + 
+					(blk_end - blk_start + 1) * sizeof(struct fuse_buf));
+	if (bufv == NULL) {
+		return -ENOMEM;
+	}
+	*bufv = FUSE_BUFVEC_INIT(0);
+	bufv->count = 0;
+
+	for (int i = blk_start; i <= blk_end; i++) {
+		newfs_blk_range(offset, size, i, &blk_ofs, &blk_sz);
+		prev = bufv->count ? &bufv->buf[bufv->count - 1] : NULL;
+
+		if (super.img_fd >= 0 && !inode->data_dirty[i] && inode->block_pointer[i] != -1 &&
+			!NEWFS_BLK_IS_UNWRITTEN(inode, i)) {
+			pos = NEWFS_DB_OFS(inode->block_pointer[i]) + blk_ofs;
+			if (prev && (prev->flags & FUSE_BUF_IS_FD) && prev->pos + prev->size == pos) {
+				prev->size += blk_sz;
+				continue;
+			}
+			fbuf        = &bufv->buf[bufv->count++];
+			fbuf->flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+			fbuf->fd    = super.img_fd;
+			fbuf->pos   = pos;
+			fbuf->mem   = NULL;
+			fbuf->size  = blk_sz;
+		}
+		else {
+			uint8_t* data = newfs_load_data(inode, i);
+			fbuf        = &bufv->buf[bufv->count++];
+			fbuf->flags = 0;
+			fbuf->fd    = -1;
+			fbuf->pos   = 0;
+			fbuf->mem   = data ? malloc(blk_sz) : calloc(1, blk_sz);	/* 空洞直接给0 */
+			fbuf->size  = fbuf->mem ? blk_sz : 0;
+			if (fbuf->mem == NULL) {
+				break;
+			}
+			if (data) {
+				memcpy(fbuf->mem, data + blk_ofs, blk_sz);
+			}
+		}
+	}
+	if (bufv->count == 0) {
+		bufv->count = 1;
+	}
+	newfs_update_atime(inode);
+
+	*bufp = bufv;
+	return NEWFS_ERROR_NONE;
 }
 
 /**
@@ -388,6 +606,7 @@ int newfs_unlink(const char* path) {
 
 	if(NEWFS_IS_DIR(inode)) return -NEWFS_ERROR_ISDIR;
 
+	newfs_update_time(dentry->parent->inode, NEWFS_UPDATE_MTIME | NEWFS_UPDATE_CTIME);
 	newfs_drop_inode(inode);
 	newfs_drop_dentry(dentry->parent->inode, dentry);
 	return NEWFS_ERROR_NONE;
@@ -419,67 +638,177 @@ int newfs_rmdir(const char* path) {
 
 	if(NEWFS_IS_REG(inode)) return -NEWFS_ERROR_NOTDIR;
 
+	newfs_update_time(dentry->parent->inode, NEWFS_UPDATE_MTIME | NEWFS_UPDATE_CTIME);
 	newfs_drop_inode(inode);
 	newfs_drop_dentry(dentry->parent->inode, dentry);
 	return NEWFS_ERROR_NONE;
 }
 
 /**
- * @brief 重命名文件 
+ * @brief dentry是否是ancestor本身或在ancestor的子树中
+ */
+static boolean newfs_is_subtree(struct newfs_dentry* ancestor, struct newfs_dentry* dentry) {
+	while (dentry != NULL) {
+		if (dentry == ancestor) {
+			return TRUE;
+		}
+		dentry = dentry->parent;
+	}
+	return FALSE;
+}
+
+/**
+ * @brief dentry所在的层数，根目录为0
+ */
+static int newfs_dentry_lvl(struct newfs_dentry* dentry) {
+	int lvl = 0;
+	while (dentry != super.root_dentry) {
+		dentry = dentry->parent;
+		lvl++;
+	}
+	return lvl;
+}
+
+/**
+ * @brief 带标志的重命名，直接在父目录之间移动已有的目录项
+ * 
+ * 目标存在时按rename(2)的语义替换：目录只能替换空目录，文件只能替换文件；
+ * NEWFS_RENAME_NOREPLACE目标存在时失败，NEWFS_RENAME_EXCHANGE交换两个目录项
  * 
  * @param from 源文件路径
  * @param to 目标文件路径
+ * @param flags NEWFS_RENAME_*
  * @return int 0成功，否则返回对应错误号
  */
-int newfs_rename(const char* from, const char* to) {
-	/* 选做 */
-	int ret = NEWFS_ERROR_NONE;
+int newfs_rename2(const char* from, const char* to, unsigned int flags) {
 	boolean	is_find, is_root;
 	struct newfs_dentry* from_dentry = newfs_lookup(from, &is_find, &is_root);
-	struct newfs_inode*  from_inode;
+	struct newfs_dentry* from_parent;
 	struct newfs_dentry* to_dentry;
-	mode_t mode = 0;
+	struct newfs_dentry* to_parent;
+	int    ret;
+
+	if (flags & ~(NEWFS_RENAME_NOREPLACE | NEWFS_RENAME_EXCHANGE) ||
+		flags == (NEWFS_RENAME_NOREPLACE | NEWFS_RENAME_EXCHANGE)) {
+		return -NEWFS_ERROR_INVAL;
+	}
 	if (is_find == FALSE) {
 		return -NEWFS_ERROR_NOTFOUND;
 	}
+	if (is_root) {
+		return -NEWFS_ERROR_INVAL;
+	}
+	from_parent = from_dentry->parent;
 
-	if (strcmp(from, to) == 0) {
-		return NEWFS_ERROR_NONE;
+	to_dentry = newfs_lookup(to, &is_find, &is_root);
+	if (is_root) {
+		return -NEWFS_ERROR_INVAL;
+	}
+	if (is_find) {
+		if (to_dentry == from_dentry) {
+			return NEWFS_ERROR_NONE;
+		}
+		if (flags & NEWFS_RENAME_NOREPLACE) {
+			return -NEWFS_ERROR_EXISTS;
+		}
+		to_parent = to_dentry->parent;
+	}
+	else {
+		if (flags & NEWFS_RENAME_EXCHANGE) {
+			return -NEWFS_ERROR_NOTFOUND;
+		}
+		to_parent = to_dentry;									/* 目标不存在时返回最后一个有效的目录项 */
+		if (NEWFS_IS_REG(to_parent->inode)) {
+			return -NEWFS_ERROR_NOTDIR;
+		}
+		if (newfs_dentry_lvl(to_parent) + 1 != newfs_calc_lvl(to)) {
+			return -NEWFS_ERROR_NOTFOUND;
+		}
 	}
 
-	from_inode = from_dentry->inode;
-	
-	if (NEWFS_IS_DIR(from_inode)) {
-		mode = S_IFDIR;
+	/* 目录不能移到自己的子树下 */
+	if (NEWFS_IS_DIR(from_dentry->inode) && newfs_is_subtree(from_dentry, to_parent)) {
+		return -NEWFS_ERROR_INVAL;
 	}
-	else if (NEWFS_IS_REG(from_inode)) {
-		mode = S_IFREG;
+
+	if (flags & NEWFS_RENAME_EXCHANGE) {
+		if (NEWFS_IS_DIR(to_dentry->inode) && newfs_is_subtree(to_dentry, from_parent)) {
+			return -NEWFS_ERROR_INVAL;
+		}
+		/* 两个目录项互换位置和名字，各自的父目录项数不变 */
+		ret = newfs_exchange_dentry(from_dentry, to_dentry);
+		if (ret != NEWFS_ERROR_NONE) {
+			return ret;
+		}
+		newfs_update_time(to_dentry->inode, NEWFS_UPDATE_CTIME);
 	}
-	
-	ret = newfs_mknod(to, mode, NULL);
-	if (ret != NEWFS_ERROR_NONE) {					  /* 保证目的文件不存在 */
-		return ret;
+	else {
+		if (is_find) {											/* 替换已有目标 */
+			if (NEWFS_IS_DIR(from_dentry->inode) && NEWFS_IS_REG(to_dentry->inode)) {
+				return -NEWFS_ERROR_NOTDIR;
+			}
+			if (NEWFS_IS_REG(from_dentry->inode) && NEWFS_IS_DIR(to_dentry->inode)) {
+				return -NEWFS_ERROR_ISDIR;
+			}
+			if (NEWFS_IS_DIR(to_dentry->inode) && to_dentry->inode->dir_cnt != 0) {
+				return -NEWFS_ERROR_NOTEMPTY;
+			}
+			/* 源目录项直接顶替目标的位置，不需要分配空间；成功后才删除目标，失败时目标原样保留 */
+			ret = newfs_move_dentry(from_dentry, to_parent->inode, newfs_get_fname(to), to_dentry);
+			if (ret != NEWFS_ERROR_NONE) {
+				return ret;
+			}
+			newfs_drop_inode(to_dentry->inode);
+			free(to_dentry);
+		}
+		else {
+			ret = newfs_move_dentry(from_dentry, to_parent->inode, newfs_get_fname(to), NULL);
+			if (ret != NEWFS_ERROR_NONE) {
+				return ret;
+			}
+		}
 	}
-	
-	to_dentry = newfs_lookup(to, &is_find, &is_root);	  
-	newfs_drop_inode(to_dentry->inode);				  /* 保证生成的inode被释放 */	
-	to_dentry->ino = from_inode->ino;				  /* 指向新的inode */
-	to_dentry->inode = from_inode;
-	
-	newfs_drop_dentry(from_dentry->parent->inode, from_dentry);
-	return ret;
+
+	newfs_update_time(from_dentry->inode, NEWFS_UPDATE_CTIME);
+	newfs_update_time(from_parent->inode, NEWFS_UPDATE_MTIME | NEWFS_UPDATE_CTIME);
+	newfs_update_time(to_parent->inode, NEWFS_UPDATE_MTIME | NEWFS_UPDATE_CTIME);
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 重命名文件 
+ * 
+ * @param from 源文件路径
+ * @param to 目标文件路径
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_rename(const char* from, const char* to) {
+	return newfs_rename2(from, to, 0);
 }
 
 /**
  * @brief 打开文件，可以在这里维护fi的信息，例如，fi->fh可以理解为一个64位指针，可以把自己想保存的数据结构
  * 保存在fh中
  * 
+ * 自上次open以来内容没有被修改过时设置keep_cache，内核保留页缓存，重复读不再进入FUSE
+ * 
  * @param path 相对于挂载点的路径
  * @param fi 文件信息
  * @return int 0成功，否则返回对应错误号
  */
 int newfs_open(const char* path, struct fuse_file_info* fi) {
 	/* 选做 */
+	boolean	is_find, is_root;
+	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
+	struct newfs_inode*  inode;
+
+	if (is_find == FALSE) {
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+
+	inode = dentry->inode;
+	fi->keep_cache = inode->cache_valid;
+	inode->cache_valid = TRUE;
 	return NEWFS_ERROR_NONE;
 }
 
@@ -495,6 +824,55 @@ int newfs_opendir(const char* path, struct fuse_file_info* fi) {
 	return NEWFS_ERROR_NONE;
 }
 
+/**
+ * @brief 把文件区间[offset, offset + length)清0：整块覆盖的释放成空洞（包括文件尾之后预分配的块），
+ * 部分覆盖的只清缓存里文件尾之前的部分。先清零头，失败时还没有释放任何块
+ * 
+ * @param inode 
+ * @param offset 起始偏移
+ * @param length 长度
+ * @return int 共享块写时复制空间不足时返回-NEWFS_ERROR_NOSPACE
+ */
+static int newfs_zero_range(struct newfs_inode* inode, off_t offset, off_t length) {
+	int   blk_ofs, blk_sz, first, last;
+	off_t pos;
+	uint8_t* data;
+
+	if (length <= 0 || offset >= NEWFS_BLKS_SIZE((off_t)MAX_DATA_PERFILE)) {
+		return NEWFS_ERROR_NONE;
+	}
+	if (length > NEWFS_BLKS_SIZE((off_t)MAX_DATA_PERFILE) - offset) {
+		length = NEWFS_BLKS_SIZE((off_t)MAX_DATA_PERFILE) - offset;
+	}
+	first = offset / NEWFS_BLK_SIZE();
+	last  = (offset + length - 1) / NEWFS_BLK_SIZE();
+	for (int i = first; i <= last; i++) {
+		newfs_blk_range(offset, length, i, &blk_ofs, &blk_sz);
+		pos = NEWFS_BLKS_SIZE((off_t)i) + blk_ofs;
+		if (blk_sz == NEWFS_BLK_SIZE() || pos >= inode->size) {
+			continue;
+		}
+		if (pos + blk_sz > inode->size) {				/* 文件尾之后本来就是0 */
+			blk_sz = inode->size - pos;
+		}
+		if (newfs_load_data(inode, i) == NULL) {		/* 空洞和未写入块本来就是0 */
+			continue;
+		}
+		if ((data = newfs_get_data(inode, i)) == NULL) {
+			return -NEWFS_ERROR_NOSPACE;
+		}
+		memset(data + blk_ofs, 0, blk_sz);
+		inode->data_dirty[i] = TRUE;
+	}
+	for (int i = first; i <= last; i++) {
+		newfs_blk_range(offset, length, i, &blk_ofs, &blk_sz);
+		if (blk_sz == NEWFS_BLK_SIZE()) {
+			newfs_free_data(inode, i);
+		}
+	}
+	return NEWFS_ERROR_NONE;
+}
+
 /**
  * @brief 改变文件大小
  * 
@@ -507,6 +885,7 @@ int newfs_truncate(const char* path, off_t offset) {
 	boolean	is_find, is_root;
 	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
 	struct newfs_inode*  inode;
+	int ret;
 	
 	if (is_find == FALSE) {
 		return -NEWFS_ERROR_NOTFOUND;
@@ -518,12 +897,213 @@ int newfs_truncate(const char* path, off_t offset) {
 		return -NEWFS_ERROR_ISDIR;
 	}
 
+	if (offset > NEWFS_BLKS_SIZE(MAX_DATA_PERFILE)) {
+		return -EFBIG;
+	}
+
+	/* 缩小时释放新文件尾之后的块，并把最后一块尾部清0，以后再扩大时读出来是0 */
+	if (offset < inode->size) {
+		ret = newfs_zero_range(inode, offset, NEWFS_ROUND_UP(offset, NEWFS_BLK_SIZE()) - offset);
+		if (ret != NEWFS_ERROR_NONE) {
+			return ret;
+		}
+		for (int i = NEWFS_ROUND_UP(offset, NEWFS_BLK_SIZE()) / NEWFS_BLK_SIZE(); 
+			 i < MAX_DATA_PERFILE; i++) {
+			newfs_free_data(inode, i);
+		}
+	}
+
 	inode->size = offset;
+	newfs_update_time(inode, NEWFS_UPDATE_MTIME | NEWFS_UPDATE_CTIME);
 
 	return NEWFS_ERROR_NONE;
 }
 
 
+/**
+ * @brief 预分配文件空间：[offset, offset + length)中还没有数据块的部分，
+ * 尽量一次分配成物理连续的一段，标记为未写入（读出为0，写回时跳过），
+ * 之后在这段范围内的追加写不再需要分配块。
+ * FALLOC_FL_PUNCH_HOLE则相反，把区间内整块释放回数据块位图，零头清0
+ * 
+ * @param path 相对于挂载点的路径
+ * @param mode 0、FALLOC_FL_KEEP_SIZE（不改变文件大小）或FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE
+ * @param offset 起始偏移
+ * @param length 长度
+ * @param fi 可忽略
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_fallocate(const char* path, int mode, off_t offset, off_t length, 
+					struct fuse_file_info* fi) {
+	boolean	is_find, is_root;
+	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
+	struct newfs_inode*  inode;
+	int blk_start, blk_end, blk_cnt, need = 0, ret;
+
+	if (is_find == FALSE) {
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+
+	inode = dentry->inode;
+
+	if (NEWFS_IS_DIR(inode)) {
+		return -NEWFS_ERROR_ISDIR;
+	}
+	if (mode & ~(FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE)) {
+		return -NEWFS_ERROR_NOTSUPP;
+	}
+	if (offset < 0 || length <= 0) {
+		return -NEWFS_ERROR_INVAL;
+	}
+
+	/* 打洞必须与KEEP_SIZE一起使用，不改变文件大小 */
+	if (mode & FALLOC_FL_PUNCH_HOLE) {
+		if (!(mode & FALLOC_FL_KEEP_SIZE)) {
+			return -NEWFS_ERROR_NOTSUPP;
+		}
+		ret = newfs_zero_range(inode, offset, length);	/* 文件尾之后预分配的块也释放 */
+		if (ret != NEWFS_ERROR_NONE) {
+			return ret;
+		}
+		newfs_update_time(inode, NEWFS_UPDATE_MTIME | NEWFS_UPDATE_CTIME);
+		return NEWFS_ERROR_NONE;
+	}
+
+	if (offset + length > NEWFS_BLKS_SIZE(MAX_DATA_PERFILE)) {
+		return -EFBIG;
+	}
+
+	blk_start = offset / NEWFS_BLK_SIZE();
+	blk_end   = (offset + length - 1) / NEWFS_BLK_SIZE();
+	for (int i = blk_start; i <= blk_end; i++) {
+		if (inode->block_pointer[i] == -1 && !NEWFS_BLK_IS_DELALLOC(inode, i)) need++;
+	}
+	if (need > newfs_count_free_data()) {
+		return -NEWFS_ERROR_NOSPACE;
+	}
+
+	/* 每段连续的空洞一次分配 */
+	for (int i = blk_start; i <= blk_end; i += blk_cnt) {
+		blk_cnt = 1;
+		if (inode->block_pointer[i] != -1 || NEWFS_BLK_IS_DELALLOC(inode, i)) {	/* 延迟分配的块已有数据 */
+			continue;
+		}
+		while (i + blk_cnt <= blk_end && inode->block_pointer[i + blk_cnt] == -1 &&
+			   !NEWFS_BLK_IS_DELALLOC(inode, i + blk_cnt)) {
+			blk_cnt++;
+		}
+		if (newfs_alloc_data_range(inode, i, blk_cnt) != NEWFS_ERROR_NONE) {
+			return -NEWFS_ERROR_NOSPACE;
+		}
+		for (int j = i; j < i + blk_cnt; j++) {
+			inode->unwritten |= 0x1 << j;
+		}
+	}
+
+	if (!(mode & FALLOC_FL_KEEP_SIZE) && offset + length > inode->size) {
+		inode->size = offset + length;
+		newfs_update_time(inode, NEWFS_UPDATE_MTIME);
+	}
+	newfs_update_time(inode, NEWFS_UPDATE_CTIME);
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 把src_path的[src_offset, src_offset + src_length)克隆到dst_path的dest_offset处，
+ * 只修改块指针和引用计数，数据在第一次写时才复制
+ * 
+ * @param dst_path 目标文件路径
+ * @param args 克隆参数
+ * @return int 0成功，否则返回对应错误号
+ */
+static int newfs_clone(const char* dst_path, struct newfs_ioc_clone* args) {
+	boolean	is_find, is_root;
+	struct newfs_dentry* src_dentry;
+	struct newfs_dentry* dst_dentry;
+	struct newfs_inode*  src;
+	struct newfs_inode*  dst;
+	off_t src_ofs = args->src_offset, dst_ofs = args->dest_offset;
+	off_t length  = args->src_length;
+	int   blk_cnt, ret;
+
+	args->src_path[NEWFS_IOC_PATH_LEN - 1] = '\0';
+	src_dentry = newfs_lookup(args->src_path, &is_find, &is_root);
+	if (is_find == FALSE) {
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	src = src_dentry->inode;
+	dst_dentry = newfs_lookup(dst_path, &is_find, &is_root);
+	if (is_find == FALSE) {
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	dst = dst_dentry->inode;
+
+	if (NEWFS_IS_DIR(src) || NEWFS_IS_DIR(dst)) {
+		return -NEWFS_ERROR_ISDIR;
+	}
+	if (src_ofs > src->size) {
+		return -NEWFS_ERROR_INVAL;
+	}
+	if (length == 0 || src_ofs + length > src->size) {
+		length = src->size - src_ofs;
+	}
+	if (length == 0) {
+		return NEWFS_ERROR_NONE;
+	}
+
+	/* 只能整块共享，最后不满一块的部分只允许是源文件尾，且不能覆盖目标文件中间的数据 */
+	if (src_ofs % NEWFS_BLK_SIZE() || dst_ofs % NEWFS_BLK_SIZE() ||
+		(length % NEWFS_BLK_SIZE() && 
+		 (src_ofs + length != src->size || dst_ofs + length < dst->size))) {
+		return -NEWFS_ERROR_INVAL;
+	}
+	if (dst_ofs + length > NEWFS_BLKS_SIZE(MAX_DATA_PERFILE)) {
+		return -EFBIG;
+	}
+	if (src == dst && src_ofs < dst_ofs + length && dst_ofs < src_ofs + length) {
+		return -NEWFS_ERROR_INVAL;
+	}
+
+	blk_cnt = NEWFS_ROUND_UP(length, NEWFS_BLK_SIZE()) / NEWFS_BLK_SIZE();
+	ret = newfs_clone_data(src, src_ofs / NEWFS_BLK_SIZE(), dst, dst_ofs / NEWFS_BLK_SIZE(), blk_cnt);
+	if (ret != NEWFS_ERROR_NONE) {
+		return ret;
+	}
+
+	if (dst_ofs + length > dst->size) {
+		dst->size = dst_ofs + length;
+	}
+	newfs_update_time(dst, NEWFS_UPDATE_MTIME | NEWFS_UPDATE_CTIME);
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 控制命令，命令号见newfs_ctl_user.h
+ * 
+ * @param path 相对于挂载点的路径
+ * @param cmd 命令号
+ * @param arg 可忽略
+ * @param fi 文件信息
+ * @param flags FUSE_IOCTL_*
+ * @param data 命令的输入/输出数据
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_ioctl(const char* path, int cmd, void* arg, struct fuse_file_info* fi,
+				unsigned int flags, void* data) {
+	switch ((unsigned int)cmd)
+	{
+	case NEWFS_IOC_CLONE:
+		return newfs_clone(path, (struct newfs_ioc_clone *)data);
+	case NEWFS_IOC_RENAME:
+		return newfs_rename2(path, ((struct newfs_ioc_rename *)data)->dest_path,
+							 ((struct newfs_ioc_rename *)data)->flags);
+	case NEWFS_IOC_CHECKPOINT:
+		return newfs_journal_checkpoint();
+	default:
+		return -ENOTTY;
+	}
+}
+
 /**
  * @brief 访问文件，因为读写文件时需要查看权限
  * 
@@ -564,20 +1144,454 @@ int newfs_access(const char* path, int type) {
 	}
 	return is_access_ok ? NEWFS_ERROR_NONE : -NEWFS_ERROR_ACCESS;
 }	
+
+/**
+ * @brief 把文件的修改持久化：写操作不等日志提交，这里什么都不用做，
+ * 由加锁入口等待当前事务（连同其中延迟分配的数据块）提交
+ * 
+ * @param path 相对于挂载点的路径
+ * @param datasync 非0时只需同步数据
+ * @param fi 可忽略
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_fsync(const char* path, int datasync, struct fuse_file_info* fi) {
+	boolean	is_find, is_root;
+
+	newfs_lookup(path, &is_find, &is_root);
+	return is_find ? NEWFS_ERROR_NONE : -NEWFS_ERROR_NOTFOUND;
+}
 /******************************************************************************
-* SECTION: FUSE入口
+* SECTION: 统计文件
+* NEWFS_STATS_DIR不在盘上，也不出现在根目录的列表里（盘上已有同名的项时不拦截）；打开NEWFS_STATS_FILE时
+* 生成一份统计快照挂在fi->fh上，之后的读都读这份快照，写入或截断则把统计清零
 *******************************************************************************/
-int main(int argc, char **argv)
-{
-    int ret;
-	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+struct newfs_stats_snap {
+	int  len;
+	char text[NEWFS_STATS_TEXT_MAX];
+};
 
-	newfs_options.device = strdup("TODO: 这里填写你的ddriver设备路径");
+/**
+ * @brief 路径是不是统计目录下的节点
+ * 
+ * @param path 相对于挂载点的路径
+ * @return int NEWFS_STATS_NODE_*
+ */
+static int newfs_stats_node(const char* path) {
+	size_t len = strlen(NEWFS_STATS_DIR);
 
-	if (fuse_opt_parse(&args, &newfs_options, option_spec, NULL) == -1)
-		return -1;
-	
-	ret = fuse_main(args.argc, args.argv, &operations, NULL);
-	fuse_opt_free_args(&args);
+	if (newfs_stats_shadowed || strncmp(path, NEWFS_STATS_DIR, len) != 0 || 
+		(path[len] != '\0' && path[len] != '/')) {
+		return NEWFS_STATS_NODE_NONE;
+	}
+	if (path[len] == '\0' || strcmp(path + len, "/") == 0) {
+		return NEWFS_STATS_NODE_DIR;
+	}
+	return strcmp(path, NEWFS_STATS_FILE) == 0 ? NEWFS_STATS_NODE_FILE : NEWFS_STATS_NODE_OTHER;
+}
+
+/**
+ * @brief 在文件系统大锁内生成统计文本，缓存占用等计数只在锁内一致
+ */
+static void newfs_stats_snapshot(struct newfs_stats_snap* snap) {
+	newfs_op_begin(NEWFS_OP_READ);
+	snap->len = newfs_stats_render(snap->text, NEWFS_STATS_TEXT_MAX);
+	newfs_op_end(NEWFS_ERROR_NONE, NEWFS_OP_READ);
+}
+
+static int newfs_stats_getattr(const char* path, struct stat* newfs_stat) {
+	struct newfs_stats_snap* snap;
+
+	memset(newfs_stat, 0, sizeof(struct stat));
+	switch (newfs_stats_node(path))
+	{
+	case NEWFS_STATS_NODE_DIR:
+		newfs_stat->st_mode  = S_IFDIR | 0555;
+		newfs_stat->st_nlink = 2;
+		break;
+	case NEWFS_STATS_NODE_FILE:
+		snap = (struct newfs_stats_snap*)malloc(sizeof(struct newfs_stats_snap));
+		if (snap == NULL) {
+			return -ENOMEM;
+		}
+		newfs_stats_snapshot(snap);
+		newfs_stat->st_mode  = S_IFREG | 0644;
+		newfs_stat->st_nlink = 1;
+		newfs_stat->st_size  = snap->len;		/* 读时以direct_io读快照，这里只是参考 */
+		free(snap);
+		break;
+	default:
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	newfs_stat->st_uid   = getuid();
+	newfs_stat->st_gid   = getgid();
+	newfs_stat->st_atime = newfs_stat->st_mtime = newfs_stat->st_ctime = time(NULL);
+	return NEWFS_ERROR_NONE;
+}
+
+static int newfs_stats_readdir(const char* path, void* buf, fuse_fill_dir_t filler, off_t offset) {
+	if (newfs_stats_node(path) != NEWFS_STATS_NODE_DIR) {
+		return -NEWFS_ERROR_NOTDIR;
+	}
+	if (offset == 0) {
+		filler(buf, strrchr(NEWFS_STATS_FILE, '/') + 1, NULL, 1);
+	}
+	return NEWFS_ERROR_NONE;
+}
+
+static int newfs_stats_open(const char* path, struct fuse_file_info* fi) {
+	struct newfs_stats_snap* snap;
+
+	if (newfs_stats_node(path) != NEWFS_STATS_NODE_FILE) {
+		return newfs_stats_node(path) == NEWFS_STATS_NODE_DIR ? -NEWFS_ERROR_ISDIR 
+															  : -NEWFS_ERROR_NOTFOUND;
+	}
+	snap = (struct newfs_stats_snap*)malloc(sizeof(struct newfs_stats_snap));
+	if (snap == NULL) {
+		return -ENOMEM;
+	}
+	newfs_stats_snapshot(snap);
+	fi->fh        = (uint64_t)(uintptr_t)snap;
+	fi->direct_io = 1;		/* 内容随时在变，不进页缓存，也不受getattr的大小限制 */
+	return NEWFS_ERROR_NONE;
+}
+
+static int newfs_stats_read(char* buf, size_t size, off_t offset, struct fuse_file_info* fi) {
+	struct newfs_stats_snap* snap = (struct newfs_stats_snap*)(uintptr_t)fi->fh;
+
+	if (snap == NULL || offset >= snap->len) {
+		return 0;
+	}
+	if (offset + size > snap->len) {
+		size = snap->len - offset;
+	}
+	memcpy(buf, snap->text + offset, size);
+	return size;
+}
+
+static int newfs_stats_read_buf(struct fuse_bufvec** bufp, size_t size, off_t offset,
+							   struct fuse_file_info* fi) {
+	struct fuse_bufvec* bufv = (struct fuse_bufvec*)malloc(sizeof(struct fuse_bufvec));
+	int read_size;
+
+	if (bufv == NULL) {
+		return -ENOMEM;
+	}
+	*bufv = FUSE_BUFVEC_INIT(size);
+	bufv->buf[0].mem = malloc(size ? size : 1);
+	if (bufv->buf[0].mem == NULL) {
+		free(bufv);
+		return -ENOMEM;
+	}
+	read_size = newfs_stats_read(bufv->buf[0].mem, size, offset, fi);
+	bufv->buf[0].size = read_size;
+	*bufp = bufv;
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 写统计文件：内容被丢弃，统计清零
+ */
+static int newfs_stats_write_buf(struct fuse_bufvec* buf) {
+	size_t size = fuse_buf_size(buf);
+	struct fuse_bufvec dst = FUSE_BUFVEC_INIT(size);
+	ssize_t ret;
+
+	dst.buf[0].mem = malloc(size ? size : 1);		/* 数据可能还在FUSE管道里，要读走 */
+	if (dst.buf[0].mem == NULL) {
+		return -ENOMEM;
+	}
+	ret = fuse_buf_copy(&dst, buf, 0);
+	free(dst.buf[0].mem);
+	newfs_stats_reset();
 	return ret;
-}
\ No newline at end of file
+}
+
+/******************************************************************************
+* SECTION: 加锁入口
+* FUSE默认多线程调用，各操作在文件系统大锁内串行执行；修改元数据的操作
+* 成功后等到所在日志事务提交才返回，并发的操作共用一次提交；写数据的操作
+* 不等提交（数据块也留到提交时才分配），需要持久化时由fsync等待。
+* 各操作的耗时（含等锁和等提交）和持锁期间的设备I/O记入统计，开启轨迹时连同
+* 参数记一条轨迹；统计目录下的路径不进大锁，也不计时
+*******************************************************************************/
+static int newfs_op_mkdir(const char* path, mode_t mode) {
+	uint64_t start = newfs_stats_now();
+
+	if (newfs_stats_node(path) != NEWFS_STATS_NODE_NONE) {
+		return -EPERM;
+	}
+	newfs_trace_args(path, NULL, 0, 0, mode);
+	newfs_op_begin(NEWFS_OP_SYNC);
+	return newfs_stats_end(NEWFS_STAT_MKDIR, start, 
+						   newfs_op_end(newfs_mkdir(path, mode), NEWFS_OP_SYNC));
+}
+
+static int newfs_op_getattr(const char* path, struct stat* newfs_stat) {
+	uint64_t start = newfs_stats_now();
+
+	if (newfs_stats_node(path) != NEWFS_STATS_NODE_NONE) {
+		return newfs_stats_getattr(path, newfs_stat);
+	}
+	newfs_trace_args(path, NULL, 0, 0, 0);
+	newfs_op_begin(NEWFS_OP_READ);
+	return newfs_stats_end(NEWFS_STAT_GETATTR, start, 
+						   newfs_op_end(newfs_getattr(path, newfs_stat), NEWFS_OP_READ));
+}
+
+static int newfs_op_readdir(const char* path, void* buf, fuse_fill_dir_t filler, off_t offset,
+						   struct fuse_file_info* fi) {
+	uint64_t start = newfs_stats_now();
+
+	if (newfs_stats_node(path) != NEWFS_STATS_NODE_NONE) {
+		return newfs_stats_readdir(path, buf, filler, offset);
+	}
+	newfs_trace_args(path, NULL, offset, 0, 0);
+	newfs_op_begin(NEWFS_OP_READ);
+	return newfs_stats_end(NEWFS_STAT_READDIR, start, 
+						   newfs_op_end(newfs_readdir(path, buf, filler, offset, fi), NEWFS_OP_READ));
+}
+
+static int newfs_op_mknod(const char* path, mode_t mode, dev_t dev) {
+	uint64_t start = newfs_stats_now();
+
+	if (newfs_stats_node(path) != NEWFS_STATS_NODE_NONE) {
+		return -EPERM;
+	}
+	newfs_trace_args(path, NULL, 0, 0, mode);
+	newfs_op_begin(NEWFS_OP_SYNC);
+	return newfs_stats_end(NEWFS_STAT_MKNOD, start, 
+						   newfs_op_end(newfs_mknod(path, mode, dev), NEWFS_OP_SYNC));
+}
+
+static int newfs_op_write(const char* path, const char* buf, size_t size, off_t offset,
+						 struct fuse_file_info* fi) {
+	uint64_t start = newfs_stats_now();
+
+	if (newfs_stats_node(path) != NEWFS_STATS_NODE_NONE) {
+		newfs_stats_reset();
+		return size;
+	}
+	newfs_trace_args(path, NULL, offset, size, 0);
+	newfs_op_begin(NEWFS_OP_ASYNC);
+	return newfs_stats_end(NEWFS_STAT_WRITE, start, 
+						   newfs_op_end(newfs_write(path, buf, size, offset, fi), NEWFS_OP_ASYNC));
+}
+
+static int newfs_op_read(const char* path, char* buf, size_t size, off_t offset,
+						struct fuse_file_info* fi) {
+	uint64_t start = newfs_stats_now();
+
+	if (newfs_stats_node(path) != NEWFS_STATS_NODE_NONE) {
+		return newfs_stats_read(buf, size, offset, fi);
+	}
+	newfs_trace_args(path, NULL, offset, size, 0);
+	newfs_op_begin(NEWFS_OP_READ);
+	return newfs_stats_end(NEWFS_STAT_READ, start, 
+						   newfs_op_end(newfs_read(path, buf, size, offset, fi), NEWFS_OP_READ));
+}
+
+static int newfs_op_write_buf(const char* path, struct fuse_bufvec* buf, off_t offset,
+							 struct fuse_file_info* fi) {
+	uint64_t start = newfs_stats_now();
+
+	if (newfs_stats_node(path) != NEWFS_STATS_NODE_NONE) {
+		return newfs_stats_write_buf(buf);
+	}
+	newfs_trace_args(path, NULL, offset, fuse_buf_size(buf), 0);
+	newfs_op_begin(NEWFS_OP_ASYNC);
+	return newfs_stats_end(NEWFS_STAT_WRITE_BUF, start, 
+						   newfs_op_end(newfs_write_buf(path, buf, offset, fi), NEWFS_OP_ASYNC));
+}
+
+static int newfs_op_read_buf(const char* path, struct fuse_bufvec** bufp, size_t size, off_t offset,
+							struct fuse_file_info* fi) {
+	uint64_t start = newfs_stats_now();
+	int      ret;
+
+	if (newfs_stats_node(path) != NEWFS_STATS_NODE_NONE) {
+		return newfs_stats_read_buf(bufp, size, offset, fi);
+	}
+	newfs_trace_args(path, NULL, offset, size, 0);
+	newfs_op_begin(NEWFS_OP_READ);
+	ret = newfs_op_end(newfs_read_buf(path, bufp, size, offset, fi), NEWFS_OP_READ);
+	if (ret == NEWFS_ERROR_NONE) {
+		newfs_stats_user_bytes(NEWFS_STAT_READ_BUF, fuse_buf_size(*bufp));
+	}
+	return newfs_stats_end(NEWFS_STAT_READ_BUF, start, ret);
+}
+
+static int newfs_op_utimens(const char* path, const struct timespec tv[2]) {
+	uint64_t start = newfs_stats_now();
+
+	if (newfs_stats_node(path) != NEWFS_STATS_NODE_NONE) {
+		return NEWFS_ERROR_NONE;
+	}
+	newfs_trace_args(path, NULL, 0, 0, 0);
+	newfs_op_begin(NEWFS_OP_SYNC);
+	return newfs_stats_end(NEWFS_STAT_UTIMENS, start, 
+						   newfs_op_end(newfs_utimens(path, tv), NEWFS_OP_SYNC));
+}
+
+static int newfs_op_truncate(const char* path, off_t offset) {
+	uint64_t start = newfs_stats_now();
+
+	if (newfs_stats_node(path) != NEWFS_STATS_NODE_NONE) {
+		newfs_stats_reset();				/* echo > NEWFS_STATS_FILE 先截断再写 */
+		return NEWFS_ERROR_NONE;
+	}
+	newfs_trace_args(path, NULL, offset, 0, 0);
+	newfs_op_begin(NEWFS_OP_SYNC);
+	return newfs_stats_end(NEWFS_STAT_TRUNCATE, start, 
+						   newfs_op_end(newfs_truncate(path, offset), NEWFS_OP_SYNC));
+}
+
+static int newfs_op_fallocate(const char* path, int mode, off_t offset, off_t length,
+							 struct fuse_file_info* fi) {
+	uint64_t start = newfs_stats_now();
+
+	if (newfs_stats_node(path) != NEWFS_STATS_NODE_NONE) {
+		return -EPERM;
+	}
+	newfs_trace_args(path, NULL, offset, length, mode);
+	newfs_op_begin(NEWFS_OP_SYNC);
+	return newfs_stats_end(NEWFS_STAT_FALLOCATE, start, 
+						   newfs_op_end(newfs_fallocate(path, mode, offset, length, fi), NEWFS_OP_SYNC));
+}
+
+static int newfs_op_ioctl(const char* path, int cmd, void* arg, struct fuse_file_info* fi,
+						 unsigned int flags, void* data) {
+	uint64_t start = newfs_stats_now();
+
+	if (newfs_stats_node(path) != NEWFS_STATS_NODE_NONE) {
+		return -ENOTTY;
+	}
+	newfs_trace_args(path, NULL, 0, 0, (uint32_t)cmd);
+	newfs_op_begin(NEWFS_OP_SYNC);
+	return newfs_stats_end(NEWFS_STAT_IOCTL, start, 
+						   newfs_op_end(newfs_ioctl(path, cmd, arg, fi, flags, data), NEWFS_OP_SYNC));
+}
+
+static int newfs_op_unlink(const char* path) {
+	uint64_t start = newfs_stats_now();
+
+	if (newfs_stats_node(path) != NEWFS_STATS_NODE_NONE) {
+		return -EPERM;
+	}
+	newfs_trace_args(path, NULL, 0, 0, 0);
+	newfs_op_begin(NEWFS_OP_SYNC);
+	return newfs_stats_end(NEWFS_STAT_UNLINK, start, 
+						   newfs_op_end(newfs_unlink(path), NEWFS_OP_SYNC));
+}
+
+static int newfs_op_rmdir(const char* path) {
+	uint64_t start = newfs_stats_now();
+
+	if (newfs_stats_node(path) != NEWFS_STATS_NODE_NONE) {
+		return -EPERM;
+	}
+	newfs_trace_args(path, NULL, 0, 0, 0);
+	newfs_op_begin(NEWFS_OP_SYNC);
+	return newfs_stats_end(NEWFS_STAT_RMDIR, start, 
+						   newfs_op_end(newfs_rmdir(path), NEWFS_OP_SYNC));
+}
+
+static int newfs_op_rename(const char* from, const char* to) {
+	uint64_t start = newfs_stats_now();
+
+	if (newfs_stats_node(from) != NEWFS_STATS_NODE_NONE || 
+		newfs_stats_node(to) != NEWFS_STATS_NODE_NONE) {
+		return -EPERM;
+	}
+	newfs_trace_args(from, to, 0, 0, 0);
+	newfs_op_begin(NEWFS_OP_SYNC);
+	return newfs_stats_end(NEWFS_STAT_RENAME, start, 
+						   newfs_op_end(newfs_rename(from, to), NEWFS_OP_SYNC));
+}
+
+static int newfs_op_open(const char* path, struct fuse_file_info* fi) {
+	uint64_t start = newfs_stats_now();
+
+	if (newfs_stats_node(path) != NEWFS_STATS_NODE_NONE) {
+		return newfs_stats_open(path, fi);
+	}
+	newfs_trace_args(path, NULL, 0, 0, fi->flags);
+	newfs_op_begin(NEWFS_OP_READ);
+	return newfs_stats_end(NEWFS_STAT_OPEN, start, 
+						   newfs_op_end(newfs_open(path, fi), NEWFS_OP_READ));
+}
+
+static int newfs_op_opendir(const char* path, struct fuse_file_info* fi) {
+	uint64_t start = newfs_stats_now();
+
+	if (newfs_stats_node(path) != NEWFS_STATS_NODE_NONE) {
+		return newfs_stats_node(path) == NEWFS_STATS_NODE_DIR ? NEWFS_ERROR_NONE : -NEWFS_ERROR_NOTDIR;
+	}
+	newfs_trace_args(path, NULL, 0, 0, 0);
+	newfs_op_begin(NEWFS_OP_READ);
+	return newfs_stats_end(NEWFS_STAT_OPENDIR, start, 
+						   newfs_op_end(newfs_opendir(path, fi), NEWFS_OP_READ));
+}
+
+static int newfs_op_access(const char* path, int type) {
+	uint64_t start = newfs_stats_now();
+
+	if (newfs_stats_node(path) != NEWFS_STATS_NODE_NONE) {
+		return newfs_stats_node(path) == NEWFS_STATS_NODE_OTHER ? -NEWFS_ERROR_NOTFOUND : NEWFS_ERROR_NONE;
+	}
+	newfs_trace_args(path, NULL, 0, 0, type);
+	newfs_op_begin(NEWFS_OP_READ);
+	return newfs_stats_end(NEWFS_STAT_ACCESS, start, 
+						   newfs_op_end(newfs_access(path, type), NEWFS_OP_READ));
+}
+
+static int newfs_op_fsync(const char* path, int datasync, struct fuse_file_info* fi) {
+	uint64_t start = newfs_stats_now();
+
+	if (newfs_stats_node(path) != NEWFS_STATS_NODE_NONE) {
+		return NEWFS_ERROR_NONE;
+	}
+	newfs_trace_args(path, NULL, 0, 0, datasync);
+	newfs_op_begin(NEWFS_OP_SYNC);
+	return newfs_stats_end(NEWFS_STAT_FSYNC, start, 
+						   newfs_op_end(newfs_fsync(path, datasync, fi), NEWFS_OP_SYNC));
+}
+
+/**
+ * @brief 关闭文件：只有统计文件在fi->fh上挂了快照，普通文件没有要释放的
+ */
+static int newfs_op_release(const char* path, struct fuse_file_info* fi) {
+	if (newfs_stats_node(path) == NEWFS_STATS_NODE_FILE) {
+		free((struct newfs_stats_snap*)(uintptr_t)fi->fh);
+		fi->fh = 0;
+	}
+	return NEWFS_ERROR_NONE;
+}
+
+/******************************************************************************
+* SECTION: FUSE操作定义
+*******************************************************************************/
+struct fuse_operations newfs_operations = {
+	.init = newfs_init,						 	/* mount文件系统 */		
+	.destroy = newfs_destroy,				 	/* umount文件系统 */
+	.mkdir = newfs_op_mkdir,					 	/* 建目录，mkdir */
+	.getattr = newfs_op_getattr,				 	/* 获取文件属性，类似stat，必须完成 */
+	.readdir = newfs_op_readdir,				 	/* 填充dentrys */
+	.mknod = newfs_op_mknod,					 	/* 创建文件，touch相关 */
+	.write = newfs_op_write,						/* 写入文件 */
+	.read = newfs_op_read,							/* 读文件 */
+	.write_buf = newfs_op_write_buf,				/* 写入文件，可直接从FUSE管道splice进缓存块 */
+	.read_buf = newfs_op_read_buf,					/* 读文件，干净块以镜像fd区间交给FUSE */
+	.utimens = newfs_op_utimens,				 	/* 修改时间，忽略，避免touch报错 */
+	.truncate = newfs_op_truncate,					/* 改变文件大小 */
+	.fallocate = newfs_op_fallocate,				/* 预分配连续数据块 */
+	.ioctl = newfs_op_ioctl,						/* 控制命令，如共享数据块的克隆 */
+	.unlink = newfs_op_unlink,						/* 删除文件 */
+	.rmdir	= newfs_op_rmdir,						/* 删除目录， rm -r */
+	.rename = newfs_op_rename,						/* 重命名，mv */
+
+	.open = newfs_op_open,							
+	.opendir = newfs_op_opendir,
+	.access = newfs_op_access,
+	.fsync = newfs_op_fsync,
+	.release = newfs_op_release
+};
@@ -0,0 +1,165 @@
+#include "../include/newfs.h"
+#include <sys/mman.h>
+
+extern struct newfs_super super;
+extern struct custom_options newfs_options;
+
+/* 线程缓存的缓冲区，gen与缓冲池不同时是上一次挂载留下的，不能再用 */
+struct newfs_buf_tls {
+    uint8_t* buf;
+    uint32_t gen;
+};
+
+static pthread_once_t newfs_bufpool_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief 缓冲区是否属于缓冲池
+ */
+static boolean newfs_bufpool_owns(uint8_t* buf) {
+    struct newfs_bufpool* pool = &super.bufpool;
+
+    return pool->base != NULL && buf >= pool->base &&
+           buf < pool->base + (long)NEWFS_BUF_NR * NEWFS_BUF_SIZE;
+}
+
+/**
+ * @brief 把缓冲区放回空闲栈
+ */
+static void newfs_bufpool_push(uint8_t* buf) {
+    struct newfs_bufpool* pool = &super.bufpool;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->free[pool->nr_free++] = (buf - pool->base) / NEWFS_BUF_SIZE;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * @brief 线程退出时归还它缓存的缓冲区
+ */
+static void newfs_bufpool_tls_destroy(void* arg) {
+    struct newfs_buf_tls* tls = (struct newfs_buf_tls*)arg;
+
+    if (tls->buf != NULL && tls->gen == super.bufpool.gen && newfs_bufpool_owns(tls->buf)) {
+        newfs_bufpool_push(tls->buf);
+    }
+    free(tls);
+}
+
+static void newfs_bufpool_key_init() {
+    pthread_key_create(&super.bufpool.key, newfs_bufpool_tls_destroy);
+    pthread_mutex_init(&super.bufpool.lock, NULL);
+}
+
+/**
+ * @brief 映射缓冲池：先尝试大页，没有预留大页时退回普通页并建议内核合并成透明大页
+ *
+ * @return int
+ */
+int newfs_bufpool_init() {
+    struct newfs_bufpool* pool = &super.bufpool;
+    size_t   len = (size_t)NEWFS_BUF_NR * NEWFS_BUF_SIZE;
+    void*    base;
+
+    pthread_once(&newfs_bufpool_once, newfs_bufpool_key_init);
+    if (pool->base != NULL) {
+        return NEWFS_ERROR_NONE;
+    }
+
+    pool->is_huge = TRUE;
+    base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (base == MAP_FAILED) {
+        pool->is_huge = FALSE;
+        base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED) {
+            return -NEWFS_ERROR_NOSPACE;
+        }
+        madvise(base, len, MADV_HUGEPAGE);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->base    = (uint8_t*)base;
+    pool->nr_free = NEWFS_BUF_NR;
+    for (int i = 0; i < NEWFS_BUF_NR; i++) {
+        pool->free[i] = NEWFS_BUF_NR - 1 - i;
+    }
+    pool->gen++;
+    pthread_mutex_unlock(&pool->lock);
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 解除缓冲池映射，调用者保证没有借出的缓冲区
+ */
+void newfs_bufpool_destroy() {
+    struct newfs_bufpool* pool = &super.bufpool;
+
+    if (pool->base == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    munmap(pool->base, (size_t)NEWFS_BUF_NR * NEWFS_BUF_SIZE);
+    pool->base    = NULL;
+    pool->nr_free = 0;
+    pool->gen++;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * @brief 借一个至少size字节、按NEWFS_BUF_ALIGN对齐的缓冲区：先取本线程缓存的，
+ * 再取空闲栈里的；超过NEWFS_BUF_SIZE或缓冲池用完时才临时分配
+ *
+ * @param size
+ * @return uint8_t* 用newfs_buf_put归还
+ */
+uint8_t* newfs_buf_get(int size) {
+    struct newfs_bufpool* pool = &super.bufpool;
+    struct newfs_buf_tls* tls;
+    uint8_t* buf = NULL;
+
+    if (size <= NEWFS_BUF_SIZE && pool->base != NULL) {
+        tls = (struct newfs_buf_tls*)pthread_getspecific(pool->key);
+        if (tls != NULL && tls->buf != NULL && tls->gen == pool->gen) {
+            buf      = tls->buf;
+            tls->buf = NULL;
+            return buf;
+        }
+        pthread_mutex_lock(&pool->lock);
+        if (pool->nr_free > 0) {
+            buf = pool->base + (long)pool->free[--pool->nr_free] * NEWFS_BUF_SIZE;
+        }
+        pthread_mutex_unlock(&pool->lock);
+        if (buf != NULL) {
+            return buf;
+        }
+    }
+    if (posix_memalign((void**)&buf, NEWFS_BUF_ALIGN, size) != 0) {
+        return NULL;
+    }
+    return buf;
+}
+
+/**
+ * @brief 归还缓冲区：本线程的缓存空着时留在线程缓存，否则放回空闲栈
+ *
+ * @param buf newfs_buf_get借出的缓冲区
+ */
+void newfs_buf_put(uint8_t* buf) {
+    struct newfs_bufpool* pool = &super.bufpool;
+    struct newfs_buf_tls* tls;
+
+    if (!newfs_bufpool_owns(buf)) {
+        free(buf);
+        return;
+    }
+    tls = (struct newfs_buf_tls*)pthread_getspecific(pool->key);
+    if (tls == NULL) {
+        tls = (struct newfs_buf_tls*)calloc(1, sizeof(struct newfs_buf_tls));
+        pthread_setspecific(pool->key, tls);
+    }
+    if (tls->buf == NULL || tls->gen != pool->gen) {
+        tls->buf = buf;
+        tls->gen = pool->gen;
+        return;
+    }
+    newfs_bufpool_push(buf);
+}
@@ -0,0 +1,521 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super super;
+extern struct custom_options newfs_options;
+
+/**
+ * @brief 初始化inode缓存
+ *
+ * @param limit_kb 内存上限（KB），不大于0时取NEWFS_CACHE_KB
+ */
+void newfs_cache_init(int limit_kb) {
+    struct newfs_cache* c = &super.cache;
+
+    c->lru_head   = NULL;
+    c->lru_tail   = NULL;
+    c->nr_inodes  = 0;
+    c->nr_blks    = 0;
+    c->nr_dentrys = 0;
+    c->limit      = (long)(limit_kb > 0 ? limit_kb : NEWFS_CACHE_KB) * 1024;
+
+    c->dentry_hsize = NEWFS_DENTRY_HASH_MIN;
+    c->dentry_htab  = (struct newfs_dentry**)calloc(c->dentry_hsize, sizeof(struct newfs_dentry*));
+    c->dblk_hsize   = NEWFS_DENTRY_HASH_MIN;
+    c->dblk_htab    = (struct newfs_dblk**)calloc(c->dblk_hsize, sizeof(struct newfs_dblk*));
+    c->dblk_head    = NULL;
+    c->dblk_tail    = NULL;
+    c->nr_dblks     = 0;
+}
+
+/**
+ * @brief 卸载时释放目录块缓存和两张哈希表，dentry随inode释放
+ */
+void newfs_cache_destroy() {
+    struct newfs_cache* c = &super.cache;
+    struct newfs_dblk*  dblk;
+
+    while ((dblk = c->dblk_head) != NULL) {
+        c->dblk_head = dblk->lru_next;
+        free(dblk->content);
+        free(dblk);
+    }
+    free(c->dentry_htab);
+    free(c->dblk_htab);
+    c->dentry_htab = NULL;
+    c->dblk_htab   = NULL;
+    c->dblk_tail   = NULL;
+    c->nr_dblks    = 0;
+}
+
+/**
+ * @brief 缓存当前占用的内存：常驻inode、数据块缓存、dentry和目录块
+ *
+ * @return long 字节数
+ */
+long newfs_cache_bytes() {
+    struct newfs_cache* c = &super.cache;
+
+    return (long)c->nr_inodes * sizeof(struct newfs_inode) +
+           (long)c->nr_blks * NEWFS_BLK_SIZE() +
+           (long)c->nr_dentrys * sizeof(struct newfs_dentry) +
+           (long)c->nr_dblks * (NEWFS_BLK_SIZE() + sizeof(struct newfs_dblk));
+}
+
+/**
+ * @brief dentry在哈希表中的桶：父目录项和文件名一起散列
+ */
+static uint32_t newfs_cache_dentry_slot(struct newfs_dentry* parent, const char* name) {
+    uint32_t hash = newfs_dx_hash(name) ^ (uint32_t)((uintptr_t)parent >> 4) * 2654435761u;
+    return hash & (super.cache.dentry_hsize - 1);
+}
+
+/**
+ * @brief dentry数超过桶数时哈希表加倍
+ */
+static void newfs_cache_dentry_grow() {
+    struct newfs_cache*   c     = &super.cache;
+    struct newfs_dentry** old   = c->dentry_htab;
+    int                   hsize = c->dentry_hsize;
+    struct newfs_dentry*  dentry;
+    uint32_t slot;
+
+    c->dentry_hsize = hsize * 2;
+    c->dentry_htab  = (struct newfs_dentry**)calloc(c->dentry_hsize, sizeof(struct newfs_dentry*));
+    for (int i = 0; i < hsize; i++) {
+        while ((dentry = old[i]) != NULL) {
+            old[i] = dentry->hnext;
+            slot   = newfs_cache_dentry_slot(dentry->parent, dentry->name);
+            dentry->hnext = c->dentry_htab[slot];
+            c->dentry_htab[slot] = dentry;
+        }
+    }
+    free(old);
+}
+
+/**
+ * @brief 把dentry挂到目录下：加入目录的dentrys链表（头插法）和哈希表，不改变dir_cnt
+ *
+ * @param inode 目录inode
+ * @param dentry
+ */
+void newfs_cache_link_dentry(struct newfs_inode* inode, struct newfs_dentry* dentry) {
+    struct newfs_cache* c = &super.cache;
+    uint32_t slot;
+
+    if (c->nr_dentrys >= c->dentry_hsize) {
+        newfs_cache_dentry_grow();
+    }
+    dentry->parent       = inode->dentry;
+    dentry->brother_prev = NULL;
+    dentry->brother      = inode->dentrys;
+    if (inode->dentrys != NULL) {
+        inode->dentrys->brother_prev = dentry;
+    }
+    inode->dentrys = dentry;
+
+    slot = newfs_cache_dentry_slot(dentry->parent, dentry->name);
+    dentry->hnext = c->dentry_htab[slot];
+    c->dentry_htab[slot] = dentry;
+    c->nr_dentrys++;
+}
+
+/**
+ * @brief 把dentry从父目录的dentrys链表和哈希表中摘下，dentry本身保留
+ *
+ * @param dentry
+ */
+void newfs_cache_unlink_dentry(struct newfs_dentry* dentry) {
+    struct newfs_cache*   c = &super.cache;
+    struct newfs_dentry** cursor;
+
+    cursor = &c->dentry_htab[newfs_cache_dentry_slot(dentry->parent, dentry->name)];
+    while (*cursor != NULL && *cursor != dentry) {
+        cursor = &(*cursor)->hnext;
+    }
+    if (*cursor == NULL) {
+        return;
+    }
+    *cursor = dentry->hnext;
+    if (dentry->brother_prev != NULL) {
+        dentry->brother_prev->brother = dentry->brother;
+    }
+    else {
+        dentry->parent->inode->dentrys = dentry->brother;
+    }
+    if (dentry->brother != NULL) {
+        dentry->brother->brother_prev = dentry->brother_prev;
+    }
+    dentry->brother      = NULL;
+    dentry->brother_prev = NULL;
+    dentry->hnext        = NULL;
+    c->nr_dentrys--;
+}
+
+/**
+ * @brief 在缓存中按名字查找目录下的dentry
+ *
+ * @param inode 目录inode
+ * @param name
+ * @return struct newfs_dentry* 不在缓存中返回NULL
+ */
+struct newfs_dentry* newfs_cache_find_dentry(struct newfs_inode* inode, const char* name) {
+    struct newfs_dentry* dentry;
+
+    dentry = super.cache.dentry_htab[newfs_cache_dentry_slot(inode->dentry, name)];
+    for (; dentry != NULL; dentry = dentry->hnext) {
+        if (dentry->parent == inode->dentry && strncmp(dentry->name, name, MAX_NAME_LEN) == 0) {
+            return dentry;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief 把目录块从LRU链表上摘下
+ */
+static void newfs_cache_dblk_unlink(struct newfs_dblk* dblk) {
+    struct newfs_cache* c = &super.cache;
+
+    if (dblk->lru_prev != NULL) {
+        dblk->lru_prev->lru_next = dblk->lru_next;
+    }
+    else {
+        c->dblk_head = dblk->lru_next;
+    }
+    if (dblk->lru_next != NULL) {
+        dblk->lru_next->lru_prev = dblk->lru_prev;
+    }
+    else {
+        c->dblk_tail = dblk->lru_prev;
+    }
+    dblk->lru_prev = NULL;
+    dblk->lru_next = NULL;
+}
+
+/**
+ * @brief 把目录块放到LRU表头
+ */
+static void newfs_cache_dblk_head(struct newfs_dblk* dblk) {
+    struct newfs_cache* c = &super.cache;
+
+    dblk->lru_prev = NULL;
+    dblk->lru_next = c->dblk_head;
+    if (c->dblk_head != NULL) {
+        c->dblk_head->lru_prev = dblk;
+    }
+    c->dblk_head = dblk;
+    if (c->dblk_tail == NULL) {
+        c->dblk_tail = dblk;
+    }
+}
+
+/**
+ * @brief 目录块数超过桶数时哈希表加倍
+ */
+static void newfs_cache_dblk_grow() {
+    struct newfs_cache*  c     = &super.cache;
+    struct newfs_dblk**  old   = c->dblk_htab;
+    int                  hsize = c->dblk_hsize;
+    struct newfs_dblk*   dblk;
+
+    c->dblk_hsize = hsize * 2;
+    c->dblk_htab  = (struct newfs_dblk**)calloc(c->dblk_hsize, sizeof(struct newfs_dblk*));
+    for (int i = 0; i < hsize; i++) {
+        while ((dblk = old[i]) != NULL) {
+            old[i] = dblk->hnext;
+            dblk->hnext = c->dblk_htab[dblk->dno & (c->dblk_hsize - 1)];
+            c->dblk_htab[dblk->dno & (c->dblk_hsize - 1)] = dblk;
+        }
+    }
+    free(old);
+}
+
+/**
+ * @brief 在缓存中找第dno个数据块，找到时移到LRU表头
+ */
+static struct newfs_dblk* newfs_cache_find_blk(int dno) {
+    struct newfs_dblk* dblk = super.cache.dblk_htab[dno & (super.cache.dblk_hsize - 1)];
+
+    while (dblk != NULL && dblk->dno != dno) {
+        dblk = dblk->hnext;
+    }
+    if (dblk != NULL && super.cache.dblk_head != dblk) {
+        newfs_cache_dblk_unlink(dblk);
+        newfs_cache_dblk_head(dblk);
+    }
+    return dblk;
+}
+
+/**
+ * @brief 新的目录块加入缓存
+ */
+static struct newfs_dblk* newfs_cache_new_blk(int dno) {
+    struct newfs_cache* c    = &super.cache;
+    struct newfs_dblk*  dblk = (struct newfs_dblk*)malloc(sizeof(struct newfs_dblk));
+
+    if (c->nr_dblks >= c->dblk_hsize) {
+        newfs_cache_dblk_grow();
+    }
+    dblk->dno     = dno;
+    dblk->jdirty  = FALSE;
+    dblk->content = (uint8_t*)malloc(NEWFS_BLK_SIZE());
+    dblk->jnext   = NULL;
+    dblk->hnext   = c->dblk_htab[dno & (c->dblk_hsize - 1)];
+    c->dblk_htab[dno & (c->dblk_hsize - 1)] = dblk;
+    newfs_cache_dblk_head(dblk);
+    c->nr_dblks++;
+    return dblk;
+}
+
+/**
+ * @brief 把目录块移出缓存并释放
+ */
+static void newfs_cache_free_blk(struct newfs_dblk* dblk) {
+    struct newfs_cache* c = &super.cache;
+    struct newfs_dblk** cursor = &c->dblk_htab[dblk->dno & (c->dblk_hsize - 1)];
+
+    while (*cursor != dblk) {
+        cursor = &(*cursor)->hnext;
+    }
+    *cursor = dblk->hnext;
+    newfs_cache_dblk_unlink(dblk);
+    c->nr_dblks--;
+    free(dblk->content);
+    free(dblk);
+}
+
+/**
+ * @brief 取目录树的第dno个数据块用于读，不在缓存中时经日志缓存读入。
+ * 缓存只在操作结束时收缩，返回的内容在本次操作内有效
+ *
+ * @param dno 数据块号
+ * @return uint8_t* 读失败返回NULL
+ */
+uint8_t* newfs_cache_read_blk(int dno) {
+    struct newfs_dblk* dblk = newfs_cache_find_blk(dno);
+
+    if (dblk != NULL) {
+        return dblk->content;
+    }
+    dblk = newfs_cache_new_blk(dno);
+    if (newfs_journal_read(NEWFS_DB_OFS(dno), dblk->content, NEWFS_BLK_SIZE()) != NEWFS_ERROR_NONE) {
+        newfs_cache_free_blk(dblk);
+        return NULL;
+    }
+    return dblk->content;
+}
+
+/**
+ * @brief 取目录树的第dno个数据块用于修改，记入当前事务，提交时整块写入日志
+ *
+ * @param dno 数据块号
+ * @param is_new 新分配的块，不读盘，内容清零
+ * @return uint8_t* 读失败返回NULL
+ */
+uint8_t* newfs_cache_write_blk(int dno, boolean is_new) {
+    struct newfs_dblk* dblk = newfs_cache_find_blk(dno);
+
+    if (dblk == NULL) {
+        if (!is_new && newfs_cache_read_blk(dno) == NULL) {
+            return NULL;
+        }
+        dblk = is_new ? newfs_cache_new_blk(dno) : newfs_cache_find_blk(dno);
+    }
+    if (is_new) {
+        memset(dblk->content, 0, NEWFS_BLK_SIZE());
+    }
+    newfs_journal_dirty_blk(dblk);
+    return dblk->content;
+}
+
+/**
+ * @brief 目录块被释放，丢弃缓存，当前事务中的修改也不再写入
+ *
+ * @param dno 数据块号
+ */
+void newfs_cache_forget_blk(int dno) {
+    struct newfs_dblk* dblk = newfs_cache_find_blk(dno);
+
+    if (dblk != NULL) {
+        newfs_journal_forget_blk(dblk);
+        newfs_cache_free_blk(dblk);
+    }
+}
+
+/**
+ * @brief 把inode从LRU链表上摘下
+ */
+static void newfs_cache_unlink(struct newfs_inode* inode) {
+    struct newfs_cache* c = &super.cache;
+
+    if (inode->lru_prev != NULL) {
+        inode->lru_prev->lru_next = inode->lru_next;
+    }
+    else {
+        c->lru_head = inode->lru_next;
+    }
+    if (inode->lru_next != NULL) {
+        inode->lru_next->lru_prev = inode->lru_prev;
+    }
+    else {
+        c->lru_tail = inode->lru_prev;
+    }
+    inode->lru_prev = NULL;
+    inode->lru_next = NULL;
+}
+
+/**
+ * @brief 新读入或新分配的inode加入缓存，放在LRU表头
+ *
+ * @param inode
+ */
+void newfs_cache_add(struct newfs_inode* inode) {
+    struct newfs_cache* c = &super.cache;
+
+    inode->lru_prev = NULL;
+    inode->lru_next = c->lru_head;
+    if (c->lru_head != NULL) {
+        c->lru_head->lru_prev = inode;
+    }
+    c->lru_head = inode;
+    if (c->lru_tail == NULL) {
+        c->lru_tail = inode;
+    }
+    c->nr_inodes++;
+}
+
+/**
+ * @brief 访问inode，移到LRU表头
+ *
+ * @param inode
+ */
+void newfs_cache_touch(struct newfs_inode* inode) {
+    if (super.cache.lru_head == inode) {
+        return;
+    }
+    newfs_cache_unlink(inode);
+    super.cache.nr_inodes--;
+    newfs_cache_add(inode);
+}
+
+/**
+ * @brief inode被删除或释放，移出缓存
+ *
+ * @param inode
+ */
+void newfs_cache_remove(struct newfs_inode* inode) {
+    newfs_cache_unlink(inode);
+    super.cache.nr_inodes--;
+}
+
+/**
+ * @brief inode能否淘汰：不是根目录，没有未提交的修改，目录下没有常驻的inode。
+ * 已提交未写回的inode和目录块重新读入时从日志缓存中取，不影响淘汰
+ *
+ * @param inode
+ * @return boolean
+ */
+static boolean newfs_cache_evictable(struct newfs_inode* inode) {
+    struct newfs_dentry* dentry_cursor;
+
+    if (inode == super.root_dentry->inode || inode->jdirty || inode->delalloc) {
+        return FALSE;
+    }
+    for (int i = 0; i < MAX_DATA_PERFILE; i++) {
+        if (inode->data_dirty[i]) {
+            return FALSE;
+        }
+    }
+    if (NEWFS_IS_DIR(inode)) {
+        for (dentry_cursor = inode->dentrys; dentry_cursor; dentry_cursor = dentry_cursor->brother) {
+            if (dentry_cursor->inode != NULL) {
+                return FALSE;
+            }
+        }
+    }
+    return TRUE;
+}
+
+/**
+ * @brief 淘汰一个inode：释放它的数据块缓存、缓存的目录项和指向它的dentry，
+ * 之后再查找时从父目录的目录树中重新读入
+ *
+ * @param inode 必须是newfs_cache_evictable的
+ */
+static void newfs_cache_evict(struct newfs_inode* inode) {
+    struct newfs_dentry* dentry_cursor;
+
+    while ((dentry_cursor = inode->dentrys) != NULL) {
+        newfs_cache_unlink_dentry(dentry_cursor);
+        free(dentry_cursor);
+    }
+    for (int i = 0; i < MAX_DATA_PERFILE; i++) {
+        if (inode->data[i] != NULL) {
+            free(inode->data[i]);
+            super.cache.nr_blks--;
+        }
+    }
+    newfs_cache_unlink_dentry(inode->dentry);
+    free(inode->dentry);
+    newfs_cache_remove(inode);
+    free(inode);
+}
+
+/**
+ * @brief 从LRU表尾开始淘汰干净的inode，直到不超过上限或没有可淘汰的。
+ * 目录要等其下的inode都淘汰后才能淘汰，所以有进展时再扫一遍；
+ * 还超过上限时再淘汰干净的目录块
+ *
+ * @return int 淘汰的inode数
+ */
+static int newfs_cache_evict_clean() {
+    struct newfs_inode* inode;
+    struct newfs_inode* prev;
+    struct newfs_dblk*  dblk;
+    struct newfs_dblk*  dblk_prev;
+    int     cnt = 0;
+    boolean is_progress = TRUE;
+
+    while (is_progress && newfs_cache_bytes() > super.cache.limit) {
+        is_progress = FALSE;
+        for (inode = super.cache.lru_tail; inode != NULL && newfs_cache_bytes() > super.cache.limit;
+             inode = prev) {
+            prev = inode->lru_prev;
+            if (newfs_cache_evictable(inode)) {
+                newfs_cache_evict(inode);
+                is_progress = TRUE;
+                cnt++;
+            }
+        }
+    }
+    for (dblk = super.cache.dblk_tail; dblk != NULL && newfs_cache_bytes() > super.cache.limit;
+         dblk = dblk_prev) {
+        dblk_prev = dblk->lru_prev;
+        if (!dblk->jdirty) {
+            newfs_cache_free_blk(dblk);
+        }
+    }
+    return cnt;
+}
+
+/**
+ * @brief 占用超过上限时淘汰干净的inode；还超过上限且当前事务里有脏inode时
+ * （例如只读遍历更新了atime），先提交事务让它们变干净再淘汰一次。
+ * 调用者持有super.lock，且没有操作还引用着inode
+ *
+ * @return int 淘汰的inode数
+ */
+int newfs_cache_shrink() {
+    int cnt;
+
+    if (newfs_cache_bytes() <= super.cache.limit) {
+        return 0;
+    }
+    cnt = newfs_cache_evict_clean();
+    if (newfs_cache_bytes() > super.cache.limit &&
+        (super.journal.inodes != NULL || super.journal.dblks != NULL)) {
+        newfs_journal_commit();
+        cnt += newfs_cache_evict_clean();
+    }
+    return cnt;
+}
@@ -0,0 +1,698 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super super;
+extern struct custom_options newfs_options;
+
+/* 从根到叶子查找时经过的结点 */
+struct newfs_dx_path {
+    int depth;                              // 经过的结点数
+    int dno[NEWFS_DX_MAX_LEVEL];            // 第d层结点的数据块号，第0层是根
+    int idx[NEWFS_DX_MAX_LEVEL];            // 索引结点中走向的子结点，叶子中找到的目录项
+};
+
+/**
+ * @brief 文件名哈希（FNV-1a），目录树按它排序
+ *
+ * @param name
+ * @return uint32_t
+ */
+uint32_t newfs_dx_hash(const char* name) {
+    uint32_t hash = 2166136261u;
+    int      len  = 0;
+
+    while (len++ < MAX_NAME_LEN && *name) {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * @brief 第level层的结点最多放几项
+ */
+static int newfs_dx_cap(int level) {
+    return level == 0 ? (int)MAX_DENTRY_PERBLK() : (int)MAX_DX_ENTRY_PERBLK();
+}
+
+/**
+ * @brief 第level层的结点中一项的大小
+ */
+static int newfs_dx_esize(int level) {
+    return level == 0 ? (int)sizeof(struct newfs_dentry_d) : (int)sizeof(struct newfs_dx_entry);
+}
+
+/**
+ * @brief 结点中的第i项
+ */
+static uint8_t* newfs_dx_item(struct newfs_dx_head* head, int i) {
+    return (uint8_t*)(head + 1) + i * newfs_dx_esize(head->level);
+}
+
+/**
+ * @brief 一项的哈希：叶子中是文件名的哈希，索引结点中是子树的下界
+ */
+static uint32_t newfs_dx_item_hash(int level, uint8_t* item) {
+    return level == 0 ? newfs_dx_hash(((struct newfs_dentry_d*)item)->name) :
+                        ((struct newfs_dx_entry*)item)->hash;
+}
+
+/**
+ * @brief 读出一个目录树结点并检查块头，结果在目录块缓存中，本次操作内有效
+ *
+ * @param dno 数据块号
+ * @param level 期望的层数，-1为不检查（根）
+ * @return struct newfs_dx_head* 读失败或结点损坏时返回NULL
+ */
+static struct newfs_dx_head* newfs_dx_read(int dno, int level) {
+    struct newfs_dx_head* head;
+
+    if (dno < 0 || dno >= super.db_blks) {
+        NEWFS_DBG("[%s] bad directory block %d\n", __func__, dno);
+        return NULL;
+    }
+    head = (struct newfs_dx_head*)newfs_cache_read_blk(dno);
+    if (head == NULL) {
+        return NULL;
+    }
+    if (head->magic != NEWFS_DX_MAGIC || head->level >= NEWFS_DX_MAX_LEVEL ||
+        (level >= 0 && head->level != level) || head->cnt < (head->level > 0 ? 1 : 0) ||
+        head->cnt > newfs_dx_cap(head->level)) {
+        NEWFS_DBG("[%s] corrupted directory block %d\n", __func__, dno);
+        return NULL;
+    }
+    return head;
+}
+
+/**
+ * @brief 取已读过的结点用于修改，当前事务提交时记入日志
+ */
+static struct newfs_dx_head* newfs_dx_write(int dno) {
+    return (struct newfs_dx_head*)newfs_cache_write_blk(dno, FALSE);
+}
+
+/**
+ * @brief 在新分配的块上建一个空结点
+ */
+static struct newfs_dx_head* newfs_dx_new(int dno, int level) {
+    struct newfs_dx_head* head = (struct newfs_dx_head*)newfs_cache_write_blk(dno, TRUE);
+
+    head->magic = NEWFS_DX_MAGIC;
+    head->level = level;
+    head->cnt   = 0;
+    return head;
+}
+
+/**
+ * @brief 为目录树分配一个数据块，尽量靠近树根
+ *
+ * @return int 数据块号，没有空间返回-1
+ */
+static int newfs_dx_alloc(struct newfs_inode* inode) {
+    int goal = inode->block_pointer[0] != -1 ? inode->block_pointer[0] :
+               super.groups[NEWFS_INO_GROUP(inode->ino)].db_start;
+    return newfs_alloc_blk(goal);
+}
+
+/**
+ * @brief 释放目录树的一个结点，事务提交后才归还位图
+ */
+static void newfs_dx_free_blk(int dno) {
+    newfs_cache_forget_blk(dno);
+    newfs_journal_free_data(dno);
+}
+
+/**
+ * @brief 在结点的pos处插入一项
+ */
+static void newfs_dx_insert_at(struct newfs_dx_head* head, int pos, uint8_t* item) {
+    int esize = newfs_dx_esize(head->level);
+
+    memmove(newfs_dx_item(head, pos + 1), newfs_dx_item(head, pos), (head->cnt - pos) * esize);
+    memcpy(newfs_dx_item(head, pos), item, esize);
+    head->cnt++;
+}
+
+/**
+ * @brief 删除结点的第pos项
+ */
+static void newfs_dx_remove_at(struct newfs_dx_head* head, int pos) {
+    int esize = newfs_dx_esize(head->level);
+
+    memmove(newfs_dx_item(head, pos), newfs_dx_item(head, pos + 1), (head->cnt - pos - 1) * esize);
+    head->cnt--;
+    memset(newfs_dx_item(head, head->cnt), 0, esize);
+}
+
+/**
+ * @brief 索引结点中最后一个下界不大于hash的子结点
+ */
+static int newfs_dx_child(struct newfs_dx_head* head, uint32_t hash) {
+    struct newfs_dx_entry* entries = (struct newfs_dx_entry*)(head + 1);
+    int lo = 0, hi = head->cnt - 1, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi + 1) / 2;
+        if (entries[mid].hash <= hash) {
+            lo = mid;
+        }
+        else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+/**
+ * @brief 从dno开始向下查找name，记下经过的结点
+ *
+ * 同一哈希的目录项可能从前一个子树延续过来，在一个子树中找不到且它的下界
+ * 正好是hash时，再查前一个子树
+ *
+ * @param dno 子树的根
+ * @param level 子树根的层数，-1为不检查
+ * @param depth 子树根在路径中的位置
+ * @param hash name的哈希
+ * @param name
+ * @param path 输出
+ * @return int
+ */
+static int newfs_dx_search(int dno, int level, int depth, uint32_t hash, const char* name,
+                           struct newfs_dx_path* path) {
+    struct newfs_dx_head*  head = newfs_dx_read(dno, level);
+    struct newfs_dx_entry* entries;
+    struct newfs_dentry_d* dentrys;
+    int ret;
+
+    if (head == NULL) {
+        return -NEWFS_ERROR_IO;
+    }
+    path->dno[depth] = dno;
+    path->depth      = depth + 1;
+    if (head->level == 0) {
+        dentrys = (struct newfs_dentry_d*)(head + 1);
+        for (int i = 0; i < head->cnt; i++) {
+            if (strncmp(dentrys[i].name, name, MAX_NAME_LEN) == 0) {
+                path->idx[depth] = i;
+                return NEWFS_ERROR_NONE;
+            }
+        }
+        return -NEWFS_ERROR_NOTFOUND;
+    }
+    entries = (struct newfs_dx_entry*)(head + 1);
+    for (int i = newfs_dx_child(head, hash); i >= 0; i--) {
+        path->idx[depth] = i;
+        ret = newfs_dx_search(entries[i].dno, head->level - 1, depth + 1, hash, name, path);
+        if (ret != -NEWFS_ERROR_NOTFOUND || i == 0 || entries[i].hash != hash) {
+            return ret;
+        }
+    }
+    return -NEWFS_ERROR_NOTFOUND;
+}
+
+/**
+ * @brief 在目录树中按名字查找目录项
+ *
+ * @param inode 目录inode
+ * @param name
+ * @param dentry_d 输出，找到的目录项
+ * @return int 找不到返回-NEWFS_ERROR_NOTFOUND，目录块损坏返回-NEWFS_ERROR_IO
+ */
+int newfs_dx_find(struct newfs_inode* inode, const char* name, struct newfs_dentry_d* dentry_d) {
+    struct newfs_dx_path path;
+    struct newfs_dx_head* leaf;
+    int ret;
+
+    if (inode->block_pointer[0] == -1) {
+        return -NEWFS_ERROR_NOTFOUND;
+    }
+    ret = newfs_dx_search(inode->block_pointer[0], -1, 0, newfs_dx_hash(name), name, &path);
+    if (ret != NEWFS_ERROR_NONE) {
+        return ret;
+    }
+    leaf = newfs_dx_read(path.dno[path.depth - 1], 0);
+    memcpy(dentry_d, newfs_dx_item(leaf, path.idx[path.depth - 1]), sizeof(struct newfs_dentry_d));
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 把满结点加上一项后分成两半，尽量在哈希变化处分开，
+ * 左半留在原结点，右半放到新分配的块
+ *
+ * @param inode 目录inode
+ * @param head 满结点
+ * @param pos 新项的位置
+ * @param item 新项
+ * @param up 输出，要插入父结点的索引项
+ */
+static void newfs_dx_split(struct newfs_inode* inode, struct newfs_dx_head* head, int pos,
+                           uint8_t* item, struct newfs_dx_entry* up) {
+    struct newfs_dx_head* right;
+    int      level = head->level;
+    int      esize = newfs_dx_esize(level);
+    int      cnt   = head->cnt + 1;
+    int      mid   = cnt / 2;
+    int      k     = mid;
+    uint8_t* items = (uint8_t*)malloc(cnt * esize);
+    int      dno;
+
+    memcpy(items, newfs_dx_item(head, 0), pos * esize);
+    memcpy(items + pos * esize, item, esize);
+    memcpy(items + (pos + 1) * esize, newfs_dx_item(head, pos), (head->cnt - pos) * esize);
+
+    /* 离中间最近的哈希变化处，全部相同时从中间分开，查找时会跨过边界 */
+    for (int off = 0; off < mid; off++) {
+        if (mid - off >= 1 && newfs_dx_item_hash(level, items + (mid - off - 1) * esize) !=
+                              newfs_dx_item_hash(level, items + (mid - off) * esize)) {
+            k = mid - off;
+            break;
+        }
+        if (mid + off < cnt - 1 && newfs_dx_item_hash(level, items + (mid + off) * esize) !=
+                                   newfs_dx_item_hash(level, items + (mid + off + 1) * esize)) {
+            k = mid + off + 1;
+            break;
+        }
+    }
+
+    dno   = newfs_dx_alloc(inode);
+    right = newfs_dx_new(dno, level);
+    memset(newfs_dx_item(head, 0), 0, head->cnt * esize);
+    memcpy(newfs_dx_item(head, 0), items, k * esize);
+    head->cnt = k;
+    memcpy(newfs_dx_item(right, 0), items + k * esize, (cnt - k) * esize);
+    right->cnt = cnt - k;
+
+    up->hash = newfs_dx_item_hash(level, items + k * esize);
+    up->dno  = dno;
+    free(items);
+}
+
+/**
+ * @brief 在目录树中插入一个目录项，不检查重名
+ *
+ * 满结点从叶子向上逐层分裂，根也分裂时树长高一层。需要的块在修改前一次算好，
+ * 空间不够时目录树不变
+ *
+ * @param inode 目录inode
+ * @param name
+ * @param ino
+ * @param ftype
+ * @return int 空间不足或树已到NEWFS_DX_MAX_LEVEL层时返回-NEWFS_ERROR_NOSPACE
+ */
+int newfs_dx_insert(struct newfs_inode* inode, const char* name, uint32_t ino, NEWFS_FILE_TYPE ftype) {
+    struct newfs_dx_path   path;
+    struct newfs_dx_head*  head;
+    struct newfs_dentry_d  dentry_d;
+    struct newfs_dx_entry  up, next;
+    uint32_t hash = newfs_dx_hash(name);
+    uint8_t* item;
+    int      dno, level = -1, need = 0, d, pos;
+
+    memset(&dentry_d, 0, sizeof(struct newfs_dentry_d));
+    strncpy(dentry_d.name, name, MAX_NAME_LEN - 1);
+    dentry_d.ino   = ino;
+    dentry_d.ftype = ftype;
+
+    if (inode->block_pointer[0] == -1) {            /* 空目录，根就是唯一的叶子 */
+        if (newfs_count_free_data() < 1 || (dno = newfs_dx_alloc(inode)) == -1) {
+            return -NEWFS_ERROR_NOSPACE;
+        }
+        head = newfs_dx_new(dno, 0);
+        newfs_dx_insert_at(head, 0, (uint8_t*)&dentry_d);
+        inode->block_pointer[0] = dno;
+        newfs_journal_dirty_inode(inode);
+        return NEWFS_ERROR_NONE;
+    }
+
+    /* 按哈希走到叶子 */
+    dno = inode->block_pointer[0];
+    for (d = 0; ; d++) {
+        head = newfs_dx_read(dno, level);
+        if (head == NULL) {
+            return -NEWFS_ERROR_IO;
+        }
+        path.dno[d] = dno;
+        if (head->level == 0) {
+            break;
+        }
+        path.idx[d] = newfs_dx_child(head, hash);
+        dno   = ((struct newfs_dx_entry*)(head + 1))[path.idx[d]].dno;
+        level = head->level - 1;
+    }
+    path.depth = d + 1;
+
+    /* 从叶子向上连续满的结点都要分裂，根也满时还要一个新根 */
+    for (d = path.depth - 1; d >= 0; d--) {
+        head = newfs_dx_read(path.dno[d], -1);
+        if (head->cnt < newfs_dx_cap(head->level)) {
+            break;
+        }
+        need++;
+    }
+    if (d < 0) {
+        if (path.depth >= NEWFS_DX_MAX_LEVEL) {
+            return -NEWFS_ERROR_NOSPACE;
+        }
+        need++;
+    }
+    if (newfs_count_free_data() < need) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+
+    /* 从叶子开始插入，分裂出的结点再插入父结点 */
+    item = (uint8_t*)&dentry_d;
+    for (d = path.depth - 1; d >= 0; d--) {
+        head = newfs_dx_write(path.dno[d]);
+        if (head->level == 0) {
+            for (pos = 0; pos < head->cnt &&
+                 newfs_dx_item_hash(0, newfs_dx_item(head, pos)) <= hash; pos++);
+        }
+        else {
+            pos = path.idx[d] + 1;
+        }
+        if (head->cnt < newfs_dx_cap(head->level)) {
+            newfs_dx_insert_at(head, pos, item);
+            return NEWFS_ERROR_NONE;
+        }
+        newfs_dx_split(inode, head, pos, item, &next);
+        up   = next;
+        item = (uint8_t*)&up;
+    }
+
+    /* 根也分裂了：新根指向原来的根和分裂出的结点 */
+    level = newfs_dx_read(path.dno[0], -1)->level;
+    dno   = newfs_dx_alloc(inode);
+    head  = newfs_dx_new(dno, level + 1);
+    next.hash = 0;
+    next.dno  = path.dno[0];
+    newfs_dx_insert_at(head, 0, (uint8_t*)&next);
+    newfs_dx_insert_at(head, 1, (uint8_t*)&up);
+    inode->block_pointer[0] = dno;
+    newfs_journal_dirty_inode(inode);
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 从目录树中删除name
+ *
+ * 删空的结点释放并从父结点中去掉；目录空了时释放根，根只剩一个子结点时树降一层
+ *
+ * @param inode 目录inode
+ * @param name
+ * @return int
+ */
+int newfs_dx_delete(struct newfs_inode* inode, const char* name) {
+    struct newfs_dx_path   path;
+    struct newfs_dx_head*  head;
+    struct newfs_dx_entry* entries;
+    uint32_t lower;
+    int      ret, d, dno;
+
+    if (inode->block_pointer[0] == -1) {
+        return -NEWFS_ERROR_NOTFOUND;
+    }
+    ret = newfs_dx_search(inode->block_pointer[0], -1, 0, newfs_dx_hash(name), name, &path);
+    if (ret != NEWFS_ERROR_NONE) {
+        return ret;
+    }
+    d    = path.depth - 1;
+    head = newfs_dx_write(path.dno[d]);
+    newfs_dx_remove_at(head, path.idx[d]);
+    while (head->cnt == 0 && d > 0) {
+        newfs_dx_free_blk(path.dno[d]);
+        d--;
+        head    = newfs_dx_write(path.dno[d]);
+        entries = (struct newfs_dx_entry*)(head + 1);
+        lower   = entries[0].hash;
+        newfs_dx_remove_at(head, path.idx[d]);
+        if (path.idx[d] == 0 && head->cnt > 0) {    /* 下一个子树接替下界 */
+            entries[0].hash = lower;
+        }
+    }
+    if (head->cnt == 0) {                           /* 根也空了 */
+        newfs_dx_free_blk(path.dno[0]);
+        inode->block_pointer[0] = -1;
+        newfs_journal_dirty_inode(inode);
+        return NEWFS_ERROR_NONE;
+    }
+
+    head = newfs_dx_read(inode->block_pointer[0], -1);
+    while (head != NULL && head->level > 0 && head->cnt == 1) {
+        dno = ((struct newfs_dx_entry*)(head + 1))[0].dno;
+        newfs_dx_free_blk(inode->block_pointer[0]);
+        inode->block_pointer[0] = dno;
+        newfs_journal_dirty_inode(inode);
+        head = newfs_dx_read(dno, -1);
+    }
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 把目录中已有的name改为指向ino，目录树结构不变（rename替换和交换用）
+ *
+ * @param inode 目录inode
+ * @param name
+ * @param ino
+ * @param ftype
+ * @return int
+ */
+int newfs_dx_set(struct newfs_inode* inode, const char* name, uint32_t ino, NEWFS_FILE_TYPE ftype) {
+    struct newfs_dx_path   path;
+    struct newfs_dentry_d* dentry_d;
+    int ret;
+
+    if (inode->block_pointer[0] == -1) {
+        return -NEWFS_ERROR_NOTFOUND;
+    }
+    ret = newfs_dx_search(inode->block_pointer[0], -1, 0, newfs_dx_hash(name), name, &path);
+    if (ret != NEWFS_ERROR_NONE) {
+        return ret;
+    }
+    dentry_d = (struct newfs_dentry_d*)newfs_dx_item(newfs_dx_write(path.dno[path.depth - 1]),
+                                                     path.idx[path.depth - 1]);
+    dentry_d->ino   = ino;
+    dentry_d->ftype = ftype;
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 遍历以dno为根的子树中哈希不小于start的目录项
+ */
+static int newfs_dx_walk(int dno, int level, uint32_t start, newfs_dx_fn fn, void* arg) {
+    struct newfs_dx_head*  head = newfs_dx_read(dno, level);
+    struct newfs_dx_entry* entries;
+    struct newfs_dentry_d* dentrys;
+    uint32_t hash;
+    int ret, i;
+
+    if (head == NULL) {
+        return -NEWFS_ERROR_IO;
+    }
+    if (head->level == 0) {
+        dentrys = (struct newfs_dentry_d*)(head + 1);
+        for (i = 0; i < head->cnt; i++) {
+            hash = newfs_dx_hash(dentrys[i].name);
+            if (hash >= start && (ret = fn(arg, &dentrys[i], hash)) != 0) {
+                return ret;
+            }
+        }
+        return 0;
+    }
+    entries = (struct newfs_dx_entry*)(head + 1);
+    for (i = newfs_dx_child(head, start); i > 0 && entries[i].hash == start; i--);
+    for (; i < head->cnt; i++) {
+        if ((ret = newfs_dx_walk(entries[i].dno, head->level - 1, start, fn, arg)) != 0) {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief 按哈希顺序遍历目录中哈希不小于start的目录项，同一哈希的项顺序固定
+ *
+ * @param inode 目录inode
+ * @param start 起始哈希，0为从头开始
+ * @param fn 回调，返回非0时停止遍历
+ * @param arg 回调的参数
+ * @return int fn返回的非0值，目录块损坏返回-NEWFS_ERROR_IO，遍历完返回0
+ */
+int newfs_dx_iterate(struct newfs_inode* inode, uint32_t start, newfs_dx_fn fn, void* arg) {
+    if (inode->block_pointer[0] == -1) {
+        return 0;
+    }
+    return newfs_dx_walk(inode->block_pointer[0], -1, start, fn, arg);
+}
+
+/**
+ * @brief 释放以dno为根的子树，损坏的结点不再向下
+ */
+static void newfs_dx_free_tree(int dno, int level) {
+    struct newfs_dx_head*  head = newfs_dx_read(dno, level);
+    struct newfs_dx_entry* entries;
+
+    if (head != NULL && head->level > 0) {
+        entries = (struct newfs_dx_entry*)(head + 1);
+        for (int i = 0; i < head->cnt; i++) {
+            newfs_dx_free_tree(entries[i].dno, head->level - 1);
+        }
+    }
+    if (dno >= 0 && dno < super.db_blks) {
+        newfs_dx_free_blk(dno);
+    }
+}
+
+/**
+ * @brief 释放目录的整棵树（删除目录时，目录项已经逐个处理过）
+ *
+ * @param inode 目录inode
+ */
+void newfs_dx_free(struct newfs_inode* inode) {
+    if (inode->block_pointer[0] == -1) {
+        return;
+    }
+    newfs_dx_free_tree(inode->block_pointer[0], -1);
+    inode->block_pointer[0] = -1;
+    newfs_journal_dirty_inode(inode);
+}
+
+struct newfs_dx_sort {
+    uint32_t hash;
+    int      idx;
+};
+
+static int newfs_dx_cmp(const void* a, const void* b) {
+    const struct newfs_dx_sort* sa = (const struct newfs_dx_sort*)a;
+    const struct newfs_dx_sort* sb = (const struct newfs_dx_sort*)b;
+
+    if (sa->hash != sb->hash) {
+        return sa->hash < sb->hash ? -1 : 1;
+    }
+    return sa->idx - sb->idx;
+}
+
+/**
+ * @brief 把目录项按文件名哈希排序（批量建树前）
+ *
+ * @param dentrys
+ * @param cnt
+ */
+void newfs_dx_sort(struct newfs_dentry_d* dentrys, int cnt) {
+    struct newfs_dx_sort*  sorted;
+    struct newfs_dentry_d* copy;
+
+    if (cnt <= 1) {
+        return;
+    }
+    sorted = (struct newfs_dx_sort*)malloc(cnt * sizeof(struct newfs_dx_sort));
+    copy   = (struct newfs_dentry_d*)malloc(cnt * sizeof(struct newfs_dentry_d));
+    for (int i = 0; i < cnt; i++) {
+        sorted[i].hash = newfs_dx_hash(dentrys[i].name);
+        sorted[i].idx  = i;
+    }
+    qsort(sorted, cnt, sizeof(struct newfs_dx_sort), newfs_dx_cmp);
+    memcpy(copy, dentrys, cnt * sizeof(struct newfs_dentry_d));
+    for (int i = 0; i < cnt; i++) {
+        dentrys[i] = copy[sorted[i].idx];
+    }
+    free(copy);
+    free(sorted);
+}
+
+/**
+ * @brief 批量建树时各层的结点数，叶子全部装满
+ *
+ * @param cnt 目录项数
+ * @param nodes 输出，第l层的结点数
+ * @return int 层数，超过NEWFS_DX_MAX_LEVEL时返回-1
+ */
+static int newfs_dx_shape(int cnt, int* nodes) {
+    int levels = 1;
+    int n      = (cnt + (int)MAX_DENTRY_PERBLK() - 1) / (int)MAX_DENTRY_PERBLK();
+
+    nodes[0] = n;
+    while (n > 1) {
+        if (levels == NEWFS_DX_MAX_LEVEL) {
+            return -1;
+        }
+        n = (n + (int)MAX_DX_ENTRY_PERBLK() - 1) / (int)MAX_DX_ENTRY_PERBLK();
+        nodes[levels++] = n;
+    }
+    return levels;
+}
+
+/**
+ * @brief 批量建树需要的块数
+ *
+ * @param cnt 目录项数
+ * @return int 块数，空目录为0，目录项太多时返回-1
+ */
+int newfs_dx_build_blks(int cnt) {
+    int nodes[NEWFS_DX_MAX_LEVEL];
+    int levels, blks = 0;
+
+    if (cnt == 0) {
+        return 0;
+    }
+    levels = newfs_dx_shape(cnt, nodes);
+    if (levels < 0) {
+        return -1;
+    }
+    for (int l = 0; l < levels; l++) {
+        blks += nodes[l];
+    }
+    return blks;
+}
+
+/**
+ * @brief 由排好序的目录项批量建树，生成其中的第k块（mkimage用，各块可以分开生成）
+ *
+ * 树占连续的newfs_dx_build_blks(cnt)块，按层从根向下排，第0块是根，
+ * 叶子在最后；结点全部装满，以后插入时再分裂
+ *
+ * @param sorted newfs_dx_sort排过序的目录项
+ * @param cnt 目录项数，不为0
+ * @param first_dno 树的第0块的数据块号
+ * @param k 要生成的块
+ * @param out 输出，一个逻辑块
+ */
+void newfs_dx_build(struct newfs_dentry_d* sorted, int cnt, int first_dno, int k, uint8_t* out) {
+    struct newfs_dx_head*  head = (struct newfs_dx_head*)out;
+    struct newfs_dx_entry* entries;
+    int nodes[NEWFS_DX_MAX_LEVEL];
+    int base[NEWFS_DX_MAX_LEVEL];           // 第l层的第一个结点是树的第几块
+    int span[NEWFS_DX_MAX_LEVEL];           // 第l层的一个结点覆盖的目录项数
+    int levels = newfs_dx_shape(cnt, nodes);
+    int level, j, first, last;
+
+    base[levels - 1] = 0;
+    for (int l = levels - 2; l >= 0; l--) {
+        base[l] = base[l + 1] + nodes[l + 1];
+    }
+    span[0] = MAX_DENTRY_PERBLK();
+    for (int l = 1; l < levels; l++) {
+        span[l] = span[l - 1] * (int)MAX_DX_ENTRY_PERBLK();
+    }
+    for (level = 0; k < base[level]; level++);
+    j = k - base[level];
+
+    memset(out, 0, NEWFS_BLK_SIZE());
+    head->magic = NEWFS_DX_MAGIC;
+    head->level = level;
+    if (level == 0) {
+        first     = j * span[0];
+        head->cnt = cnt - first < span[0] ? cnt - first : span[0];
+        memcpy(head + 1, sorted + first, head->cnt * sizeof(struct newfs_dentry_d));
+        return;
+    }
+    entries = (struct newfs_dx_entry*)(head + 1);
+    first   = j * (int)MAX_DX_ENTRY_PERBLK();
+    last    = first + (int)MAX_DX_ENTRY_PERBLK();
+    if (last > nodes[level - 1]) {
+        last = nodes[level - 1];
+    }
+    for (int c = first; c < last; c++) {
+        entries[c - first].hash = newfs_dx_hash(sorted[c * span[level - 1]].name);
+        entries[c - first].dno  = first_dno + base[level - 1] + c;
+    }
+    head->cnt = last - first;
+}
@@ -0,0 +1,689 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super super;
+extern struct custom_options newfs_options;
+
+/**
+ * @brief 日志块内容的校验和（FNV-1a），重放时丢弃没写完整的事务
+ *
+ * @param content
+ * @param size
+ * @return uint32_t
+ */
+static uint32_t newfs_journal_checksum(uint8_t* content, int size) {
+    uint32_t sum = 2166136261u;
+    for (int i = 0; i < size; i++) {
+        sum ^= content[i];
+        sum *= 16777619u;
+    }
+    return sum;
+}
+
+/**
+ * @brief 写日志区第pos块的日志超级块或事务头
+ *
+ * @param pos 日志区内的块号
+ * @param jd
+ * @return int
+ */
+static int newfs_journal_write_desc(int pos, struct newfs_journal_d* jd) {
+    uint8_t* desc = newfs_buf_get(NEWFS_BLK_SIZE());
+    int ret;
+
+    memset(desc, 0, NEWFS_BLK_SIZE());
+    memcpy(desc, jd, sizeof(struct newfs_journal_d));
+    ret = newfs_driver_write(super.journal.offset + NEWFS_BLKS_SIZE(pos), desc, NEWFS_BLK_SIZE());
+    newfs_buf_put(desc);
+    return ret;
+}
+
+/**
+ * @brief 重置日志：日志超级块记下下一个事务序号，之前的事务都不再重放
+ *
+ * @return int
+ */
+static int newfs_journal_reset() {
+    struct newfs_journal_d jd;
+
+    memset(&jd, 0, sizeof(struct newfs_journal_d));
+    jd.magic = NEWFS_JOURNAL_MAGIC;
+    jd.tid   = super.journal.seq;
+    super.journal.head = 1;
+    return newfs_journal_write_desc(0, &jd);
+}
+
+/**
+ * @brief 超级块区（位图、引用计数）中offset处对应的内存
+ *
+ * @param offset 磁盘偏移
+ * @return uint8_t* 不是这几个区域时返回NULL
+ */
+static uint8_t* newfs_journal_meta_mem(int offset) {
+    if (offset >= super.ino_map_offset &&
+        offset <  super.ino_map_offset + NEWFS_BLKS_SIZE(super.ino_map_blks)) {
+        return super.map_inode + (offset - super.ino_map_offset);
+    }
+    if (offset >= super.db_map_offset &&
+        offset <  super.db_map_offset + NEWFS_BLKS_SIZE(super.db_map_blks)) {
+        return super.map_db + (offset - super.db_map_offset);
+    }
+    if (offset >= super.refcnt_offset &&
+        offset <  super.refcnt_offset + NEWFS_BLKS_SIZE(super.refcnt_blks)) {
+        return super.refcnt + (offset - super.refcnt_offset);
+    }
+    return NULL;
+}
+
+/**
+ * @brief 当前事务提交时最多要记录的块数
+ *
+ * @return int
+ */
+static int newfs_journal_estimate() {
+    struct newfs_inode* inode;
+    int blks = super.journal.nr_meta + super.journal.nr_dblks;     /* 目录块 */
+
+    for (inode = super.journal.inodes; inode != NULL; inode = inode->jnext) {
+        blks++;                                             /* inode表所在块 */
+    }
+    return blks;
+}
+
+/**
+ * @brief 已提交未写回的块在ckpt_imgs中的位置
+ *
+ * @param blk 设备块号
+ * @return int 不在其中时返回-1
+ */
+static int newfs_journal_ckpt_find(int blk) {
+    for (int i = 0; i < super.journal.nr_ckpt; i++) {
+        if (super.journal.ckpt_blks[i] == blk) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief 读一个元数据块的最新已提交内容，还没写回原位置时取日志中的版本
+ *
+ * @param blk 设备块号
+ * @param out_content
+ * @return int
+ */
+static int newfs_journal_read_blk(int blk, uint8_t* out_content) {
+    int i = newfs_journal_ckpt_find(blk);
+
+    if (i >= 0) {
+        memcpy(out_content, super.journal.ckpt_imgs + NEWFS_BLKS_SIZE(i), NEWFS_BLK_SIZE());
+        return NEWFS_ERROR_NONE;
+    }
+    return newfs_driver_read(NEWFS_BLKS_SIZE(blk), out_content, NEWFS_BLK_SIZE());
+}
+
+/**
+ * @brief 读一个块内的元数据（inode、目录块），取最新的已提交内容。
+ * 淘汰后重新读入的inode和目录可能还有修改没写回原位置
+ *
+ * @param offset 设备偏移
+ * @param out_content
+ * @param size 不能跨块
+ * @return int
+ */
+int newfs_journal_read(int offset, uint8_t* out_content, int size) {
+    int i = newfs_journal_ckpt_find(offset / NEWFS_BLK_SIZE());
+
+    if (i >= 0) {
+        memcpy(out_content, super.journal.ckpt_imgs + NEWFS_BLKS_SIZE(i) + offset % NEWFS_BLK_SIZE(), size);
+        return NEWFS_ERROR_NONE;
+    }
+    return newfs_driver_read(offset, out_content, size);
+}
+
+/**
+ * @brief 按顺序重放日志中已提交的事务，遇到序号不连续或校验和不对的事务头就停止
+ *
+ * @return int
+ */
+static int newfs_journal_replay() {
+    struct newfs_journal_d jd;
+    uint32_t seq, first;
+    uint8_t* imgs = (uint8_t*)malloc(NEWFS_BLKS_SIZE(NEWFS_JOURNAL_MAX_BLKS));
+    int      pos  = 1;
+    boolean  is_valid;
+
+    if (newfs_driver_read(super.journal.offset, (uint8_t *)&jd,
+                          sizeof(struct newfs_journal_d)) != NEWFS_ERROR_NONE) {
+        free(imgs);
+        return -NEWFS_ERROR_IO;
+    }
+    is_valid = jd.magic == NEWFS_JOURNAL_MAGIC;
+    seq      = is_valid ? jd.tid : 1;
+    first    = seq;
+
+    while (is_valid && pos < super.journal.blks) {
+        if (newfs_driver_read(super.journal.offset + NEWFS_BLKS_SIZE(pos), (uint8_t *)&jd,
+                              sizeof(struct newfs_journal_d)) != NEWFS_ERROR_NONE) {
+            free(imgs);
+            return -NEWFS_ERROR_IO;
+        }
+        if (jd.magic != NEWFS_JOURNAL_MAGIC || jd.tid != seq || jd.nr_blks <= 0 ||
+            jd.nr_blks > NEWFS_JOURNAL_MAX_BLKS || pos + 1 + jd.nr_blks > super.journal.blks) {
+            break;
+        }
+        if (newfs_driver_read(super.journal.offset + NEWFS_BLKS_SIZE(pos + 1), imgs,
+                              NEWFS_BLKS_SIZE(jd.nr_blks)) != NEWFS_ERROR_NONE) {
+            free(imgs);
+            return -NEWFS_ERROR_IO;
+        }
+        if (newfs_journal_checksum(imgs, NEWFS_BLKS_SIZE(jd.nr_blks)) != jd.checksum) {
+            break;
+        }
+        for (int i = 0; i < jd.nr_blks; i++) {
+            newfs_driver_write(NEWFS_BLKS_SIZE(jd.blk_no[i]), imgs + NEWFS_BLKS_SIZE(i),
+                               NEWFS_BLK_SIZE());
+        }
+        pos += 1 + jd.nr_blks;
+        seq++;
+    }
+    free(imgs);
+
+    if (pos > 1) {                                      /* 只在没有正常卸载后的挂载时输出一次 */
+        NEWFS_DBG("[%s] replayed %u transactions, %d journal blocks\n", __func__, seq - first, pos - 1);
+    }
+    super.journal.seq = seq;
+    if (pos == 1 && is_valid) {                         /* 日志本来就是空的，不用写 */
+        super.journal.head = 1;
+        return NEWFS_ERROR_NONE;
+    }
+    return newfs_journal_reset();
+}
+
+/**
+ * @brief 初始化日志，挂载时在读位图之前调用：正常卸载过的盘（包括刚格式化的）不用读日志，否则重放
+ *
+ * @param seq 正常卸载时超级块记下的下一个事务序号
+ * @return int
+ */
+int newfs_journal_init(uint32_t seq) {
+    struct newfs_journal*  j = &super.journal;
+
+    pthread_mutex_init(&super.lock, NULL);
+    pthread_mutex_init(&j->lock, NULL);
+    pthread_cond_init(&j->cond, NULL);
+    j->running_tid = 1;
+    j->commit_tid  = 0;
+    j->commit_time = time(NULL);
+    j->committing  = FALSE;
+    j->nr_active   = 0;
+    j->meta_blks   = NULL;
+    j->nr_meta     = 0;
+    j->max_meta    = 0;
+    j->inodes      = NULL;
+    j->dblks       = NULL;
+    j->nr_dblks    = 0;
+    j->freed       = NULL;
+    j->nr_freed    = 0;
+    j->max_freed   = 0;
+    j->nr_ckpt     = 0;
+    /* 检查点之前每个日志块最多带来一个待写回的块，按日志区大小分配 */
+    j->ckpt_blks   = (int*)malloc(j->blks * sizeof(int));
+    j->ckpt_imgs   = (uint8_t*)malloc(NEWFS_BLKS_SIZE(j->blks));
+    if (j->ckpt_blks == NULL || j->ckpt_imgs == NULL) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+
+    if (super.state == NEWFS_STATE_CLEAN) {
+        j->seq  = seq;
+        j->head = 1;
+        return NEWFS_ERROR_NONE;
+    }
+    return newfs_journal_replay();
+}
+
+/**
+ * @brief 记录当前事务修改了超级块区（位图、引用计数）中offset所在的块。
+ * 不限块数：一个操作弄脏的块超过日志容量时，提交时整个事务直接写回原位置，不能丢下
+ *
+ * @param offset 磁盘偏移
+ */
+void newfs_journal_dirty_meta(int offset) {
+    struct newfs_journal* j = &super.journal;
+    int blk = offset / NEWFS_BLK_SIZE();
+
+    for (int i = 0; i < j->nr_meta; i++) {
+        if (j->meta_blks[i] == blk) {
+            return;
+        }
+    }
+    if (j->nr_meta == j->max_meta) {
+        j->max_meta  = j->max_meta ? j->max_meta * 2 : NEWFS_JOURNAL_MAX_BLKS;
+        j->meta_blks = (int*)realloc(j->meta_blks, j->max_meta * sizeof(int));
+    }
+    j->meta_blks[j->nr_meta++] = blk;
+}
+
+/**
+ * @brief 当前事务释放了数据块dno。位图先不清，等事务提交后再归还：
+ * 提交前崩溃时重放不到这次释放，原文件还指向它，这期间不能分给别的文件写入
+ *
+ * @param dno 数据块号
+ */
+void newfs_journal_free_data(int dno) {
+    struct newfs_journal* j = &super.journal;
+
+    if (j->nr_freed == j->max_freed) {
+        j->max_freed = j->max_freed ? j->max_freed * 2 : 64;
+        j->freed     = (int*)realloc(j->freed, j->max_freed * sizeof(int));
+    }
+    j->freed[j->nr_freed++] = dno;
+    newfs_journal_dirty_meta(super.db_map_offset + dno / UINT8_BITS);
+}
+
+/**
+ * @brief 当前事务释放的数据块清出位图，随本事务的位图块一起提交
+ */
+static void newfs_journal_release_freed() {
+    struct newfs_journal* j = &super.journal;
+    int dno;
+
+    for (int i = 0; i < j->nr_freed; i++) {
+        dno = j->freed[i];
+        NEWFS_BM_CLEAR(super.map_db, dno);
+        super.db_free++;
+        super.groups[NEWFS_DB_GROUP(dno)].db_free++;
+    }
+    j->nr_freed = 0;
+}
+
+/**
+ * @brief 记录当前事务修改了inode（属性、数据块指针，目录则包括目录项）
+ *
+ * @param inode
+ */
+void newfs_journal_dirty_inode(struct newfs_inode* inode) {
+    if (inode->jdirty) {
+        return;
+    }
+    inode->jdirty = TRUE;
+    inode->jnext  = super.journal.inodes;
+    super.journal.inodes = inode;
+}
+
+/**
+ * @brief 记录当前事务修改了一个目录块，提交时整块记入日志
+ *
+ * @param dblk 缓存中的目录块
+ */
+void newfs_journal_dirty_blk(struct newfs_dblk* dblk) {
+    if (dblk->jdirty) {
+        return;
+    }
+    dblk->jdirty = TRUE;
+    dblk->jnext  = super.journal.dblks;
+    super.journal.dblks = dblk;
+    super.journal.nr_dblks++;
+}
+
+/**
+ * @brief 目录块被释放前从当前事务中摘掉
+ *
+ * @param dblk
+ */
+void newfs_journal_forget_blk(struct newfs_dblk* dblk) {
+    struct newfs_dblk** cursor = &super.journal.dblks;
+
+    if (!dblk->jdirty) {
+        return;
+    }
+    while (*cursor != NULL) {
+        if (*cursor == dblk) {
+            *cursor = dblk->jnext;
+            super.journal.nr_dblks--;
+            break;
+        }
+        cursor = &(*cursor)->jnext;
+    }
+    dblk->jdirty = FALSE;
+    dblk->jnext  = NULL;
+}
+
+/**
+ * @brief inode被删除前从当前事务中摘掉，它的位图变化已经记录
+ *
+ * @param inode
+ */
+void newfs_journal_forget(struct newfs_inode* inode) {
+    struct newfs_inode** cursor = &super.journal.inodes;
+
+    if (!inode->jdirty) {
+        return;
+    }
+    while (*cursor != NULL) {
+        if (*cursor == inode) {
+            *cursor = inode->jnext;
+            break;
+        }
+        cursor = &(*cursor)->jnext;
+    }
+    inode->jdirty = FALSE;
+    inode->jnext  = NULL;
+}
+
+/**
+ * @brief 记下块blk最新的已提交内容，检查点时写回
+ *
+ * @param blk 设备块号
+ * @param img
+ */
+static void newfs_journal_ckpt_add(int blk, uint8_t* img) {
+    struct newfs_journal* j = &super.journal;
+    int i = newfs_journal_ckpt_find(blk);
+
+    if (i < 0) {
+        i = j->nr_ckpt++;
+        j->ckpt_blks[i] = blk;
+    }
+    memcpy(j->ckpt_imgs + NEWFS_BLKS_SIZE(i), img, NEWFS_BLK_SIZE());
+}
+
+/**
+ * @brief 检查点：把已提交未写回的块经写回调度写回原位置，然后清空日志，调用者持有super.lock
+ *
+ * @return int
+ */
+static int newfs_journal_do_checkpoint() {
+    struct newfs_journal* j = &super.journal;
+    struct newfs_wb       wb;
+
+    if (j->nr_ckpt == 0 && j->head == 1) {
+        return NEWFS_ERROR_NONE;
+    }
+    newfs_wb_init(&wb);
+    for (int i = 0; i < j->nr_ckpt; i++) {
+        newfs_wb_add(&wb, j->ckpt_blks[i], j->ckpt_imgs + NEWFS_BLKS_SIZE(i));
+    }
+    if (newfs_wb_submit(&wb) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;                             /* 日志保留，下次挂载重放 */
+    }
+    j->nr_ckpt = 0;
+    return newfs_journal_reset();
+}
+
+/**
+ * @brief 事务中文件的脏数据块是否落在还没写回的元数据块上（块被释放后又分配给了文件），
+ * 这时要先做检查点，否则重放时旧的元数据会盖掉新数据
+ *
+ * @return boolean
+ */
+static boolean newfs_journal_data_conflict() {
+    struct newfs_inode* inode;
+
+    if (super.journal.nr_ckpt == 0) {
+        return FALSE;
+    }
+    for (inode = super.journal.inodes; inode != NULL; inode = inode->jnext) {
+        if (!NEWFS_IS_REG(inode)) {
+            continue;
+        }
+        for (int i = 0; i < MAX_DATA_PERFILE; i++) {
+            if (inode->data_dirty[i] && inode->block_pointer[i] != -1 &&
+                newfs_journal_ckpt_find(NEWFS_DB_OFS(inode->block_pointer[i]) / NEWFS_BLK_SIZE()) >= 0) {
+                return TRUE;
+            }
+        }
+    }
+    return FALSE;
+}
+
+/**
+ * @brief 提交当前事务，调用者持有super.lock
+ *
+ * 1) 给延迟分配的块分配数据块，再写回事务中文件的脏数据块，元数据提交后不会指向没写过的块
+ * 2) 生成被修改的位图、inode表、目录块的新内容，追加到日志区
+ * 3) 写事务头，事务提交；这些块留到检查点再写回原位置
+ *
+ * @return int
+ */
+int newfs_journal_commit() {
+    struct newfs_journal*  j = &super.journal;
+    struct newfs_journal_d jd;
+    struct newfs_inode*    inode;
+    struct newfs_inode*    redo = NULL;
+    struct newfs_dblk*     dblk;
+    struct newfs_inode_d   inode_d;
+    struct newfs_wb        wb;
+    boolean  is_data_ok = TRUE;
+    uint32_t tid = j->running_tid;
+    struct ddriver_state mark;
+    uint64_t start = newfs_stats_phase_begin(&mark);
+    uint8_t* imgs;
+    int*     blk_no;
+    int      nr = 0, i, blk, ret = NEWFS_ERROR_NONE;
+
+    if (j->nr_meta != 0 || j->inodes != NULL || j->dblks != NULL || j->nr_freed != 0) {
+        /* 挂载后第一次修改元数据，先在超级块上记下没有正常卸载 */
+        if (super.state != NEWFS_STATE_DIRTY && newfs_write_super(NEWFS_STATE_DIRTY) != NEWFS_ERROR_NONE) {
+            ret = -NEWFS_ERROR_IO;
+        }
+        /* 延迟分配的块现在分配，文件大小已经确定，整个文件尽量一次分配成连续的一段 */
+        for (inode = j->inodes; inode != NULL; inode = inode->jnext) {
+            if (NEWFS_IS_REG(inode) && newfs_alloc_delalloc(inode) != NEWFS_ERROR_NONE) {
+                ret = -NEWFS_ERROR_NOSPACE;
+            }
+        }
+        if (newfs_journal_data_conflict() && newfs_journal_do_checkpoint() != NEWFS_ERROR_NONE) {
+            ret = -NEWFS_ERROR_IO;
+        }
+        newfs_wb_init(&wb);
+        for (inode = j->inodes; inode != NULL; inode = inode->jnext) {
+            if (NEWFS_IS_REG(inode)) {
+                newfs_flush_data(inode, &wb);
+            }
+        }
+        if (newfs_wb_submit(&wb) != NEWFS_ERROR_NONE) {
+            ret = -NEWFS_ERROR_IO;
+            is_data_ok = FALSE;
+        }
+        for (inode = j->inodes; is_data_ok && inode != NULL; inode = inode->jnext) {
+            if (NEWFS_IS_REG(inode)) {
+                newfs_flush_data_done(inode);
+            }
+        }
+
+        newfs_journal_release_freed();                      /* 这之后分配的事务都在本事务之后提交 */
+        imgs   = (uint8_t*)malloc(NEWFS_BLKS_SIZE(newfs_journal_estimate()));
+        blk_no = (int*)malloc(newfs_journal_estimate() * sizeof(int));
+        for (i = 0; i < j->nr_meta; i++, nr++) {
+            blk_no[nr] = j->meta_blks[i];
+            memcpy(imgs + NEWFS_BLKS_SIZE(nr), newfs_journal_meta_mem(NEWFS_BLKS_SIZE(blk_no[nr])),
+                   NEWFS_BLK_SIZE());
+        }
+        for (inode = j->inodes; inode != NULL; inode = inode->jnext) {
+            blk = NEWFS_INO_OFS(inode->ino) / NEWFS_BLK_SIZE();
+            for (i = 0; i < nr && blk_no[i] != blk; i++);
+            if (i == nr) {                                  /* 同一inode表块只记一次 */
+                blk_no[nr] = blk;
+                newfs_journal_read_blk(blk, imgs + NEWFS_BLKS_SIZE(nr));
+                nr++;
+            }
+            newfs_inode_to_d(inode, &inode_d);
+            memcpy(imgs + NEWFS_BLKS_SIZE(i) + NEWFS_INO_OFS(inode->ino) % NEWFS_BLK_SIZE(),
+                   &inode_d, sizeof(struct newfs_inode_d));
+        }
+        for (dblk = j->dblks; dblk != NULL; dblk = dblk->jnext, nr++) {     /* 只记改过的目录块 */
+            blk_no[nr] = NEWFS_DB_OFS(dblk->dno) / NEWFS_BLK_SIZE();
+            memcpy(imgs + NEWFS_BLKS_SIZE(nr), dblk->content, NEWFS_BLK_SIZE());
+        }
+
+        if (nr <= NEWFS_JOURNAL_MAX_BLKS) {
+            /* 日志区放不下就先做检查点，从头开始写 */
+            if (j->head + 1 + nr > j->blks && newfs_journal_do_checkpoint() != NEWFS_ERROR_NONE) {
+                ret = -NEWFS_ERROR_IO;
+            }
+            memset(&jd, 0, sizeof(struct newfs_journal_d));
+            jd.magic    = NEWFS_JOURNAL_MAGIC;
+            jd.tid      = j->seq++;
+            jd.nr_blks  = nr;
+            jd.checksum = newfs_journal_checksum(imgs, NEWFS_BLKS_SIZE(nr));
+            memcpy(jd.blk_no, blk_no, nr * sizeof(int));
+            if (newfs_driver_write(j->offset + NEWFS_BLKS_SIZE(j->head + 1), imgs,
+                                   NEWFS_BLKS_SIZE(nr)) != NEWFS_ERROR_NONE ||
+                newfs_journal_write_desc(j->head, &jd) != NEWFS_ERROR_NONE) {
+                ret = -NEWFS_ERROR_IO;
+            }
+            j->head += 1 + nr;
+            for (i = 0; i < nr; i++) {
+                newfs_journal_ckpt_add(blk_no[i], imgs + NEWFS_BLKS_SIZE(i));
+            }
+        }
+        else {
+            /* 超出日志容量的事务：先清空日志，再直接写原位置 */
+            if (newfs_journal_do_checkpoint() != NEWFS_ERROR_NONE) {
+                ret = -NEWFS_ERROR_IO;
+            }
+            for (i = 0; i < nr; i++) {
+                newfs_wb_add(&wb, blk_no[i], imgs + NEWFS_BLKS_SIZE(i));
+            }
+            if (newfs_wb_submit(&wb) != NEWFS_ERROR_NONE) {
+                ret = -NEWFS_ERROR_IO;
+            }
+            newfs_journal_reset();
+        }
+        free(imgs);
+        free(blk_no);
+
+        while (j->inodes != NULL) {
+            inode = j->inodes;
+            j->inodes = inode->jnext;
+            inode->jdirty = FALSE;
+            inode->jnext  = NULL;
+            if (NEWFS_IS_REG(inode) && (!is_data_ok || inode->delalloc)) {  /* 数据没写成功或没分配到块，留到下一个事务 */
+                inode->jnext = redo;
+                redo = inode;
+            }
+        }
+        while (redo != NULL) {
+            inode = redo;
+            redo  = inode->jnext;
+            newfs_journal_dirty_inode(inode);
+        }
+        while (j->dblks != NULL) {
+            dblk = j->dblks;
+            j->dblks = dblk->jnext;
+            dblk->jdirty = FALSE;
+            dblk->jnext  = NULL;
+        }
+        j->nr_dblks = 0;
+        j->nr_meta  = 0;
+        newfs_stats_phase_end(NEWFS_STAT_SYNC, start, &mark, 0);     /* 空事务不计 */
+    }
+
+    j->running_tid = tid + 1;
+    pthread_mutex_lock(&j->lock);
+    j->commit_tid  = tid;
+    j->commit_time = time(NULL);
+    pthread_cond_broadcast(&j->cond);
+    pthread_mutex_unlock(&j->lock);
+    return ret;
+}
+
+/**
+ * @brief 提交当前事务并做检查点，卸载和NEWFS_IOC_CHECKPOINT使用，调用者持有super.lock
+ *
+ * @return int
+ */
+int newfs_journal_checkpoint() {
+    int ret = newfs_journal_commit();
+
+    if (newfs_journal_do_checkpoint() != NEWFS_ERROR_NONE) {
+        ret = -NEWFS_ERROR_IO;
+    }
+    return ret;
+}
+
+/**
+ * @brief 等待事务tid提交（组提交）
+ *
+ * 没有线程在提交时由当前线程提交，还有修改操作在执行时先稍等，
+ * 让它们加入同一个事务，多个操作共用一次日志写入
+ *
+ * @param tid
+ */
+static void newfs_journal_wait(uint32_t tid) {
+    struct newfs_journal* j = &super.journal;
+
+    pthread_mutex_lock(&j->lock);
+    while ((int32_t)(j->commit_tid - tid) < 0) {
+        if (j->committing) {
+            pthread_cond_wait(&j->cond, &j->lock);
+            continue;
+        }
+        j->committing = TRUE;
+        if (j->nr_active > 0) {
+            pthread_mutex_unlock(&j->lock);
+            usleep(NEWFS_JOURNAL_BATCH_US);
+        }
+        else {
+            pthread_mutex_unlock(&j->lock);
+        }
+
+        pthread_mutex_lock(&super.lock);
+        newfs_journal_commit();
+        pthread_mutex_unlock(&super.lock);
+
+        pthread_mutex_lock(&j->lock);
+        j->committing = FALSE;
+        pthread_cond_broadcast(&j->cond);
+    }
+    pthread_mutex_unlock(&j->lock);
+}
+
+/**
+ * @brief FUSE操作开始：拿文件系统大锁，当前事务快满时先提交
+ *
+ * @param type NEWFS_OP_*
+ */
+void newfs_op_begin(int type) {
+    if (type != NEWFS_OP_READ) {                            /* 排队等锁的也算，提交者会等它们 */
+        pthread_mutex_lock(&super.journal.lock);
+        super.journal.nr_active++;
+        pthread_mutex_unlock(&super.journal.lock);
+    }
+    pthread_mutex_lock(&super.lock);
+    newfs_stats_op_mark();
+    /* 空闲块不多而当前事务有释放的块时也先提交，让它们可以再分配 */
+    if (newfs_journal_estimate() + NEWFS_JOURNAL_CREDITS > NEWFS_JOURNAL_MAX_BLKS ||
+        (super.journal.nr_freed > 0 && newfs_count_free_data() < MAX_DATA_PERFILE)) {
+        newfs_journal_commit();
+    }
+}
+
+/**
+ * @brief FUSE操作结束：放锁，修改元数据成功的操作等到所在事务提交后才返回；
+ * 写数据的操作不等，只在距上次提交超过NEWFS_JOURNAL_COMMIT_SECS时顺便提交
+ *
+ * @param ret 操作的返回值
+ * @param type NEWFS_OP_*
+ * @return int ret
+ */
+int newfs_op_end(int ret, int type) {
+    struct newfs_journal* j = &super.journal;
+    uint32_t tid = j->running_tid;
+    boolean  is_wait;
+
+    newfs_cache_shrink();                                   /* 操作结束后不再引用inode，可以淘汰 */
+    newfs_stats_op_take();
+    pthread_mutex_unlock(&super.lock);
+    if (type == NEWFS_OP_READ) {
+        return ret;
+    }
+    pthread_mutex_lock(&j->lock);
+    j->nr_active--;
+    is_wait = type == NEWFS_OP_SYNC || time(NULL) - j->commit_time >= NEWFS_JOURNAL_COMMIT_SECS;
+    pthread_mutex_unlock(&j->lock);
+    if (ret >= 0 && is_wait) {
+        newfs_journal_wait(tid);
+    }
+    return ret;
+}
@@ -0,0 +1,40 @@
+#define _XOPEN_SOURCE 700
+
+#include "newfs.h"
+
+/******************************************************************************
+* SECTION: 宏定义
+*******************************************************************************/
+#define OPTION(t, p)        { t, offsetof(struct custom_options, p), 1 }
+
+/******************************************************************************
+* SECTION: 全局变量
+*******************************************************************************/
+static const struct fuse_opt option_spec[] = {		/* 用于FUSE文件系统解析参数 */
+	OPTION("--device=%s", device),
+	OPTION("--cache_kb=%d", cache_kb),
+	OPTION("--trace=%s", trace),
+	FUSE_OPT_END
+};
+
+struct custom_options newfs_options;			 /* 全局选项 */
+struct newfs_super super; 
+
+/******************************************************************************
+* SECTION: FUSE入口
+* 回调和newfs_operations在newfs.c中，与其余代码一起编进核心库，回放工具也链接它
+*******************************************************************************/
+int main(int argc, char **argv)
+{
+    int ret;
+	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+
+	newfs_options.device = strdup("TODO: 这里填写你的ddriver设备路径");
+
+	if (fuse_opt_parse(&args, &newfs_options, option_spec, NULL) == -1)
+		return -1;
+	
+	ret = fuse_main(args.argc, args.argv, &newfs_operations, NULL);
+	fuse_opt_free_args(&args);
+	return ret;
+}
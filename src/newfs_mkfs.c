@@ -0,0 +1,213 @@
+#include "../include/newfs.h"
+
+/* 格式化时的顺序写：设备是普通镜像文件时直接大块pwrite，否则经ddriver逐个IO单位写 */
+struct newfs_mkfs_dev {
+    int fd;                     // ddriver_open返回的fd
+    int img_fd;                 // 镜像文件可写fd，-1表示不是普通文件
+    int io_sz;
+};
+
+/**
+ * @brief 从设备偏移offset开始顺序写size字节，offset、size都是IO单位的整数倍
+ *
+ * @param dev
+ * @param offset
+ * @param buf
+ * @param size
+ * @return int
+ */
+static int newfs_mkfs_write(struct newfs_mkfs_dev* dev, int offset, uint8_t* buf, int size) {
+    if (dev->img_fd >= 0) {
+        return pwrite(dev->img_fd, buf, size, offset) == size ? NEWFS_ERROR_NONE : -NEWFS_ERROR_IO;
+    }
+    if (ddriver_seek(dev->fd, offset, SEEK_SET) < 0) {
+        return -NEWFS_ERROR_IO;
+    }
+    for (int done = 0; done < size; done += dev->io_sz) {
+        if (ddriver_write(dev->fd, (char*)buf + done, dev->io_sz) < 0) {
+            return -NEWFS_ERROR_IO;
+        }
+    }
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 对象[obj_ofs, obj_ofs+size)落在这一段[chunk_ofs, chunk_ofs+len)中时拷进去
+ */
+static void newfs_mkfs_place(uint8_t* chunk, int chunk_ofs, int len, int obj_ofs, void* obj, int size) {
+    if (obj_ofs >= chunk_ofs && obj_ofs + size <= chunk_ofs + len) {
+        memcpy(chunk + (obj_ofs - chunk_ofs), obj, size);
+    }
+}
+
+/**
+ * @brief 按参数算出布局：| Super | Inode Map | Data Map | Refcount | Journal | Inode | Data |
+ * 数据块占满剩下的空间，数据块位图和引用计数的大小随数据块数变化，从大往小找到放得下的最大值
+ *
+ * @param sb 输出，偏移以字节为单位
+ * @param opts
+ * @param disk_size
+ * @param io_sz
+ * @return int
+ */
+static int newfs_mkfs_layout(struct newfs_super_d* sb, struct newfs_mkfs_opts* opts, int disk_size, int io_sz) {
+    int blk      = opts->blks_size > 0 ? opts->blks_size : io_sz * 2;
+    int blks     = disk_size / blk;
+    int ino_cnt  = opts->ino_cnt > 0 ? opts->ino_cnt : blks;
+    int jnl_blks = opts->journal_blks > 0 ? opts->journal_blks : JOURNAL_BLKS_NUM;
+    int rest, db_blks;
+
+    /* 块要是IO单位的2的幂倍，放得下一块inode、日志事务头和超级块 */
+    if (blk < io_sz || blk % io_sz != 0 || (blk & (blk - 1)) != 0 || blk > NEWFS_MKFS_CHUNK ||
+        blk < MAX_INODE_NUM_PERBLK * (int)sizeof(struct newfs_inode_d) ||
+        blk < (int)sizeof(struct newfs_journal_d) || blk < (int)sizeof(struct newfs_super_d)) {
+        return -NEWFS_ERROR_INVAL;
+    }
+    if (jnl_blks < JOURNAL_BLKS_NUM || jnl_blks > JOURNAL_BLKS_MAX || (opts->features & ~NEWFS_FEATURE_ALL) != 0) {
+        return -NEWFS_ERROR_INVAL;
+    }
+    ino_cnt = NEWFS_ROUND_UP(ino_cnt, MAX_INODE_NUM_PERBLK);
+
+    memset(sb, 0, sizeof(struct newfs_super_d));
+    sb->magic        = NEWFS_MAGIC_NUM;
+    sb->blks_size    = blk;
+    sb->features     = opts->features | NEWFS_FEATURE_REQUIRED;     /* 目录树格式总是打开 */
+    sb->sb_blks      = SUPER_BLKS_NUM;
+    sb->ino_map_blks = (ino_cnt + blk * UINT8_BITS - 1) / (blk * UINT8_BITS);
+    sb->journal_blks = jnl_blks;
+    sb->ino_blks     = ino_cnt / MAX_INODE_NUM_PERBLK;
+
+    rest    = blks - sb->sb_blks - sb->ino_map_blks - sb->journal_blks - sb->ino_blks;
+    db_blks = rest;
+    while (db_blks > 0 &&
+           db_blks + (db_blks + blk * UINT8_BITS - 1) / (blk * UINT8_BITS) + (db_blks + blk - 1) / blk > rest) {
+        db_blks--;
+    }
+    if (db_blks <= 0) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    sb->db_map_blks = (db_blks + blk * UINT8_BITS - 1) / (blk * UINT8_BITS);
+    sb->refcnt_blks = (db_blks + blk - 1) / blk;
+    sb->db_blks     = db_blks;
+
+    sb->sb_offset      = NEWFS_SUPER_OFS;
+    sb->ino_map_offset = sb->sb_offset      + sb->sb_blks      * blk;
+    sb->db_map_offset  = sb->ino_map_offset + sb->ino_map_blks * blk;
+    sb->refcnt_offset  = sb->db_map_offset  + sb->db_map_blks  * blk;
+    sb->journal_offset = sb->refcnt_offset  + sb->refcnt_blks  * blk;
+    sb->ino_offset     = sb->journal_offset + sb->journal_blks * blk;
+    sb->db_offset      = sb->ino_offset     + sb->ino_blks     * blk;
+
+    sb->ino_max  = ino_cnt;
+    sb->file_max = db_blks;
+    sb->root_ino = NEWFS_ROOT_INO;
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 格式化设备：超级块、位图、引用计数、空日志、inode表和根目录在数据区之前连成一段，
+ * 按NEWFS_MKFS_CHUNK一段段拼好后顺序写出；数据区不写。NEWFS_FEATURE_LAZY_ITABLE时
+ * inode表只写根目录所在的块
+ *
+ * @param device 设备路径，不能已挂载
+ * @param opts
+ * @param out_sb 输出写入的超级块，可以为NULL；is_dry_run时是将要写入的布局
+ * @return int 设备达到NEWFS_DISK_SIZE_MAX时返回-NEWFS_ERROR_FBIG
+ */
+int newfs_mkfs(const char* device, struct newfs_mkfs_opts* opts, struct newfs_super_d* out_sb) {
+    struct newfs_mkfs_dev  dev;
+    struct newfs_super_d   sb;
+    struct newfs_journal_d jd;
+    struct newfs_inode_d   root;
+    struct stat            img_stat;
+    uint8_t  imap = 0x1;                            /* 根目录占0号inode */
+    uint8_t* chunk;
+    int      disk_size, end;
+    int      ret;
+    boolean  is_big;
+
+    dev.fd = ddriver_open((char*)device);
+    if (dev.fd < 0) {
+        return -NEWFS_ERROR_IO;
+    }
+    ddriver_ioctl(dev.fd, IOC_REQ_DEVICE_SIZE, &disk_size);
+    ddriver_ioctl(dev.fd, IOC_REQ_DEVICE_IO_SZ, &dev.io_sz);
+    is_big     = disk_size <= 0;                    /* 驱动按int返回大小，2GB以上会溢出 */
+    dev.img_fd = open(device, O_WRONLY);
+    if (dev.img_fd >= 0 && fstat(dev.img_fd, &img_stat) == 0 && S_ISREG(img_stat.st_mode) &&
+        img_stat.st_size > NEWFS_DISK_SIZE_MAX) {
+        is_big = TRUE;
+    }
+    if (dev.img_fd >= 0 && (fstat(dev.img_fd, &img_stat) != 0 || !S_ISREG(img_stat.st_mode) ||
+                            img_stat.st_size < disk_size)) {
+        close(dev.img_fd);
+        dev.img_fd = -1;
+    }
+
+    chunk = (uint8_t*)malloc(NEWFS_MKFS_CHUNK);
+    ret   = is_big ? -NEWFS_ERROR_FBIG : newfs_mkfs_layout(&sb, opts, disk_size, dev.io_sz);
+
+    /* 已经是newfs时不覆盖，除非指定了is_force */
+    if (ret == NEWFS_ERROR_NONE && !opts->is_force) {
+        if (ddriver_seek(dev.fd, NEWFS_SUPER_OFS, SEEK_SET) < 0 ||
+            ddriver_read(dev.fd, (char*)chunk, dev.io_sz) < 0) {
+            ret = -NEWFS_ERROR_IO;
+        }
+        else if (((struct newfs_super_d*)chunk)->magic == NEWFS_MAGIC_NUM) {
+            ret = -NEWFS_ERROR_EXISTS;
+        }
+    }
+    if (ret != NEWFS_ERROR_NONE) {
+        goto out;
+    }
+    if (opts->is_dry_run) {                         /* 调用者先按布局检查容量，放得下再真正格式化 */
+        if (out_sb != NULL) {
+            *out_sb = sb;
+        }
+        goto out;
+    }
+
+    sb.state         = NEWFS_STATE_CLEAN;
+    sb.journal_seq   = (uint32_t)time(NULL);       /* 与日志超级块的tid一致，日志为空 */
+    sb.group_dirs[0] = 1;                           /* 根目录在第0组 */
+
+    memset(&jd, 0, sizeof(struct newfs_journal_d));
+    jd.magic = NEWFS_JOURNAL_MAGIC;
+    jd.tid   = sb.journal_seq;
+
+    memset(&root, 0, sizeof(struct newfs_inode_d));
+    root.ino   = NEWFS_ROOT_INO;
+    root.ftype = DIR;
+    root.atime = root.mtime = root.ctime = (uint32_t)time(NULL);
+    for (int i = 0; i < MAX_DATA_PERFILE; i++) {
+        root.block_pointer[i] = -1;
+    }
+
+    end = (opts->features & NEWFS_FEATURE_LAZY_ITABLE) ? sb.ino_offset + sb.blks_size : sb.db_offset;
+    for (int ofs = 0; ofs < end; ofs += NEWFS_MKFS_CHUNK) {
+        int len = end - ofs < NEWFS_MKFS_CHUNK ? end - ofs : NEWFS_MKFS_CHUNK;
+
+        memset(chunk, 0, len);
+        newfs_mkfs_place(chunk, ofs, len, sb.sb_offset, &sb, sizeof(struct newfs_super_d));
+        newfs_mkfs_place(chunk, ofs, len, sb.ino_map_offset, &imap, sizeof(imap));
+        newfs_mkfs_place(chunk, ofs, len, sb.journal_offset, &jd, sizeof(struct newfs_journal_d));
+        newfs_mkfs_place(chunk, ofs, len, sb.ino_offset, &root, sizeof(struct newfs_inode_d));
+        if ((ret = newfs_mkfs_write(&dev, ofs, chunk, len)) != NEWFS_ERROR_NONE) {
+            goto out;
+        }
+    }
+    if (dev.img_fd >= 0 && fsync(dev.img_fd) != 0) {
+        ret = -NEWFS_ERROR_IO;
+    }
+    if (out_sb != NULL) {
+        *out_sb = sb;
+    }
+
+out:
+    free(chunk);
+    if (dev.img_fd >= 0) {
+        close(dev.img_fd);
+    }
+    ddriver_close(dev.fd);
+    return ret;
+}
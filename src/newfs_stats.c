@@ -0,0 +1,321 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super super;
+extern struct custom_options newfs_options;
+
+static const char* newfs_stat_names[NEWFS_STAT_NR] = {
+    "mkdir", "getattr", "readdir", "mknod", "write", "read", "write_buf", "read_buf",
+    "utimens", "truncate", "fallocate", "ioctl", "unlink", "rmdir", "rename", "open",
+    "opendir", "access", "fsync",
+    "lookup", "read_inode", "sync", "driver_read", "driver_write", "mount", "lookup_miss",
+    "writeback",
+};
+
+/* 本线程正在执行的FUSE操作：持锁期间的设备计数起点和得到的差 */
+static __thread struct ddriver_state newfs_op_mark;
+static __thread struct newfs_stat_io  newfs_op_io;
+
+/**
+ * @brief 当前时间，单调时钟经vDSO读取，不进内核
+ *
+ * @return uint64_t 纳秒
+ */
+uint64_t newfs_stats_now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * @brief 延迟落在哪个桶：小于4ns的各占一桶，之后每个2的幂按次高的两位再分4桶
+ */
+static int newfs_stats_bucket(uint64_t ns) {
+    int msb;
+
+    if (ns < (1 << NEWFS_STATS_SUB_BITS)) {
+        return (int)ns;
+    }
+    msb = 63 - __builtin_clzll(ns);
+    return (msb << NEWFS_STATS_SUB_BITS) |
+           (int)((ns >> (msb - NEWFS_STATS_SUB_BITS)) & ((1 << NEWFS_STATS_SUB_BITS) - 1));
+}
+
+/**
+ * @brief 桶内最大的延迟，报告分位数时取它
+ */
+static uint64_t newfs_stats_bucket_max(int idx) {
+    int msb = idx >> NEWFS_STATS_SUB_BITS;
+    int sub = idx & ((1 << NEWFS_STATS_SUB_BITS) - 1);
+
+    if (idx < (1 << NEWFS_STATS_SUB_BITS)) {
+        return idx;
+    }
+    return (((uint64_t)((1 << NEWFS_STATS_SUB_BITS) + sub + 1)) << (msb - NEWFS_STATS_SUB_BITS)) - 1;
+}
+
+/**
+ * @brief 记录一次操作的耗时，不加锁，多个线程可以同时记录
+ *
+ * @param op NEWFS_STAT_*
+ * @param start newfs_stats_now()取得的开始时间
+ */
+void newfs_stats_record(int op, uint64_t start) {
+    struct newfs_stat_hist* h = &super.stats.ops[op];
+    uint64_t ns  = newfs_stats_now() - start;
+    uint64_t max = __atomic_load_n(&h->max_ns, __ATOMIC_RELAXED);
+
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum_ns, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->buckets[newfs_stats_bucket(ns)], 1, __ATOMIC_RELAXED);
+    while (ns > max && !__atomic_compare_exchange_n(&h->max_ns, &max, ns, TRUE,
+                                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/**
+ * @brief 读设备的读、写、寻道计数
+ *
+ * @param state 读不到时全为0
+ */
+void newfs_stats_dev_state(struct ddriver_state* state) {
+    if (ddriver_ioctl(super.fd, IOC_REQ_DEVICE_STATE, state) != 0) {
+        memset(state, 0, sizeof(struct ddriver_state));
+    }
+}
+
+/**
+ * @brief 把从mark到现在的设备I/O累加到一种操作上
+ */
+static boolean newfs_stats_io_add(int op, struct ddriver_state* mark, uint64_t user_bytes) {
+    struct newfs_stat_io* io = &super.stats.io[op];
+    struct ddriver_state  now;
+
+    newfs_stats_dev_state(&now);
+    /* 设备计数是int，差按无符号算，回绕时也对 */
+    __atomic_fetch_add(&io->reads, (unsigned)now.read_cnt - (unsigned)mark->read_cnt, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&io->writes, (unsigned)now.write_cnt - (unsigned)mark->write_cnt, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&io->seeks, (unsigned)now.seek_cnt - (unsigned)mark->seek_cnt, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&io->user_bytes, user_bytes, __ATOMIC_RELAXED);
+    return now.read_cnt != mark->read_cnt || now.write_cnt != mark->write_cnt;
+}
+
+/**
+ * @brief 开始统计一个内部环节：记下开始时间和设备计数
+ *
+ * @param mark 设备计数的起点，交给newfs_stats_phase_end
+ * @return uint64_t 开始时间
+ */
+uint64_t newfs_stats_phase_begin(struct ddriver_state* mark) {
+    newfs_stats_dev_state(mark);
+    return newfs_stats_now();
+}
+
+/**
+ * @brief 结束统计一个内部环节：记录耗时和期间的设备I/O
+ *
+ * @param op NEWFS_STAT_*
+ * @param start newfs_stats_phase_begin的返回值
+ * @param mark
+ * @param user_bytes 该环节本身要读写的字节数，没有时为0
+ * @return boolean 期间设备上有没有读写
+ */
+boolean newfs_stats_phase_end(int op, uint64_t start, struct ddriver_state* mark, uint64_t user_bytes) {
+    newfs_stats_record(op, start);
+    return newfs_stats_io_add(op, mark, user_bytes);
+}
+
+/**
+ * @brief 拿到文件系统大锁后调用，记下本线程的设备计数起点
+ */
+void newfs_stats_op_mark() {
+    newfs_stats_dev_state(&newfs_op_mark);
+}
+
+/**
+ * @brief 放锁前调用，算出本线程持锁期间的设备I/O，留给newfs_stats_end。
+ * 操作在大锁内串行，这段时间的I/O都是它引起的；等提交的部分算在sync上
+ */
+void newfs_stats_op_take() {
+    struct ddriver_state now;
+
+    newfs_stats_dev_state(&now);
+    newfs_op_io.reads  = (unsigned)now.read_cnt - (unsigned)newfs_op_mark.read_cnt;
+    newfs_op_io.writes = (unsigned)now.write_cnt - (unsigned)newfs_op_mark.write_cnt;
+    newfs_op_io.seeks  = (unsigned)now.seek_cnt - (unsigned)newfs_op_mark.seek_cnt;
+}
+
+/**
+ * @brief 记录一个FUSE操作的耗时和设备I/O（开启轨迹时再写一条轨迹）并原样返回它的结果，
+ * 供加锁入口包在最外层；read、write成功时返回值就是用户读写的字节数
+ *
+ * @param op NEWFS_STAT_*
+ * @param start
+ * @param ret 操作的返回值
+ * @return int ret
+ */
+int newfs_stats_end(int op, uint64_t start, int ret) {
+    struct newfs_stat_io* io = &super.stats.io[op];
+
+    newfs_stats_record(op, start);
+    newfs_trace_record(op, start, ret, newfs_op_io.reads + newfs_op_io.writes);
+    __atomic_fetch_add(&io->reads, newfs_op_io.reads, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&io->writes, newfs_op_io.writes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&io->seeks, newfs_op_io.seeks, __ATOMIC_RELAXED);
+    if (ret > 0 && (op == NEWFS_STAT_READ || op == NEWFS_STAT_WRITE || op == NEWFS_STAT_WRITE_BUF)) {
+        __atomic_fetch_add(&io->user_bytes, (uint64_t)ret, __ATOMIC_RELAXED);
+    }
+    memset(&newfs_op_io, 0, sizeof(struct newfs_stat_io));
+    return ret;
+}
+
+/**
+ * @brief 返回值不是字节数的操作（read_buf）另外记用户读写的字节数
+ */
+void newfs_stats_user_bytes(int op, uint64_t bytes) {
+    __atomic_fetch_add(&super.stats.io[op].user_bytes, bytes, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief 缓存命中计数
+ *
+ * @param counter super.stats中的inode_hit等
+ */
+void newfs_stats_inc(uint64_t* counter) {
+    __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief 统计清零，可以和记录并发
+ */
+void newfs_stats_reset() {
+    uint64_t* p   = (uint64_t*)&super.stats;
+    size_t    cnt = sizeof(struct newfs_stats) / sizeof(uint64_t);
+    struct ddriver_state now;
+
+    for (size_t i = 0; i < cnt; i++) {
+        __atomic_store_n(&p[i], 0, __ATOMIC_RELAXED);
+    }
+    newfs_stats_dev_state(&now);
+    __atomic_store_n(&super.stats.dev_base.reads, (unsigned)now.read_cnt, __ATOMIC_RELAXED);
+    __atomic_store_n(&super.stats.dev_base.writes, (unsigned)now.write_cnt, __ATOMIC_RELAXED);
+    __atomic_store_n(&super.stats.dev_base.seeks, (unsigned)now.seek_cnt, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief 从直方图中取分位数
+ *
+ * @param snap 直方图的快照
+ * @param permille 千分位，如990表示p99
+ * @return uint64_t 纳秒，落在桶的上界
+ */
+static uint64_t newfs_stats_percentile(struct newfs_stat_hist* snap, int permille) {
+    uint64_t rank = (snap->count * permille + 999) / 1000;
+    uint64_t seen = 0;
+
+    for (int i = 0; i < NEWFS_STATS_BUCKETS; i++) {
+        seen += snap->buckets[i];
+        if (seen >= rank && seen > 0) {
+            return newfs_stats_bucket_max(i) < snap->max_ns ? newfs_stats_bucket_max(i) : snap->max_ns;
+        }
+    }
+    return snap->max_ns;
+}
+
+static double newfs_stats_ratio(uint64_t hit, uint64_t miss) {
+    return hit + miss == 0 ? 0.0 : 100.0 * hit / (hit + miss);
+}
+
+/**
+ * @brief I/O放大：设备读写的字节数比操作本身读写的字节数
+ */
+static double newfs_stats_amp(uint64_t dev_bytes, uint64_t user_bytes) {
+    return user_bytes == 0 ? 0.0 : (double)dev_bytes / user_bytes;
+}
+
+/**
+ * @brief 把统计输出成文本，每种做过的操作一行，延迟单位为微秒
+ *
+ * @param buf
+ * @param size buf的大小
+ * @return int 输出的长度（不含结尾的0），buf不够时截断
+ */
+int newfs_stats_render(char* buf, int size) {
+    struct newfs_stat_hist snap;
+    struct newfs_stats*    s = &super.stats;
+    uint64_t ihit  = __atomic_load_n(&s->inode_hit, __ATOMIC_RELAXED);
+    uint64_t imiss = __atomic_load_n(&s->inode_miss, __ATOMIC_RELAXED);
+    uint64_t bhit  = __atomic_load_n(&s->blk_hit, __ATOMIC_RELAXED);
+    uint64_t bmiss = __atomic_load_n(&s->blk_miss, __ATOMIC_RELAXED);
+    uint64_t dev_rd, dev_wr, user_rd, user_wr;
+    struct ddriver_state dev_now;
+    int len = 0;
+
+#define NEWFS_STATS_PRINTF(...) \
+    len += snprintf(buf + len, len < size ? size - len : 0, __VA_ARGS__)
+
+    NEWFS_STATS_PRINTF("%-12s %10s %10s %10s %10s %10s %10s\n",
+                       "op", "count", "avg_us", "p50_us", "p99_us", "p999_us", "max_us");
+    for (int op = 0; op < NEWFS_STAT_NR; op++) {
+        /* 逐个计数读出快照，并发记录时各项之间可能差几次，不影响分位数 */
+        snap.count  = 0;
+        snap.sum_ns = __atomic_load_n(&s->ops[op].sum_ns, __ATOMIC_RELAXED);
+        snap.max_ns = __atomic_load_n(&s->ops[op].max_ns, __ATOMIC_RELAXED);
+        for (int i = 0; i < NEWFS_STATS_BUCKETS; i++) {
+            snap.buckets[i] = __atomic_load_n(&s->ops[op].buckets[i], __ATOMIC_RELAXED);
+            snap.count     += snap.buckets[i];
+        }
+        if (snap.count == 0) {
+            continue;
+        }
+        NEWFS_STATS_PRINTF("%-12s %10lu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+                           newfs_stat_names[op], (unsigned long)snap.count,
+                           snap.sum_ns / 1000.0 / snap.count,
+                           newfs_stats_percentile(&snap, 500) / 1000.0,
+                           newfs_stats_percentile(&snap, 990) / 1000.0,
+                           newfs_stats_percentile(&snap, 999) / 1000.0,
+                           snap.max_ns / 1000.0);
+    }
+
+    /* 各操作平均每次引起的设备I/O（IO单位），amp为设备字节数比操作本身读写的字节数 */
+    NEWFS_STATS_PRINTF("\n%-12s %10s %10s %10s %10s %10s %10s %10s\n",
+                       "op", "count", "rd_io/op", "wr_io/op", "seek/op", "user_kb", "dev_kb", "amp");
+    for (int op = 0; op < NEWFS_STAT_NR; op++) {
+        uint64_t cnt   = __atomic_load_n(&s->ops[op].count, __ATOMIC_RELAXED);
+        uint64_t rd    = __atomic_load_n(&s->io[op].reads, __ATOMIC_RELAXED);
+        uint64_t wr    = __atomic_load_n(&s->io[op].writes, __ATOMIC_RELAXED);
+        uint64_t sk    = __atomic_load_n(&s->io[op].seeks, __ATOMIC_RELAXED);
+        uint64_t user  = __atomic_load_n(&s->io[op].user_bytes, __ATOMIC_RELAXED);
+        uint64_t dev   = (rd + wr) * NEWFS_IO_SIZE();
+
+        if (cnt == 0 || (rd + wr + sk + user) == 0) {
+            continue;
+        }
+        NEWFS_STATS_PRINTF("%-12s %10lu %10.2f %10.2f %10.2f %10.1f %10.1f %10.2f\n",
+                           newfs_stat_names[op], (unsigned long)cnt,
+                           (double)rd / cnt, (double)wr / cnt, (double)sk / cnt,
+                           user / 1024.0, dev / 1024.0, newfs_stats_amp(dev, user));
+    }
+    /* 清零以来设备上的全部I/O，包括提交、检查点这些不算在单个操作上的部分 */
+    newfs_stats_dev_state(&dev_now);
+    dev_rd  = (unsigned)dev_now.read_cnt - __atomic_load_n(&s->dev_base.reads, __ATOMIC_RELAXED);
+    dev_wr  = (unsigned)dev_now.write_cnt - __atomic_load_n(&s->dev_base.writes, __ATOMIC_RELAXED);
+    user_rd = __atomic_load_n(&s->io[NEWFS_STAT_READ].user_bytes, __ATOMIC_RELAXED) +
+              __atomic_load_n(&s->io[NEWFS_STAT_READ_BUF].user_bytes, __ATOMIC_RELAXED);
+    user_wr = __atomic_load_n(&s->io[NEWFS_STAT_WRITE].user_bytes, __ATOMIC_RELAXED) +
+              __atomic_load_n(&s->io[NEWFS_STAT_WRITE_BUF].user_bytes, __ATOMIC_RELAXED);
+    NEWFS_STATS_PRINTF("device_read  %lu io %.1f kb user %.1f kb amp %.2f\n", (unsigned long)dev_rd,
+                       dev_rd * NEWFS_IO_SIZE() / 1024.0, user_rd / 1024.0,
+                       newfs_stats_amp(dev_rd * NEWFS_IO_SIZE(), user_rd));
+    NEWFS_STATS_PRINTF("device_write %lu io %.1f kb user %.1f kb amp %.2f\n\n", (unsigned long)dev_wr,
+                       dev_wr * NEWFS_IO_SIZE() / 1024.0, user_wr / 1024.0,
+                       newfs_stats_amp(dev_wr * NEWFS_IO_SIZE(), user_wr));
+
+    NEWFS_STATS_PRINTF("inode_cache  hit %lu miss %lu ratio %.1f%%\n",
+                       (unsigned long)ihit, (unsigned long)imiss, newfs_stats_ratio(ihit, imiss));
+    NEWFS_STATS_PRINTF("block_cache  hit %lu miss %lu ratio %.1f%%\n",
+                       (unsigned long)bhit, (unsigned long)bmiss, newfs_stats_ratio(bhit, bmiss));
+    NEWFS_STATS_PRINTF("cache_kb     %ld / %ld\n", newfs_cache_bytes() / 1024, super.cache.limit / 1024);
+
+#undef NEWFS_STATS_PRINTF
+    return len < size ? len : size - 1;
+}
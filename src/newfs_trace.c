@@ -0,0 +1,194 @@
+#include "../include/newfs.h"
+#include <signal.h>
+#include <sys/mman.h>
+
+extern struct newfs_super super;
+extern struct custom_options newfs_options;
+
+/* 本线程的环和当前操作的参数，gen与super.trace不同时环是上一次开启时分的 */
+static __thread struct newfs_trace_ring_d* newfs_trace_ring;
+static __thread uint32_t                   newfs_trace_gen;
+static __thread struct newfs_trace_rec     newfs_trace_cur;
+
+static struct newfs_trace_d* newfs_trace_hdr() {
+    return (struct newfs_trace_d*)super.trace.base;
+}
+
+static struct newfs_trace_ring_d* newfs_trace_ring_hdr(int ring) {
+    return (struct newfs_trace_ring_d*)(super.trace.base + sizeof(struct newfs_trace_d)) + ring;
+}
+
+static struct newfs_trace_rec* newfs_trace_ring_recs(int ring) {
+    return (struct newfs_trace_rec*)(super.trace.base + sizeof(struct newfs_trace_d) +
+                                     NEWFS_TRACE_RINGS * sizeof(struct newfs_trace_ring_d)) +
+           (size_t)ring * NEWFS_TRACE_RING_RECS;
+}
+
+/**
+ * @brief 信号处理：把整段轨迹写到dump_path，只用异步信号安全的调用
+ */
+static void newfs_trace_dump(int sig) {
+    int     fd;
+    size_t  done = 0;
+    ssize_t n;
+
+    if (super.trace.base == NULL) {
+        return;
+    }
+    fd = open(super.trace.dump_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return;
+    }
+    while (done < super.trace.size &&
+           (n = write(fd, super.trace.base + done, super.trace.size - done)) > 0) {
+        done += n;
+    }
+    close(fd);
+}
+
+/**
+ * @brief 开启操作轨迹：把文件映射成各线程的环形缓冲区，并注册转储信号
+ *
+ * @param path 轨迹文件，已有内容被覆盖
+ * @return int
+ */
+int newfs_trace_init(const char* path) {
+    struct newfs_trace*   t = &super.trace;
+    struct newfs_trace_d* hdr;
+    struct sigaction      sa;
+    size_t size = sizeof(struct newfs_trace_d) +
+                  NEWFS_TRACE_RINGS * sizeof(struct newfs_trace_ring_d) +
+                  (size_t)NEWFS_TRACE_RINGS * NEWFS_TRACE_RING_RECS * sizeof(struct newfs_trace_rec);
+    int   fd;
+    void* base;
+
+    if (t->base != NULL) {
+        return NEWFS_ERROR_NONE;
+    }
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return -NEWFS_ERROR_IO;
+    }
+    if (ftruncate(fd, size) != 0) {
+        close(fd);
+        return -NEWFS_ERROR_IO;
+    }
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return -NEWFS_ERROR_IO;
+    }
+
+    hdr = (struct newfs_trace_d*)base;
+    hdr->magic     = NEWFS_TRACE_MAGIC;
+    hdr->version   = NEWFS_TRACE_VERSION;
+    hdr->rec_size  = sizeof(struct newfs_trace_rec);
+    hdr->nr_rings  = NEWFS_TRACE_RINGS;
+    hdr->ring_recs = NEWFS_TRACE_RING_RECS;
+    hdr->start_ns  = newfs_stats_now();
+    snprintf(t->dump_path, sizeof(t->dump_path), "%s.dump", path);
+    t->size      = size;
+    t->next_ring = 0;
+    __atomic_add_fetch(&t->gen, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&t->base, (uint8_t*)base, __ATOMIC_RELEASE);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = newfs_trace_dump;
+    sa.sa_flags   = SA_RESTART;
+    sigaction(NEWFS_TRACE_DUMP_SIG, &sa, NULL);
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 关闭操作轨迹，映射写回文件，调用者保证没有操作在执行
+ */
+void newfs_trace_destroy() {
+    struct newfs_trace* t = &super.trace;
+
+    if (t->base == NULL) {
+        return;
+    }
+    signal(NEWFS_TRACE_DUMP_SIG, SIG_DFL);
+    msync(t->base, t->size, MS_SYNC);
+    munmap(t->base, t->size);
+    t->base = NULL;
+}
+
+/**
+ * @brief 加锁入口开始时记下操作的参数，没有开启轨迹时什么都不做
+ *
+ * @param path
+ * @param path2 rename的目标，没有时为NULL
+ * @param offset
+ * @param size
+ * @param mode 见struct newfs_trace_rec
+ */
+void newfs_trace_args(const char* path, const char* path2, int64_t offset, uint64_t size, uint32_t mode) {
+    struct newfs_trace_rec* r = &newfs_trace_cur;
+
+    if (__atomic_load_n(&super.trace.base, __ATOMIC_RELAXED) == NULL) {
+        return;
+    }
+    r->offset = offset;
+    r->size   = size;
+    r->mode   = mode;
+    r->ino    = (uint32_t)-1;
+    strncpy(r->path, path, NEWFS_TRACE_PATH - 1);
+    r->path[NEWFS_TRACE_PATH - 1] = '\0';
+    if (path2 != NULL) {
+        strncpy(r->path2, path2, NEWFS_TRACE_PATH - 1);
+        r->path2[NEWFS_TRACE_PATH - 1] = '\0';
+    }
+    else {
+        r->path2[0] = '\0';
+    }
+}
+
+/**
+ * @brief 路径查找结束时记下找到的inode，轨迹里留下操作最后一次查找的结果
+ */
+void newfs_trace_ino(uint32_t ino) {
+    newfs_trace_cur.ino = ino;
+}
+
+/**
+ * @brief 把当前操作写进本线程的环：只有本线程写这个环，写完记录再推进head
+ *
+ * @param op NEWFS_STAT_*
+ * @param start 开始时间
+ * @param ret 返回值
+ * @param dev_io 持锁期间设备读写的IO单位数
+ */
+void newfs_trace_record(int op, uint64_t start, int ret, uint32_t dev_io) {
+    struct newfs_trace*     t    = &super.trace;
+    struct newfs_trace_d*   hdr;
+    struct newfs_trace_rec* r;
+    uint32_t ring;
+    uint64_t head;
+
+    if (__atomic_load_n(&t->base, __ATOMIC_ACQUIRE) == NULL) {
+        return;
+    }
+    hdr = newfs_trace_hdr();
+    if (newfs_trace_ring == NULL || newfs_trace_gen != t->gen) {
+        ring = __atomic_fetch_add(&t->next_ring, 1, __ATOMIC_RELAXED);
+        if (ring >= NEWFS_TRACE_RINGS) {                /* 线程比环多，丢掉 */
+            __atomic_fetch_add(&hdr->dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        newfs_trace_ring = newfs_trace_ring_hdr(ring);
+        newfs_trace_gen  = t->gen;
+    }
+    ring = newfs_trace_ring - newfs_trace_ring_hdr(0);
+    head = newfs_trace_ring->head;
+    r    = newfs_trace_ring_recs(ring) + (head & (NEWFS_TRACE_RING_RECS - 1));
+
+    newfs_trace_cur.ts_ns  = start - hdr->start_ns;
+    newfs_trace_cur.lat_ns = newfs_stats_now() - start;
+    newfs_trace_cur.op     = op;
+    newfs_trace_cur.ret    = ret;
+    newfs_trace_cur.dev_io = dev_io;
+    newfs_trace_cur.tid    = ring;
+    memcpy(r, &newfs_trace_cur, sizeof(struct newfs_trace_rec));
+    __atomic_store_n(&newfs_trace_ring->head, head + 1, __ATOMIC_RELEASE);
+}
@@ -32,6 +32,62 @@ int newfs_calc_lvl(const char * path) {
     return lvl;
 }
 
+/**
+ * @brief 刷新inode的时间戳，修改内容（mtime）时内核页缓存随之失效
+ * 
+ * @param inode 
+ * @param flags NEWFS_UPDATE_ATIME | NEWFS_UPDATE_MTIME | NEWFS_UPDATE_CTIME
+ */
+void newfs_update_time(struct newfs_inode* inode, int flags) {
+    uint32_t now = (uint32_t)time(NULL);
+
+    if (flags & NEWFS_UPDATE_ATIME) {
+        inode->atime = now;
+    }
+    if (flags & NEWFS_UPDATE_MTIME) {
+        inode->mtime = now;
+        inode->cache_valid = FALSE;
+    }
+    if (flags & NEWFS_UPDATE_CTIME) {
+        inode->ctime = now;
+    }
+    newfs_journal_dirty_inode(inode);
+}
+
+/**
+ * @brief 读访问后按relatime策略刷新atime：只有atime不晚于mtime/ctime，
+ * 或者距上次刷新超过一天时才更新，避免每次读都把inode弄脏
+ * 
+ * @param inode 
+ */
+void newfs_update_atime(struct newfs_inode* inode) {
+    uint32_t now = (uint32_t)time(NULL);
+
+    if (inode->atime <= inode->mtime || inode->atime <= inode->ctime ||
+        now - inode->atime >= NEWFS_RELATIME_SECS) {
+        inode->atime = now;
+        newfs_journal_dirty_inode(inode);
+    }
+}
+
+/**
+ * @brief 从对齐的位置按IO单位读入对齐长度的内容
+ * 
+ * @param offset_aligned 按逻辑块对齐的偏移
+ * @param content 至少size_aligned字节
+ * @param size_aligned 逻辑块的整数倍
+ */
+static void newfs_driver_read_aligned(int offset_aligned, uint8_t *content, int size_aligned) {
+    ddriver_seek(super.fd, offset_aligned, SEEK_SET);
+    // 按一个逻辑块读写
+    while (size_aligned != 0)
+    {
+        ddriver_read(super.fd, content, NEWFS_IO_SIZE());
+        content      += NEWFS_IO_SIZE();
+        size_aligned -= NEWFS_IO_SIZE();   
+    }
+}
+
 /**
  * @brief 驱动读
  * 
@@ -41,23 +97,21 @@ int newfs_calc_lvl(const char * path) {
  * @return int 
  */
 int newfs_driver_read(int offset, uint8_t *out_content, int size){
-    // 按照一个逻辑块大小(1024B)封装
+    // 按照一个逻辑块大小(1024B)封装，中转缓冲区从缓冲池借
+    struct ddriver_state mark;
+    uint64_t start = newfs_stats_phase_begin(&mark);
     int offset_aligned = NEWFS_ROUND_DOWN(offset, NEWFS_BLK_SIZE());
     int bias = offset - offset_aligned;
     int size_aligned = NEWFS_ROUND_UP(size+bias, NEWFS_BLK_SIZE());
-    uint8_t* temp_content = (uint8_t*)malloc(size_aligned);
-    uint8_t* cur = temp_content;
+    uint8_t* temp_content = newfs_buf_get(size_aligned);
 
-    ddriver_seek(super.fd, offset_aligned, SEEK_SET);
-    // 按一个逻辑块读写
-    while (size_aligned != 0)
-    {
-        ddriver_read(super.fd, cur, NEWFS_IO_SIZE());
-        cur          += NEWFS_IO_SIZE();
-        size_aligned -= NEWFS_IO_SIZE();   
+    if (temp_content == NULL) {
+        return -NEWFS_ERROR_NOSPACE;
     }
+    newfs_driver_read_aligned(offset_aligned, temp_content, size_aligned);
     memcpy(out_content, temp_content + bias, size);
-    free(temp_content);
+    newfs_buf_put(temp_content);
+    newfs_stats_phase_end(NEWFS_STAT_DRIVER_READ, start, &mark, size);
     return NEWFS_ERROR_NONE;
 }
 
@@ -70,14 +124,23 @@ int newfs_driver_read(int offset, uint8_t *out_content, int size){
  * @return int 
  */
 int newfs_driver_write(int offset, uint8_t *in_content, int size) {
-    // 按照一个逻辑块大小(1024B)封装
+    // 按照一个逻辑块大小(1024B)封装，中转缓冲区从缓冲池借
+    struct ddriver_state mark;
+    uint64_t start          = newfs_stats_phase_begin(&mark);
     int      offset_aligned = NEWFS_ROUND_DOWN(offset, NEWFS_BLK_SIZE());
     int      bias           = offset - offset_aligned;
     int      size_aligned   = NEWFS_ROUND_UP((size + bias), NEWFS_BLK_SIZE());
-    uint8_t* temp_content   = (uint8_t*)malloc(size_aligned);
+    uint8_t* temp_content   = newfs_buf_get(size_aligned);
     uint8_t* cur            = temp_content;
-    // 读出需要的磁盘块到内存
-    newfs_driver_read(offset_aligned, temp_content, size_aligned);
+    int      ret            = NEWFS_ERROR_NONE;
+
+    if (temp_content == NULL) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    // 读出需要的磁盘块到同一个缓冲区，整块覆盖时不用读
+    if (bias != 0 || size_aligned != size) {
+        newfs_driver_read_aligned(offset_aligned, temp_content, size_aligned);
+    }
     // 在内存覆盖指定内容
     memcpy(temp_content + bias, in_content, size);
     
@@ -86,109 +149,363 @@ int newfs_driver_write(int offset, uint8_t *in_content, int size) {
     // 将读出的磁盘块再依次写回到内存
     while (size_aligned != 0)
     {
-        ddriver_write(super.fd, cur, NEWFS_IO_SIZE());
+        if (ddriver_write(super.fd, (char*)cur, NEWFS_IO_SIZE()) < 0) {    /* 写失败要报给调用者，脏数据不能当作已写回 */
+            ret = -NEWFS_ERROR_IO;
+            break;
+        }
         cur          +=  NEWFS_IO_SIZE();
         size_aligned -=  NEWFS_IO_SIZE();   
     }
 
-    free(temp_content);
-    return NEWFS_ERROR_NONE;
+    newfs_buf_put(temp_content);
+    newfs_stats_phase_end(NEWFS_STAT_DRIVER_WRITE, start, &mark, size);     /* 不按块对齐时要先读 */
+    return ret;
 }
 
 /**
- * @brief 将denry插入到inode中，采用头插法
+ * @brief 在目录中按名字查找目录项：先查dentry缓存，不在缓存中时
+ * 沿目录树从根走到一个叶子，只读这一条路径上的块
+ * 
+ * @param inode 目录inode
+ * @param name 
+ * @return struct newfs_dentry* 找不到返回NULL
+ */
+struct newfs_dentry* newfs_find_dentry(struct newfs_inode* inode, const char* name) {
+    struct newfs_dentry*  dentry = newfs_cache_find_dentry(inode, name);
+    struct newfs_dentry_d dentry_d;
+
+    if (dentry != NULL) {
+        return dentry;
+    }
+    if (newfs_dx_find(inode, name, &dentry_d) != NEWFS_ERROR_NONE) {
+        return NULL;
+    }
+    dentry = new_dentry(dentry_d.name, dentry_d.ftype);
+    dentry->ino = dentry_d.ino;
+    newfs_cache_link_dentry(inode, dentry);
+    return dentry;
+}
+
+/**
+ * @brief 将dentry插入到目录inode中：写入目录树，并挂入dentry缓存
  * 
  * @param inode 
  * @param dentry 
- * @return int 
+ * @return int 插入后的目录项数，空间不足返回-NEWFS_ERROR_NOSPACE
  */
 int newfs_alloc_dentry(struct newfs_inode* inode, struct newfs_dentry* dentry) {
-    if (inode->dentrys == NULL) {
-        inode->dentrys = dentry;
-    }
-    else {
-        dentry->brother = inode->dentrys;
-        inode->dentrys = dentry;
+    int ret = newfs_dx_insert(inode, dentry->name, dentry->ino, dentry->ftype);
+
+    if (ret != NEWFS_ERROR_NONE) {
+        return ret;
     }
+    newfs_cache_link_dentry(inode, dentry);
     inode->dir_cnt++;
-    int current_blk = inode->dir_cnt / MAX_DENTRY_PERBLK();
-    //当前数据块满，寻找新数据块
-    if(inode->dir_cnt % MAX_DENTRY_PERBLK() == 1){
-        newfs_alloc_data(inode, current_blk);
+    newfs_journal_dirty_inode(inode);
+    return inode->dir_cnt;
+}
+
+/**
+ * @brief 将dentry从目录树和dentry缓存中摘下，dentry本身保留
+ * 
+ * @param inode 一个目录的索引结点
+ * @param dentry 该目录下的一个目录项
+ * @return int 
+ */
+int newfs_detach_dentry(struct newfs_inode * inode, struct newfs_dentry * dentry) {
+    int ret = newfs_dx_delete(inode, dentry->name);
+
+    if (ret != NEWFS_ERROR_NONE) {
+        return ret;
     }
+    newfs_cache_unlink_dentry(dentry);
+    inode->dir_cnt--;
+    newfs_journal_dirty_inode(inode);
     return inode->dir_cnt;
 }
 
 /**
- * @brief 将dentry从inode的dentrys中取出
+ * @brief 把dentry从原父目录移到新父目录并改名，dentry和inode都不重新分配
+ * 
+ * 先在新位置写入（顶替victim或插入新项），成功后才从原目录删除，失败时目录树不变
+ * 
+ * @param dentry 被移动的目录项
+ * @param to 新父目录
+ * @param fname 新名字
+ * @param victim 非空时dentry顶替新父目录下的这个目录项，victim被摘下但不释放
+ * @return int 
+ */
+int newfs_move_dentry(struct newfs_dentry* dentry, struct newfs_inode* to, const char* fname,
+                      struct newfs_dentry* victim) {
+    struct newfs_inode* from = dentry->parent->inode;
+    int ret;
+
+    ret = victim != NULL ? newfs_dx_set(to, fname, dentry->ino, dentry->ftype) :
+                           newfs_dx_insert(to, fname, dentry->ino, dentry->ftype);
+    if (ret != NEWFS_ERROR_NONE) {
+        return ret;
+    }
+    ret = newfs_dx_delete(from, dentry->name);
+    if (ret != NEWFS_ERROR_NONE) {                         /* 撤销新位置的修改 */
+        if (victim != NULL) {
+            newfs_dx_set(to, fname, victim->ino, victim->ftype);
+        }
+        else {
+            newfs_dx_delete(to, fname);
+        }
+        return ret;
+    }
+
+    newfs_cache_unlink_dentry(dentry);
+    from->dir_cnt--;
+    if (victim != NULL) {
+        newfs_cache_unlink_dentry(victim);
+        to->dir_cnt--;
+    }
+    memset(dentry->name, 0, MAX_NAME_LEN);
+    NEWFS_ASSIGN_FNAME(dentry, fname);
+    newfs_cache_link_dentry(to, dentry);
+    to->dir_cnt++;
+    newfs_journal_dirty_inode(from);
+    newfs_journal_dirty_inode(to);
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 两个目录项互换位置和名字，只改叶子中目录项指向的inode，各自的父目录项数不变
+ * 
+ * @param a 
+ * @param b 
+ * @return int 
+ */
+int newfs_exchange_dentry(struct newfs_dentry* a, struct newfs_dentry* b) {
+    struct newfs_inode* a_parent = a->parent->inode;
+    struct newfs_inode* b_parent = b->parent->inode;
+    char   name[MAX_NAME_LEN];
+    int    ret;
+
+    ret = newfs_dx_set(a_parent, a->name, b->ino, b->ftype);
+    if (ret != NEWFS_ERROR_NONE) {
+        return ret;
+    }
+    ret = newfs_dx_set(b_parent, b->name, a->ino, a->ftype);
+    if (ret != NEWFS_ERROR_NONE) {
+        newfs_dx_set(a_parent, a->name, a->ino, a->ftype);
+        return ret;
+    }
+    newfs_cache_unlink_dentry(a);
+    newfs_cache_unlink_dentry(b);
+    memcpy(name, a->name, MAX_NAME_LEN);
+    memcpy(a->name, b->name, MAX_NAME_LEN);
+    memcpy(b->name, name, MAX_NAME_LEN);
+    newfs_cache_link_dentry(b_parent, a);
+    newfs_cache_link_dentry(a_parent, b);
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 将dentry从inode的目录中删除并释放
  * 
  * @param inode 一个目录的索引结点
  * @param dentry 该目录下的一个目录项
  * @return int 
  */
 int newfs_drop_dentry(struct newfs_inode * inode, struct newfs_dentry * dentry) {
-    boolean is_find = FALSE;
-    struct newfs_dentry* dentry_cursor;
-    dentry_cursor = inode->dentrys;
-    
-    if (dentry_cursor == dentry) {
-        inode->dentrys = dentry->brother;
-        is_find = TRUE;
-    }
-    else {
-        while (dentry_cursor)
-        {
-            if (dentry_cursor->brother == dentry) {
-                dentry_cursor->brother = dentry->brother;
-                is_find = TRUE;
-                break;
+    int ret = newfs_detach_dentry(inode, dentry);
+    if (ret >= 0) {
+        free(dentry);
+    }
+    return ret;
+}
+
+/**
+ * @brief 按位图统计各分配组的空闲inode和数据块，并汇总出super.db_free
+ * 
+ * @param dirs 各组的目录数，来自超级块
+ */
+static void newfs_init_groups(int* dirs) {
+    struct newfs_group* grp;
+
+    super.ino_per_group = NEWFS_ROUND_UP((super.ino_max + NEWFS_GROUPS - 1) / NEWFS_GROUPS, UINT8_BITS);
+    super.db_per_group  = NEWFS_ROUND_UP((super.db_blks + NEWFS_GROUPS - 1) / NEWFS_GROUPS, UINT8_BITS);
+    super.group_rotor   = 0;
+    super.db_free       = 0;
+    super.db_reserved   = 0;
+
+    for (int gno = 0; gno < NEWFS_GROUPS; gno++) {
+        grp = &super.groups[gno];
+        grp->ino_start = gno * super.ino_per_group;
+        grp->ino_cnt   = super.ino_max - grp->ino_start;
+        grp->ino_cnt   = grp->ino_cnt > super.ino_per_group ? super.ino_per_group : 
+                         grp->ino_cnt < 0 ? 0 : grp->ino_cnt;
+        grp->db_start  = gno * super.db_per_group;
+        grp->db_cnt    = super.db_blks - grp->db_start;
+        grp->db_cnt    = grp->db_cnt > super.db_per_group ? super.db_per_group : 
+                         grp->db_cnt < 0 ? 0 : grp->db_cnt;
+        grp->dirs      = dirs[gno];
+        grp->ino_free  = 0;
+        grp->db_free   = 0;
+        for (int ino = grp->ino_start; ino < grp->ino_start + grp->ino_cnt; ino++) {
+            if (!NEWFS_BM_TEST(super.map_inode, ino)) {
+                grp->ino_free++;
             }
-            dentry_cursor = dentry_cursor->brother;
         }
+        for (int dno = grp->db_start; dno < grp->db_start + grp->db_cnt; dno++) {
+            if (!NEWFS_BM_TEST(super.map_db, dno)) {
+                grp->db_free++;
+            }
+        }
+        super.db_free += grp->db_free;
     }
-    if (!is_find) {
-        return -NEWFS_ERROR_NOTFOUND;
+}
+
+/**
+ * @brief 没有正常卸载时超级块中各组的目录数是第一次修改元数据时的值，重放日志后按inode表重新统计
+ * 
+ * @return int
+ */
+static int newfs_count_dirs() {
+    int      per_read = NEWFS_JOURNAL_MAX_BLKS;                /* 一次读的inode表块数 */
+    uint8_t* blks     = (uint8_t*)malloc(NEWFS_BLKS_SIZE(per_read));
+    struct newfs_inode_d* inode_d;
+    int      nr, ino;
+
+    if (blks == NULL) {
+        return -NEWFS_ERROR_NOSPACE;
     }
-    inode->dir_cnt--;
-    free(dentry);
-    return inode->dir_cnt;
+    for (int gno = 0; gno < NEWFS_GROUPS; gno++) {
+        super.groups[gno].dirs = 0;
+    }
+    for (int blk = 0; blk < super.ino_blks; blk += per_read) {
+        nr = super.ino_blks - blk < per_read ? super.ino_blks - blk : per_read;
+        if (newfs_driver_read(super.ino_offset + NEWFS_BLKS_SIZE(blk), blks,
+                              NEWFS_BLKS_SIZE(nr)) != NEWFS_ERROR_NONE) {
+            free(blks);
+            return -NEWFS_ERROR_IO;
+        }
+        for (int i = 0; i < nr * MAX_INODE_NUM_PERBLK; i++) {
+            ino     = blk * MAX_INODE_NUM_PERBLK + i;
+            inode_d = (struct newfs_inode_d*)(blks + NEWFS_BLKS_SIZE(i / MAX_INODE_NUM_PERBLK)) +
+                      i % MAX_INODE_NUM_PERBLK;
+            if (ino < super.ino_max && NEWFS_BM_TEST(super.map_inode, ino) && inode_d->ftype == DIR) {
+                super.groups[NEWFS_INO_GROUP(ino)].dirs++;
+            }
+        }
+    }
+    free(blks);
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 为新目录选择分配组。根目录下的目录分散到空闲inode和数据块都不少于平均值、
+ * 目录最少的组；更深的目录在父目录所在组还宽裕时跟着父目录
+ * 
+ * @param parent 父目录的dentry，根目录为NULL
+ * @return int 组号，没有空闲inode时返回-1
+ */
+static int newfs_find_group_dir(struct newfs_dentry* parent) {
+    struct newfs_group* grp;
+    int ino_free = 0, db_free = 0;
+    int best = -1;
+    int pgno;
+
+    if (parent == NULL) {
+        return super.groups[0].ino_free > 0 ? 0 : -1;
+    }
+    for (int gno = 0; gno < NEWFS_GROUPS; gno++) {
+        ino_free += super.groups[gno].ino_free;
+        db_free  += super.groups[gno].db_free;
+    }
+    if (ino_free == 0) {
+        return -1;
+    }
+
+    pgno = NEWFS_INO_GROUP(parent->ino);
+    if (parent->parent != NULL) {
+        grp = &super.groups[pgno];
+        if (grp->ino_free * 2 * NEWFS_GROUPS > ino_free && 
+            grp->db_free * 2 * NEWFS_GROUPS > db_free) {
+            return pgno;
+        }
+    }
+
+    for (int i = 0; i < NEWFS_GROUPS; i++) {
+        int gno = (super.group_rotor + i) % NEWFS_GROUPS;
+        grp = &super.groups[gno];
+        if (grp->ino_free * NEWFS_GROUPS < ino_free || grp->db_free * NEWFS_GROUPS < db_free) {
+            continue;
+        }
+        if (best == -1 || grp->dirs < super.groups[best].dirs) {
+            best = gno;
+        }
+    }
+    if (best != -1) {
+        super.group_rotor = (best + 1) % NEWFS_GROUPS;
+        return best;
+    }
+    for (int i = 0; i < NEWFS_GROUPS; i++) {
+        int gno = (pgno + i) % NEWFS_GROUPS;
+        if (super.groups[gno].ino_free > 0) {
+            return gno;
+        }
+    }
+    return -1;
 }
 
 /**
- * @brief 分配一个inode，占用位图
+ * @brief 为新文件选择分配组：父目录所在组，满了依次找后面的组
  * 
- * @param dentry 该dentry指向分配的inode
- * @return newfs_inode
+ * @param parent 父目录的dentry
+ * @return int 组号，没有空闲inode时返回-1
+ */
+static int newfs_find_group_file(struct newfs_dentry* parent) {
+    int pgno = NEWFS_INO_GROUP(parent->ino);
+
+    for (int i = 0; i < NEWFS_GROUPS; i++) {
+        int gno = (pgno + i) % NEWFS_GROUPS;
+        if (super.groups[gno].ino_free > 0) {
+            return gno;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief 分配一个inode，占用位图。先选分配组，再在组内找空闲inode
+ * 
+ * @param dentry 该dentry指向分配的inode，dentry->parent必须已设置（根目录除外）
+ * @return newfs_inode 没有空闲inode时返回NULL
  */
 struct newfs_inode* newfs_alloc_inode(struct newfs_dentry * dentry) {
     struct newfs_inode* inode;
-    int byte_cursor = 0; 
-    int bit_cursor  = 0; 
-    int dno_cursor  = 0;
-    boolean is_find_free_blk = FALSE;
-    /* 检查位图是否有空位 */
-    for (byte_cursor = 0; byte_cursor < NEWFS_BLKS_SIZE(super.ino_map_blks); 
-         byte_cursor++)
-    {
-        for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {
-            if((super.map_inode[byte_cursor] & (0x1 << bit_cursor)) == 0) {    
-                                                      /* 当前dno_cursor位置空闲 */
-                super.map_inode[byte_cursor] |= (0x1 << bit_cursor);
-                is_find_free_blk = TRUE;           
-                break;
-            }
-            dno_cursor++;
-        }
-        if (is_find_free_blk) {
+    struct newfs_group* grp;
+    int gno;
+    int ino_cursor = -1;
+
+    gno = dentry->ftype == DIR ? newfs_find_group_dir(dentry->parent) : 
+                                 newfs_find_group_file(dentry->parent);
+    if (gno == -1) {
+        return NULL;
+    }
+    grp = &super.groups[gno];
+    for (int ino = grp->ino_start; ino < grp->ino_start + grp->ino_cnt; ino++) {
+        if (!NEWFS_BM_TEST(super.map_inode, ino)) {
+            ino_cursor = ino;
             break;
         }
     }
-
-    if (!is_find_free_blk || dno_cursor == super.ino_max)
-        return -NEWFS_ERROR_NOSPACE;
+    if (ino_cursor == -1) {
+        return NULL;
+    }
+    NEWFS_BM_SET(super.map_inode, ino_cursor);
+    newfs_journal_dirty_meta(super.ino_map_offset + ino_cursor / UINT8_BITS);
+    grp->ino_free--;
+    if (dentry->ftype == DIR) {
+        grp->dirs++;
+    }
 
     inode = (struct newfs_inode*)malloc(sizeof(struct newfs_inode));
-    inode->ino  = dno_cursor; 
+    inode->ino  = ino_cursor; 
     inode->size = 0;
     /* dentry指向inode */
     dentry->inode = inode;
@@ -198,79 +515,233 @@ struct newfs_inode* newfs_alloc_inode(struct newfs_dentry * dentry) {
     
     inode->dir_cnt = 0;
     inode->dentrys = NULL;
+    inode->cache_valid = FALSE;
+    inode->jdirty = FALSE;
+    inode->jnext = NULL;
+    newfs_update_time(inode, NEWFS_UPDATE_ATIME | NEWFS_UPDATE_MTIME | NEWFS_UPDATE_CTIME);
     
-    if (NEWFS_IS_REG(inode)) {
-        for(int i = 0;i<MAX_DATA_PERFILE;i++)
-            inode->data[i] = (uint8_t *)malloc(NEWFS_BLK_SIZE());
-    }
-
-    for(int i = 0;i<MAX_DATA_PERFILE;i++)
+    /* 数据块缓存在第一次写入时才分配，空洞不占内存 */
+    for(int i = 0;i<MAX_DATA_PERFILE;i++) {
         inode->block_pointer[i] = -1;
+        inode->data[i] = NULL;
+        inode->data_dirty[i] = FALSE;
+    }
+    inode->unwritten = 0;
+    inode->delalloc = 0;
+    newfs_cache_add(inode);
 
     return inode;
 }
 
 /**
- * @brief 删除内存中的一个inode
+ * @brief 删除目录时对其下每个目录项调用：读入子inode，递归删除后释放dentry
+ */
+static int newfs_drop_child(void* arg, struct newfs_dentry_d* dentry_d, uint32_t hash) {
+    struct newfs_inode*  inode  = (struct newfs_inode*)arg;
+    struct newfs_dentry* dentry = newfs_cache_find_dentry(inode, dentry_d->name);
+
+    (void)hash;
+    if (dentry == NULL) {
+        dentry = new_dentry(dentry_d->name, dentry_d->ftype);
+        dentry->ino = dentry_d->ino;
+        newfs_cache_link_dentry(inode, dentry);
+    }
+    if (dentry->inode == NULL) {
+        dentry->inode = newfs_read_inode(dentry, dentry->ino);
+    }
+    if (dentry->inode != NULL) {
+        newfs_drop_inode(dentry->inode);
+    }
+    newfs_cache_unlink_dentry(dentry);
+    free(dentry);
+    return 0;
+}
+
+/**
+ * @brief 删除一个inode，释放它占用的数据块和inode位图，目录则递归删除其下所有项
  * @param inode 
  * @return int 
  */
 int newfs_drop_inode(struct newfs_inode * inode) {
-    struct newfs_dentry*  dentry_cursor;
-    struct newfs_dentry*  dentry_to_free;
-    struct newfs_inode*   inode_cursor;
-
     if (inode == super.root_dentry->inode) {
         return NEWFS_ERROR_INVAL;
     }
 
+    /* 递归向下drop，子项都删完后一次释放整棵目录树 */
     if (NEWFS_IS_DIR(inode)) {
-        dentry_cursor = inode->dentrys;
+        newfs_dx_iterate(inode, 0, newfs_drop_child, inode);
+        newfs_dx_free(inode);
+        inode->dir_cnt = 0;
+    }
 
-        /* 递归向下drop */
-        while (dentry_cursor)
-        {   
-            inode_cursor = dentry_cursor->inode;
-            newfs_drop_inode(inode_cursor);
-            newfs_drop_dentry(inode, dentry_cursor);
-            dentry_to_free = dentry_cursor;
-            dentry_cursor = dentry_cursor->brother;
-            free(dentry_to_free);
+    /* 调整datamap */
+    for (int blk_no = 0; blk_no < MAX_DATA_PERFILE; blk_no++) {
+        newfs_free_data(inode, blk_no);
+    }
+
+    /* 调整inodemap */
+    NEWFS_BM_CLEAR(super.map_inode, inode->ino);
+    super.groups[NEWFS_INO_GROUP(inode->ino)].ino_free++;
+    if (NEWFS_IS_DIR(inode) && super.groups[NEWFS_INO_GROUP(inode->ino)].dirs > 0) {
+        super.groups[NEWFS_INO_GROUP(inode->ino)].dirs--;
+    }
+    newfs_journal_dirty_meta(super.ino_map_offset + inode->ino / UINT8_BITS);
+    newfs_journal_forget(inode);
+    newfs_cache_remove(inode);
+
+    free(inode);
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 在数据块位图中找一段连续cnt个空闲块，从goal开始向后找，找不到再从头找
+ * 
+ * @param goal 期望的起始块号，一般是文件前一块之后
+ * @param cnt 连续块数
+ * @return int 起始块号，找不到返回-1
+ */
+static int newfs_find_free_run(int goal, int cnt) {
+    int run_start = -1, run_len = 0;
+
+    if (goal < 0 || goal >= super.db_blks) {
+        goal = 0;
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        int from = pass == 0 ? goal : 0;
+        int to   = pass == 0 ? super.db_blks : goal + cnt - 1;
+
+        run_len = 0;
+        for (int dno = from; dno < to && dno < super.db_blks; dno++) {
+            if (NEWFS_BM_TEST(super.map_db, dno)) {
+                run_len = 0;
+                continue;
+            }
+            if (run_len++ == 0) {
+                run_start = dno;
+            }
+            if (run_len == cnt) {
+                return run_start;
+            }
         }
     }
-    else if (NEWFS_IS_REG(inode)) {
-        /* 调整datamap */
-        for(int blk_no = 0; blk_no < MAX_DATA_PERFILE; blk_no++) {
-            free(inode->data[blk_no]);
-            if(inode->block_pointer[blk_no] == -1) continue;
-            boolean find = FALSE;
-            for(int i = 0;i < NEWFS_BLKS_SIZE(super.db_map_blks);i++) {
-                for(int j = 0;j < UINT8_BITS; j++) {
-                    if(inode->block_pointer[blk_no] = i * 8 + j) {
-                        super.map_db[i] &= (uint8_t)(~(0x1 << j));
-                        find = TRUE;
-                        break;
-                    }
-                }
-                if(find) break;
+    return -1;
+}
+
+/**
+ * @brief 还能使用的数据块数：位图中的空闲块减去延迟分配已经预留的块
+ * 
+ * @return int 
+ */
+int newfs_count_free_data() {
+    return super.db_free - super.db_reserved;
+}
+
+/**
+ * @brief 为文件第blk_no块预留一个数据块，提交时再分配（延迟分配）
+ * 
+ * @param inode 
+ * @param blk_no 该文件的第几块，对应的block_pointer必须未分配
+ * @return int 
+ */
+static int newfs_reserve_data(struct newfs_inode* inode, int blk_no) {
+    if (newfs_count_free_data() <= 0) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    super.db_reserved++;
+    inode->delalloc |= 0x1 << blk_no;
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 给文件所有延迟分配的块分配数据块，每段连续的块一次分配，
+ * 整个文件都是延迟分配时就是一次分配
+ * 
+ * @param inode 
+ * @return int 
+ */
+int newfs_alloc_delalloc(struct newfs_inode* inode) {
+    int blk_cnt;
+    int ret = NEWFS_ERROR_NONE;
+
+    for (int i = 0; i < MAX_DATA_PERFILE && inode->delalloc; i += blk_cnt) {
+        blk_cnt = 1;
+        if (!NEWFS_BLK_IS_DELALLOC(inode, i)) {
+            continue;
+        }
+        while (i + blk_cnt < MAX_DATA_PERFILE && NEWFS_BLK_IS_DELALLOC(inode, i + blk_cnt)) {
+            blk_cnt++;
+        }
+        if (newfs_alloc_data_range(inode, i, blk_cnt) != NEWFS_ERROR_NONE) {
+            ret = -NEWFS_ERROR_NOSPACE;
+        }
+        /* 分配到的块预留转为真正占用；逐块退化时可能只分到一部分，其余的保持延迟分配，缓存块仍是脏的 */
+        for (int j = i; j < i + blk_cnt; j++) {
+            if (inode->block_pointer[j] != -1) {
+                super.db_reserved--;
+                inode->delalloc &= ~(0x1 << j);
             }
         }
     }
+    return ret;
+}
 
-     /* 调整inodemap */
-    boolean find = FALSE;
-    for(int i = 0;i < NEWFS_BLKS_SIZE(super.ino_map_blks);i++) {
-        for(int j = 0;j < UINT8_BITS; j++) {
-            if(inode->ino = i * 8 + j) {
-                super.map_inode[i] &= (uint8_t)(~(0x1 << j));
-                find = TRUE;
-                break;
+/**
+ * @brief 在位图中占用第dno个数据块
+ */
+static void newfs_take_data(int dno) {
+    NEWFS_BM_SET(super.map_db, dno);
+    super.db_free--;
+    super.groups[NEWFS_DB_GROUP(dno)].db_free--;
+    newfs_journal_dirty_meta(super.db_map_offset + dno / UINT8_BITS);
+}
+
+/**
+ * @brief 分配一个不属于文件数据的数据块（目录树结点），占用位图
+ * 
+ * @param goal 期望的块号
+ * @return int 块号，没有空闲块返回-1
+ */
+int newfs_alloc_blk(int goal) {
+    int dno = newfs_find_free_run(goal, 1);
+
+    if (dno != -1) {
+        newfs_take_data(dno);
+    }
+    return dno;
+}
+
+/**
+ * @brief 为文件第blk_no块起的blk_cnt块分配一段连续的数据块，占用位图。
+ * 找不到足够长的连续空间时退化为逐块分配
+ * 
+ * @param inode 需要分配数据块的文件inode
+ * @param blk_no 该文件的第几块，对应的block_pointer必须都未分配
+ * @param blk_cnt 块数
+ * @return int
+ */
+int newfs_alloc_data_range(struct newfs_inode* inode, int blk_no, int blk_cnt) {
+    int goal = blk_no > 0 && inode->block_pointer[blk_no - 1] != -1 ? 
+               inode->block_pointer[blk_no - 1] + 1 : 
+               super.groups[NEWFS_INO_GROUP(inode->ino)].db_start;
+    int dno  = newfs_find_free_run(goal, blk_cnt);
+
+    if (dno == -1) {
+        if (blk_cnt == 1) {
+            return -NEWFS_ERROR_NOSPACE;
+        }
+        for (int i = 0; i < blk_cnt; i++) {
+            if (newfs_alloc_data_range(inode, blk_no + i, 1) != NEWFS_ERROR_NONE) {
+                return -NEWFS_ERROR_NOSPACE;
             }
         }
-        if(find) break;
+        return NEWFS_ERROR_NONE;
     }
 
-    free(inode);
+    for (int i = 0; i < blk_cnt; i++) {
+        newfs_take_data(dno + i);
+        inode->block_pointer[blk_no + i] = dno + i;
+    }
+    newfs_journal_dirty_inode(inode);
     return NEWFS_ERROR_NONE;
 }
 
@@ -282,22 +753,161 @@ int newfs_drop_inode(struct newfs_inode * inode) {
  * @return int
  */
 int newfs_alloc_data(struct newfs_inode* inode,int blk_no) {
-    boolean find = FALSE;
-    /* 检查位图是否有空位 */
-    for(int i = 0;i < super.ino_max / UINT8_BITS;i++) {
-            for(int j =0;j < UINT8_BITS; j++) {
-                if(!(super.map_db[i] & (0x1 << j))) {   //第8*j+i位为0，分配
-                    super.map_db[i] |= (0x1 << j);      //置1
-                    inode->block_pointer[blk_no] = 8 * j + i;
-                    find = TRUE;
-                    break;
-                }
+    return newfs_alloc_data_range(inode, blk_no, 1);
+}
+
+/**
+ * @brief 释放文件的第blk_no块，归还数据块位图（共享块只减引用计数，延迟分配块只退还预留）
+ * 并丢弃缓存，之后该块是空洞
+ * 
+ * @param inode 
+ * @param blk_no 该文件的第几块
+ */
+void newfs_free_data(struct newfs_inode* inode, int blk_no) {
+    int dno = inode->block_pointer[blk_no];
+
+    if (dno != -1) {
+        if (super.refcnt[dno] > 0) {        /* 还有其他文件共享，只减引用 */
+            super.refcnt[dno]--;
+            newfs_journal_dirty_meta(super.refcnt_offset + dno);
+        }
+        else {
+            newfs_journal_free_data(dno);       /* 事务提交后才归还位图 */
+        }
+        newfs_journal_dirty_inode(inode);
+    }
+    if (NEWFS_BLK_IS_DELALLOC(inode, blk_no)) {    /* 还没分配过，只退还预留 */
+        super.db_reserved--;
+        inode->delalloc &= ~(0x1 << blk_no);
+    }
+    if (inode->data[blk_no] != NULL) {
+        free(inode->data[blk_no]);
+        inode->data[blk_no] = NULL;
+        super.cache.nr_blks--;
+    }
+    inode->block_pointer[blk_no] = -1;
+    inode->data_dirty[blk_no] = FALSE;
+    inode->unwritten &= ~(0x1 << blk_no);
+}
+
+/**
+ * @brief 取文件第blk_no块的缓存用于读，第一次访问时才从磁盘读入
+ * 
+ * @param inode 
+ * @param blk_no 该文件的第几块
+ * @return uint8_t* 空洞或预分配未写入的块返回NULL，表示内容全0
+ */
+uint8_t* newfs_load_data(struct newfs_inode* inode, int blk_no) {
+    if (inode->data[blk_no] != NULL) {
+        newfs_stats_inc(&super.stats.blk_hit);
+    }
+    else if (inode->block_pointer[blk_no] != -1 && !NEWFS_BLK_IS_UNWRITTEN(inode, blk_no)) {
+        newfs_stats_inc(&super.stats.blk_miss);
+        inode->data[blk_no] = (uint8_t *)malloc(NEWFS_BLK_SIZE());
+        super.cache.nr_blks++;
+        if (newfs_driver_read(NEWFS_DB_OFS(inode->block_pointer[blk_no]), inode->data[blk_no],
+                              NEWFS_BLK_SIZE()) != NEWFS_ERROR_NONE) {
+            NEWFS_DBG("[%s] io error\n", __func__);
+            free(inode->data[blk_no]);
+            inode->data[blk_no] = NULL;
+            super.cache.nr_blks--;
+        }
+    }
+    return inode->data[blk_no];
+}
+
+/**
+ * @brief 取文件第blk_no块的缓存用于写入：没有数据块就只预留空间，提交时才分配；
+ * 与其他文件共享的块先写时复制，读出内容后放弃共享，同样等提交时再分配自己的块；
+ * 空洞或预分配块第一次写时给一块全0的缓存
+ * 
+ * @param inode 
+ * @param blk_no 该文件的第几块
+ * @return uint8_t* 空间不足返回NULL
+ */
+uint8_t* newfs_get_data(struct newfs_inode* inode, int blk_no) {
+    int dno = inode->block_pointer[blk_no];
+
+    if (dno == -1) {
+        if (!NEWFS_BLK_IS_DELALLOC(inode, blk_no) && 
+            newfs_reserve_data(inode, blk_no) != NEWFS_ERROR_NONE) {
+            return NULL;
+        }
+    }
+    else if (super.refcnt[dno] > 0) {
+        if (newfs_reserve_data(inode, blk_no) != NEWFS_ERROR_NONE) {
+            return NULL;
+        }
+        newfs_load_data(inode, blk_no);
+        inode->block_pointer[blk_no] = -1;
+        super.refcnt[dno]--;
+        newfs_journal_dirty_meta(super.refcnt_offset + dno);
+        newfs_journal_dirty_inode(inode);
+        inode->data_dirty[blk_no] = TRUE;
+    }
+
+    if (inode->data[blk_no] == NULL) {
+        inode->data[blk_no] = (uint8_t *)calloc(1, NEWFS_BLK_SIZE());
+        super.cache.nr_blks++;
+    }
+    return inode->data[blk_no];
+}
+
+/**
+ * @brief 把src从第src_blk块起的blk_cnt块克隆给dst的第dst_blk块起：
+ * dst直接指向src的数据块并增加引用计数，不复制数据。
+ * src在这段里比磁盘新的缓存块先刷回去，dst之后按需从磁盘读
+ * 
+ * @param src 源文件inode
+ * @param src_blk 源文件的第几块
+ * @param dst 目标文件inode
+ * @param dst_blk 目标文件的第几块
+ * @param blk_cnt 块数
+ * @return int 
+ */
+int newfs_clone_data(struct newfs_inode* src, int src_blk, 
+                     struct newfs_inode* dst, int dst_blk, int blk_cnt) {
+    if (newfs_alloc_delalloc(src) != NEWFS_ERROR_NONE) {    /* 共享前源文件的块要先落位 */
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    for (int i = 0; i < blk_cnt; i++) {
+        int s   = src_blk + i;
+        int d   = dst_blk + i;
+        int dno = src->block_pointer[s];
+
+        newfs_free_data(dst, d);
+        if (dno == -1) {                    /* 空洞克隆过去还是空洞 */
+            continue;
+        }
+
+        if (src->data_dirty[s]) {
+            if (newfs_driver_write(NEWFS_DB_OFS(dno), src->data[s], 
+                                   NEWFS_BLK_SIZE()) != NEWFS_ERROR_NONE) {
+                return -NEWFS_ERROR_IO;
             }
-            if(find) break;
+            src->data_dirty[s] = FALSE;
         }
 
-    if (!find) return -NEWFS_ERROR_NOSPACE;
-    
+        if (super.refcnt[dno] == MAX_REFCNT) {  /* 引用计数满了，只能真的复制一份 */
+            uint8_t* content = newfs_load_data(src, s);
+            uint8_t* copy    = newfs_get_data(dst, d);
+            if (copy == NULL) {
+                return -NEWFS_ERROR_NOSPACE;
+            }
+            if (content != NULL) {
+                memcpy(copy, content, NEWFS_BLK_SIZE());
+            }
+            dst->data_dirty[d] = TRUE;
+            continue;
+        }
+
+        super.refcnt[dno]++;
+        newfs_journal_dirty_meta(super.refcnt_offset + dno);
+        dst->block_pointer[d] = dno;
+        if (NEWFS_BLK_IS_UNWRITTEN(src, s)) {
+            dst->unwritten |= 0x1 << d;
+        }
+    }
     return NEWFS_ERROR_NONE;
 }
 
@@ -311,159 +921,127 @@ int newfs_alloc_data(struct newfs_inode* inode,int blk_no) {
 struct newfs_inode* newfs_read_inode(struct newfs_dentry * dentry, int ino) {
     struct newfs_inode* inode = (struct newfs_inode*)malloc(sizeof(struct newfs_inode));
     struct newfs_inode_d inode_d;
-    struct newfs_dentry* sub_dentry;
-    struct newfs_dentry_d dentry_d;
-    int    dir_cnt = 0, i;
+    struct ddriver_state mark;
+    uint64_t start = newfs_stats_phase_begin(&mark);
     /* 从磁盘读索引结点 */
-    if (newfs_driver_read(NEWFS_INO_OFS(ino), (uint8_t *)&inode_d, 
+    if (newfs_journal_read(NEWFS_INO_OFS(ino), (uint8_t *)&inode_d, 
                         sizeof(struct newfs_inode_d)) != NEWFS_ERROR_NONE) {
         NEWFS_DBG("[%s] io error\n", __func__);
+        free(inode);
         return NULL;                    
     }
-    inode->dir_cnt = 0;
     inode->ino = inode_d.ino;
     inode->size = inode_d.size;
     inode->dentry = dentry;
     inode->dentrys = NULL;
+    inode->atime = inode_d.atime;
+    inode->mtime = inode_d.mtime;
+    inode->ctime = inode_d.ctime;
+    inode->cache_valid = FALSE;
+    inode->unwritten = inode_d.unwritten;
+    inode->delalloc = 0;
+    inode->jdirty = FALSE;
+    inode->jnext = NULL;
     for(int i = 0; i < MAX_DATA_PERFILE; i++){
         inode->block_pointer[i] = inode_d.block_pointer[i];
+        inode->data[i] = NULL;
+        inode->data_dirty[i] = FALSE;
     }
 
-    //判断结点类型
-    // 节点是目录，读取每一个目录项
-    if (NEWFS_IS_DIR(inode)) {
-        dir_cnt = inode_d.dir_cnt;
-        // 对于节点指向的所有数据块
-        for(i = 0;i < MAX_DATA_PERFILE;i++) {
-            if(!dir_cnt) break; //没有目录项了   
-            int offset = NEWFS_DB_OFS(inode->block_pointer[i]);
-            // 对于每个数据块，逐dentry读取
-            while(dir_cnt && offset + sizeof(struct newfs_dentry_d) < NEWFS_DB_OFS(inode->block_pointer[i] + 1)) {
-                if (newfs_driver_read(offset, (uint8_t *)&dentry_d, 
-                    sizeof(struct newfs_dentry_d)) != NEWFS_ERROR_NONE) {
-                NEWFS_DBG("[%s] io error\n", __func__);
-                return NULL;
-                }
-                sub_dentry = new_dentry(dentry_d.name, dentry_d.ftype);
-                sub_dentry->parent = inode->dentry;
-                sub_dentry->ino    = dentry_d.ino; 
-                newfs_alloc_dentry(inode, sub_dentry);
-
-                //下一个dentry
-                offset += sizeof(struct newfs_dentry_d);
-                dir_cnt--;
-            }
-        }
-    }
+    //节点是目录，目录项在查找时才从目录树读入（newfs_find_dentry）
+    inode->dir_cnt = inode_d.dir_cnt;
+    newfs_cache_add(inode);
 
-    //节点是文件
-    else if (NEWFS_IS_REG(inode)) {
-        for(i = 0;i < MAX_DATA_PERFILE; i++) {
-            inode->data[i] = (uint8_t *)malloc(NEWFS_BLK_SIZE());
-            if (newfs_driver_read(NEWFS_DB_OFS(inode->block_pointer[i]), (uint8_t *)inode->data[i], 
-                NEWFS_BLK_SIZE()) != NEWFS_ERROR_NONE) {
-                NEWFS_DBG("[%s] io error\n", __func__);
-                return NULL;                    
-            }
-        }
-    }
+    //节点是文件，数据块在第一次访问时才读入（newfs_load_data）
+    newfs_stats_phase_end(NEWFS_STAT_READ_INODE, start, &mark, sizeof(struct newfs_inode_d));
     return inode;
 }
 
 /**
- * @brief 将内存inode及其下方结构全部刷回磁盘
+ * @brief 把内存inode转成磁盘上的inode_d
  * 
  * @param inode 
- * @return int 
+ * @param inode_d 输出
  */
-int newfs_sync_inode(struct newfs_inode *inode) {
-    struct newfs_inode_d  inode_d;
-    struct newfs_dentry*  dentry_cursor;
-    struct newfs_dentry*  pre_dentry_cursor;
-    struct newfs_dentry_d dentry_d;
-    int ino             = inode->ino;
-    
-    //将内存的inode刷回磁盘的inode_d
-    inode_d.ino         = ino;
-    inode_d.size        = inode->size;
-    inode_d.ftype       = inode->dentry->ftype;
-    inode_d.dir_cnt     = inode->dir_cnt;
-
-    for(int i = 0;i < MAX_DATA_PERFILE; i++) 
-        inode_d.block_pointer[i] = inode->block_pointer[i];
-
-    /* 先写inode本身 */
-    if (newfs_driver_write(NEWFS_INO_OFS(ino), (uint8_t *)&inode_d, 
-                     sizeof(struct newfs_inode_d)) != NEWFS_ERROR_NONE) {
-        NEWFS_DBG("[%s] io error\n", __func__);
-        return -NEWFS_ERROR_IO;
+void newfs_inode_to_d(struct newfs_inode* inode, struct newfs_inode_d* inode_d) {
+    memset(inode_d, 0, sizeof(struct newfs_inode_d));
+    inode_d->ino         = inode->ino;
+    inode_d->size        = inode->size;
+    inode_d->ftype       = inode->dentry->ftype;
+    inode_d->dir_cnt     = inode->dir_cnt;
+    inode_d->atime       = inode->atime;
+    inode_d->mtime       = inode->mtime;
+    inode_d->ctime       = inode->ctime;
+    inode_d->unwritten   = inode->unwritten;
+    for (int i = 0; i < MAX_DATA_PERFILE; i++) {
+        inode_d->block_pointer[i] = inode->block_pointer[i];
     }
+}
 
-    /* 再写inode下方的数据 */
-    if (NEWFS_IS_DIR(inode)) { /* 如果当前inode是目录，那么数据是目录项，且目录项的inode也要写回 */                          
-        dentry_cursor = inode->dentrys;
+/**
+ * @brief 缓存块比磁盘新且已经有数据块，需要写回
+ */
+static boolean newfs_data_need_flush(struct newfs_inode* inode, int i) {
+    return inode->data_dirty[i] && inode->data[i] != NULL &&
+           inode->block_pointer[i] != -1 && !NEWFS_BLK_IS_UNWRITTEN(inode, i);
+}
 
-        for(int i = 0;i < MAX_DATA_PERFILE;i++) {
-            if(dentry_cursor == NULL) break;
-            int offset = NEWFS_DB_OFS(inode->block_pointer[i]);
-            while ((dentry_cursor != NULL) && (offset < NEWFS_DB_OFS(inode->block_pointer[i] + 1))) {
-                memcpy(dentry_d.name, dentry_cursor->name, MAX_NAME_LEN);
-                dentry_d.ftype = dentry_cursor->ftype;
-                dentry_d.ino = dentry_cursor->ino;
-                if (newfs_driver_write(offset, (uint8_t *)&dentry_d, 
-                    sizeof(struct newfs_dentry_d)) != NEWFS_ERROR_NONE) {
-                    NEWFS_DBG("[%s] io error\n", __func__);
-                    return -NEWFS_ERROR_IO;                     
-                }
-                
-                //递归调用
-                if (dentry_cursor->inode != NULL) {
-                    newfs_sync_inode(dentry_cursor->inode);
-                }
-
-                //下一个目录项
-                pre_dentry_cursor = dentry_cursor;
-                dentry_cursor = dentry_cursor->brother;
-                free(pre_dentry_cursor);
-                
-                offset += sizeof(struct newfs_dentry_d);
-            }
+/**
+ * @brief 把文件比磁盘新的缓存块加入写回队列，写回成功后再用newfs_flush_data_done清脏标记
+ * 
+ * @param inode 
+ * @param wb 提交前缓存块不能被释放
+ */
+void newfs_flush_data(struct newfs_inode* inode, struct newfs_wb* wb) {
+    for (int i = 0; i < MAX_DATA_PERFILE; i++) {
+        if (newfs_data_need_flush(inode, i)) {
+            newfs_wb_add(wb, NEWFS_DB_OFS(inode->block_pointer[i]) / NEWFS_BLK_SIZE(), inode->data[i]);
         }
     }
-    else if (NEWFS_IS_REG(inode)) { /* 如果当前inode是文件，那么数据是文件内容，直接写即可 */
-        for(int i =0;i < MAX_DATA_PERFILE;i++) {
-            if(inode->block_pointer[i] == -1) continue;
-            if (newfs_driver_write(NEWFS_DB_OFS(inode->block_pointer[i]), inode->data[i], 
-                NEWFS_BLK_SIZE()) != NEWFS_ERROR_NONE) {
-                NEWFS_DBG("[%s] io error\n", __func__);
-                return -NEWFS_ERROR_IO;
-            }
-            free(inode->data[i]);
+}
+
+/**
+ * @brief newfs_flush_data加入队列的块已经写回，清掉脏标记；写回失败时不调用，缓存块保持脏
+ * 
+ * @param inode 
+ */
+void newfs_flush_data_done(struct newfs_inode* inode) {
+    for (int i = 0; i < MAX_DATA_PERFILE; i++) {
+        if (newfs_data_need_flush(inode, i)) {
+            inode->data_dirty[i] = FALSE;
         }
     }
-    free(inode);
-    return NEWFS_ERROR_NONE;
 }
 
 /**
- * @brief 
+ * @brief 释放内存中的inode及其下方已读入的结构，不写盘（修改已经由日志提交）
  * 
  * @param inode 
- * @param dir [0...]
- * @return struct newfs_dentry* 
  */
-struct newfs_dentry* newfs_get_dentry(struct newfs_inode * inode, int dir) {
-    struct newfs_dentry* dentry_cursor = inode->dentrys;
-    int    cnt = 0;
-    while (dentry_cursor)
-    {
-        if (dir == cnt) {
-            return dentry_cursor;
+void newfs_release_inode(struct newfs_inode *inode) {
+    struct newfs_dentry*  dentry_cursor;
+    struct newfs_dentry*  pre_dentry_cursor;
+
+    if (NEWFS_IS_DIR(inode)) {
+        dentry_cursor = inode->dentrys;
+        while (dentry_cursor != NULL) {
+            if (dentry_cursor->inode != NULL) {
+                newfs_release_inode(dentry_cursor->inode);
+            }
+            pre_dentry_cursor = dentry_cursor;
+            dentry_cursor = dentry_cursor->brother;
+            free(pre_dentry_cursor);
+            super.cache.nr_dentrys--;
+        }
+    }
+    for (int i = 0; i < MAX_DATA_PERFILE; i++) {
+        if (inode->data[i] != NULL) {
+            free(inode->data[i]);
+            super.cache.nr_blks--;
         }
-        cnt++;
-        dentry_cursor = dentry_cursor->brother;
     }
-    return NULL;
+    newfs_cache_remove(inode);
+    free(inode);
 }
 
 /**
@@ -498,8 +1076,11 @@ struct newfs_dentry* newfs_lookup(const char * path, boolean* is_find, boolean*
     int   total_lvl = newfs_calc_lvl(path);
     int   lvl = 0;
     boolean is_hit;
+    struct ddriver_state mark;
+    uint64_t start = newfs_stats_phase_begin(&mark);
     char* fname = NULL;
-    char* path_cpy = (char*)malloc(sizeof(path));
+    char* path_cpy = (char*)malloc(strlen(path) + 1);
+    *is_find = FALSE;
     *is_root = FALSE;
     strcpy(path_cpy, path);
 
@@ -515,11 +1096,16 @@ struct newfs_dentry* newfs_lookup(const char * path, boolean* is_find, boolean*
     {   
         lvl++;
         if (dentry_cursor->inode == NULL) {           /* Cache机制 */
-            newfs_read_inode(dentry_cursor, dentry_cursor->ino);
+            newfs_stats_inc(&super.stats.inode_miss);
+            dentry_cursor->inode = newfs_read_inode(dentry_cursor, dentry_cursor->ino);
+        }
+        else {
+            newfs_stats_inc(&super.stats.inode_hit);
         }
 
         // 获取当前inode对应的inode
         inode = dentry_cursor->inode;
+        newfs_cache_touch(inode);
 
         //文件夹名是文件类型，路径出错
         if (NEWFS_IS_REG(inode) && lvl < total_lvl) {
@@ -530,17 +1116,8 @@ struct newfs_dentry* newfs_lookup(const char * path, boolean* is_find, boolean*
 
         //是文件夹类型，遍历目录项
         if (NEWFS_IS_DIR(inode)) {
-            dentry_cursor = inode->dentrys; //指向头dentry
-            is_hit        = FALSE;
-
-            while (dentry_cursor)   /* 遍历子目录项 */
-            {
-                if (memcmp(dentry_cursor->name, fname, strlen(fname)) == 0) {
-                    is_hit = TRUE;
-                    break;
-                }
-                dentry_cursor = dentry_cursor->brother;
-            }
+            dentry_cursor = newfs_find_dentry(inode, fname);    /* 冷目录只读树中的一条路径 */
+            is_hit        = (dentry_cursor != NULL);
             
             //没在该层文件夹找到该文件，报错，退出
             if (!is_hit) {
@@ -562,19 +1139,102 @@ struct newfs_dentry* newfs_lookup(const char * path, boolean* is_find, boolean*
 
     //从磁盘中读出目标inode
     if (dentry_ret->inode == NULL) {
+        newfs_stats_inc(&super.stats.inode_miss);
         dentry_ret->inode = newfs_read_inode(dentry_ret, dentry_ret->ino);
     }
+    newfs_cache_touch(dentry_ret->inode);
+    newfs_trace_ino(dentry_ret->ino);
     
+    free(path_cpy);
+    if (newfs_stats_phase_end(NEWFS_STAT_LOOKUP, start, &mark, 0)) {      /* 读了盘的另记一份 */
+        newfs_stats_phase_end(NEWFS_STAT_LOOKUP_MISS, start, &mark, 0);
+    }
     return dentry_ret;
 }
 
+/**
+ * @brief 把内存中的布局信息和卸载状态写入超级块
+ * 
+ * @param state NEWFS_STATE_*
+ * @return int 
+ */
+int newfs_write_super(uint32_t state) {
+    struct newfs_super_d  newfs_super_d; 
+
+    memset(&newfs_super_d, 0, sizeof(struct newfs_super_d));
+    newfs_super_d.magic             = NEWFS_MAGIC_NUM;
+    newfs_super_d.sb_blks           = super.sb_blks;
+    newfs_super_d.sb_offset         = super.sb_offset;
+    newfs_super_d.ino_map_blks      = super.ino_map_blks;
+    newfs_super_d.ino_map_offset    = super.ino_map_offset;
+    newfs_super_d.db_map_blks       = super.db_map_blks;
+    newfs_super_d.db_map_offset     = super.db_map_offset;
+    newfs_super_d.refcnt_blks       = super.refcnt_blks;
+    newfs_super_d.refcnt_offset     = super.refcnt_offset;
+    newfs_super_d.journal_blks      = super.journal.blks;
+    newfs_super_d.journal_offset    = super.journal.offset;
+    newfs_super_d.ino_blks          = super.ino_blks;
+    newfs_super_d.ino_offset        = super.ino_offset;
+    newfs_super_d.db_blks           = super.db_blks;
+    newfs_super_d.db_offset         = super.db_offset;
+
+    newfs_super_d.ino_max           = super.ino_max;
+    newfs_super_d.file_max          = super.file_max;
+
+    newfs_super_d.blks_size         = super.blks_size;
+    newfs_super_d.features          = super.features;
+
+    newfs_super_d.state             = state;
+    newfs_super_d.journal_seq       = super.journal.seq;
+    for (int gno = 0; gno < NEWFS_GROUPS; gno++) {
+        newfs_super_d.group_dirs[gno] = super.groups[gno].dirs;
+    }
+
+    if (newfs_driver_write(NEWFS_SUPER_OFS, (uint8_t *)&newfs_super_d, 
+                           sizeof(struct newfs_super_d)) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    super.state = state;
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 挂载失败时关闭设备，释放已经建立的结构
+ *
+ * @param root_dentry
+ */
+static void newfs_mount_abort(struct newfs_dentry* root_dentry) {
+    free(root_dentry);
+    free(super.map_inode);
+    free(super.map_db);
+    free(super.refcnt);
+    free(super.journal.ckpt_blks);
+    free(super.journal.ckpt_imgs);
+    free(super.journal.freed);
+    free(super.journal.meta_blks);
+    super.map_inode = NULL;
+    super.map_db    = NULL;
+    super.refcnt    = NULL;
+    super.journal.ckpt_blks = NULL;
+    super.journal.ckpt_imgs = NULL;
+    super.journal.freed     = NULL;
+    super.journal.meta_blks = NULL;
+    if (super.img_fd >= 0) {
+        close(super.img_fd);
+        super.img_fd = -1;
+    }
+    ddriver_close(super.fd);
+    newfs_bufpool_destroy();
+    newfs_cache_destroy();
+}
+
 /**
  * @brief 挂载newfs, Layout 如下
  * 
  * Layout
- * | Super | Inode Map | Data Map | Inode | Data |
+ * | Super | Inode Map | Data Map | Refcount | Journal | Inode | Data |
  * 
- * BLK_SZ = IO_SZ * 2
+ * 各区大小和BLK_SZ由mkfs.newfs写在超级块中，旧盘BLK_SZ = IO_SZ * 2
  * 
  * @param options 
  * @return int 
@@ -585,42 +1245,79 @@ int newfs_mount(struct custom_options options){
     struct newfs_super_d  newfs_super_d; 
     struct newfs_dentry*  root_dentry;
     struct newfs_inode*   root_inode;
-    boolean             is_init = FALSE;
+    struct ddriver_state  mark;
+    uint64_t              stat_start;
 
     super.is_mounted = FALSE;
+    super.map_inode  = NULL;                            /* 失败时newfs_mount_abort只释放这次分配的 */
+    super.map_db     = NULL;
+    super.refcnt     = NULL;
+    super.journal.ckpt_blks = NULL;
+    super.journal.ckpt_imgs = NULL;
+    super.journal.freed     = NULL;
+    super.journal.meta_blks = NULL;
 
     driver_fd = ddriver_open(newfs_options.device);
     if (driver_fd < 0) return driver_fd;
     super.fd = driver_fd;
 
+    /* 设备是普通镜像文件时，另开一个只读fd，读文件时把干净块直接交给FUSE splice */
+    super.img_fd = open(newfs_options.device, O_RDONLY);
+    if (super.img_fd >= 0) {
+        struct stat img_stat;
+        if (fstat(super.img_fd, &img_stat) != 0 || !S_ISREG(img_stat.st_mode)) {
+            close(super.img_fd);
+            super.img_fd = -1;
+        }
+    }
+
     ddriver_ioctl(super.fd, IOC_REQ_DEVICE_SIZE,  &super.disk_size);
     ddriver_ioctl(super.fd, IOC_REQ_DEVICE_IO_SZ,  &super.io_size);
     super.blks_size = NEWFS_IO_SIZE() * 2;
     super.blks_nums = super.disk_size / NEWFS_BLK_SIZE();
 
     root_dentry = new_dentry("/", DIR);
+    newfs_cache_init(options.cache_kb);
+    newfs_stats_reset();
+    stat_start = newfs_stats_phase_begin(&mark);
+    if (newfs_bufpool_init() != NEWFS_ERROR_NONE) {
+        newfs_mount_abort(root_dentry);
+        return -NEWFS_ERROR_NOSPACE;
+    }
 
     if(newfs_driver_read(NEWFS_SUPER_OFS, (uint8_t *)(&newfs_super_d),
         sizeof(struct newfs_super_d)) != NEWFS_ERROR_NONE) {
-                return -NEWFS_ERROR_IO;
+        newfs_mount_abort(root_dentry);
+        return -NEWFS_ERROR_IO;
     }
 
-    if(newfs_super_d.magic != NEWFS_MAGIC) {
-        newfs_super_d.sb_blks           = SUPER_BLKS_NUM;
-        newfs_super_d.sb_offset         = NEWFS_SUPER_OFS;
-        newfs_super_d.ino_map_blks      = INODE_MAP_BLKS_NUM;
-        newfs_super_d.ino_map_offset    = newfs_super_d.sb_offset + NEWFS_BLKS_SIZE(newfs_super_d.sb_blks);
-        newfs_super_d.db_map_blks       = DATA_MAP_BLKS_NUM;
-        newfs_super_d.db_map_offset     = newfs_super_d.ino_map_offset + NEWFS_BLKS_SIZE(newfs_super_d.ino_map_blks);
-        newfs_super_d.ino_blks          = MAX_INODE_BLKS_NUM;
-        newfs_super_d.ino_offset        = newfs_super_d.db_map_offset + NEWFS_BLKS_SIZE(newfs_super_d.db_map_blks);
-        newfs_super_d.db_blks           = MAX_DATA_BLKS_NUM;
-        newfs_super_d.db_offset         = newfs_super_d.ino_offset + NEWFS_BLKS_SIZE(newfs_super_d.ino_blks);
-
-        newfs_super_d.ino_max           = MAX_INODE_BLKS_NUM * MAX_INODE_NUM_PERBLK;
-        newfs_super_d.file_max          = MAX_DATA_BLKS_NUM;
-
-        is_init = TRUE;
+    /* 不再隐式格式化：超级块坏了时拒绝挂载，而不是把整个盘清空 */
+    if (newfs_super_d.magic != NEWFS_MAGIC) {
+        NEWFS_DBG("[%s] %s is not formatted, run mkfs.newfs first\n", __func__, newfs_options.device);
+        newfs_mount_abort(root_dentry);
+        return -NEWFS_ERROR_INVAL;
+    }
+    if ((newfs_super_d.features & ~NEWFS_FEATURE_ALL) != 0) {
+        NEWFS_DBG("[%s] unknown features 0x%x\n", __func__, newfs_super_d.features);
+        newfs_mount_abort(root_dentry);
+        return -NEWFS_ERROR_NOTSUPP;
+    }
+    /* 旧格式的单层目录索引不能按目录树读，要重新格式化 */
+    if ((newfs_super_d.features & NEWFS_FEATURE_REQUIRED) != NEWFS_FEATURE_REQUIRED) {
+        NEWFS_DBG("[%s] old directory format, features 0x%x\n", __func__, newfs_super_d.features);
+        newfs_mount_abort(root_dentry);
+        return -NEWFS_ERROR_NOTSUPP;
+    }
+    if (newfs_super_d.blks_size != 0) {
+        super.blks_size = newfs_super_d.blks_size;
+        super.blks_nums = super.disk_size / NEWFS_BLK_SIZE();
+    }
+    if (NEWFS_BLK_SIZE() % NEWFS_IO_SIZE() != 0 ||
+        newfs_super_d.journal_blks < JOURNAL_BLKS_NUM || newfs_super_d.journal_blks > JOURNAL_BLKS_MAX ||
+        newfs_super_d.db_offset + (long)NEWFS_BLKS_SIZE(newfs_super_d.db_blks) > super.disk_size) {
+        NEWFS_DBG("[%s] bad layout in super block\n", __func__);
+        newfs_mount_abort(root_dentry);
+        return -NEWFS_ERROR_INVAL;
     }
 
     /* 建立in mem结构 */
@@ -630,6 +1327,10 @@ int newfs_mount(struct custom_options options){
     super.ino_map_offset            = newfs_super_d.ino_map_offset; 
     super.db_map_blks               = newfs_super_d.db_map_blks; 
     super.db_map_offset             = newfs_super_d.db_map_offset; 
+    super.refcnt_blks               = newfs_super_d.refcnt_blks;
+    super.refcnt_offset             = newfs_super_d.refcnt_offset;
+    super.journal.blks              = newfs_super_d.journal_blks;
+    super.journal.offset            = newfs_super_d.journal_offset;
     super.ino_blks                  = newfs_super_d.ino_blks;
     super.ino_offset                = newfs_super_d.ino_offset; 
     super.db_blks                   = newfs_super_d.db_blks; 
@@ -637,34 +1338,53 @@ int newfs_mount(struct custom_options options){
 
     super.ino_max                   = newfs_super_d.ino_max; 
     super.file_max                  = newfs_super_d.file_max; 
+    super.features                  = newfs_super_d.features;
 
     super.map_inode = (uint8_t *)malloc(NEWFS_BLKS_SIZE(newfs_super_d.ino_map_blks));
     super.map_db = (uint8_t *)malloc(NEWFS_BLKS_SIZE(newfs_super_d.db_map_blks));
-    // newfs_dump_map();
+    super.refcnt = (uint8_t *)malloc(NEWFS_BLKS_SIZE(newfs_super_d.refcnt_blks));
+    super.state  = newfs_super_d.state;
 
-    if(newfs_driver_read(super.ino_map_offset, (uint8_t *)(super.map_inode), 
-        NEWFS_BLKS_SIZE(super.ino_map_blks)) != NEWFS_ERROR_NONE) {
-        return -NEWFS_ERROR_IO;
+    if (super.map_inode == NULL || super.map_db == NULL || super.refcnt == NULL) {
+        newfs_mount_abort(root_dentry);
+        return -NEWFS_ERROR_NOSPACE;
     }
 
-    if(newfs_driver_read(super.db_map_offset, (uint8_t *)(super.map_db), 
-        NEWFS_BLKS_SIZE(super.db_map_blks)) != NEWFS_ERROR_NONE) {
-        return -NEWFS_ERROR_IO;
+    /* 上次没有正常卸载时，先重放日志里已提交的事务，再读位图 */
+    if ((ret = newfs_journal_init(newfs_super_d.journal_seq)) != NEWFS_ERROR_NONE) {
+        newfs_mount_abort(root_dentry);
+        return ret;
     }
 
+    if(newfs_driver_read(super.ino_map_offset, (uint8_t *)(super.map_inode), 
+        NEWFS_BLKS_SIZE(super.ino_map_blks)) != NEWFS_ERROR_NONE ||
+       newfs_driver_read(super.db_map_offset, (uint8_t *)(super.map_db), 
+        NEWFS_BLKS_SIZE(super.db_map_blks)) != NEWFS_ERROR_NONE ||
+       newfs_driver_read(super.refcnt_offset, (uint8_t *)(super.refcnt), 
+        NEWFS_BLKS_SIZE(super.refcnt_blks)) != NEWFS_ERROR_NONE) {
+        newfs_mount_abort(root_dentry);
+        return -NEWFS_ERROR_IO;
+    }
 
-    /* 初始化根目录 */
-    if(is_init) {
-        root_inode = newfs_alloc_inode(root_dentry);
-        newfs_sync_inode(root_inode);
+    newfs_init_groups(newfs_super_d.group_dirs);
+    if (super.state != NEWFS_STATE_CLEAN && newfs_count_dirs() != NEWFS_ERROR_NONE) {
+        newfs_mount_abort(root_dentry);
+        return -NEWFS_ERROR_IO;
     }
 
     root_inode = newfs_read_inode(root_dentry, NEWFS_ROOT_INO);
+    if (root_inode == NULL) {
+        NEWFS_DBG("[%s] cannot read root inode\n", __func__);
+        newfs_mount_abort(root_dentry);
+        return -NEWFS_ERROR_IO;
+    }
     root_dentry->inode = root_inode;
     super.root_dentry = root_dentry;
     super.is_mounted = TRUE;
-
-    newfs_dump_map();
+    newfs_stats_phase_end(NEWFS_STAT_MOUNT, stat_start, &mark, 0);
+    if (options.trace != NULL && newfs_trace_init(options.trace) != NEWFS_ERROR_NONE) {
+        NEWFS_DBG("[%s] cannot trace to %s\n", __func__, options.trace);
+    }
     return ret;
 }
 
@@ -674,52 +1394,37 @@ int newfs_mount(struct custom_options options){
  * @return int 
  */
 int newfs_umount(){
-struct newfs_super_d  newfs_super_d; 
-
     if (!super.is_mounted) {
         return NEWFS_ERROR_NONE;
     }
 
-    newfs_sync_inode(super.root_dentry->inode);     /* 从根节点向下刷写节点 */
-                                                    
-    newfs_super_d.magic             = NEWFS_MAGIC_NUM;
-    newfs_super_d.sb_blks           = super.sb_blks;
-    newfs_super_d.sb_offset         = super.sb_offset;
-    newfs_super_d.ino_map_blks      = super.ino_map_blks;
-    newfs_super_d.ino_map_offset    = super.ino_map_offset;
-    newfs_super_d.db_map_blks       = super.db_map_blks;
-    newfs_super_d.db_map_offset     = super.db_map_offset;
-    newfs_super_d.ino_blks          = super.ino_blks;
-    newfs_super_d.ino_offset        = super.ino_offset;
-    newfs_super_d.db_blks           = super.db_blks;
-    newfs_super_d.db_offset         = super.db_offset;
-
-    newfs_super_d.ino_max           = super.ino_max;
-    newfs_super_d.file_max          = super.file_max;
-
-    //刷超级块进磁盘
-    if (newfs_driver_write(NEWFS_SUPER_OFS, (uint8_t *)&newfs_super_d, 
-                     sizeof(struct newfs_super_d)) != NEWFS_ERROR_NONE) {
-        return -NEWFS_ERROR_IO;
-    }
-
-    //刷节点位图进磁盘
-    if (newfs_driver_write(newfs_super_d.ino_map_offset, (uint8_t *)(super.map_inode), 
-                         NEWFS_BLKS_SIZE(newfs_super_d.ino_map_blks)) != NEWFS_ERROR_NONE) {
+    /* 只写回日志里已提交的块，挂载后改过元数据时再把超级块标记为正常卸载 */
+    if (newfs_journal_checkpoint() != NEWFS_ERROR_NONE) {
         return -NEWFS_ERROR_IO;
     }
-
-    //刷数据位图进磁盘
-    if (newfs_driver_write(newfs_super_d.db_map_offset, (uint8_t *)(super.map_db), 
-                         NEWFS_BLKS_SIZE(newfs_super_d.db_map_blks)) != NEWFS_ERROR_NONE) {
+    if (super.state != NEWFS_STATE_CLEAN && newfs_write_super(NEWFS_STATE_CLEAN) != NEWFS_ERROR_NONE) {
         return -NEWFS_ERROR_IO;
     }
+    newfs_release_inode(super.root_dentry->inode);
+    free(super.root_dentry);
 
     free(super.map_inode);
     free(super.map_db);
+    free(super.refcnt);
+    free(super.journal.ckpt_blks);
+    free(super.journal.ckpt_imgs);
+    free(super.journal.freed);
+    free(super.journal.meta_blks);
+    newfs_cache_destroy();
 
     //关闭驱动
+    if (super.img_fd >= 0) {
+        close(super.img_fd);
+        super.img_fd = -1;
+    }
     ddriver_close(super.fd);
+    newfs_bufpool_destroy();
+    newfs_trace_destroy();
 
     return NEWFS_ERROR_NONE;
 }
\ No newline at end of file
@@ -0,0 +1,92 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super super;
+extern struct custom_options newfs_options;
+
+/**
+ * @brief 初始化一个空的写回队列
+ *
+ * @param wb
+ */
+void newfs_wb_init(struct newfs_wb* wb) {
+    wb->reqs = NULL;
+    wb->nr   = 0;
+    wb->cap  = 0;
+}
+
+/**
+ * @brief 把一个块加入写回队列，只记录指针，提交前不能释放或修改content
+ *
+ * @param wb
+ * @param blk 设备块号
+ * @param content 一个逻辑块的内容
+ */
+void newfs_wb_add(struct newfs_wb* wb, int blk, uint8_t* content) {
+    if (wb->nr == wb->cap) {
+        wb->cap  = wb->cap ? wb->cap * 2 : 16;
+        wb->reqs = (struct newfs_wb_req*)realloc(wb->reqs, wb->cap * sizeof(struct newfs_wb_req));
+    }
+    wb->reqs[wb->nr].blk     = blk;
+    wb->reqs[wb->nr].seq     = wb->nr;
+    wb->reqs[wb->nr].content = content;
+    wb->nr++;
+}
+
+/**
+ * @brief 按块号排序，块号相同时按加入顺序
+ */
+static int newfs_wb_cmp(const void* a, const void* b) {
+    const struct newfs_wb_req* ra = (const struct newfs_wb_req*)a;
+    const struct newfs_wb_req* rb = (const struct newfs_wb_req*)b;
+
+    if (ra->blk != rb->blk) {
+        return ra->blk < rb->blk ? -1 : 1;
+    }
+    return ra->seq - rb->seq;
+}
+
+/**
+ * @brief 提交写回队列：按块号排序，同一块只写最后加入的内容，
+ * 块号连续的请求拼成一次写（最多NEWFS_WB_MAX_RUN块），一段只寻道一次
+ *
+ * @param wb 提交后清空
+ * @return int
+ */
+int newfs_wb_submit(struct newfs_wb* wb) {
+    uint8_t* run;
+    int      ret = NEWFS_ERROR_NONE;
+    int      i, start, nr_blks;
+    struct ddriver_state mark;
+    uint64_t stat_start;
+
+    if (wb->nr == 0) {
+        return NEWFS_ERROR_NONE;
+    }
+    stat_start = newfs_stats_phase_begin(&mark);
+    qsort(wb->reqs, wb->nr, sizeof(struct newfs_wb_req), newfs_wb_cmp);
+
+    run = newfs_buf_get(NEWFS_BLKS_SIZE(NEWFS_WB_MAX_RUN));
+    i = 0;
+    while (i < wb->nr) {
+        start   = wb->reqs[i].blk;
+        nr_blks = 0;
+        while (i < wb->nr && nr_blks < NEWFS_WB_MAX_RUN && wb->reqs[i].blk == start + nr_blks) {
+            while (i + 1 < wb->nr && wb->reqs[i + 1].blk == wb->reqs[i].blk) {
+                i++;                                        /* 被后加入的内容覆盖 */
+            }
+            memcpy(run + NEWFS_BLKS_SIZE(nr_blks), wb->reqs[i].content, NEWFS_BLK_SIZE());
+            nr_blks++;
+            i++;
+        }
+        if (newfs_driver_write(NEWFS_BLKS_SIZE(start), run, NEWFS_BLKS_SIZE(nr_blks)) != NEWFS_ERROR_NONE) {
+            ret = -NEWFS_ERROR_IO;
+        }
+    }
+    newfs_buf_put(run);
+    /* 请求的块数算作本身要写的量，同一块多次加入只写一次时放大小于1 */
+    newfs_stats_phase_end(NEWFS_STAT_WRITEBACK, stat_start, &mark, NEWFS_BLKS_SIZE(wb->nr));
+
+    free(wb->reqs);
+    newfs_wb_init(wb);
+    return ret;
+}
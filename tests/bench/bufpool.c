@@ -0,0 +1,99 @@
+/**
+ * 驱动层微基准：不经过FUSE，直接挂载设备后反复做inode大小的读改写，
+ * 统计I/O路径上每次操作的堆分配次数和耗时。
+ *
+ * 链接时用 -Wl,--wrap=malloc,--wrap=calloc,--wrap=posix_memalign 统计分配，
+ * 见CMakeLists.txt中的newfs_bufpool_bench
+ *
+ * 用法: newfs_bufpool_bench [设备路径] [次数]
+ * 开始时会重新格式化设备，跑完后设备上的inode表和数据块都是无意义的内容
+ */
+#include "newfs.h"
+
+struct custom_options newfs_options;
+struct newfs_super    super;
+
+static long nr_alloc;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t nmemb, size_t size);
+int   __real_posix_memalign(void** ptr, size_t align, size_t size);
+
+void* __wrap_malloc(size_t size) {
+    nr_alloc++;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t nmemb, size_t size) {
+    nr_alloc++;
+    return __real_calloc(nmemb, size);
+}
+
+int __wrap_posix_memalign(void** ptr, size_t align, size_t size) {
+    nr_alloc++;
+    return __real_posix_memalign(ptr, align, size);
+}
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * @brief 跑一组操作，打印每次操作的分配次数和耗时
+ */
+static void run(const char* name, int iters, int size, boolean is_write) {
+    struct newfs_inode_d inode_d;
+    uint8_t* blks = (uint8_t*)calloc(1, size);
+    long   alloc0;
+    double t0, t1;
+
+    memset(&inode_d, 0, sizeof(inode_d));
+    alloc0 = nr_alloc;
+    t0 = now_ns();
+    for (int i = 0; i < iters; i++) {
+        int ino = i % super.ino_max;
+        if (size == 0) {                    /* 一个inode：块内读改写 */
+            if (is_write) {
+                newfs_driver_write(NEWFS_INO_OFS(ino), (uint8_t*)&inode_d, sizeof(inode_d));
+            }
+            else {
+                newfs_driver_read(NEWFS_INO_OFS(ino), (uint8_t*)&inode_d, sizeof(inode_d));
+            }
+        }
+        else if (is_write) {
+            newfs_driver_write(NEWFS_DB_OFS(i % (super.db_blks - size / NEWFS_BLK_SIZE())), blks, size);
+        }
+        else {
+            newfs_driver_read(NEWFS_DB_OFS(i % (super.db_blks - size / NEWFS_BLK_SIZE())), blks, size);
+        }
+    }
+    t1 = now_ns();
+    printf("%-18s %8d %12.2f %12.0f\n", name, iters,
+           (double)(nr_alloc - alloc0) / iters, (t1 - t0) / iters);
+    free(blks);
+}
+
+int main(int argc, char** argv) {
+    char dev[256];
+    int  iters = argc > 2 ? atoi(argv[2]) : 20000;
+    struct newfs_mkfs_opts mkfs = { .is_force = TRUE };
+
+    snprintf(dev, sizeof(dev), "%s/ddriver", getenv("HOME") ? getenv("HOME") : ".");
+    newfs_options.device = argc > 1 ? argv[1] : dev;
+    if (newfs_mkfs(newfs_options.device, &mkfs, NULL) != NEWFS_ERROR_NONE ||
+        newfs_mount(newfs_options) != NEWFS_ERROR_NONE) {
+        fprintf(stderr, "挂载 %s 失败\n", newfs_options.device);
+        return 1;
+    }
+    printf("bufpool %s\n", super.bufpool.is_huge ? "hugetlb" : "4K pages (MADV_HUGEPAGE)");
+    printf("%-18s %8s %12s %12s\n", "case", "iters", "allocs/op", "ns/op");
+    run("inode read", iters, 0, FALSE);
+    run("inode write", iters, 0, TRUE);
+    run("block read 1K", iters, NEWFS_BLK_SIZE(), FALSE);
+    run("block write 1K", iters, NEWFS_BLK_SIZE(), TRUE);
+    run("run write 64K", iters / 16, NEWFS_BLKS_SIZE(NEWFS_WB_MAX_RUN), TRUE);
+    newfs_umount();
+    return 0;
+}
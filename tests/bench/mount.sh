@@ -0,0 +1,106 @@
+#!/bin/bash
+# 挂载延迟基准：在不同文件数下测量正常卸载后重新挂载到根目录可访问的耗时
+# 挂载只读超级块、位图和根inode，子树在第一次访问时才读入，耗时应与文件数无关
+#
+# 用法: ./mount.sh [文件数 ...]
+# 默认1万/10万/100万个文件，超出4MB的ddriver，需要用 -DNEWFS_DDRIVER_SIM=ON 编译；
+# 每档重新建镜像文件（NEWFS_BENCH_DEVICE 指定路径，默认 tests/bench/mount.img），
+# 镜像大小由脚本设置DDRIVER_SIM_SIZE，mkfs.newfs按文件数加-N。每个目录放 FILES_PER_DIR 个文件
+
+ROOT_PATH=$(cd "$(dirname "$0")" && pwd)
+PROJECT_NAME="newfs"
+BIN="$ROOT_PATH"/../../build/"${PROJECT_NAME}"
+MKFS="$ROOT_PATH"/../../build/mkfs.newfs
+MNTPOINT="$ROOT_PATH"/mnt
+DEVICE=${NEWFS_BENCH_DEVICE:-"$ROOT_PATH"/mount.img}
+FILES_PER_DIR=100
+ROUNDS=5
+SIZES=("$@")
+if (( ${#SIZES[@]} == 0 )); then
+    SIZES=(10000 100000 1000000)
+fi
+
+function check_mount() {
+    mount | grep "$(realpath "$MNTPOINT")" >/dev/null
+}
+
+function clean_mount() {
+    while check_mount; do
+        umount "${MNTPOINT}"
+        sleep 0.2
+    done
+}
+
+function mount_fuse() {
+    "$BIN" --device="$DEVICE" "${MNTPOINT}"
+}
+
+# 按文件数建镜像：inode数留出目录的余量并按1024取整，空文件不占数据块，每4000个文件给1MB放目录块
+function reset_device() {
+    _FILES=$1
+    _INODES=$(( (_FILES + _FILES / FILES_PER_DIR + FILES_PER_DIR + 1023) / 1024 * 1024 ))
+    export DDRIVER_SIM_SIZE=$(( (16 + _FILES / 4000) * 1024 * 1024 ))
+    rm -f "$DEVICE"
+    "$MKFS" -N "$_INODES" "$DEVICE" >/dev/null
+}
+
+# 两级目录 /dI/dJ/fK，根目录和每个目录都不超过 FILES_PER_DIR 项，最多 FILES_PER_DIR^3 个文件
+function populate() {
+    _FILES=$1
+    _DIRS=$(( (_FILES + FILES_PER_DIR - 1) / FILES_PER_DIR ))
+    for (( d = 0; d < _DIRS; d++ )); do
+        _TOP="${MNTPOINT}/d$(( d / FILES_PER_DIR ))"
+        _SUB="${_TOP}/d$(( d % FILES_PER_DIR ))"
+        [ -d "$_TOP" ] || mkdir "$_TOP" || return 1
+        mkdir "$_SUB" || return 1
+        _CNT=$(( _FILES - d * FILES_PER_DIR ))
+        (( _CNT > FILES_PER_DIR )) && _CNT=$FILES_PER_DIR
+        ( cd "$_SUB" && touch $(seq -f "f%g" 0 $(( _CNT - 1 ))) ) || return 1
+    done
+}
+
+# 挂载并stat根目录（FUSE在第一个请求时才调用init），返回毫秒
+function time_mount() {
+    _T0=$(date +%s%N)
+    mount_fuse || return 1
+    stat "${MNTPOINT}" >/dev/null || return 1
+    _T1=$(date +%s%N)
+    echo $(( (_T1 - _T0) / 1000000 ))
+}
+
+if [ ! -x "$BIN" ] || [ ! -x "$MKFS" ]; then
+    echo "找不到 $BIN 或 $MKFS，请先编译"
+    exit 1
+fi
+for files in "${SIZES[@]}"; do
+    if (( files > FILES_PER_DIR * FILES_PER_DIR * FILES_PER_DIR )); then
+        echo "文件数 $files 超过两级目录能放下的 $(( FILES_PER_DIR * FILES_PER_DIR * FILES_PER_DIR )) 个"
+        exit 1
+    fi
+done
+mkdir -p "$MNTPOINT"
+clean_mount
+
+printf "%-10s %-12s %-12s\n" "files" "mount(ms)" "min(ms)"
+for files in "${SIZES[@]}"; do
+    reset_device "$files" || exit 1
+    mount_fuse || exit 1
+    if ! populate "$files"; then
+        echo "创建 $files 个文件失败"
+        clean_mount
+        exit 1
+    fi
+    clean_mount
+
+    TOTAL=0
+    MIN=-1
+    for (( r = 0; r < ROUNDS; r++ )); do
+        MS=$(time_mount) || { echo "挂载失败"; exit 1; }
+        clean_mount
+        TOTAL=$(( TOTAL + MS ))
+        (( MIN < 0 || MS < MIN )) && MIN=$MS
+    done
+    printf "%-10s %-12s %-12s\n" "$files" "$(( TOTAL / ROUNDS ))" "$MIN"
+done
+
+rm -f "$DEVICE"
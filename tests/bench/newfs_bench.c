@@ -0,0 +1,389 @@
+/**
+ * newfs核心库微基准：不经过FUSE，在镜像文件上直接调用newfs_utils中的函数，
+ * 测量查找深度、目录大小、分配时的填充程度和一次提交的inode数对性能的影响。
+ *
+ * 每一项输出每秒操作数、延迟分位数和每次操作引起的设备I/O（IOC_REQ_DEVICE_STATE
+ * 的差，计时区间之外读取），-o 时另外写一份JSON，便于对比回归
+ *
+ * 用法: newfs_bench [-d 设备] [-n 次数] [-o 结果.json]
+ * 开始时会重新格式化设备
+ */
+#include "newfs.h"
+
+struct custom_options newfs_options;
+struct newfs_super    super;
+
+#define BENCH_FANOUT      30            /* 填充时每个目录的项数 */
+#define BENCH_MAX_RESULTS 64
+
+struct bench_result {
+    char   name[64];
+    int    param;
+    int    nr;
+    double ops;                         /* 每秒操作数 */
+    double p50, p90, p99, max;          /* 纳秒 */
+    double io, seeks;                   /* 每次操作的设备读写IO单位数和寻道数 */
+};
+
+static struct bench_result results[BENCH_MAX_RESULTS];
+static int                 nr_results;
+static double*             samples;
+static int                 iters = 2000;
+static uint64_t            case_io, case_seeks;     /* 本项计时区间内累计的设备I/O */
+
+/* 填充出来的文件，读inode、提交时从中挑选 */
+static struct newfs_dentry** fill_files;
+static int                   nr_fill_files;
+static int                   nr_fill_dirs;
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int cmp_double(const void* a, const void* b) {
+    double da = *(const double*)a, db = *(const double*)b;
+    return da < db ? -1 : da > db;
+}
+
+/**
+ * @brief 计时区间开始前记下设备计数
+ */
+static void io_mark(struct ddriver_state* mark) {
+    newfs_stats_dev_state(mark);
+}
+
+/**
+ * @brief 计时区间结束后把设备计数的差累加到本项
+ */
+static void io_add(struct ddriver_state* mark) {
+    struct ddriver_state now;
+
+    newfs_stats_dev_state(&now);
+    case_io    += (unsigned)(now.read_cnt - mark->read_cnt) + (unsigned)(now.write_cnt - mark->write_cnt);
+    case_seeks += (unsigned)(now.seek_cnt - mark->seek_cnt);
+}
+
+/**
+ * @brief 整理samples中的nr个样本和累计的设备I/O，记一条结果并打印
+ */
+static void record(const char* name, int param, int nr) {
+    struct bench_result* r = &results[nr_results++];
+    double total = 0;
+
+    for (int i = 0; i < nr; i++) {
+        total += samples[i];
+    }
+    qsort(samples, nr, sizeof(double), cmp_double);
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    r->param = param;
+    r->nr    = nr;
+    r->ops   = total > 0 ? nr * 1e9 / total : 0;
+    r->p50   = samples[nr * 50 / 100];
+    r->p90   = samples[nr * 90 / 100];
+    r->p99   = samples[nr * 99 / 100];
+    r->max   = samples[nr - 1];
+    r->io    = (double)case_io / nr;
+    r->seeks = (double)case_seeks / nr;
+    case_io    = 0;
+    case_seeks = 0;
+    printf("%-14s %6d %7d %12.0f %10.0f %10.0f %10.0f %10.0f %8.2f %8.2f\n",
+           r->name, r->param, r->nr, r->ops, r->p50, r->p90, r->p99, r->max, r->io, r->seeks);
+}
+
+/**
+ * @brief 在parent下新建一个文件或目录，与mknod/mkdir相同，只是不经过路径解析
+ */
+static struct newfs_dentry* create(struct newfs_dentry* parent, const char* name, NEWFS_FILE_TYPE ftype) {
+    struct newfs_dentry* dentry = new_dentry((char*)name, ftype);
+    struct newfs_inode*  inode;
+
+    dentry->parent = parent;
+    newfs_op_begin(NEWFS_OP_ASYNC);
+    inode = newfs_alloc_inode(dentry);
+    if (inode != NULL && newfs_alloc_dentry(parent->inode, dentry) < 0) {
+        newfs_drop_inode(inode);
+        inode = NULL;
+    }
+    newfs_op_end(0, NEWFS_OP_ASYNC);
+    if (inode == NULL) {
+        free(dentry);
+        return NULL;
+    }
+    return dentry;
+}
+
+/**
+ * @brief 路径查找：/d/d/...深depth层，缓存是热的
+ */
+static void bench_lookup_depth() {
+    struct newfs_dentry* dentry = super.root_dentry;
+    char    path[256] = "";
+    boolean is_find, is_root;
+
+    for (int depth = 1; depth <= 8; depth++) {
+        dentry = create(dentry, "d", DIR);
+        strcat(path, "/d");
+        newfs_lookup(path, &is_find, &is_root);
+        for (int i = 0; i < iters; i++) {
+            struct ddriver_state mark;
+            io_mark(&mark);
+            double t0 = now_ns();
+            newfs_lookup(path, &is_find, &is_root);
+            samples[i] = now_ns() - t0;
+            io_add(&mark);
+        }
+        record("lookup_depth", depth, iters);
+    }
+}
+
+/**
+ * @brief 目录大小：在有n项的目录中随机查找，n覆盖单个叶子块、两层和三层的目录树
+ */
+static void bench_dir_size() {
+    int  sizes[] = { 1, (int)MAX_DENTRY_PERBLK(), 100, 1000 };
+    char path[64];
+    boolean is_find, is_root;
+
+    for (int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++) {
+        struct newfs_dentry* dir;
+        snprintf(path, sizeof(path), "s%d", sizes[s]);
+        dir = create(super.root_dentry, path, DIR);
+        for (int k = 0; k < sizes[s]; k++) {
+            snprintf(path, sizeof(path), "f%d", k);
+            create(dir, path, REG_FILE);
+        }
+        for (int i = 0; i < iters; i++) {
+            struct ddriver_state mark;
+            snprintf(path, sizeof(path), "/s%d/f%d", sizes[s], rand() % sizes[s]);
+            io_mark(&mark);
+            double t0 = now_ns();
+            newfs_lookup(path, &is_find, &is_root);
+            samples[i] = now_ns() - t0;
+            io_add(&mark);
+        }
+        record("dir_size", sizes[s], iters);
+    }
+}
+
+/**
+ * @brief 建文件直到inode位图用掉pct%，同时给文件分配数据块直到数据块位图用掉pct%
+ */
+static void fill_to(int pct) {
+    static struct newfs_dentry* top;
+    static struct newfs_dentry* mid;
+    char name[32];
+    int  target_ino = super.ino_max * pct / 100;
+    int  target_db  = super.db_blks * pct / 100;
+    int  used_ino   = 0;
+
+    for (int i = 0; i < super.ino_max; i++) {
+        used_ino += NEWFS_BM_TEST(super.map_inode, i) ? 1 : 0;
+    }
+    while (used_ino < target_ino) {
+        struct newfs_dentry* dentry;
+        if (nr_fill_files % (BENCH_FANOUT * BENCH_FANOUT) == 0) {
+            snprintf(name, sizeof(name), "fill%d", nr_fill_dirs++);
+            top = create(super.root_dentry, name, DIR);
+            used_ino++;
+        }
+        if (nr_fill_files % BENCH_FANOUT == 0) {
+            snprintf(name, sizeof(name), "d%d", nr_fill_files / BENCH_FANOUT % BENCH_FANOUT);
+            mid = create(top, name, DIR);
+            used_ino++;
+        }
+        snprintf(name, sizeof(name), "f%d", nr_fill_files % BENCH_FANOUT);
+        if (top == NULL || mid == NULL || (dentry = create(mid, name, REG_FILE)) == NULL) {
+            break;
+        }
+        if (super.db_blks - super.db_free < target_db) {
+            newfs_op_begin(NEWFS_OP_ASYNC);
+            newfs_alloc_data(dentry->inode, 0);
+            newfs_op_end(0, NEWFS_OP_ASYNC);
+        }
+        fill_files[nr_fill_files++] = dentry;
+        used_ino++;
+    }
+    newfs_op_begin(NEWFS_OP_SYNC);
+    newfs_op_end(0, NEWFS_OP_SYNC);
+}
+
+/**
+ * @brief 分配inode和数据块的开销随位图填充程度的变化，每次分配后立即归还
+ */
+static void bench_alloc(int pct) {
+    struct newfs_dentry* scratch = create(super.root_dentry, "scratch", REG_FILE);
+    struct newfs_dentry* dentry;
+    struct newfs_inode*  inode;
+    int nr = 0;
+
+    for (int i = 0; i < iters; i++) {
+        dentry = new_dentry("a", REG_FILE);
+        dentry->parent = super.root_dentry;
+        struct ddriver_state mark;
+        newfs_op_begin(NEWFS_OP_ASYNC);
+        io_mark(&mark);
+        double t0 = now_ns();
+        inode = newfs_alloc_inode(dentry);
+        double t1 = now_ns();
+        io_add(&mark);
+        if (inode != NULL) {
+            samples[nr++] = t1 - t0;
+            newfs_drop_inode(inode);
+        }
+        newfs_op_end(0, NEWFS_OP_ASYNC);
+        free(dentry);
+    }
+    if (nr > 0) {
+        record("alloc_inode", pct, nr);
+    }
+
+    nr = 0;
+    for (int i = 0; scratch != NULL && i < iters; i++) {
+        struct ddriver_state mark;
+        newfs_op_begin(NEWFS_OP_ASYNC);
+        io_mark(&mark);
+        double t0 = now_ns();
+        int ret = newfs_alloc_data(scratch->inode, 0);
+        double t1 = now_ns();
+        io_add(&mark);
+        if (ret == NEWFS_ERROR_NONE) {
+            samples[nr++] = t1 - t0;
+            newfs_free_data(scratch->inode, 0);
+        }
+        newfs_op_end(0, NEWFS_OP_ASYNC);
+    }
+    if (nr > 0) {
+        record("alloc_data", pct, nr);
+    }
+    if (scratch != NULL) {
+        newfs_op_begin(NEWFS_OP_SYNC);
+        newfs_drop_inode(scratch->inode);
+        newfs_drop_dentry(super.root_dentry->inode, scratch);
+        newfs_op_end(0, NEWFS_OP_SYNC);
+    }
+}
+
+/**
+ * @brief 从盘上读一个inode（不经过缓存）
+ */
+static void bench_read_inode() {
+    struct newfs_inode* inode;
+
+    for (int i = 0; i < iters; i++) {
+        struct newfs_dentry* dentry = fill_files[rand() % nr_fill_files];
+        struct ddriver_state mark;
+        io_mark(&mark);
+        double t0 = now_ns();
+        inode = newfs_read_inode(dentry, dentry->ino);
+        samples[i] = now_ns() - t0;
+        io_add(&mark);
+        newfs_cache_remove(inode);
+        free(inode);
+    }
+    record("read_inode", 0, iters);
+}
+
+/**
+ * @brief 提交修改了n个inode的事务的耗时
+ */
+static void bench_sync() {
+    int sizes[] = { 1, 8, 32, 128 };
+    int rounds  = iters / 10 > 0 ? iters / 10 : 1;
+
+    for (int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++) {
+        for (int r = 0; r < rounds; r++) {
+            int start = rand() % nr_fill_files;
+            newfs_op_begin(NEWFS_OP_ASYNC);
+            for (int k = 0; k < sizes[s]; k++) {
+                newfs_update_time(fill_files[(start + k) % nr_fill_files]->inode, NEWFS_UPDATE_CTIME);
+            }
+            struct ddriver_state mark;
+            io_mark(&mark);
+            double t0 = now_ns();
+            newfs_journal_commit();
+            samples[r] = now_ns() - t0;
+            io_add(&mark);
+            newfs_op_end(0, NEWFS_OP_ASYNC);
+        }
+        record("sync_inodes", sizes[s], rounds);
+    }
+}
+
+/**
+ * @brief 把结果写成JSON
+ */
+static int write_json(const char* path) {
+    FILE* fp = fopen(path, "w");
+
+    if (fp == NULL) {
+        return -1;
+    }
+    fprintf(fp, "{\n  \"iters\": %d,\n  \"results\": [\n", iters);
+    for (int i = 0; i < nr_results; i++) {
+        struct bench_result* r = &results[i];
+        fprintf(fp, "    {\"name\": \"%s\", \"param\": %d, \"n\": %d, \"ops_per_sec\": %.0f, "
+                    "\"p50_ns\": %.0f, \"p90_ns\": %.0f, \"p99_ns\": %.0f, \"max_ns\": %.0f, "
+                    "\"dev_io_per_op\": %.2f, \"seeks_per_op\": %.2f}%s\n",
+                r->name, r->param, r->nr, r->ops, r->p50, r->p90, r->p99, r->max,
+                r->io, r->seeks, i + 1 < nr_results ? "," : "");
+    }
+    fprintf(fp, "  ]\n}\n");
+    fclose(fp);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    char        dev[256];
+    const char* json = NULL;
+    int         opt;
+    struct newfs_mkfs_opts mkfs = { .is_force = TRUE };
+
+    snprintf(dev, sizeof(dev), "%s/ddriver", getenv("HOME") ? getenv("HOME") : ".");
+    newfs_options.device   = dev;
+    newfs_options.cache_kb = 1024 * 1024;       /* 测的是函数本身，不让缓存淘汰干扰 */
+    while ((opt = getopt(argc, argv, "d:n:o:")) != -1) {
+        switch (opt) {
+        case 'd': newfs_options.device = optarg; break;
+        case 'n': iters = atoi(optarg); break;
+        case 'o': json = optarg; break;
+        default:
+            fprintf(stderr, "用法: %s [-d 设备] [-n 次数] [-o 结果.json]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (iters <= 0) {
+        iters = 1;
+    }
+
+    srand(1);
+    if (newfs_mkfs(newfs_options.device, &mkfs, NULL) != NEWFS_ERROR_NONE ||
+        newfs_mount(newfs_options) != NEWFS_ERROR_NONE) {
+        fprintf(stderr, "挂载 %s 失败\n", newfs_options.device);
+        return 1;
+    }
+    samples    = (double*)malloc(iters * sizeof(double));
+    fill_files = (struct newfs_dentry**)malloc(super.ino_max * sizeof(struct newfs_dentry*));
+
+    printf("%-14s %6s %7s %12s %10s %10s %10s %10s %8s %8s\n",
+           "case", "param", "n", "ops/s", "p50(ns)", "p90(ns)", "p99(ns)", "max(ns)", "io/op", "seek/op");
+    bench_lookup_depth();
+    bench_dir_size();
+    bench_alloc(0);
+    fill_to(50);
+    bench_alloc(50);
+    fill_to(90);
+    bench_alloc(90);
+    bench_read_inode();
+    bench_sync();
+
+    newfs_umount();
+    if (json != NULL && write_json(json) != 0) {
+        fprintf(stderr, "写 %s 失败\n", json);
+        return 1;
+    }
+    free(samples);
+    free(fill_files);
+    return 0;
+}
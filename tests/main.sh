@@ -3,8 +3,8 @@ POINTS=0
 TOTAL_POINTS=0
 TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh)
 # mount.sh mkdir.sh touch.sh ls.sh remount.sh (read.sh write.sh cp.sh)
-ALL_TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh)
-ALL_TEST_SCORES=(1 4 5 4 16 2 2)
+ALL_TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh bigdir.sh fsck.sh crash.sh clone.sh rename.sh)
+ALL_TEST_SCORES=(1 4 5 4 16 2 2 6 5 4 5 6)
 MNTPOINT='./mnt'
 PROJECT_NAME="newfs"
 
@@ -35,6 +35,26 @@ elif [[ "${LEVEL}" == "6" ]]; then
     echo "开始mount, mkdir, touch, ls, read&write, cp, umount测试"
     TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh)
     sleep 1
+elif [[ "${LEVEL}" == "7" ]]; then
+    echo "开始mount, mkdir, touch, ls, read&write, cp, umount, 大目录测试"
+    TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh bigdir.sh)
+    sleep 1
+elif [[ "${LEVEL}" == "8" ]]; then
+    echo "开始mount, mkdir, touch, ls, read&write, cp, umount, 大目录, fsck测试"
+    TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh bigdir.sh fsck.sh)
+    sleep 1
+elif [[ "${LEVEL}" == "9" ]]; then
+    echo "开始mount, mkdir, touch, ls, read&write, cp, umount, 大目录, fsck, 崩溃恢复测试"
+    TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh bigdir.sh fsck.sh crash.sh)
+    sleep 1
+elif [[ "${LEVEL}" == "10" ]]; then
+    echo "开始mount, mkdir, touch, ls, read&write, cp, umount, 大目录, fsck, 崩溃恢复, 克隆测试"
+    TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh bigdir.sh fsck.sh crash.sh clone.sh)
+    sleep 1
+elif [[ "${LEVEL}" == "11" ]]; then
+    echo "开始mount, mkdir, touch, ls, read&write, cp, umount, 大目录, fsck, 崩溃恢复, 克隆, rename测试"
+    TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh bigdir.sh fsck.sh crash.sh clone.sh rename.sh)
+    sleep 1
 else
     echo "未知测试参数"
     exit 1
@@ -81,6 +101,7 @@ function core_tester() {
 function clean_ddriver() {
     sleep 1
     ddriver -r > /dev/null
+    "$ROOT_PATH"/../build/mkfs.newfs "$HOME"/ddriver > /dev/null
 }
 
 function pass() {
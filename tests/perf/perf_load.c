@@ -0,0 +1,319 @@
+/**
+ * 挂载性能回归的负载程序：在已挂载的newfs目录下执行一种负载，经过内核和FUSE，
+ * 逐个操作计时，输出一行 "名称 次数 每秒操作数 p50(us) p99(us)"，由run.sh汇总并与基线比较。
+ * 每秒操作数按整段负载的墙钟时间算，写负载包括最后的fsync
+ *
+ * 用法: perf_load <挂载点> <负载> [参数...]
+ *   mkdir  <个数> [项数]        在 /mk 下按三级、每个目录<项数>项（默认30）的树建目录
+ *   touch  <个数> [项数]        在 /tc 下按同样的树建文件，<项数>不小于<个数>时全部建在同一个目录中
+ *   ls                          对 /tc 下每个最底层目录做一次 ls -l（readdir + 逐项lstat）
+ *   seqwrite|randwrite <大小> <文件数>   /io 下的文件写满 NEWFS 单文件上限，按<大小>顺序或随机写
+ *   seqread|randread   <大小> <文件数>   同上，读
+ *   stat   <深度> <次数> <线程数>       建一条<深度>层的路径，多个线程反复stat最深处
+ */
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PERF_FANOUT     30              /* 默认每个目录的项数 */
+#define PERF_FILE_SIZE  (6 * 1024)      /* 单文件上限：6个1KB数据块 */
+#define PERF_MAX_THREAD 16
+
+static const char* mnt;
+static int         fanout = PERF_FANOUT;
+static double*     samples;
+static int         nr_samples;
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int cmp_double(const void* a, const void* b) {
+    double da = *(const double*)a, db = *(const double*)b;
+    return da < db ? -1 : da > db;
+}
+
+static void die(const char* what, const char* path) {
+    fprintf(stderr, "perf_load: %s %s: %s\n", what, path, strerror(errno));
+    exit(1);
+}
+
+/**
+ * @brief 整理样本并输出一行结果，wall为整段负载的墙钟时间（纳秒）
+ */
+static void report(const char* name, double wall) {
+    if (nr_samples == 0) {
+        printf("%s 0 0 0 0\n", name);
+        return;
+    }
+    qsort(samples, nr_samples, sizeof(double), cmp_double);
+    printf("%s %d %.0f %.1f %.1f\n", name, nr_samples, wall > 0 ? nr_samples * 1e9 / wall : 0,
+           samples[nr_samples * 50 / 100] / 1e3, samples[nr_samples * 99 / 100] / 1e3);
+}
+
+/**
+ * @brief 第i项在树中的路径：<top>/a<i/F²>/b<i/F%F>/<prefix><i%F>，F为fanout，缺的中间目录顺带建出（也计时）
+ */
+static void tree_path(char* path, size_t size, const char* top, int i, const char* prefix) {
+    char dir[512];
+    int  a = (int)(i / ((long)fanout * fanout));
+    int  b = i / fanout % fanout;
+
+    if (i % ((long)fanout * fanout) == 0) {
+        snprintf(dir, sizeof(dir), "%s/%s/a%d", mnt, top, a);
+        double t0 = now_ns();
+        if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+            die("mkdir", dir);
+        }
+        samples[nr_samples++] = now_ns() - t0;
+    }
+    if (i % fanout == 0) {
+        snprintf(dir, sizeof(dir), "%s/%s/a%d/b%d", mnt, top, a, b);
+        double t0 = now_ns();
+        if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+            die("mkdir", dir);
+        }
+        samples[nr_samples++] = now_ns() - t0;
+    }
+    snprintf(path, size, "%s/%s/a%d/b%d/%s%d", mnt, top, a, b, prefix, i % fanout);
+}
+
+/**
+ * @brief 建n个目录或文件
+ */
+static void load_create(const char* top, int n, int is_dir) {
+    char   path[512];
+    char   name[64];
+    double wall = now_ns();
+
+    snprintf(path, sizeof(path), "%s/%s", mnt, top);
+    if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+        die("mkdir", path);
+    }
+    samples = (double*)malloc(sizeof(double) * (n + n / fanout + n / ((long)fanout * fanout) + 3));
+    for (int i = 0; i < n; i++) {
+        tree_path(path, sizeof(path), top, i, is_dir ? "d" : "f");
+        double t0 = now_ns();
+        if (is_dir) {
+            if (mkdir(path, 0755) != 0) {
+                die("mkdir", path);
+            }
+        }
+        else {
+            int fd = open(path, O_CREAT | O_WRONLY, 0644);
+            if (fd < 0) {
+                die("create", path);
+            }
+            close(fd);
+        }
+        samples[nr_samples++] = now_ns() - t0;
+    }
+    snprintf(name, sizeof(name), "%s_%d", is_dir ? "mkdir" : "touch", n);
+    report(name, now_ns() - wall);
+}
+
+/**
+ * @brief 对/tc下每个最底层目录做一次ls -l
+ */
+static void load_ls() {
+    char   top[512], mid[600], path[1024];
+    double wall = now_ns();
+    int    cap  = 1024;
+    int    nr_ent = 0;
+    char   name[64];
+
+    samples = (double*)malloc(sizeof(double) * cap);
+    for (int a = 0; ; a++) {
+        snprintf(top, sizeof(top), "%s/tc/a%d", mnt, a);
+        if (access(top, F_OK) != 0) {
+            break;
+        }
+        for (int b = 0; ; b++) {
+            struct dirent* ent;
+            struct stat    st;
+            DIR*           dir;
+
+            snprintf(mid, sizeof(mid), "%s/b%d", top, b);
+            double t0 = now_ns();
+            if ((dir = opendir(mid)) == NULL) {
+                break;
+            }
+            while ((ent = readdir(dir)) != NULL) {
+                if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+                    continue;
+                }
+                snprintf(path, sizeof(path), "%s/%s", mid, ent->d_name);
+                lstat(path, &st);
+                nr_ent++;
+            }
+            closedir(dir);
+            if (nr_samples == cap) {
+                cap    *= 2;
+                samples = (double*)realloc(samples, sizeof(double) * cap);
+            }
+            samples[nr_samples++] = now_ns() - t0;
+        }
+    }
+    snprintf(name, sizeof(name), "ls_%d", nr_ent);
+    report(name, now_ns() - wall);
+}
+
+/**
+ * @brief 读写/io下的nr_files个文件，每次size字节；顺序时逐个文件从头到尾，随机时总量相同
+ */
+static void load_rw(const char* kind, int size, int nr_files) {
+    int    is_write = strstr(kind, "write") != NULL;
+    int    is_rand  = strncmp(kind, "rand", 4) == 0;
+    int    per_file = (PERF_FILE_SIZE + size - 1) / size;
+    int    total    = per_file * nr_files;
+    int*   fds      = (int*)malloc(sizeof(int) * nr_files);
+    char*  buf      = (char*)malloc(size);
+    char   path[512];
+    char   name[64];
+    double wall;
+
+    memset(buf, 'p', size);
+    snprintf(path, sizeof(path), "%s/io", mnt);
+    if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+        die("mkdir", path);
+    }
+    for (int f = 0; f < nr_files; f++) {           /* 按30个一组放在子目录中 */
+        snprintf(path, sizeof(path), "%s/io/d%d", mnt, f / PERF_FANOUT);
+        if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+            die("mkdir", path);
+        }
+        snprintf(path, sizeof(path), "%s/io/d%d/f%d", mnt, f / PERF_FANOUT, f % PERF_FANOUT);
+        fds[f] = open(path, is_write ? O_CREAT | O_RDWR : O_RDONLY, 0644);
+        if (fds[f] < 0) {
+            die("open", path);
+        }
+    }
+    samples = (double*)malloc(sizeof(double) * total);
+    srand(size * 131 + nr_files);
+    wall = now_ns();
+    for (int i = 0; i < total; i++) {
+        int     f   = is_rand ? rand() % nr_files : i / per_file;
+        off_t   off = (off_t)(is_rand ? rand() % per_file : i % per_file) * size;
+        size_t  len = off + size > PERF_FILE_SIZE ? PERF_FILE_SIZE - off : size;
+        ssize_t ret;
+
+        double t0 = now_ns();
+        ret = is_write ? pwrite(fds[f], buf, len, off) : pread(fds[f], buf, len, off);
+        samples[nr_samples++] = now_ns() - t0;
+        if (ret < 0) {
+            die(kind, "pwrite/pread");
+        }
+    }
+    if (is_write && nr_files > 0) {
+        fsync(fds[0]);                              /* 一次提交把所有文件写回 */
+    }
+    wall = now_ns() - wall;
+    for (int f = 0; f < nr_files; f++) {
+        close(fds[f]);
+    }
+    snprintf(name, sizeof(name), "%s_%d", kind, size);
+    report(name, wall);
+    free(fds);
+    free(buf);
+}
+
+struct stat_arg {
+    const char* path;
+    int         n;
+    double*     out;
+};
+
+static void* stat_worker(void* p) {
+    struct stat_arg* arg = (struct stat_arg*)p;
+    struct stat      st;
+
+    for (int i = 0; i < arg->n; i++) {
+        double t0 = now_ns();
+        if (stat(arg->path, &st) != 0) {
+            die("stat", arg->path);
+        }
+        arg->out[i] = now_ns() - t0;
+    }
+    return NULL;
+}
+
+/**
+ * @brief 建一条depth层的路径，nr_threads个线程共stat n次最深处
+ */
+static void load_stat(int depth, int n, int nr_threads) {
+    pthread_t       tids[PERF_MAX_THREAD];
+    struct stat_arg args[PERF_MAX_THREAD];
+    char   path[4096];
+    char   name[64];
+    size_t len;
+    double wall;
+
+    nr_threads = nr_threads < 1 ? 1 : nr_threads > PERF_MAX_THREAD ? PERF_MAX_THREAD : nr_threads;
+    len = snprintf(path, sizeof(path), "%s/st", mnt);
+    if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+        die("mkdir", path);
+    }
+    for (int d = 0; d < depth && len + 4 < sizeof(path); d++) {
+        len += snprintf(path + len, sizeof(path) - len, "/d%d", d % 10);
+        if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+            die("mkdir", path);
+        }
+    }
+    samples = (double*)malloc(sizeof(double) * n);
+    wall    = now_ns();
+    for (int t = 0; t < nr_threads; t++) {
+        args[t].path = path;
+        args[t].n    = n / nr_threads;
+        args[t].out  = samples + t * (n / nr_threads);
+        pthread_create(&tids[t], NULL, stat_worker, &args[t]);
+    }
+    for (int t = 0; t < nr_threads; t++) {
+        pthread_join(tids[t], NULL);
+    }
+    wall       = now_ns() - wall;
+    nr_samples = n / nr_threads * nr_threads;
+    snprintf(name, sizeof(name), "stat_d%d_t%d", depth, nr_threads);
+    report(name, wall);
+}
+
+int main(int argc, char** argv) {
+    const char* load;
+
+    if (argc < 3) {
+        fprintf(stderr, "用法: %s <挂载点> <负载> [参数...]\n", argv[0]);
+        return 1;
+    }
+    mnt  = argv[1];
+    load = argv[2];
+    if ((strcmp(load, "mkdir") == 0 || strcmp(load, "touch") == 0) && (argc == 4 || argc == 5)) {
+        fanout = argc == 5 && atoi(argv[4]) > 0 ? atoi(argv[4]) : PERF_FANOUT;
+        load_create(load[0] == 'm' ? "mk" : "tc", atoi(argv[3]), load[0] == 'm');
+    }
+    else if (strcmp(load, "ls") == 0) {
+        load_ls();
+    }
+    else if ((strcmp(load, "seqwrite") == 0 || strcmp(load, "randwrite") == 0 ||
+              strcmp(load, "seqread") == 0 || strcmp(load, "randread") == 0) && argc == 5) {
+        load_rw(load, atoi(argv[3]), atoi(argv[4]));
+    }
+    else if (strcmp(load, "stat") == 0 && argc == 6) {
+        load_stat(atoi(argv[3]), atoi(argv[4]), atoi(argv[5]));
+    }
+    else {
+        fprintf(stderr, "未知负载或参数不对: %s\n", load);
+        return 1;
+    }
+    free(samples);
+    return 0;
+}
@@ -0,0 +1,190 @@
+#!/bin/bash
+# 挂载性能回归：真的挂载newfs，用build/newfs_perf_load跑各种负载，记录吞吐和延迟，
+# 与保存的基线比较，每秒操作数下降或p50延迟上升超过容差、或基线中的某项这次没有结果时失败（p99只打印）
+#
+# 用法: ./run.sh [-s small|medium|full] [-b 基线文件] [-u] [-t 容差%] [-o 结果目录]
+#   -s  规模：目录和文件各建多少项。small 各1千项（默认），medium 各10万项，full 各100万项；
+#       目录按每个目录100项的三级树建，文件全部建在同一个目录中
+#   -b  基线文件，默认 tests/perf/baseline-<规模>.txt
+#   -u  把这次的结果写成基线，不做比较；没有基线时也只记录结果，不算失败
+#   -t  容差百分比，默认25
+#   -o  结果目录，默认 tests/perf/out；每个负载卸载前的/.newfs/stats也存在这里
+#
+# 设备由环境变量 NEWFS_PERF_DEVICE 指定，默认 ~/ddriver，每轮开始前用 ddriver -r 清空再mkfs.newfs；
+# 用 -DNEWFS_DDRIVER_SIM=ON 编译时设成镜像文件路径，清空时直接删除文件
+# （mem:设备在进程退出后就没了，不能用于重新挂载）。medium和full超出4MB的ddriver，只能用镜像文件，
+# 镜像大小由脚本设置DDRIVER_SIM_SIZE，mkfs.newfs按规模加-N
+
+ROOT_PATH=$(cd "$(dirname "$0")" && pwd)
+BIN="$ROOT_PATH"/../../build/newfs
+LOAD="$ROOT_PATH"/../../build/newfs_perf_load
+MKFS="$ROOT_PATH"/../../build/mkfs.newfs
+MNTPOINT="$ROOT_PATH"/mnt
+DEVICE=${NEWFS_PERF_DEVICE:-"$HOME"/ddriver}
+SCALE=small
+BASELINE=""
+UPDATE=0
+TOL=25
+OUT="$ROOT_PATH"/out
+ROUNDS=5
+
+while getopts "s:b:ut:o:" opt; do
+    case $opt in
+        s) SCALE=$OPTARG ;;
+        b) BASELINE=$OPTARG ;;
+        u) UPDATE=1 ;;
+        t) TOL=$OPTARG ;;
+        o) OUT=$OPTARG ;;
+        *) sed -n '5,10p' "$0"; exit 1 ;;
+    esac
+done
+BASELINE=${BASELINE:-"$ROOT_PATH"/baseline-"$SCALE".txt}
+
+# 各规模的参数：建的项数、读写的文件数（每个6KB）、stat的路径深度/次数/线程数、镜像MB数和inode数（0为默认）
+case $SCALE in
+    small)  ENTRIES=1000;    IO_FILES=64;  STAT_DEPTH=16; STAT_N=20000;  STAT_THREADS=4; DEV_MB=0;    INODES=0 ;;
+    medium) ENTRIES=100000;  IO_FILES=400; STAT_DEPTH=32; STAT_N=200000; STAT_THREADS=8; DEV_MB=128;  INODES=204800 ;;
+    full)   ENTRIES=1000000; IO_FILES=400; STAT_DEPTH=32; STAT_N=200000; STAT_THREADS=8; DEV_MB=1024; INODES=2048000 ;;
+    *)      echo "未知规模 $SCALE"; exit 1 ;;
+esac
+DIR_FANOUT=100
+IO_SIZES=(512 2048)
+MKFS_ARGS=()
+if (( DEV_MB > 0 )); then
+    if [[ -z "${NEWFS_PERF_DEVICE}" ]]; then
+        echo "规模 $SCALE 需要模拟设备，用 NEWFS_PERF_DEVICE 指定镜像文件路径"
+        exit 1
+    fi
+    export DDRIVER_SIM_SIZE=$(( DEV_MB * 1024 * 1024 ))
+    MKFS_ARGS=(-N "$INODES")
+fi
+
+function check_mount() {
+    mount | grep "$(realpath "$MNTPOINT")" >/dev/null
+}
+
+function clean_mount() {
+    while check_mount; do
+        umount "${MNTPOINT}"
+        sleep 0.2
+    done
+}
+
+function mount_fuse() {
+    "$BIN" --device="$DEVICE" "${MNTPOINT}" || return 1
+    stat "${MNTPOINT}" >/dev/null
+}
+
+function reset_device() {
+    if [ -f "$DEVICE" ]; then
+        rm -f "$DEVICE"
+    else
+        ddriver -r >/dev/null
+    fi
+    "$MKFS" "${MKFS_ARGS[@]}" "$DEVICE" >/dev/null
+}
+
+# 保存统计后卸载
+function save_umount() {
+    cat "${MNTPOINT}"/.newfs/stats > "$OUT"/stats-"$1".txt 2>/dev/null
+    clean_mount
+}
+
+# 跑一个负载，结果追加到results.txt
+function run_load() {
+    _LINE=$("$LOAD" "$MNTPOINT" "$@") || { echo "负载 $* 失败"; clean_mount; exit 1; }
+    echo "$_LINE" | tee -a "$OUT"/results.txt
+}
+
+# 重新挂载到根目录可访问的耗时，ROUNDS次，按与负载相同的格式输出
+function run_remount() {
+    _MS=()
+    for (( r = 0; r < ROUNDS; r++ )); do
+        _T0=$(date +%s%N)
+        mount_fuse || { echo "挂载失败"; exit 1; }
+        _T1=$(date +%s%N)
+        clean_mount
+        _MS+=($(( (_T1 - _T0) / 1000 )))
+    done
+    printf "%s\n" "${_MS[@]}" | sort -n | awk -v name="remount_$1" '
+        { v[NR] = $1; sum += $1 }
+        END { printf "%s %d %.0f %.1f %.1f\n", name, NR, NR * 1e6 / sum, v[int(NR * 0.5) + 1], v[NR] }' |
+        tee -a "$OUT"/results.txt
+}
+
+if [ ! -x "$BIN" ] || [ ! -x "$LOAD" ] || [ ! -x "$MKFS" ]; then
+    echo "找不到 $BIN、$LOAD 或 $MKFS，请先编译"
+    exit 1
+fi
+mkdir -p "$MNTPOINT" "$OUT"
+rm -f "$OUT"/results.txt "$OUT"/stats-*.txt
+clean_mount
+trap clean_mount EXIT
+
+echo "规模 $SCALE，设备 $DEVICE"
+echo "name count ops_per_s p50_us p99_us"
+
+# 建目录树和大目录，卸载后测重新挂载，再冷缓存 ls -l
+reset_device
+mount_fuse || exit 1
+run_load mkdir "$ENTRIES" "$DIR_FANOUT"
+run_load touch "$ENTRIES" "$ENTRIES"
+save_umount create
+run_remount "$(( ENTRIES * 2 ))"
+mount_fuse || exit 1
+run_load ls
+save_umount ls
+
+# 顺序、随机写，卸载后冷缓存读
+for size in "${IO_SIZES[@]}"; do
+    reset_device
+    mount_fuse || exit 1
+    run_load seqwrite "$size" "$IO_FILES"
+    run_load randwrite "$size" "$IO_FILES"
+    save_umount write-"$size"
+    mount_fuse || exit 1
+    run_load seqread "$size" "$IO_FILES"
+    run_load randread "$size" "$IO_FILES"
+    save_umount read-"$size"
+done
+
+# 深路径stat
+reset_device
+mount_fuse || exit 1
+run_load stat "$STAT_DEPTH" "$STAT_N" "$STAT_THREADS"
+save_umount stat
+reset_device
+
+if (( UPDATE )); then
+    cp "$OUT"/results.txt "$BASELINE"
+    echo "基线已写入 $BASELINE"
+    exit 0
+fi
+if [ ! -f "$BASELINE" ]; then
+    echo "没有基线 $BASELINE，这次只记录结果（$OUT/results.txt），用 -u 在同一台机器上生成基线"
+    exit 0
+fi
+
+# 逐项比较：每秒操作数不低于基线的(1-容差)，p50不高于基线的(1+容差)，基线中的每一项这次都要有结果
+echo ""
+awk -v tol="$TOL" '
+    NR == FNR { ops[$1] = $3; p50[$1] = $4; p99[$1] = $5; next }
+    {
+        seen[$1] = 1
+        if (!($1 in ops)) { printf "%-22s 没有基线\n", $1; next }
+        d_ops = ops[$1] > 0 ? ($3 - ops[$1]) * 100 / ops[$1] : 0
+        d_p50 = p50[$1] > 0 ? ($4 - p50[$1]) * 100 / p50[$1] : 0
+        d_p99 = p99[$1] > 0 ? ($5 - p99[$1]) * 100 / p99[$1] : 0
+        bad = d_ops < -tol || d_p50 > tol
+        nr_bad += bad
+        printf "%-22s ops %+7.1f%%  p50 %+7.1f%%  p99 %+7.1f%%  %s\n", $1, d_ops, d_p50, d_p99, bad ? "REGRESSION" : "ok"
+    }
+    END {
+        for (name in ops) {
+            if (!(name in seen)) { printf "%-22s 这次没有结果  MISSING\n", name; nr_missing++ }
+        }
+        if (nr_missing > 0) { printf "\n基线中有 %d 项这次没有结果\n", nr_missing }
+        if (nr_bad > 0) { printf "\n%d 项退化超过 %s%%\n", nr_bad, tol }
+        if (nr_bad + nr_missing > 0) { exit 1 }
+        printf "\n全部在 %s%% 容差内\n", tol
+    }' "$BASELINE" "$OUT"/results.txt
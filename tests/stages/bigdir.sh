@@ -0,0 +1,97 @@
+#!/bin/bash
+
+TEST_CASE="case 8 - big directory"
+
+BIGDIR_CNT=2000
+BIGDIR_SAMPLES=(f1 f7 f8 f35 f36 f500 f1024 f1999 f2000)
+
+function create_bigdir () {
+    mkdir_and_check "${MNTPOINT}"/bigdir
+    # 分批创建，远超单块目录能容纳的目录项数
+    for ((i = 1; i <= BIGDIR_CNT; i += 500)); do
+        END=$((i + 499))
+        if ! (cd "${MNTPOINT}"/bigdir && touch $(seq -f "f%g" "$i" "$END")); then
+            fail "$TEST_CASE: 在${MNTPOINT}/bigdir下创建f$i~f$END失败"
+            return 1
+        fi
+    done
+    return 0
+}
+
+function check_bigdir () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    CNT=$(ls "$_PARAM" | wc -l)
+    if (( CNT != BIGDIR_CNT )); then
+        fail "$_TEST_CASE: ls $_PARAM输出$CNT项, 应为$BIGDIR_CNT项"
+        return 1
+    fi
+
+    DUP=$(ls "$_PARAM" | sort | uniq -d | head -n 1)
+    if [[ -n "${DUP}" ]]; then
+        fail "$_TEST_CASE: ls $_PARAM输出了重复的目录项$DUP"
+        return 1
+    fi
+
+    for name in "${BIGDIR_SAMPLES[@]}"; do
+        if [ ! -f "$_PARAM/$name" ]; then
+            fail "$_TEST_CASE: 找不到文件$_PARAM/$name"
+            return 1
+        fi
+    done
+
+    if [ -e "$_PARAM/f$((BIGDIR_CNT + 1))" ]; then
+        fail "$_TEST_CASE: 查找到了不存在的文件$_PARAM/f$((BIGDIR_CNT + 1))"
+        return 1
+    fi
+    return 0
+}
+
+function check_bigdir_unlink () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    # 删掉奇数项后剩下一半
+    if ! (cd "$_PARAM" && rm -f $(seq -f "f%g" 1 2 "$BIGDIR_CNT")); then
+        fail "$_TEST_CASE: 删除$_PARAM下的文件失败"
+        return 1
+    fi
+
+    CNT=$(ls "$_PARAM" | wc -l)
+    if (( CNT != BIGDIR_CNT / 2 )); then
+        fail "$_TEST_CASE: 删除一半后ls $_PARAM输出$CNT项, 应为$((BIGDIR_CNT / 2))项"
+        return 1
+    fi
+
+    if [ -e "$_PARAM/f1" ] || [ ! -f "$_PARAM/f2" ] || [ ! -f "$_PARAM/f$BIGDIR_CNT" ]; then
+        fail "$_TEST_CASE: 删除一半后$_PARAM下的文件不符合预期"
+        return 1
+    fi
+    return 0
+}
+
+clean_mount
+clean_ddriver
+
+try_mount_or_fail
+
+create_bigdir
+
+TEST_CASE="case 8.1 - ls big directory"
+core_tester ls "${MNTPOINT}"/bigdir check_bigdir "$TEST_CASE" 2
+
+clean_mount
+
+sleep 1
+
+try_mount_or_fail
+
+TEST_CASE="case 8.2 - remount big directory"
+core_tester ls "${MNTPOINT}"/bigdir check_bigdir "$TEST_CASE" 2
+
+TEST_CASE="case 8.3 - unlink in big directory"
+core_tester ls "${MNTPOINT}"/bigdir check_bigdir_unlink "$TEST_CASE" 2
+
+clean_mount
+clean_ddriver
@@ -0,0 +1,131 @@
+#!/bin/bash
+
+TEST_CASE="case 11 - clone"
+
+CLONE_SIZE=5000
+CLONE_DATA=$(mktemp)
+FSCK_BIN="$ROOT_PATH"/../build/fsck.newfs
+FSCK_DEV="$HOME"/ddriver
+FSCK_USED=""
+
+# 对目标文件$2发起NEWFS_IOC_CLONE，把源文件$1（相对于挂载点的路径）整个克隆过去
+function clone_file () {
+    python3 - "${MNTPOINT}" "$1" "$2" <<'EOF'
+import fcntl, struct, sys
+mnt, src, dest = sys.argv[1], sys.argv[2], sys.argv[3]
+arg = struct.pack("<256sQQQ", src.encode(), 0, 0, 0)        # struct newfs_ioc_clone
+cmd = (1 << 30) | (len(arg) << 16) | (ord("N") << 8) | 1   # _IOW('N', 1, ...)
+with open(mnt + dest, "r+b") as f:
+    fcntl.ioctl(f.fileno(), cmd, arg)
+EOF
+}
+
+# fsck.newfs报告的在用数据块数
+function fsck_used_blocks () {
+    "$FSCK_BIN" "$FSCK_DEV" | grep -o "[0-9]* 个数据块在用" | grep -o "^[0-9]*"
+}
+
+function create_clone () {
+    mkdir_and_check "${MNTPOINT}"/clonedir
+    head -c "$CLONE_SIZE" /dev/urandom > "$CLONE_DATA"
+    if ! cp "$CLONE_DATA" "${MNTPOINT}"/clonedir/a; then
+        fail "$TEST_CASE: 写入${MNTPOINT}/clonedir/a失败"
+        return 1
+    fi
+    touch_and_check "${MNTPOINT}"/clonedir/b
+    if ! clone_file /clonedir/a /clonedir/b; then
+        fail "$TEST_CASE: 把${MNTPOINT}/clonedir/a克隆到${MNTPOINT}/clonedir/b失败"
+        return 1
+    fi
+    return 0
+}
+
+# 两份副本：a是原来的数据，b是原来的数据在偏移100处改成了"CLONE"
+function check_clone_copies () {
+    _TEST_CASE=$1
+
+    if ! cmp -s "$CLONE_DATA" "${MNTPOINT}"/clonedir/a; then
+        fail "$_TEST_CASE: 写克隆出的${MNTPOINT}/clonedir/b后，源文件a的内容变了"
+        return 1
+    fi
+    if [[ "$(stat -c %s "${MNTPOINT}"/clonedir/b)" != "$CLONE_SIZE" ]] ||
+       [[ "$(dd if="${MNTPOINT}"/clonedir/b bs=1 skip=100 count=5 2>/dev/null)" != "CLONE" ]]; then
+        fail "$_TEST_CASE: ${MNTPOINT}/clonedir/b的大小或写入的内容不对"
+        return 1
+    fi
+    if ! cmp -s <(head -c 100 "$CLONE_DATA") <(head -c 100 "${MNTPOINT}"/clonedir/b) ||
+       ! cmp -s <(tail -c +106 "$CLONE_DATA") <(tail -c +106 "${MNTPOINT}"/clonedir/b); then
+        fail "$_TEST_CASE: ${MNTPOINT}/clonedir/b没有写到的部分与源文件不同"
+        return 1
+    fi
+    return 0
+}
+
+function check_clone_write () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    if ! cmp -s "$CLONE_DATA" "${MNTPOINT}"/clonedir/b; then
+        fail "$_TEST_CASE: 克隆出的${MNTPOINT}/clonedir/b与源文件内容不同"
+        return 1
+    fi
+    if ! printf "CLONE" | dd of="${MNTPOINT}"/clonedir/b bs=1 seek=100 conv=notrunc 2>/dev/null; then
+        fail "$_TEST_CASE: 写${MNTPOINT}/clonedir/b失败"
+        return 1
+    fi
+    check_clone_copies "$_TEST_CASE"
+}
+
+function check_clone_remount () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    clean_mount
+    try_mount_or_fail
+    check_clone_copies "$_TEST_CASE"
+}
+
+function check_clone_free () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    if ! rm "${MNTPOINT}"/clonedir/a "${MNTPOINT}"/clonedir/b || ! rmdir "${MNTPOINT}"/clonedir; then
+        fail "$_TEST_CASE: 删除${MNTPOINT}/clonedir失败"
+        return 1
+    fi
+    clean_mount
+    if ! OUTPUT=$("$FSCK_BIN" "$FSCK_DEV"); then
+        fail "$_TEST_CASE: 删除两份副本后fsck.newfs报告了问题: $OUTPUT"
+        return 1
+    fi
+    # 共享的块和写时复制出的块都要还回去
+    USED=$(fsck_used_blocks)
+    if [[ -z "${FSCK_USED}" ]] || [[ "${USED}" != "${FSCK_USED}" ]]; then
+        fail "$_TEST_CASE: 删除两份副本后有$USED个数据块在用, 克隆前为$FSCK_USED个"
+        return 1
+    fi
+    return 0
+}
+
+clean_mount
+clean_ddriver
+
+FSCK_USED=$(fsck_used_blocks)
+
+try_mount_or_fail
+
+create_clone
+
+TEST_CASE="case 11.1 - write one copy of a clone"
+core_tester true "" check_clone_write "$TEST_CASE" 2
+
+TEST_CASE="case 11.2 - remount after clone"
+core_tester true "" check_clone_remount "$TEST_CASE" 1
+
+TEST_CASE="case 11.3 - no leaked blocks after deleting both copies"
+core_tester true "" check_clone_free "$TEST_CASE" 2
+
+rm -f "$CLONE_DATA"
+
+clean_mount
+clean_ddriver
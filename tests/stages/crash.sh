@@ -0,0 +1,107 @@
+#!/bin/bash
+
+TEST_CASE="case 10 - crash and replay"
+
+CRASH_PRE=20
+CRASH_CNT=400
+FSCK_BIN="$ROOT_PATH"/../build/fsck.newfs
+FSCK_DEV="$HOME"/ddriver
+
+function create_before_crash () {
+    mkdir_and_check "${MNTPOINT}"/pre
+    for ((i = 0; i < CRASH_PRE; i++)); do
+        mkdir_and_check "${MNTPOINT}"/pre/d$i
+        touch_and_check "${MNTPOINT}"/pre/d$i/file
+    done
+    # mkdir和touch返回时所在事务已经提交，崩溃后也要在；写数据不等提交，再建一个目录把它带上
+    echo "before crash" > "${MNTPOINT}"/pre/data
+    mkdir_and_check "${MNTPOINT}"/pre/flush
+}
+
+# 后台一边建目录、文件、写数据、删文件，一边在中途杀掉newfs进程，不让它卸载
+function crash_mid_workload () {
+    (
+        cd "${MNTPOINT}" || exit
+        mkdir work 2>/dev/null
+        for ((i = 0; i < CRASH_CNT; i++)); do
+            mkdir work/d$i && echo "data $i" > work/d$i/file && rm -f work/d$((i - 1))/file
+        done
+    ) > /dev/null 2>&1 &
+    WORKLOAD=$!
+
+    sleep 1
+    pkill -9 -f "build/${PROJECT_NAME} --device="
+    wait "$WORKLOAD" 2>/dev/null
+
+    # 进程已经没了，挂载点只剩下断开的连接
+    fusermount -u "${MNTPOINT}" 2>/dev/null || umount -l "${MNTPOINT}" 2>/dev/null
+}
+
+function check_crash_fsck () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    # -y时先重放日志，之后的树应该完全一致
+    OUTPUT=$("$FSCK_BIN" -y "$FSCK_DEV")
+    RET=$?
+    if (( RET != 0 )); then
+        fail "$_TEST_CASE: 重放日志后fsck.newfs -y返回$RET, 输出: $OUTPUT"
+        return 1
+    fi
+    if ! echo "$OUTPUT" | grep -q "重放日志"; then
+        fail "$_TEST_CASE: 杀掉newfs后超级块仍然是正常卸载的状态"
+        return 1
+    fi
+    return 0
+}
+
+function check_crash_tree () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    try_mount_or_fail
+    for ((i = 0; i < CRASH_PRE; i++)); do
+        if [ ! -f "${MNTPOINT}"/pre/d$i/file ]; then
+            fail "$_TEST_CASE: 崩溃前已提交的${MNTPOINT}/pre/d$i/file丢失了"
+            return 1
+        fi
+    done
+    if [[ "$(cat "${MNTPOINT}"/pre/data)" != "before crash" ]]; then
+        fail "$_TEST_CASE: 崩溃前写入的${MNTPOINT}/pre/data内容不对"
+        return 1
+    fi
+    for dir in $(ls "${MNTPOINT}"/work 2>/dev/null); do
+        if ! stat "${MNTPOINT}"/work/"$dir" > /dev/null; then
+            fail "$_TEST_CASE: 列出的${MNTPOINT}/work/$dir无法访问"
+            return 1
+        fi
+    done
+    # 重放后还能继续修改，卸载后依然一致
+    mkdir_and_check "${MNTPOINT}"/post
+    clean_mount
+    if ! OUTPUT=$("$FSCK_BIN" "$FSCK_DEV"); then
+        fail "$_TEST_CASE: 重放后挂载、修改、卸载，fsck.newfs报告了问题: $OUTPUT"
+        return 1
+    fi
+    return 0
+}
+
+clean_mount
+clean_ddriver
+
+try_mount_or_fail
+
+create_before_crash
+
+crash_mid_workload
+
+sleep 1
+
+TEST_CASE="case 10.1 - fsck after replay"
+core_tester true "" check_crash_fsck "$TEST_CASE" 2
+
+TEST_CASE="case 10.2 - tree after replay"
+core_tester true "" check_crash_tree "$TEST_CASE" 2
+
+clean_mount
+clean_ddriver
@@ -0,0 +1,129 @@
+#!/bin/bash
+
+TEST_CASE="case 9 - fsck"
+
+FSCK_CNT=40
+FSCK_BIN="$ROOT_PATH"/../build/fsck.newfs
+FSCK_DEV="$HOME"/ddriver
+FSCK_SAVED=""
+
+# 在设备上找到有FSCK_CNT项的目录，把它目录树根下第2个子结点的magic改掉（$1=corrupt）或恢复成$2（$1=restore），
+# 输出原来的magic
+function fsck_poke () {
+    python3 - "$FSCK_DEV" "$FSCK_CNT" "$1" "$2" <<'EOF'
+import struct, sys
+dev, cnt, action = sys.argv[1], int(sys.argv[2]), sys.argv[3]
+with open(dev, "r+b") as f:
+    sb = struct.unpack("<31i", f.read(124))
+    ino_ofs, db_ofs, ino_max, blk = sb[11], sb[13], sb[15], sb[29]
+    for ino in range(ino_max):
+        f.seek(ino_ofs + (ino // 16) * blk + (ino % 16) * 60)
+        inode = struct.unpack("<4i6iIi3I", f.read(60))
+        if inode[3] == 1 and inode[11] == cnt:          # DIR，dir_cnt
+            break
+    else:
+        sys.exit(1)
+    f.seek(db_ofs + inode[4] * blk)
+    magic, level, n = struct.unpack("<HHi", f.read(8))
+    if level < 1 or n < 2:
+        sys.exit(1)
+    child = struct.unpack("<Ii", f.read(16)[8:])[1]
+    f.seek(db_ofs + child * blk)
+    print(struct.unpack("<H", f.read(2))[0])
+    f.seek(db_ofs + child * blk)
+    f.write(struct.pack("<H", 0 if action == "corrupt" else int(sys.argv[4])))
+EOF
+}
+
+function create_fsck_tree () {
+    mkdir_and_check "${MNTPOINT}"/fsckdir
+    mkdir_and_check "${MNTPOINT}"/keep
+    touch_and_check "${MNTPOINT}"/keep/file0
+    if ! (cd "${MNTPOINT}"/fsckdir && touch $(seq -f "f%g" 1 "$FSCK_CNT")); then
+        fail "$TEST_CASE: 在${MNTPOINT}/fsckdir下创建文件失败"
+        return 1
+    fi
+    return 0
+}
+
+function check_fsck_clean () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    if ! OUTPUT=$("$FSCK_BIN" "$FSCK_DEV"); then
+        fail "$_TEST_CASE: fsck.newfs报告了问题: $OUTPUT"
+        return 1
+    fi
+    return 0
+}
+
+function check_fsck_partial () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    if ! FSCK_SAVED=$(fsck_poke corrupt); then
+        fail "$_TEST_CASE: 没有在设备上找到${MNTPOINT}/fsckdir的目录树"
+        return 1
+    fi
+
+    OUTPUT=$("$FSCK_BIN" -y "$FSCK_DEV")
+    RET=$?
+    if (( RET != 4 )); then
+        fail "$_TEST_CASE: 目录树结点损坏时fsck.newfs -y应返回4, 实际返回$RET"
+        return 1
+    fi
+    if ! echo "$OUTPUT" | grep -q "目录树没有走完"; then
+        fail "$_TEST_CASE: fsck.newfs没有报告目录树没有走完"
+        return 1
+    fi
+    if echo "$OUTPUT" | grep -q "已释放"; then
+        fail "$_TEST_CASE: 目录树没有走完时fsck.newfs -y释放了走不到的inode或数据块"
+        return 1
+    fi
+    return 0
+}
+
+function check_fsck_restore () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    # 坏结点恢复后，-y没有动过的盘应该完全正常
+    if [[ -z "${FSCK_SAVED}" ]] || ! fsck_poke restore "$FSCK_SAVED" > /dev/null; then
+        fail "$_TEST_CASE: 恢复目录树结点失败"
+        return 1
+    fi
+    if ! check_fsck_clean "$_PARAM" "$_TEST_CASE"; then
+        return 1
+    fi
+
+    try_mount_or_fail
+    CNT=$(ls "${MNTPOINT}"/fsckdir | wc -l)
+    if (( CNT != FSCK_CNT )) || [ ! -f "${MNTPOINT}"/keep/file0 ]; then
+        fail "$_TEST_CASE: 修复后${MNTPOINT}/fsckdir下有$CNT项, 应为$FSCK_CNT项"
+        return 1
+    fi
+    return 0
+}
+
+clean_mount
+clean_ddriver
+
+try_mount_or_fail
+
+create_fsck_tree
+
+clean_mount
+
+sleep 1
+
+TEST_CASE="case 9.1 - fsck clean image"
+core_tester true "" check_fsck_clean "$TEST_CASE" 1
+
+TEST_CASE="case 9.2 - fsck -y with a broken directory tree"
+core_tester true "" check_fsck_partial "$TEST_CASE" 2
+
+TEST_CASE="case 9.3 - nothing freed by fsck -y"
+core_tester true "" check_fsck_restore "$TEST_CASE" 2
+
+clean_mount
+clean_ddriver
@@ -0,0 +1,144 @@
+#!/bin/bash
+
+TEST_CASE="case 12 - rename"
+
+# 对源文件$1发起NEWFS_IOC_RENAME，改名到$2（都是相对于挂载点的路径），$3为NEWFS_RENAME_*；
+# 失败时以errno退出
+function rename_flags () {
+    python3 - "${MNTPOINT}" "$1" "$2" "$3" <<'EOF'
+import fcntl, struct, sys
+mnt, src, dest, flags = sys.argv[1], sys.argv[2], sys.argv[3], int(sys.argv[4])
+arg = struct.pack("<256sI", dest.encode(), flags)           # struct newfs_ioc_rename
+cmd = (1 << 30) | (len(arg) << 16) | (ord("N") << 8) | 2   # _IOW('N', 2, ...)
+try:
+    with open(mnt + src, "rb") as f:
+        fcntl.ioctl(f.fileno(), cmd, arg)
+except OSError as e:
+    sys.exit(e.errno)
+EOF
+}
+
+RENAME_NOREPLACE=1
+RENAME_EXCHANGE=2
+EEXIST=17
+
+# 文件$1存在且内容为$2
+function file_is () {
+    [ -f "$1" ] && [[ "$(cat "$1")" == "$2" ]]
+}
+
+# 改名是绕过内核直接发给newfs的，重新挂载后再从盘上看结果
+function remount () {
+    clean_mount
+    try_mount_or_fail
+}
+
+function create_rename_tree () {
+    mkdir_and_check "${MNTPOINT}"/ra
+    mkdir_and_check "${MNTPOINT}"/rb
+    echo "from a" > "${MNTPOINT}"/ra/x
+    echo "from b" > "${MNTPOINT}"/rb/y
+    echo "source" > "${MNTPOINT}"/ra/src
+    echo "target" > "${MNTPOINT}"/rb/dst
+    echo "keep a" > "${MNTPOINT}"/ra/k
+    echo "keep b" > "${MNTPOINT}"/rb/k
+    mkdir_and_check "${MNTPOINT}"/ra/sub
+    echo "in sub" > "${MNTPOINT}"/ra/sub/f
+    echo "plain" > "${MNTPOINT}"/rb/plain
+    mkdir_and_check "${MNTPOINT}"/ra/full
+    touch_and_check "${MNTPOINT}"/ra/full/f
+    mkdir_and_check "${MNTPOINT}"/rb/full
+    touch_and_check "${MNTPOINT}"/rb/full/f
+}
+
+function check_rename_replace () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    if ! mv "${MNTPOINT}"/ra/src "${MNTPOINT}"/rb/dst; then
+        fail "$_TEST_CASE: 跨目录把${MNTPOINT}/ra/src改名覆盖${MNTPOINT}/rb/dst失败"
+        return 1
+    fi
+    # 目标是非空目录时替换失败，两边都不动
+    if mv -T "${MNTPOINT}"/ra/full "${MNTPOINT}"/rb/full 2>/dev/null; then
+        fail "$_TEST_CASE: 把${MNTPOINT}/ra/full改名覆盖非空目录${MNTPOINT}/rb/full成功了"
+        return 1
+    fi
+    remount
+    if [ -e "${MNTPOINT}"/ra/src ] || ! file_is "${MNTPOINT}"/rb/dst "source"; then
+        fail "$_TEST_CASE: 覆盖后${MNTPOINT}/ra/src应不存在, ${MNTPOINT}/rb/dst应为源文件的内容"
+        return 1
+    fi
+    if [ ! -f "${MNTPOINT}"/ra/full/f ] || [ ! -f "${MNTPOINT}"/rb/full/f ]; then
+        fail "$_TEST_CASE: 替换非空目录失败后${MNTPOINT}/ra/full或${MNTPOINT}/rb/full中的文件丢失了"
+        return 1
+    fi
+    return 0
+}
+
+function check_rename_exchange () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    if ! rename_flags /ra/x /rb/y "$RENAME_EXCHANGE"; then
+        fail "$_TEST_CASE: 交换${MNTPOINT}/ra/x和${MNTPOINT}/rb/y失败"
+        return 1
+    fi
+    # 文件和另一个目录下的目录也能交换，目录带着它的内容一起走
+    if ! rename_flags /rb/plain /ra/sub "$RENAME_EXCHANGE"; then
+        fail "$_TEST_CASE: 交换${MNTPOINT}/rb/plain和${MNTPOINT}/ra/sub失败"
+        return 1
+    fi
+    remount
+    if ! file_is "${MNTPOINT}"/ra/x "from b" || ! file_is "${MNTPOINT}"/rb/y "from a"; then
+        fail "$_TEST_CASE: 交换后${MNTPOINT}/ra/x和${MNTPOINT}/rb/y的内容没有互换"
+        return 1
+    fi
+    if ! file_is "${MNTPOINT}"/ra/sub "plain" || ! file_is "${MNTPOINT}"/rb/plain/f "in sub"; then
+        fail "$_TEST_CASE: 交换后${MNTPOINT}/ra/sub应为文件, ${MNTPOINT}/rb/plain应为原来的目录"
+        return 1
+    fi
+    return 0
+}
+
+function check_rename_noreplace () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    rename_flags /ra/k /rb/k "$RENAME_NOREPLACE" 2>/dev/null
+    RET=$?
+    if (( RET != EEXIST )); then
+        fail "$_TEST_CASE: 目标已存在时NOREPLACE改名应返回EEXIST, 实际为$RET"
+        return 1
+    fi
+    if ! rename_flags /ra/k /rb/new "$RENAME_NOREPLACE"; then
+        fail "$_TEST_CASE: 目标不存在时NOREPLACE改名${MNTPOINT}/ra/k失败"
+        return 1
+    fi
+    remount
+    if ! file_is "${MNTPOINT}"/rb/k "keep b" || ! file_is "${MNTPOINT}"/rb/new "keep a" ||
+       [ -e "${MNTPOINT}"/ra/k ]; then
+        fail "$_TEST_CASE: NOREPLACE改名失败后${MNTPOINT}/rb/k被覆盖了, 或成功后${MNTPOINT}/rb/new不对"
+        return 1
+    fi
+    return 0
+}
+
+clean_mount
+clean_ddriver
+
+try_mount_or_fail
+
+create_rename_tree
+
+TEST_CASE="case 12.1 - rename over an existing entry"
+core_tester true "" check_rename_replace "$TEST_CASE" 2
+
+TEST_CASE="case 12.2 - exchange across directories"
+core_tester true "" check_rename_exchange "$TEST_CASE" 2
+
+TEST_CASE="case 12.3 - noreplace keeps both entries"
+core_tester true "" check_rename_noreplace "$TEST_CASE" 2
+
+clean_mount
+clean_ddriver
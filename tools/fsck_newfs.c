@@ -0,0 +1,601 @@
+/**
+ * 离线检查newfs：顺序大块读入位图、引用计数和整张inode表，从根目录出发用线程池并行遍历目录，
+ * 再把能走到的inode和数据块与inode位图、数据块位图、引用计数逐一对照：
+ *   - 位图中已分配但走不到的inode和数据块（泄漏）
+ *   - 在用但位图未置位的inode和数据块
+ *   - 被多个文件引用、引用计数却不够的数据块（重复分配），以及越界的块指针
+ *   - 目录项指向越界、类型不符或已被别处链接的inode，目录树结点损坏或与目录项数不符
+ * -y 时修复位图、引用计数、越界的块指针和超级块中各组的目录数；目录项本身的问题只报告。
+ * 有目录树没走完（结点损坏、块号越界）时，走不到的inode和数据块可能还挂在坏结点下面，
+ * 这时泄漏和各组目录数只报告不修复，免得把整棵子树释放掉
+ *
+ * 用法: fsck.newfs [-y] [-j 线程数] 设备
+ * 退出码与e2fsck相同：0 没有问题，1 问题都已修复，4 还有未修复的问题，8 无法检查
+ */
+#include "newfs.h"
+#include <getopt.h>
+
+struct custom_options newfs_options;
+struct newfs_super    super;
+
+#define FSCK_EXIT_OK        0
+#define FSCK_EXIT_FIXED     1
+#define FSCK_EXIT_UNFIXED   4
+#define FSCK_EXIT_ERROR     8
+#define FSCK_MAX_THREADS    64
+
+/* 每个inode的检查标志 */
+#define FSCK_REACHED        0x01        // 从根目录能走到
+#define FSCK_DUP_LINK       0x02        // 被不止一个目录项指向
+#define FSCK_BAD_PTR        0x04        // 有越界的块指针
+#define FSCK_BAD_DIR        0x08        // 目录树损坏、哈希顺序不对或与目录项数不符
+#define FSCK_BAD_DENTRY     0x10        // 目录中有指向越界、未初始化或类型不符inode的目录项
+
+struct fsck_dev {
+    int             fd;                 // ddriver fd
+    int             img_fd;             // 镜像文件fd，-1时经ddriver读写
+    pthread_mutex_t lock;               // ddriver不是线程安全的
+};
+
+struct fsck {
+    struct fsck_dev       dev;
+    struct newfs_super_d  sb;
+    uint8_t*              map_inode;
+    uint8_t*              map_db;
+    uint8_t*              refcnt;
+    uint8_t*              itable;       // 整张inode表
+    uint8_t*              flags;        // 每个inode一个FSCK_*
+    uint16_t*             refs;         // 每个数据块被引用的次数
+
+    /* 待遍历的目录 */
+    pthread_mutex_t       lock;
+    pthread_cond_t        cond;
+    uint32_t*             queue;
+    int                   nr_queue;
+    int                   nr_busy;      // 正在处理目录的线程数
+    int                   nr_bad_dentry;
+    int                   nr_incomplete;    // 目录树没能走完的目录数
+};
+
+static struct fsck fsck;
+
+static double now_s() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief 读写设备上[offset, offset+size)，都是IO单位的整数倍；镜像文件直接大块pread/pwrite
+ */
+static int fsck_io(int offset, uint8_t* buf, int size, boolean is_write) {
+    struct fsck_dev* dev = &fsck.dev;
+    int ret = 0;
+
+    if (dev->img_fd >= 0) {
+        ssize_t n = is_write ? pwrite(dev->img_fd, buf, size, offset) : pread(dev->img_fd, buf, size, offset);
+        return n == size ? NEWFS_ERROR_NONE : -NEWFS_ERROR_IO;
+    }
+    pthread_mutex_lock(&dev->lock);
+    if (ddriver_seek(dev->fd, offset, SEEK_SET) < 0) {
+        ret = -1;
+    }
+    for (int done = 0; ret >= 0 && done < size; done += NEWFS_IO_SIZE()) {
+        ret = is_write ? ddriver_write(dev->fd, (char*)buf + done, NEWFS_IO_SIZE()) :
+                         ddriver_read(dev->fd, (char*)buf + done, NEWFS_IO_SIZE());
+    }
+    pthread_mutex_unlock(&dev->lock);
+    return ret < 0 ? -NEWFS_ERROR_IO : NEWFS_ERROR_NONE;
+}
+
+static struct newfs_inode_d* fsck_inode(uint32_t ino) {
+    return (struct newfs_inode_d*)(fsck.itable + (size_t)(ino / MAX_INODE_NUM_PERBLK) * NEWFS_BLK_SIZE() +
+                                   (ino % MAX_INODE_NUM_PERBLK) * sizeof(struct newfs_inode_d));
+}
+
+/**
+ * @brief 打开设备，上次没有正常卸载时先借核心库挂载一次重放日志（只在-y时）
+ */
+static int fsck_open(const char* device, boolean is_repair) {
+    struct stat st;
+    uint8_t*    io;
+
+    newfs_options.device = device;
+    fsck.dev.fd = ddriver_open((char*)device);
+    if (fsck.dev.fd < 0) {
+        fprintf(stderr, "无法打开 %s\n", device);
+        return -1;
+    }
+    ddriver_ioctl(fsck.dev.fd, IOC_REQ_DEVICE_SIZE, &super.disk_size);
+    ddriver_ioctl(fsck.dev.fd, IOC_REQ_DEVICE_IO_SZ, &super.io_size);
+    pthread_mutex_init(&fsck.dev.lock, NULL);
+    fsck.dev.img_fd = open(device, is_repair ? O_RDWR : O_RDONLY);
+    if (fsck.dev.img_fd >= 0 && (fstat(fsck.dev.img_fd, &st) != 0 || !S_ISREG(st.st_mode))) {
+        close(fsck.dev.img_fd);
+        fsck.dev.img_fd = -1;
+    }
+
+    io = (uint8_t*)malloc(super.io_size);
+    if (fsck_io(NEWFS_SUPER_OFS, io, super.io_size, FALSE) != NEWFS_ERROR_NONE) {
+        free(io);
+        return -1;
+    }
+    memcpy(&fsck.sb, io, sizeof(struct newfs_super_d));
+    free(io);
+    if (fsck.sb.magic != NEWFS_MAGIC_NUM) {
+        fprintf(stderr, "%s 不是newfs（magic 0x%x）\n", device, fsck.sb.magic);
+        return -1;
+    }
+    if ((fsck.sb.features & ~NEWFS_FEATURE_ALL) != 0) {
+        fprintf(stderr, "不认识的特性 0x%x\n", fsck.sb.features);
+        return -1;
+    }
+    if ((fsck.sb.features & NEWFS_FEATURE_REQUIRED) != NEWFS_FEATURE_REQUIRED) {
+        fprintf(stderr, "旧格式的目录（特性 0x%x），要用mkfs.newfs重新格式化\n", fsck.sb.features);
+        return -1;
+    }
+    super.blks_size = fsck.sb.blks_size != 0 ? fsck.sb.blks_size : super.io_size * 2;
+    if (fsck.sb.db_offset + (long)NEWFS_BLKS_SIZE(fsck.sb.db_blks) > super.disk_size ||
+        fsck.sb.ino_max > fsck.sb.ino_blks * MAX_INODE_NUM_PERBLK || fsck.sb.db_blks <= 0 ||
+        NEWFS_BLKS_SIZE(fsck.sb.ino_map_blks) * UINT8_BITS < fsck.sb.ino_max ||
+        NEWFS_BLKS_SIZE(fsck.sb.db_map_blks) * UINT8_BITS < fsck.sb.db_blks ||
+        NEWFS_BLKS_SIZE(fsck.sb.refcnt_blks) < fsck.sb.db_blks) {
+        fprintf(stderr, "超级块中的布局不合法\n");
+        return -1;
+    }
+
+    if (fsck.sb.state != NEWFS_STATE_CLEAN) {
+        if (!is_repair) {
+            printf("上次没有正常卸载，日志没有重放，下面的结果可能不准；用 -y 先重放日志\n");
+            return 0;
+        }
+        printf("上次没有正常卸载，重放日志\n");
+        if (fsck.dev.img_fd >= 0) {
+            close(fsck.dev.img_fd);
+        }
+        ddriver_close(fsck.dev.fd);
+        if (newfs_mount(newfs_options) != NEWFS_ERROR_NONE || newfs_umount() != NEWFS_ERROR_NONE) {
+            fprintf(stderr, "重放日志失败\n");
+            return -1;
+        }
+        memset(&super, 0, sizeof(super));
+        return fsck_open(device, is_repair);
+    }
+    return 0;
+}
+
+/**
+ * @brief 顺序读入位图、引用计数和inode表
+ */
+static int fsck_load() {
+    struct newfs_super_d* sb = &fsck.sb;
+
+    super.ino_offset = sb->ino_offset;
+    super.db_offset  = sb->db_offset;
+    fsck.map_inode = (uint8_t*)malloc(NEWFS_BLKS_SIZE(sb->ino_map_blks));
+    fsck.map_db    = (uint8_t*)malloc(NEWFS_BLKS_SIZE(sb->db_map_blks));
+    fsck.refcnt    = (uint8_t*)malloc(NEWFS_BLKS_SIZE(sb->refcnt_blks));
+    fsck.itable    = (uint8_t*)malloc((size_t)NEWFS_BLKS_SIZE(sb->ino_blks));
+    fsck.flags     = (uint8_t*)calloc(sb->ino_max, 1);
+    fsck.refs      = (uint16_t*)calloc(sb->db_blks, sizeof(uint16_t));
+    fsck.queue     = (uint32_t*)malloc(sizeof(uint32_t) * sb->ino_max);
+    if (fsck.itable == NULL || fsck.flags == NULL || fsck.refs == NULL || fsck.queue == NULL) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    if (fsck_io(sb->ino_map_offset, fsck.map_inode, NEWFS_BLKS_SIZE(sb->ino_map_blks), FALSE) ||
+        fsck_io(sb->db_map_offset, fsck.map_db, NEWFS_BLKS_SIZE(sb->db_map_blks), FALSE) ||
+        fsck_io(sb->refcnt_offset, fsck.refcnt, NEWFS_BLKS_SIZE(sb->refcnt_blks), FALSE)) {
+        return -NEWFS_ERROR_IO;
+    }
+    for (int ofs = 0; ofs < NEWFS_BLKS_SIZE(sb->ino_blks); ofs += NEWFS_MKFS_CHUNK) {
+        int len = NEWFS_BLKS_SIZE(sb->ino_blks) - ofs;
+        len = len < NEWFS_MKFS_CHUNK ? len : NEWFS_MKFS_CHUNK;
+        if (fsck_io(sb->ino_offset + ofs, fsck.itable + ofs, len, FALSE) != NEWFS_ERROR_NONE) {
+            return -NEWFS_ERROR_IO;
+        }
+    }
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 第一次走到一个inode：记下它的数据块引用，越界的块指针标记出来
+ */
+static void fsck_reach(uint32_t ino) {
+    struct newfs_inode_d* inode_d = fsck_inode(ino);
+
+    for (int i = 0; i < MAX_DATA_PERFILE; i++) {
+        int dno = inode_d->block_pointer[i];
+        if (dno == -1) {
+            continue;
+        }
+        if (dno < 0 || dno >= fsck.sb.db_blks) {
+            __atomic_or_fetch(&fsck.flags[ino], FSCK_BAD_PTR, __ATOMIC_RELAXED);
+            continue;
+        }
+        __atomic_add_fetch(&fsck.refs[dno], 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void fsck_push(uint32_t ino) {
+    pthread_mutex_lock(&fsck.lock);
+    fsck.queue[fsck.nr_queue++] = ino;
+    pthread_cond_signal(&fsck.cond);
+    pthread_mutex_unlock(&fsck.lock);
+}
+
+/**
+ * @brief 检查目录中的一个目录项，第一次走到的子目录放回队列
+ */
+static void fsck_dentry(uint32_t dir_ino, struct newfs_dentry_d* d) {
+    struct newfs_inode_d* child;
+    uint8_t old;
+
+    if (d->ino == NEWFS_ROOT_INO || d->ino >= (uint32_t)fsck.sb.ino_max ||
+        memchr(d->name, '\0', MAX_NAME_LEN) == NULL || d->name[0] == '\0' ||
+        (child = fsck_inode(d->ino))->ino != d->ino || child->ftype != d->ftype) {
+        __atomic_or_fetch(&fsck.flags[dir_ino], FSCK_BAD_DENTRY, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&fsck.nr_bad_dentry, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    old = __atomic_fetch_or(&fsck.flags[d->ino], FSCK_REACHED, __ATOMIC_RELAXED);
+    if (old & FSCK_REACHED) {
+        __atomic_or_fetch(&fsck.flags[d->ino], FSCK_DUP_LINK, __ATOMIC_RELAXED);
+        return;
+    }
+    fsck_reach(d->ino);
+    if (d->ftype == DIR) {
+        fsck_push(d->ino);
+    }
+}
+
+/**
+ * @brief 检查目录树中以dno为根的子树：块头、层数、项数和哈希顺序，叶子中的目录项逐个检查。
+ * 子结点的块引用在这里记下（树根由fsck_reach记），损坏的结点不再向下，其余子树照常检查
+ *
+ * @param dir_ino 目录
+ * @param dno 子树的根
+ * @param level 期望的层数，-1为不检查（树根）
+ * @param lo 父结点给出的哈希下界
+ * @param hi 父结点给出的哈希上界
+ * @param blk 每层一个块的缓冲区，本层用第0块
+ * @return int 子树中的目录项数，有结点损坏时返回-1
+ */
+static int fsck_dx(uint32_t dir_ino, int dno, int level, uint32_t lo, uint32_t hi, uint8_t* blk) {
+    struct newfs_dx_head*  head = (struct newfs_dx_head*)blk;
+    struct newfs_dx_entry* entries;
+    struct newfs_dentry_d* dentrys;
+    uint32_t prev = lo, hash;
+    int total = 0, cnt;
+
+    if (fsck_io(NEWFS_DB_OFS(dno), blk, NEWFS_BLK_SIZE(), FALSE) != NEWFS_ERROR_NONE ||
+        head->magic != NEWFS_DX_MAGIC || head->level >= NEWFS_DX_MAX_LEVEL ||
+        (level >= 0 && head->level != level) || head->cnt < 1 ||
+        head->cnt > (head->level == 0 ? (int)MAX_DENTRY_PERBLK() : (int)MAX_DX_ENTRY_PERBLK())) {
+        return -1;
+    }
+    if (head->level == 0) {
+        dentrys = (struct newfs_dentry_d*)(head + 1);
+        for (int i = 0; i < head->cnt; i++) {
+            hash = newfs_dx_hash(dentrys[i].name);
+            if (hash < prev || hash > hi) {                 /* 查找会找不到，但目录项本身还在 */
+                __atomic_or_fetch(&fsck.flags[dir_ino], FSCK_BAD_DIR, __ATOMIC_RELAXED);
+            }
+            prev = hash;
+            fsck_dentry(dir_ino, &dentrys[i]);
+        }
+        return head->cnt;
+    }
+
+    entries = (struct newfs_dx_entry*)(head + 1);
+    for (int i = 0; i < head->cnt; i++) {
+        if (i > 0 && (entries[i].hash < prev || entries[i].hash > hi)) {
+            __atomic_or_fetch(&fsck.flags[dir_ino], FSCK_BAD_DIR, __ATOMIC_RELAXED);
+        }
+        prev = i > 0 ? entries[i].hash : lo;
+        if (entries[i].dno < 0 || entries[i].dno >= fsck.sb.db_blks) {
+            total = -1;
+            continue;
+        }
+        __atomic_add_fetch(&fsck.refs[entries[i].dno], 1, __ATOMIC_RELAXED);
+        cnt = fsck_dx(dir_ino, entries[i].dno, head->level - 1, prev,
+                      i + 1 < head->cnt ? entries[i + 1].hash : hi, blk + NEWFS_BLK_SIZE());
+        if (cnt < 0 || total < 0) {
+            total = -1;
+        }
+        else {
+            total += cnt;
+        }
+    }
+    return total;
+}
+
+/**
+ * @brief 检查一个目录的目录树和全部目录项，子目录放回队列
+ */
+static void fsck_dir(uint32_t dir_ino, uint8_t* blks) {
+    struct newfs_inode_d* dir = fsck_inode(dir_ino);
+    int total = 0;
+
+    for (int i = 1; i < MAX_DATA_PERFILE; i++) {          /* 目录只有树根一个块指针 */
+        if (dir->block_pointer[i] != -1) {
+            __atomic_or_fetch(&fsck.flags[dir_ino], FSCK_BAD_DIR, __ATOMIC_RELAXED);
+        }
+    }
+    if (dir->block_pointer[0] >= 0 && dir->block_pointer[0] < fsck.sb.db_blks) {
+        total = fsck_dx(dir_ino, dir->block_pointer[0], -1, 0, UINT32_MAX, blks);
+    }
+    else if (dir->block_pointer[0] != -1) {
+        total = -1;
+    }
+    if (total < 0) {                                    /* 坏结点下面的目录项没有走到 */
+        __atomic_add_fetch(&fsck.nr_incomplete, 1, __ATOMIC_RELAXED);
+    }
+    if (total != dir->dir_cnt) {
+        __atomic_or_fetch(&fsck.flags[dir_ino], FSCK_BAD_DIR, __ATOMIC_RELAXED);
+    }
+}
+
+static void* fsck_worker(void* arg) {
+    uint8_t* blk = (uint8_t*)malloc(NEWFS_BLKS_SIZE(NEWFS_DX_MAX_LEVEL));
+
+    pthread_mutex_lock(&fsck.lock);
+    for (;;) {
+        uint32_t ino;
+        while (fsck.nr_queue == 0 && fsck.nr_busy > 0) {
+            pthread_cond_wait(&fsck.cond, &fsck.lock);
+        }
+        if (fsck.nr_queue == 0) {                       /* 队列空且没有线程还会加入 */
+            pthread_cond_broadcast(&fsck.cond);
+            break;
+        }
+        ino = fsck.queue[--fsck.nr_queue];
+        fsck.nr_busy++;
+        pthread_mutex_unlock(&fsck.lock);
+
+        fsck_dir(ino, blk);
+
+        pthread_mutex_lock(&fsck.lock);
+        fsck.nr_busy--;
+        if (fsck.nr_busy == 0 && fsck.nr_queue == 0) {
+            pthread_cond_broadcast(&fsck.cond);
+        }
+    }
+    pthread_mutex_unlock(&fsck.lock);
+    free(blk);
+    return NULL;
+}
+
+/**
+ * @brief 从根目录出发并行遍历
+ */
+static void fsck_walk(int nr_threads) {
+    pthread_t tids[FSCK_MAX_THREADS];
+
+    pthread_mutex_init(&fsck.lock, NULL);
+    pthread_cond_init(&fsck.cond, NULL);
+    fsck.flags[NEWFS_ROOT_INO] |= FSCK_REACHED;
+    fsck_reach(NEWFS_ROOT_INO);
+    fsck.queue[fsck.nr_queue++] = NEWFS_ROOT_INO;
+    for (int t = 0; t < nr_threads; t++) {
+        pthread_create(&tids[t], NULL, fsck_worker, NULL);
+    }
+    for (int t = 0; t < nr_threads; t++) {
+        pthread_join(tids[t], NULL);
+    }
+}
+
+/**
+ * @brief 对照位图、引用计数，需要时修复
+ *
+ * @return int 退出码
+ */
+static int fsck_check(boolean is_repair) {
+    struct newfs_super_d* sb = &fsck.sb;
+    int  ino_per_group = NEWFS_ROUND_UP((sb->ino_max + NEWFS_GROUPS - 1) / NEWFS_GROUPS, UINT8_BITS);
+    int  group_dirs[NEWFS_GROUPS] = { 0 };
+    int  nr_fixed = 0, nr_unfixed = 0;
+    int  nr_inodes = 0, nr_dirs = 0, nr_blks = 0;
+    boolean is_bm_dirty = FALSE, is_super_dirty = FALSE;
+    boolean is_partial  = fsck.nr_incomplete > 0;     /* 走不到的不一定真的泄漏 */
+    boolean is_free     = is_repair && !is_partial;
+
+    if (fsck_inode(NEWFS_ROOT_INO)->ftype != DIR) {
+        printf("根目录inode不是目录\n");
+        return FSCK_EXIT_UNFIXED;
+    }
+
+    for (int ino = 0; ino < sb->ino_max; ino++) {
+        struct newfs_inode_d* inode_d = fsck_inode(ino);
+        uint8_t flags  = fsck.flags[ino];
+        boolean in_map = NEWFS_BM_TEST(fsck.map_inode, ino) != 0;
+
+        if (!(flags & FSCK_REACHED)) {
+            if (in_map) {
+                printf("inode %d: 已分配但从根目录走不到（泄漏）%s\n", ino,
+                       is_free ? "，已释放" : is_repair ? "，目录树没有走完，未释放" : "");
+                if (is_free) {
+                    NEWFS_BM_CLEAR(fsck.map_inode, ino);
+                    is_bm_dirty = TRUE;
+                }
+                is_free ? nr_fixed++ : nr_unfixed++;
+            }
+            continue;
+        }
+        nr_inodes++;
+        if (inode_d->ftype == DIR) {
+            nr_dirs++;
+            group_dirs[ino / ino_per_group]++;
+        }
+        if (!in_map) {
+            printf("inode %d: 在用但位图未置位%s\n", ino, is_repair ? "，已置位" : "");
+            if (is_repair) {
+                NEWFS_BM_SET(fsck.map_inode, ino);
+                is_bm_dirty = TRUE;
+            }
+            is_repair ? nr_fixed++ : nr_unfixed++;
+        }
+        if (flags & FSCK_BAD_PTR) {
+            printf("inode %d: 有越界的块指针%s\n", ino, is_repair ? "，已改为空洞" : "");
+            if (is_repair) {
+                for (int i = 0; i < MAX_DATA_PERFILE; i++) {
+                    if (inode_d->block_pointer[i] < -1 || inode_d->block_pointer[i] >= sb->db_blks) {
+                        inode_d->block_pointer[i] = -1;
+                        inode_d->unwritten &= ~(0x1u << i);
+                    }
+                }
+                if (fsck_io(sb->ino_offset + (ino / MAX_INODE_NUM_PERBLK) * NEWFS_BLK_SIZE(),
+                            (uint8_t*)fsck_inode(ino - ino % MAX_INODE_NUM_PERBLK),
+                            NEWFS_BLK_SIZE(), TRUE) != NEWFS_ERROR_NONE) {
+                    return FSCK_EXIT_ERROR;
+                }
+            }
+            is_repair ? nr_fixed++ : nr_unfixed++;
+        }
+        if (flags & FSCK_DUP_LINK) {
+            printf("inode %d: 被多个目录项指向\n", ino);
+            nr_unfixed++;
+        }
+        if (flags & FSCK_BAD_DIR) {
+            printf("inode %d: 目录树损坏或与目录项数（%d）不符\n", ino, inode_d->dir_cnt);
+            nr_unfixed++;
+        }
+        if (flags & FSCK_BAD_DENTRY) {
+            printf("inode %d: 有指向越界、未初始化或类型不符inode的目录项\n", ino);
+            nr_unfixed++;
+        }
+    }
+
+    for (int dno = 0; dno < sb->db_blks; dno++) {
+        int     refs   = fsck.refs[dno];
+        boolean in_map = NEWFS_BM_TEST(fsck.map_db, dno) != 0;
+        int     want   = refs > 1 ? refs - 1 : 0;      /* 引用计数记的是额外共享者数 */
+
+        nr_blks += refs > 0;
+        if (refs > MAX_REFCNT + 1) {
+            printf("数据块 %d: 被 %d 个文件引用，超过引用计数的上限\n", dno, refs);
+            nr_unfixed++;
+            continue;
+        }
+        if (refs == 0 && (in_map || fsck.refcnt[dno] != 0) && is_repair && is_partial) {
+            printf("数据块 %d: 没有走到的文件引用，目录树没有走完，未修复\n", dno);
+            nr_unfixed++;
+            continue;
+        }
+        if (refs == 0 && in_map) {
+            printf("数据块 %d: 已分配但没有文件引用（泄漏）%s\n", dno, is_repair ? "，已释放" : "");
+        }
+        else if (refs > 0 && !in_map) {
+            printf("数据块 %d: 被引用但位图未置位%s\n", dno, is_repair ? "，已置位" : "");
+        }
+        else if (refs > 1 && fsck.refcnt[dno] == 0) {
+            printf("数据块 %d: 被 %d 个文件引用却不是共享块（重复分配）%s\n", dno, refs,
+                   is_repair ? "，改为共享" : "");
+        }
+        else if (fsck.refcnt[dno] != want) {
+            printf("数据块 %d: 引用计数 %d，实际 %d 个引用%s\n", dno, fsck.refcnt[dno], refs,
+                   is_repair ? "，已更正" : "");
+        }
+        else {
+            continue;
+        }
+        if (is_repair) {
+            if (refs > 0) {
+                NEWFS_BM_SET(fsck.map_db, dno);
+            }
+            else {
+                NEWFS_BM_CLEAR(fsck.map_db, dno);
+            }
+            fsck.refcnt[dno] = want;
+            is_bm_dirty = TRUE;
+        }
+        is_repair ? nr_fixed++ : nr_unfixed++;
+    }
+
+    for (int gno = 0; gno < NEWFS_GROUPS; gno++) {
+        if (sb->group_dirs[gno] != group_dirs[gno]) {
+            printf("分配组 %d: 目录数 %d，走到 %d%s\n", gno, sb->group_dirs[gno], group_dirs[gno],
+                   is_free ? "，已更正" : is_repair ? "，目录树没有走完，未更正" : "");
+            if (is_free) {
+                sb->group_dirs[gno] = group_dirs[gno];
+                is_super_dirty = TRUE;
+            }
+            is_free ? nr_fixed++ : nr_unfixed++;
+        }
+    }
+
+    if (is_repair && is_bm_dirty &&
+        (fsck_io(sb->ino_map_offset, fsck.map_inode, NEWFS_BLKS_SIZE(sb->ino_map_blks), TRUE) ||
+         fsck_io(sb->db_map_offset, fsck.map_db, NEWFS_BLKS_SIZE(sb->db_map_blks), TRUE) ||
+         fsck_io(sb->refcnt_offset, fsck.refcnt, NEWFS_BLKS_SIZE(sb->refcnt_blks), TRUE))) {
+        return FSCK_EXIT_ERROR;
+    }
+    if (is_repair && is_super_dirty) {
+        uint8_t* io = (uint8_t*)calloc(1, NEWFS_IO_SIZE());
+        int      ret;
+        fsck_io(NEWFS_SUPER_OFS, io, NEWFS_IO_SIZE(), FALSE);
+        memcpy(io, sb, sizeof(struct newfs_super_d));
+        ret = fsck_io(NEWFS_SUPER_OFS, io, NEWFS_IO_SIZE(), TRUE);
+        free(io);
+        if (ret != NEWFS_ERROR_NONE) {
+            return FSCK_EXIT_ERROR;
+        }
+    }
+    if (fsck.dev.img_fd >= 0 && is_repair && (is_bm_dirty || is_super_dirty)) {
+        fsync(fsck.dev.img_fd);
+    }
+
+    printf("%d 个inode（%d 个目录）在用，共 %d 个；%d 个数据块在用，共 %d 个\n",
+           nr_inodes, nr_dirs, sb->ino_max, nr_blks, sb->db_blks);
+    if (is_partial) {
+        printf("%d 个目录的目录树没有走完，走不到的inode和数据块只报告\n", fsck.nr_incomplete);
+    }
+    if (nr_unfixed > 0) {
+        printf("%d 个问题%s\n", nr_unfixed, is_repair ? "无法自动修复" : "，用 -y 修复");
+        return FSCK_EXIT_UNFIXED;
+    }
+    if (nr_fixed > 0) {
+        printf("修复了 %d 个问题\n", nr_fixed);
+        return FSCK_EXIT_FIXED;
+    }
+    return FSCK_EXIT_OK;
+}
+
+int main(int argc, char** argv) {
+    boolean is_repair  = FALSE;
+    int     nr_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int     opt, ret;
+    double  t0;
+
+    while ((opt = getopt(argc, argv, "yj:")) != -1) {
+        switch (opt) {
+        case 'y': is_repair  = TRUE;         break;
+        case 'j': nr_threads = atoi(optarg); break;
+        default:
+            fprintf(stderr, "用法: %s [-y] [-j 线程数] 设备\n", argv[0]);
+            return FSCK_EXIT_ERROR;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "用法: %s [-y] [-j 线程数] 设备\n", argv[0]);
+        return FSCK_EXIT_ERROR;
+    }
+    nr_threads = nr_threads < 1 ? 1 : nr_threads > FSCK_MAX_THREADS ? FSCK_MAX_THREADS : nr_threads;
+
+    t0 = now_s();
+    if (fsck_open(argv[optind], is_repair) != 0) {
+        return FSCK_EXIT_ERROR;
+    }
+    if (fsck_load() != NEWFS_ERROR_NONE) {
+        fprintf(stderr, "读 %s 失败\n", argv[optind]);
+        return FSCK_EXIT_ERROR;
+    }
+    fsck_walk(nr_threads);
+    ret = fsck_check(is_repair);
+    printf("%.3f 秒，%d 个线程\n", now_s() - t0, nr_threads);
+
+    if (fsck.dev.img_fd >= 0) {
+        close(fsck.dev.img_fd);
+    }
+    ddriver_close(fsck.dev.fd);
+    return ret;
+}
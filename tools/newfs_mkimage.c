@@ -0,0 +1,477 @@
+/**
+ * 由主机上的目录树直接生成newfs镜像（类似mke2fs -d）：先用newfs_mkfs格式化，
+ * 再按广度优先顺序给目录和文件连续编号inode、连续分配数据块，同一目录下的项inode相邻，
+ * 每个文件的数据块连成一段。数据区按1MB一段由多个线程各自拼好（读主机文件、用核心库的
+ * newfs_dx_build生成目录树的块）后整段写出，最后写inode表、位图和超级块，不经过挂载和日志
+ *
+ * 用法: newfs-mkimage [-b 块大小] [-N inode数] [-J 日志块数] [-O 特性] [-f] [-j 线程数] 源目录 设备
+ *   -b -N -J -O -f 与mkfs.newfs相同
+ *   -j  拼数据区的线程数，默认CPU数
+ * 只复制普通文件和目录，符号链接和设备文件跳过；硬链接按独立的文件复制
+ */
+#define DIR HOST_DIR                  /* 与types.h中的文件类型DIR重名 */
+#include <dirent.h>
+#undef DIR
+#include "newfs.h"
+#include <getopt.h>
+
+struct custom_options newfs_options;
+struct newfs_super    super;
+
+#define MKIMAGE_MAX_THREADS 64
+
+/* 主机目录树中的一项，数组下标就是inode号 */
+struct mkimage_node {
+    char*           path;           // 主机上的路径
+    char*           name;
+    NEWFS_FILE_TYPE ftype;
+    int             size;           // 普通文件的大小
+    int             parent;
+    int             first_child;    // 子项的inode号连续：[first_child, first_child + nr_child)
+    int             nr_child;
+    int             dno;            // 第一个数据块，数据块连续（目录是整棵目录树）
+    int             nr_blks;
+    struct newfs_dentry_d* dentrys; // 目录的子项，按文件名哈希排好序
+    uint32_t        atime;
+    uint32_t        mtime;
+    uint32_t        ctime;
+};
+
+struct mkimage {
+    struct mkimage_node* nodes;
+    int                  nr_nodes;
+    int                  cap_nodes;
+    int                  nr_dirs;
+    int                  nr_blks;       // 用掉的数据块数
+    long                 nr_bytes;      // 文件内容的总字节数
+
+    int                  fd;            // ddriver fd
+    int                  img_fd;        // 镜像文件fd，-1时经ddriver写
+    pthread_mutex_t      dev_lock;
+
+    int                  nr_chunks;     // 数据区按NEWFS_MKFS_CHUNK切成的段数
+    int                  next_chunk;
+    int                  ret;
+};
+
+static struct mkimage img;
+
+static double now_s() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief 写设备上[offset, offset+size)，都是IO单位的整数倍
+ */
+static int mkimage_write(long offset, uint8_t* buf, int size) {
+    int ret = 0;
+
+    if (img.img_fd >= 0) {
+        return pwrite(img.img_fd, buf, size, offset) == size ? NEWFS_ERROR_NONE : -NEWFS_ERROR_IO;
+    }
+    pthread_mutex_lock(&img.dev_lock);
+    if (ddriver_seek(img.fd, offset, SEEK_SET) < 0) {
+        ret = -1;
+    }
+    for (int done = 0; ret >= 0 && done < size; done += NEWFS_IO_SIZE()) {
+        ret = ddriver_write(img.fd, (char*)buf + done, NEWFS_IO_SIZE());
+    }
+    pthread_mutex_unlock(&img.dev_lock);
+    return ret < 0 ? -NEWFS_ERROR_IO : NEWFS_ERROR_NONE;
+}
+
+static int mkimage_add(const char* path, const char* name, struct stat* st, int parent) {
+    struct mkimage_node* node;
+
+    if (img.nr_nodes == img.cap_nodes) {
+        img.cap_nodes = img.cap_nodes ? img.cap_nodes * 2 : 1024;
+        img.nodes     = (struct mkimage_node*)realloc(img.nodes, sizeof(struct mkimage_node) * img.cap_nodes);
+    }
+    node = &img.nodes[img.nr_nodes];
+    memset(node, 0, sizeof(struct mkimage_node));
+    node->path   = strdup(path);
+    node->name   = node->path + strlen(path) - strlen(name);
+    node->ftype  = S_ISDIR(st->st_mode) ? DIR : REG_FILE;
+    node->size   = S_ISDIR(st->st_mode) ? 0 : (int)st->st_size;
+    node->parent = parent;
+    node->atime  = (uint32_t)st->st_atime;
+    node->mtime  = (uint32_t)st->st_mtime;
+    node->ctime  = (uint32_t)st->st_ctime;
+    if (node->ftype == DIR) {
+        img.nr_dirs++;
+    }
+    else {
+        img.nr_bytes += node->size;
+    }
+    return img.nr_nodes++;
+}
+
+/**
+ * @brief 广度优先扫描主机目录树，检查是否放得进newfs
+ *
+ * @param src 源目录
+ * @return int
+ */
+static int mkimage_scan(const char* src) {
+    struct stat st;
+    int max_size = NEWFS_BLKS_SIZE(MAX_DATA_PERFILE);
+
+    if (stat(src, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "%s 不是目录\n", src);
+        return -1;
+    }
+    mkimage_add(src, "", &st, -1);
+
+    for (int dir = 0; dir < img.nr_nodes; dir++) {
+        HOST_DIR*      dp;
+        struct dirent* de;
+
+        if (img.nodes[dir].ftype != DIR) {
+            continue;
+        }
+        if ((dp = opendir(img.nodes[dir].path)) == NULL) {
+            fprintf(stderr, "打不开 %s: %s\n", img.nodes[dir].path, strerror(errno));
+            return -1;
+        }
+        img.nodes[dir].first_child = img.nr_nodes;
+        while ((de = readdir(dp)) != NULL) {
+            char path[PATH_MAX];
+
+            if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) {
+                continue;
+            }
+            snprintf(path, sizeof(path), "%s/%s", img.nodes[dir].path, de->d_name);
+            if (lstat(path, &st) != 0) {
+                fprintf(stderr, "%s: %s\n", path, strerror(errno));
+                closedir(dp);
+                return -1;
+            }
+            if (!S_ISDIR(st.st_mode) && !S_ISREG(st.st_mode)) {
+                fprintf(stderr, "跳过 %s：newfs只有普通文件和目录\n", path);
+                continue;
+            }
+            if (strlen(de->d_name) >= MAX_NAME_LEN) {
+                fprintf(stderr, "%s: 文件名超过 %d 字节\n", path, MAX_NAME_LEN - 1);
+                closedir(dp);
+                return -1;
+            }
+            if (S_ISREG(st.st_mode) && st.st_size > max_size) {
+                fprintf(stderr, "%s: 超过单文件上限 %d 字节\n", path, max_size);
+                closedir(dp);
+                return -1;
+            }
+            mkimage_add(path, de->d_name, &st, dir);
+        }
+        closedir(dp);
+        img.nodes[dir].nr_child = img.nr_nodes - img.nodes[dir].first_child;
+        if (newfs_dx_build_blks(img.nodes[dir].nr_child) < 0) {
+            fprintf(stderr, "%s: %d 项，目录树超过 %d 层\n", img.nodes[dir].path,
+                    img.nodes[dir].nr_child, NEWFS_DX_MAX_LEVEL);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief 按inode号顺序连续分配数据块，目录的子项按哈希排好序，供各线程分块建树
+ */
+static void mkimage_layout() {
+    int dno = 0;
+
+    for (int ino = 0; ino < img.nr_nodes; ino++) {
+        struct mkimage_node* node = &img.nodes[ino];
+        node->dno = dno;
+        if (node->ftype == DIR) {
+            node->nr_blks = newfs_dx_build_blks(node->nr_child);
+            node->dentrys = (struct newfs_dentry_d*)calloc(node->nr_child, sizeof(struct newfs_dentry_d));
+            for (int i = 0; i < node->nr_child; i++) {
+                struct mkimage_node* child = &img.nodes[node->first_child + i];
+                strncpy(node->dentrys[i].name, child->name, MAX_NAME_LEN - 1);
+                node->dentrys[i].ino   = node->first_child + i;
+                node->dentrys[i].ftype = child->ftype;
+            }
+            newfs_dx_sort(node->dentrys, node->nr_child);
+        }
+        else {
+            node->nr_blks = (node->size + NEWFS_BLK_SIZE() - 1) / NEWFS_BLK_SIZE();
+        }
+        dno += node->nr_blks;
+    }
+    img.nr_blks = dno;
+}
+
+/**
+ * @brief 拼好数据区的第chunk段：找出与这一段有交集的inode，把对应部分拷进来
+ */
+static int mkimage_fill_chunk(int chunk, uint8_t* buf) {
+    int blks_per_chunk = NEWFS_MKFS_CHUNK / NEWFS_BLK_SIZE();
+    int start = chunk * blks_per_chunk;
+    int end   = start + blks_per_chunk < img.nr_blks ? start + blks_per_chunk : img.nr_blks;
+    int lo = 0, hi = img.nr_nodes - 1;
+
+    /* 最后一个起始块 <= start 的inode */
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (img.nodes[mid].dno <= start) {
+            lo = mid;
+        }
+        else {
+            hi = mid - 1;
+        }
+    }
+
+    memset(buf, 0, NEWFS_BLKS_SIZE(end - start));
+    for (int ino = lo; ino < img.nr_nodes && img.nodes[ino].dno < end; ino++) {
+        struct mkimage_node* node = &img.nodes[ino];
+        int from = node->dno > start ? node->dno : start;                   /* 与这一段重叠的块 */
+        int to   = node->dno + node->nr_blks < end ? node->dno + node->nr_blks : end;
+
+        if (from >= to) {
+            continue;
+        }
+        if (node->ftype == DIR) {                   /* 目录树的块可以单独生成 */
+            for (int k = from; k < to; k++) {
+                newfs_dx_build(node->dentrys, node->nr_child, node->dno, k - node->dno,
+                               buf + NEWFS_BLKS_SIZE(k - start));
+            }
+        }
+        else {
+            int     fd  = open(node->path, O_RDONLY);
+            off_t   ofs = NEWFS_BLKS_SIZE((off_t)(from - node->dno));
+            ssize_t len = NEWFS_BLKS_SIZE(to - from);
+            len = ofs + len > node->size ? node->size - ofs : len;
+            if (fd < 0 || pread(fd, buf + NEWFS_BLKS_SIZE(from - start), len, ofs) != len) {
+                fprintf(stderr, "读 %s 失败\n", node->path);
+                if (fd >= 0) {
+                    close(fd);
+                }
+                return -NEWFS_ERROR_IO;
+            }
+            close(fd);
+        }
+    }
+    return mkimage_write(NEWFS_DB_OFS((long)start), buf, NEWFS_BLKS_SIZE(end - start));
+}
+
+static void* mkimage_worker(void* arg) {
+    uint8_t* buf = (uint8_t*)malloc(NEWFS_MKFS_CHUNK);
+
+    for (;;) {
+        int chunk = __atomic_fetch_add(&img.next_chunk, 1, __ATOMIC_RELAXED);
+        int ret;
+        if (chunk >= img.nr_chunks || __atomic_load_n(&img.ret, __ATOMIC_RELAXED) != 0) {
+            break;
+        }
+        if ((ret = mkimage_fill_chunk(chunk, buf)) != NEWFS_ERROR_NONE) {
+            __atomic_store_n(&img.ret, ret, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    free(buf);
+    return NULL;
+}
+
+/**
+ * @brief 写inode表、位图和超级块
+ */
+static int mkimage_write_meta(struct newfs_super_d* sb) {
+    int      ino_per_group = NEWFS_ROUND_UP((sb->ino_max + NEWFS_GROUPS - 1) / NEWFS_GROUPS, UINT8_BITS);
+    int      itable_size   = NEWFS_BLKS_SIZE((img.nr_nodes + MAX_INODE_NUM_PERBLK - 1) / MAX_INODE_NUM_PERBLK);
+    uint8_t* itable        = (uint8_t*)calloc(1, itable_size);
+    uint8_t* imap          = (uint8_t*)calloc(1, NEWFS_BLKS_SIZE(sb->ino_map_blks));
+    uint8_t* dmap          = (uint8_t*)calloc(1, NEWFS_BLKS_SIZE(sb->db_map_blks));
+    uint8_t* io            = (uint8_t*)calloc(1, NEWFS_IO_SIZE());
+    int      ret           = NEWFS_ERROR_NONE;
+
+    memset(sb->group_dirs, 0, sizeof(sb->group_dirs));
+    for (int ino = 0; ino < img.nr_nodes; ino++) {
+        struct mkimage_node* node = &img.nodes[ino];
+        struct newfs_dentry  dentry;
+        struct newfs_inode   inode;
+
+        memset(&dentry, 0, sizeof(struct newfs_dentry));
+        memset(&inode, 0, sizeof(struct newfs_inode));
+        dentry.ftype  = node->ftype;
+        inode.dentry  = &dentry;
+        inode.ino     = ino;
+        inode.size    = node->size;
+        inode.dir_cnt = node->nr_child;
+        inode.atime   = node->atime;
+        inode.mtime   = node->mtime;
+        inode.ctime   = node->ctime;
+        for (int i = 0; i < MAX_DATA_PERFILE; i++) {            /* 目录只有树根 */
+            inode.block_pointer[i] = i < node->nr_blks && (node->ftype != DIR || i == 0) ?
+                                     node->dno + i : -1;
+        }
+        newfs_inode_to_d(&inode, (struct newfs_inode_d*)(itable + NEWFS_INO_OFS(ino) - sb->ino_offset));
+        NEWFS_BM_SET(imap, ino);
+        if (node->ftype == DIR) {
+            sb->group_dirs[ino / ino_per_group]++;
+        }
+    }
+    for (int dno = 0; dno < img.nr_blks; dno++) {
+        NEWFS_BM_SET(dmap, dno);
+    }
+
+    for (int ofs = 0; ret == NEWFS_ERROR_NONE && ofs < itable_size; ofs += NEWFS_MKFS_CHUNK) {
+        int len = itable_size - ofs < NEWFS_MKFS_CHUNK ? itable_size - ofs : NEWFS_MKFS_CHUNK;
+        ret = mkimage_write(sb->ino_offset + ofs, itable + ofs, len);
+    }
+    if (ret == NEWFS_ERROR_NONE) {
+        ret = mkimage_write(sb->ino_map_offset, imap, NEWFS_BLKS_SIZE(sb->ino_map_blks));
+    }
+    if (ret == NEWFS_ERROR_NONE) {
+        ret = mkimage_write(sb->db_map_offset, dmap, NEWFS_BLKS_SIZE(sb->db_map_blks));
+    }
+    if (ret == NEWFS_ERROR_NONE) {                  /* 超级块最后写 */
+        memcpy(io, sb, sizeof(struct newfs_super_d));
+        ret = mkimage_write(NEWFS_SUPER_OFS, io, NEWFS_IO_SIZE());
+    }
+    free(itable);
+    free(imap);
+    free(dmap);
+    free(io);
+    return ret;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "用法: %s [-b 块大小] [-N inode数] [-J 日志块数] [-O lazy_itable] [-f] [-j 线程数] "
+            "源目录 设备\n", prog);
+}
+
+int main(int argc, char** argv) {
+    struct newfs_mkfs_opts opts;
+    struct newfs_super_d   sb;
+    pthread_t tids[MKIMAGE_MAX_THREADS];
+    int       nr_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int       opt, ret, fd;
+    double    t0;
+    struct stat st;
+    const char* src;
+    const char* device;
+
+    memset(&opts, 0, sizeof(opts));
+    while ((opt = getopt(argc, argv, "b:N:J:O:fj:")) != -1) {
+        switch (opt) {
+        case 'b': opts.blks_size    = atoi(optarg); break;
+        case 'N': opts.ino_cnt      = atoi(optarg); break;
+        case 'J': opts.journal_blks = atoi(optarg); break;
+        case 'O':
+            if (strcmp(optarg, "lazy_itable") != 0) {
+                fprintf(stderr, "未知特性 %s\n", optarg);
+                return 1;
+            }
+            opts.features |= NEWFS_FEATURE_LAZY_ITABLE;
+            break;
+        case 'f': opts.is_force = TRUE;          break;
+        case 'j': nr_threads    = atoi(optarg);  break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 2) {
+        usage(argv[0]);
+        return 1;
+    }
+    src        = argv[optind];
+    device     = argv[optind + 1];
+    nr_threads = nr_threads < 1 ? 1 : nr_threads > MKIMAGE_MAX_THREADS ? MKIMAGE_MAX_THREADS : nr_threads;
+    t0         = now_s();
+
+    /* 先按块大小检查目录树，放不下时不动设备 */
+    if ((fd = ddriver_open((char*)device)) < 0) {
+        fprintf(stderr, "无法打开 %s\n", device);
+        return 1;
+    }
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_IO_SZ, &super.io_size);
+    ddriver_close(fd);
+    super.blks_size = opts.blks_size > 0 ? opts.blks_size : super.io_size * 2;
+    if (super.blks_size <= 0 || mkimage_scan(src) != 0) {
+        return 1;
+    }
+    mkimage_layout();
+
+    /* 先只算布局，容量不够时不动设备（-f时也不会抹掉原来的镜像） */
+    opts.is_dry_run = TRUE;
+    ret = newfs_mkfs(device, &opts, &sb);
+    if (ret == -NEWFS_ERROR_EXISTS) {
+        fprintf(stderr, "%s 上已有newfs，用 -f 覆盖\n", device);
+        return 1;
+    }
+    if (ret == -NEWFS_ERROR_INVAL) {
+        fprintf(stderr, "参数不合法：块大小须是IO单位的2的幂倍，日志 %d 到 %d 块\n", JOURNAL_BLKS_NUM,
+                JOURNAL_BLKS_MAX);
+        return 1;
+    }
+    if (ret == -NEWFS_ERROR_FBIG) {
+        fprintf(stderr, "%s 太大：newfs最多支持 %d 字节（2GB减1）的设备\n", device, NEWFS_DISK_SIZE_MAX);
+        return 1;
+    }
+    if (ret != NEWFS_ERROR_NONE) {
+        fprintf(stderr, "格式化 %s 失败: %s\n", device, strerror(-ret));
+        return 1;
+    }
+    if (img.nr_nodes > sb.ino_max || img.nr_blks > sb.db_blks) {
+        fprintf(stderr, "放不下：需要 %d 个inode、%d 个数据块，只有 %d、%d 个\n",
+                img.nr_nodes, img.nr_blks, sb.ino_max, sb.db_blks);
+        return 1;
+    }
+    opts.is_dry_run = FALSE;
+    if ((ret = newfs_mkfs(device, &opts, &sb)) != NEWFS_ERROR_NONE) {
+        fprintf(stderr, "格式化 %s 失败: %s\n", device, strerror(-ret));
+        return 1;
+    }
+    super.ino_offset = sb.ino_offset;
+    super.db_offset  = sb.db_offset;
+
+    img.fd = ddriver_open((char*)device);
+    if (img.fd < 0) {
+        fprintf(stderr, "无法打开 %s\n", device);
+        return 1;
+    }
+    pthread_mutex_init(&img.dev_lock, NULL);
+    img.img_fd = open(device, O_WRONLY);
+    if (img.img_fd >= 0 && (fstat(img.img_fd, &st) != 0 || !S_ISREG(st.st_mode))) {
+        close(img.img_fd);
+        img.img_fd = -1;
+    }
+
+    /* 数据区按段并行拼好写出，再写元数据 */
+    img.nr_chunks = (NEWFS_BLKS_SIZE((long)img.nr_blks) + NEWFS_MKFS_CHUNK - 1) / NEWFS_MKFS_CHUNK;
+    for (int t = 0; t < nr_threads; t++) {
+        if (pthread_create(&tids[t], NULL, mkimage_worker, NULL) != 0) {
+            nr_threads = t;                         /* 已经起来的线程会把剩下的段做完 */
+            break;
+        }
+    }
+    if (nr_threads == 0) {
+        mkimage_worker(NULL);
+    }
+    for (int t = 0; t < nr_threads; t++) {
+        pthread_join(tids[t], NULL);
+    }
+    ret = img.ret;
+    if (ret == NEWFS_ERROR_NONE) {
+        ret = mkimage_write_meta(&sb);
+    }
+    if (ret == NEWFS_ERROR_NONE && img.img_fd >= 0 && fsync(img.img_fd) != 0) {
+        ret = -NEWFS_ERROR_IO;
+    }
+    if (img.img_fd >= 0) {
+        close(img.img_fd);
+    }
+    ddriver_close(img.fd);
+    if (ret != NEWFS_ERROR_NONE) {
+        fprintf(stderr, "写 %s 失败\n", device);
+        return 1;
+    }
+
+    printf("%s: %d 个目录、%d 个文件，%ld 字节，%d 个数据块，%.3f 秒（%.1f MB/s），%d 个线程\n", device,
+           img.nr_dirs, img.nr_nodes - img.nr_dirs, img.nr_bytes, img.nr_blks, now_s() - t0,
+           NEWFS_BLKS_SIZE((double)img.nr_blks) / (now_s() - t0) / (1024 * 1024), nr_threads > 0 ? nr_threads : 1);
+    return 0;
+}
@@ -0,0 +1,230 @@
+/**
+ * 操作轨迹回放：读入挂载时用 --trace=<文件> 记下的轨迹（或收到SIGUSR1时另存的
+ * <文件>.dump），按开始时间合并各线程的环，在镜像上经newfs_operations逐条重新执行，
+ * 结束时打印与/.newfs/stats相同的统计，便于对比缓存、分配策略的改动。
+ *
+ * 轨迹只记参数不记数据，写入的内容是固定的填充；镜像要与开始记录时一致，
+ * 否则返回值会对不上（只计数，不中止）。回放是单线程的，按记录的开始时间串行执行
+ *
+ * 用法: newfs_replay [-d 设备] [-c 缓存KB] [-t] 轨迹文件
+ *   -t  按原来的时间间隔回放，默认尽快回放
+ */
+#include "newfs.h"
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+struct custom_options newfs_options;
+struct newfs_super    super;
+
+static struct newfs_trace_rec* recs;
+static int                     nr_recs;
+static uint8_t*                io_buf;
+static size_t                  io_buf_size;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int cmp_rec(const void* a, const void* b) {
+    const struct newfs_trace_rec* ra = (const struct newfs_trace_rec*)a;
+    const struct newfs_trace_rec* rb = (const struct newfs_trace_rec*)b;
+
+    if (ra->ts_ns != rb->ts_ns) {
+        return ra->ts_ns < rb->ts_ns ? -1 : 1;
+    }
+    return (int)ra->tid - (int)rb->tid;
+}
+
+static int fill_noop(void* buf, const char* name, const struct stat* stbuf, off_t off) {
+    return 0;
+}
+
+/**
+ * @brief 读入轨迹文件，取出各环中还在的记录并按开始时间排序
+ */
+static int load_trace(const char* path) {
+    struct newfs_trace_d*      hdr;
+    struct newfs_trace_ring_d* rings;
+    struct newfs_trace_rec*    all;
+    struct stat st;
+    uint8_t*    base;
+    int         fd = open(path, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct newfs_trace_d)) {
+        fprintf(stderr, "无法读取轨迹文件 %s\n", path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    base = (uint8_t*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return -1;
+    }
+    hdr = (struct newfs_trace_d*)base;
+    if (hdr->magic != NEWFS_TRACE_MAGIC || hdr->version != NEWFS_TRACE_VERSION ||
+        hdr->rec_size != sizeof(struct newfs_trace_rec) ||
+        st.st_size < (off_t)(sizeof(struct newfs_trace_d) +
+                             hdr->nr_rings * sizeof(struct newfs_trace_ring_d) +
+                             (size_t)hdr->nr_rings * hdr->ring_recs * hdr->rec_size)) {
+        fprintf(stderr, "%s 不是newfs轨迹文件\n", path);
+        munmap(base, st.st_size);
+        return -1;
+    }
+    rings = (struct newfs_trace_ring_d*)(base + sizeof(struct newfs_trace_d));
+    all   = (struct newfs_trace_rec*)(rings + hdr->nr_rings);
+    recs  = (struct newfs_trace_rec*)malloc((size_t)hdr->nr_rings * hdr->ring_recs * hdr->rec_size);
+
+    for (uint32_t r = 0; r < hdr->nr_rings; r++) {
+        uint64_t head = rings[r].head;
+        uint64_t n    = head < hdr->ring_recs ? head : hdr->ring_recs;
+        if (head > hdr->ring_recs) {
+            fprintf(stderr, "环%u 覆盖了最早的 %lu 条记录\n", r, (unsigned long)(head - hdr->ring_recs));
+        }
+        for (uint64_t i = head - n; i < head; i++) {
+            recs[nr_recs++] = all[(size_t)r * hdr->ring_recs + (i & (hdr->ring_recs - 1))];
+        }
+    }
+    if (hdr->dropped > 0) {
+        fprintf(stderr, "线程比环多，记录时丢掉了 %u 条\n", hdr->dropped);
+    }
+    munmap(base, st.st_size);
+    qsort(recs, nr_recs, sizeof(struct newfs_trace_rec), cmp_rec);
+    return 0;
+}
+
+/**
+ * @brief 读写用的缓冲区，写入的内容是固定的填充
+ */
+static uint8_t* get_io_buf(size_t size) {
+    if (size > io_buf_size) {
+        free(io_buf);
+        io_buf      = (uint8_t*)malloc(size);
+        io_buf_size = size;
+        for (size_t i = 0; i < size; i++) {
+            io_buf[i] = (uint8_t)(i * 131 + 7);
+        }
+    }
+    return io_buf;
+}
+
+/**
+ * @brief 重新执行一条记录
+ *
+ * @return int 操作的返回值；轨迹里不能回放的ioctl返回记录的值
+ */
+static int replay_one(struct newfs_trace_rec* r) {
+    struct fuse_operations* ops = &newfs_operations;
+    struct fuse_file_info   fi;
+    struct fuse_bufvec*     bufv;
+    struct fuse_bufvec      src;
+    struct stat             st;
+    int ret;
+
+    memset(&fi, 0, sizeof(fi));
+    switch (r->op)
+    {
+    case NEWFS_STAT_MKDIR:      return ops->mkdir(r->path, r->mode);
+    case NEWFS_STAT_GETATTR:    return ops->getattr(r->path, &st);
+    case NEWFS_STAT_READDIR:    return ops->readdir(r->path, NULL, fill_noop, r->offset, &fi);
+    case NEWFS_STAT_MKNOD:      return ops->mknod(r->path, r->mode, 0);
+    case NEWFS_STAT_WRITE:
+        return ops->write(r->path, (char*)get_io_buf(r->size), r->size, r->offset, &fi);
+    case NEWFS_STAT_READ:
+        return ops->read(r->path, (char*)get_io_buf(r->size), r->size, r->offset, &fi);
+    case NEWFS_STAT_WRITE_BUF:
+        src = FUSE_BUFVEC_INIT(r->size);
+        src.buf[0].mem = get_io_buf(r->size);
+        return ops->write_buf(r->path, &src, r->offset, &fi);
+    case NEWFS_STAT_READ_BUF:
+        ret = ops->read_buf(r->path, &bufv, r->size, r->offset, &fi);
+        if (ret == NEWFS_ERROR_NONE) {                  /* FUSE负责释放的部分 */
+            for (size_t i = 0; i < bufv->count; i++) {
+                if (!(bufv->buf[i].flags & FUSE_BUF_IS_FD)) {
+                    free(bufv->buf[i].mem);
+                }
+            }
+            free(bufv);
+        }
+        return ret;
+    case NEWFS_STAT_UTIMENS:    return ops->utimens(r->path, NULL);
+    case NEWFS_STAT_TRUNCATE:   return ops->truncate(r->path, r->offset);
+    case NEWFS_STAT_FALLOCATE:  return ops->fallocate(r->path, r->mode, r->offset, r->size, &fi);
+    case NEWFS_STAT_IOCTL:                              /* 只有检查点不带参数 */
+        if (r->mode == NEWFS_IOC_CHECKPOINT) {
+            return ops->ioctl(r->path, r->mode, NULL, &fi, 0, NULL);
+        }
+        return r->ret;
+    case NEWFS_STAT_UNLINK:     return ops->unlink(r->path);
+    case NEWFS_STAT_RMDIR:      return ops->rmdir(r->path);
+    case NEWFS_STAT_RENAME:     return ops->rename(r->path, r->path2);
+    case NEWFS_STAT_OPEN:
+        fi.flags = r->mode;
+        return ops->open(r->path, &fi);
+    case NEWFS_STAT_OPENDIR:    return ops->opendir(r->path, &fi);
+    case NEWFS_STAT_ACCESS:     return ops->access(r->path, r->mode);
+    case NEWFS_STAT_FSYNC:      return ops->fsync(r->path, r->mode, &fi);
+    default:
+        return r->ret;
+    }
+}
+
+int main(int argc, char** argv) {
+    char     dev[256];
+    char     report[8192];
+    int      opt, is_timed = FALSE, nr_diff = 0;
+    uint64_t t0, t1;
+
+    snprintf(dev, sizeof(dev), "%s/ddriver", getenv("HOME") ? getenv("HOME") : ".");
+    newfs_options.device = dev;
+    while ((opt = getopt(argc, argv, "d:c:t")) != -1) {
+        switch (opt) {
+        case 'd': newfs_options.device   = optarg;       break;
+        case 'c': newfs_options.cache_kb = atoi(optarg); break;
+        case 't': is_timed = TRUE;                       break;
+        default:
+            fprintf(stderr, "用法: %s [-d 设备] [-c 缓存KB] [-t] 轨迹文件\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc || load_trace(argv[optind]) != 0) {
+        fprintf(stderr, "用法: %s [-d 设备] [-c 缓存KB] [-t] 轨迹文件\n", argv[0]);
+        return 1;
+    }
+    if (newfs_mount(newfs_options) != NEWFS_ERROR_NONE) {
+        fprintf(stderr, "挂载 %s 失败\n", newfs_options.device);
+        return 1;
+    }
+
+    t0 = now_ns();
+    for (int i = 0; i < nr_recs; i++) {
+        if (is_timed) {
+            uint64_t due = t0 + recs[i].ts_ns - recs[0].ts_ns;
+            uint64_t now = now_ns();
+            if (due > now) {
+                struct timespec ts = { (time_t)((due - now) / 1000000000ull), (long)((due - now) % 1000000000ull) };
+                nanosleep(&ts, NULL);
+            }
+        }
+        if (replay_one(&recs[i]) != recs[i].ret) {
+            nr_diff++;
+        }
+    }
+    t1 = now_ns();
+
+    printf("回放 %d 条，%.3f 秒，%.0f ops/s，返回值与记录不同 %d 条\n", nr_recs,
+           (t1 - t0) / 1e9, nr_recs > 0 && t1 > t0 ? nr_recs * 1e9 / (t1 - t0) : 0.0, nr_diff);
+    if (nr_recs > 0) {
+        printf("原轨迹跨度 %.3f 秒\n\n", (recs[nr_recs - 1].ts_ns + recs[nr_recs - 1].lat_ns - recs[0].ts_ns) / 1e9);
+    }
+    newfs_stats_render(report, sizeof(report));
+    printf("%s", report);
+    newfs_umount();
+    free(recs);
+    free(io_buf);
+    return 0;
+}